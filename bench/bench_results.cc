@@ -0,0 +1,129 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "bench/bench_results.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+// Returns the value at |percentile| of the sorted |samples|, by nearest rank.
+static double get_percentile(const std::vector<double> &samples,
+                             double percentile) {
+  size_t rank = static_cast<size_t>(
+      std::ceil(percentile / 100.0 * static_cast<double>(samples.size())));
+  return samples[rank > 0 ? rank - 1 : 0];
+}
+
+BenchResult SummarizeSamples(const std::string &name, const std::string &unit,
+                             bool higher_is_better,
+                             std::vector<double> *samples) {
+  BenchResult result;
+  result.name = name;
+  result.unit = unit;
+  result.higher_is_better = higher_is_better;
+  result.count = samples->size();
+  if (!samples->empty()) {
+    std::sort(samples->begin(), samples->end());
+    result.p50 = get_percentile(*samples, 50.0);
+    result.p99 = get_percentile(*samples, 99.0);
+    result.max = samples->back();
+  }
+  return result;
+}
+
+void WriteBenchResults(const std::vector<BenchResult> &results,
+                       std::ostream &out) {
+  out << "{" << std::endl;
+  for (size_t i = 0; i < results.size(); ++i) {
+    const BenchResult &result = results[i];
+    char line[512];
+    snprintf(line, sizeof(line),
+             "  \"%s\": {\"unit\": \"%s\", \"better\": \"%s\", \"count\": %zu, "
+             "\"p50\": %.3f, \"p99\": %.3f, \"max\": %.3f}%s",
+             result.name.c_str(), result.unit.c_str(),
+             result.higher_is_better ? "higher" : "lower", result.count,
+             result.p50, result.p99, result.max,
+             i + 1 < results.size() ? "," : "");
+    out << line << std::endl;
+  }
+  out << "}" << std::endl;
+}
+
+bool ReadBenchResults(std::istream &in, std::vector<BenchResult> *results) {
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line == "{" || line == "}" || line.empty()) {
+      continue;
+    }
+    char name[128] = {};
+    char unit[16] = {};
+    char better[16] = {};
+    BenchResult result;
+    if (sscanf(line.c_str(),
+               " \"%127[^\"]\": {\"unit\": \"%15[^\"]\", \"better\": "
+               "\"%15[^\"]\", \"count\": %zu, \"p50\": %lf, \"p99\": %lf, "
+               "\"max\": %lf}",
+               name, unit, better, &result.count, &result.p50, &result.p99,
+               &result.max) != 7) {
+      std::cerr << "Unable to read benchmark result: " << line << std::endl;
+      return false;
+    }
+    result.name = name;
+    result.unit = unit;
+    result.higher_is_better = std::string(better) == "higher";
+    results->push_back(result);
+  }
+  return true;
+}
+
+// Returns how much worse |value| is than |baseline|, as a fraction of
+// |baseline|. Negative if it is better.
+static double get_regression(double baseline, double value,
+                             bool higher_is_better) {
+  if (baseline == 0.0) {
+    return 0.0;
+  }
+  return (higher_is_better ? baseline - value : value - baseline) / baseline;
+}
+
+bool CompareBenchResults(const std::vector<BenchResult> &baseline,
+                         const std::vector<BenchResult> &results,
+                         double tolerance, std::ostream &log) {
+  bool passed = true;
+  log << "Change from the baseline (positive is worse):" << std::endl;
+  for (const auto &result : results) {
+    auto it = std::find_if(
+        baseline.begin(), baseline.end(),
+        [&result](const BenchResult &b) { return b.name == result.name; });
+    if (it == baseline.end()) {
+      log << result.name << ": no baseline" << std::endl;
+      continue;
+    }
+    double p50_regression =
+        get_regression(it->p50, result.p50, result.higher_is_better);
+    double p99_regression =
+        get_regression(it->p99, result.p99, result.higher_is_better);
+    bool regressed = p50_regression > tolerance || p99_regression > tolerance;
+    char line[512];
+    snprintf(line, sizeof(line),
+             "%-40s p50 %10.3f -> %10.3f %s (%+6.1f%%)  "
+             "p99 %10.3f -> %10.3f (%+6.1f%%)%s",
+             result.name.c_str(), it->p50, result.p50, result.unit.c_str(),
+             100.0 * p50_regression, it->p99, result.p99,
+             100.0 * p99_regression, regressed ? "  REGRESSED" : "");
+    log << line << std::endl;
+    passed &= !regressed;
+  }
+  return passed;
+}
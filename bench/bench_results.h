@@ -0,0 +1,55 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef LINUX_BENCH_BENCH_RESULTS_H_
+#define LINUX_BENCH_BENCH_RESULTS_H_
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// The summary of one benchmark's samples.
+struct BenchResult {
+  std::string name;
+  std::string unit;
+  // Whether larger values are better (e.g. throughput), rather than smaller
+  // ones (e.g. latency).
+  bool higher_is_better = false;
+  size_t count = 0;
+  double p50 = 0.0;
+  double p99 = 0.0;
+  double max = 0.0;
+};
+
+// Summarizes |samples| (which are reordered) into a result.
+BenchResult SummarizeSamples(const std::string &name, const std::string &unit,
+                             bool higher_is_better,
+                             std::vector<double> *samples);
+
+// Writes |results| as a JSON object, one result per line, keyed by name.
+void WriteBenchResults(const std::vector<BenchResult> &results,
+                       std::ostream &out);
+
+// Reads results written by WriteBenchResults.
+//
+// Returns false (after logging the reason) if any line could not be read.
+bool ReadBenchResults(std::istream &in, std::vector<BenchResult> *results);
+
+// Compares |results| against |baseline|, logging each benchmark they share.
+//
+// Returns false if the median or 99th percentile of any benchmark got worse by
+// more than |tolerance| (a fraction of the baseline value).
+bool CompareBenchResults(const std::vector<BenchResult> &baseline,
+                         const std::vector<BenchResult> &results,
+                         double tolerance, std::ostream &log);
+#endif  // LINUX_BENCH_BENCH_RESULTS_H_
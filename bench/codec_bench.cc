@@ -0,0 +1,466 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "bench/codec_bench.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <string>
+
+#include "include/standard_message_codec.h"
+
+// Counts every heap allocation made through new, across the whole binary.
+static std::atomic<uint64_t> allocation_count(0);
+
+void *operator new(size_t size) {
+  allocation_count.fetch_add(1, std::memory_order_relaxed);
+  void *pointer = malloc(size > 0 ? size : 1);
+  if (pointer == nullptr) {
+    throw std::bad_alloc();
+  }
+  return pointer;
+}
+
+void operator delete(void *pointer) noexcept { free(pointer); }
+
+namespace {
+
+constexpr int kBatchCount = 20;
+constexpr int kMessagesPerBatch = 50;
+
+// A batch of sensor readings, as a map of typed data and strings.
+struct Telemetry {
+  int64_t timestamp;
+  std::vector<double> samples;
+  std::vector<int32_t> ids;
+  std::vector<std::string> tags;
+};
+
+// Map tiles, as a list of maps each holding a tile's RGBA pixels.
+struct Tile {
+  int32_t x;
+  int32_t y;
+  std::vector<uint8_t> pixels;
+};
+
+Telemetry MakeTelemetry() {
+  Telemetry telemetry;
+  telemetry.timestamp = 1500000000000;
+  for (int i = 0; i < 8192; ++i) {
+    telemetry.samples.push_back(i * 0.5);
+  }
+  for (int i = 0; i < 2048; ++i) {
+    telemetry.ids.push_back(i);
+  }
+  for (int i = 0; i < 32; ++i) {
+    telemetry.tags.push_back("sensor_tag_" + std::to_string(i));
+  }
+  return telemetry;
+}
+
+std::vector<Tile> MakeTiles() {
+  std::vector<Tile> tiles;
+  for (int i = 0; i < 32; ++i) {
+    Tile tile = {i % 8, i / 8, std::vector<uint8_t>(64 * 64 * 4)};
+    for (size_t j = 0; j < tile.pixels.size(); ++j) {
+      tile.pixels[j] = static_cast<uint8_t>(i + j);
+    }
+    tiles.push_back(std::move(tile));
+  }
+  return tiles;
+}
+
+void EncodeTelemetry(const Telemetry &telemetry,
+                     StandardMessageEncoder *encoder) {
+  encoder->WriteMap(4);
+  encoder->WriteString("timestamp");
+  encoder->WriteInt(telemetry.timestamp);
+  encoder->WriteString("samples");
+  encoder->WriteTypedData(telemetry.samples.data(), telemetry.samples.size());
+  encoder->WriteString("ids");
+  encoder->WriteTypedData(telemetry.ids.data(), telemetry.ids.size());
+  encoder->WriteString("tags");
+  encoder->WriteList(telemetry.tags.size());
+  for (const std::string &tag : telemetry.tags) {
+    encoder->WriteString(tag);
+  }
+}
+
+void EncodeTiles(const std::vector<Tile> &tiles,
+                 StandardMessageEncoder *encoder) {
+  encoder->WriteList(tiles.size());
+  for (const Tile &tile : tiles) {
+    encoder->WriteMap(3);
+    encoder->WriteString("x");
+    encoder->WriteInt(tile.x);
+    encoder->WriteString("y");
+    encoder->WriteInt(tile.y);
+    encoder->WriteString("pixels");
+    encoder->WriteTypedData(tile.pixels.data(), tile.pixels.size());
+  }
+}
+
+// A straightforward codec, which copies everything into a tree of its own
+// when decoding, and builds such a tree to encode.
+struct NaiveValue {
+  StandardType type = StandardType::kNull;
+  int64_t int_value = 0;
+  double double_value = 0.0;
+  std::string string_value;
+  // The elements of typed data.
+  std::vector<uint8_t> bytes;
+  // Elements of lists, or keys and values of maps.
+  std::vector<NaiveValue> children;
+};
+
+NaiveValue NaiveString(const std::string &string) {
+  NaiveValue value;
+  value.type = StandardType::kString;
+  value.string_value = string;
+  return value;
+}
+
+// Uses kInt32 where the value fits, as the standard codec does.
+NaiveValue NaiveInt(int64_t int_value) {
+  NaiveValue value;
+  value.type = int_value >= INT32_MIN && int_value <= INT32_MAX
+                   ? StandardType::kInt32
+                   : StandardType::kInt64;
+  value.int_value = int_value;
+  return value;
+}
+
+template <typename T>
+NaiveValue NaiveTypedData(const std::vector<T> &elements) {
+  NaiveValue value;
+  value.type = StandardTypedData<T>::kType;
+  const uint8_t *bytes = reinterpret_cast<const uint8_t *>(elements.data());
+  value.bytes.assign(bytes, bytes + elements.size() * sizeof(T));
+  return value;
+}
+
+NaiveValue NaiveTelemetry(const Telemetry &telemetry) {
+  NaiveValue map;
+  map.type = StandardType::kMap;
+  map.children.push_back(NaiveString("timestamp"));
+  map.children.push_back(NaiveInt(telemetry.timestamp));
+  map.children.push_back(NaiveString("samples"));
+  map.children.push_back(NaiveTypedData(telemetry.samples));
+  map.children.push_back(NaiveString("ids"));
+  map.children.push_back(NaiveTypedData(telemetry.ids));
+  map.children.push_back(NaiveString("tags"));
+  NaiveValue tags;
+  tags.type = StandardType::kList;
+  for (const std::string &tag : telemetry.tags) {
+    tags.children.push_back(NaiveString(tag));
+  }
+  map.children.push_back(tags);
+  return map;
+}
+
+NaiveValue NaiveTiles(const std::vector<Tile> &tiles) {
+  NaiveValue list;
+  list.type = StandardType::kList;
+  for (const Tile &tile : tiles) {
+    NaiveValue map;
+    map.type = StandardType::kMap;
+    map.children.push_back(NaiveString("x"));
+    map.children.push_back(NaiveInt(tile.x));
+    map.children.push_back(NaiveString("y"));
+    map.children.push_back(NaiveInt(tile.y));
+    map.children.push_back(NaiveString("pixels"));
+    map.children.push_back(NaiveTypedData(tile.pixels));
+    list.children.push_back(map);
+  }
+  return list;
+}
+
+size_t NaiveElementSize(StandardType type) {
+  switch (type) {
+    case StandardType::kInt32List:
+    case StandardType::kFloat32List:
+      return 4;
+    case StandardType::kInt64List:
+    case StandardType::kFloat64List:
+      return 8;
+    default:
+      return 1;
+  }
+}
+
+void NaiveWriteSize(size_t size, std::vector<uint8_t> *out) {
+  if (size < 254) {
+    out->push_back(static_cast<uint8_t>(size));
+  } else if (size <= 0xffff) {
+    out->push_back(254);
+    out->push_back(size & 0xff);
+    out->push_back(size >> 8);
+  } else {
+    out->push_back(255);
+    for (int i = 0; i < 4; ++i) {
+      out->push_back((size >> (i * 8)) & 0xff);
+    }
+  }
+}
+
+void NaiveEncode(const NaiveValue &value, std::vector<uint8_t> *out) {
+  out->push_back(static_cast<uint8_t>(value.type));
+  switch (value.type) {
+    case StandardType::kInt32:
+      for (int i = 0; i < 4; ++i) {
+        out->push_back((value.int_value >> (i * 8)) & 0xff);
+      }
+      break;
+    case StandardType::kFloat64: {
+      while (out->size() % 8 != 0) {
+        out->push_back(0);
+      }
+      const uint8_t *bytes =
+          reinterpret_cast<const uint8_t *>(&value.double_value);
+      out->insert(out->end(), bytes, bytes + sizeof(double));
+      break;
+    }
+    case StandardType::kInt64:
+      for (int i = 0; i < 8; ++i) {
+        out->push_back((value.int_value >> (i * 8)) & 0xff);
+      }
+      break;
+    case StandardType::kString:
+      NaiveWriteSize(value.string_value.size(), out);
+      for (char c : value.string_value) {
+        out->push_back(c);
+      }
+      break;
+    case StandardType::kList:
+    case StandardType::kMap:
+      NaiveWriteSize(value.type == StandardType::kMap
+                         ? value.children.size() / 2
+                         : value.children.size(),
+                     out);
+      for (const NaiveValue &child : value.children) {
+        NaiveEncode(child, out);
+      }
+      break;
+    default: {
+      size_t element_size = NaiveElementSize(value.type);
+      NaiveWriteSize(value.bytes.size() / element_size, out);
+      while (out->size() % element_size != 0) {
+        out->push_back(0);
+      }
+      for (uint8_t byte : value.bytes) {
+        out->push_back(byte);
+      }
+      break;
+    }
+  }
+}
+
+size_t NaiveReadSize(const uint8_t **position) {
+  uint8_t byte = *(*position)++;
+  if (byte < 254) {
+    return byte;
+  }
+  size_t size = 0;
+  int bytes = byte == 254 ? 2 : 4;
+  for (int i = 0; i < bytes; ++i) {
+    size |= static_cast<size_t>(*(*position)++) << (i * 8);
+  }
+  return size;
+}
+
+// Decodes the kinds of values the payloads have.
+NaiveValue NaiveDecode(const uint8_t *begin, const uint8_t **position) {
+  NaiveValue value;
+  value.type = static_cast<StandardType>(*(*position)++);
+  switch (value.type) {
+    case StandardType::kInt32: {
+      int32_t int_value;
+      memcpy(&int_value, *position, 4);
+      value.int_value = int_value;
+      *position += 4;
+      break;
+    }
+    case StandardType::kInt64:
+      memcpy(&value.int_value, *position, 8);
+      *position += 8;
+      break;
+    case StandardType::kFloat64:
+      while ((*position - begin) % 8 != 0) {
+        ++*position;
+      }
+      memcpy(&value.double_value, *position, 8);
+      *position += 8;
+      break;
+    case StandardType::kString: {
+      size_t size = NaiveReadSize(position);
+      value.string_value.assign(reinterpret_cast<const char *>(*position),
+                                size);
+      *position += size;
+      break;
+    }
+    case StandardType::kList:
+    case StandardType::kMap: {
+      size_t count = NaiveReadSize(position);
+      if (value.type == StandardType::kMap) {
+        count *= 2;
+      }
+      for (size_t i = 0; i < count; ++i) {
+        value.children.push_back(NaiveDecode(begin, position));
+      }
+      break;
+    }
+    default: {
+      size_t element_size = NaiveElementSize(value.type);
+      size_t size = NaiveReadSize(position) * element_size;
+      while ((*position - begin) % element_size != 0) {
+        ++*position;
+      }
+      value.bytes.assign(*position, *position + size);
+      *position += size;
+      break;
+    }
+  }
+  return value;
+}
+
+// Reads a little of each typed data, so decoding cannot be optimized away.
+uint64_t Checksum(const StandardValue &value) {
+  uint64_t sum = value.size();
+  if (value.type() == StandardType::kUint8List) {
+    TypedDataView<uint8_t> bytes = value.AsTypedData<uint8_t>();
+    sum += bytes.size() + bytes[bytes.size() / 2];
+  } else if (value.type() == StandardType::kFloat64List) {
+    TypedDataView<double> doubles = value.AsTypedData<double>();
+    sum += doubles.size() + static_cast<uint64_t>(doubles[doubles.size() / 2]);
+  }
+  for (size_t i = 0; i < value.size(); ++i) {
+    if (value.type() == StandardType::kMap) {
+      sum += Checksum(value.MapValue(i));
+    } else {
+      sum += Checksum(value[i]);
+    }
+  }
+  return sum;
+}
+
+uint64_t Checksum(const NaiveValue &value) {
+  uint64_t sum = value.type == StandardType::kMap ? value.children.size() / 2
+                                                  : value.children.size();
+  if (value.type == StandardType::kUint8List) {
+    sum += value.bytes.size() + value.bytes[value.bytes.size() / 2];
+  } else if (value.type == StandardType::kFloat64List) {
+    size_t count = value.bytes.size() / sizeof(double);
+    double element;
+    memcpy(&element, value.bytes.data() + count / 2 * sizeof(double),
+           sizeof(double));
+    sum += count + static_cast<uint64_t>(element);
+  }
+  for (size_t i = 0; i < value.children.size(); ++i) {
+    if (value.type != StandardType::kMap || i % 2 == 1) {
+      sum += Checksum(value.children[i]);
+    }
+  }
+  return sum;
+}
+
+// Runs |run| on a message of |message_size| bytes in batches, adding its
+// throughput and the allocations it makes per message to |results|.
+void MeasureCodec(const std::string &name, size_t message_size,
+                  const std::function<void()> &run,
+                  std::vector<BenchResult> *results) {
+  // Lets buffers kept between messages grow first.
+  run();
+  std::vector<double> throughput;
+  uint64_t first_allocation_count = allocation_count.load();
+  for (int batch = 0; batch < kBatchCount; ++batch) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kMessagesPerBatch; ++i) {
+      run();
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    throughput.push_back(message_size * kMessagesPerBatch / 1e6 /
+                         elapsed.count());
+  }
+  std::vector<double> allocations = {
+      static_cast<double>(allocation_count.load() - first_allocation_count) /
+      (kBatchCount * kMessagesPerBatch)};
+  results->push_back(SummarizeSamples(name, "MB/s", true, &throughput));
+  results->push_back(SummarizeSamples(name + "_allocations", "allocations",
+                                      false, &allocations));
+}
+
+// Benchmarks both codecs on the message |encode| writes, and that |naive|
+// builds.
+void BenchPayload(const std::string &name,
+                  const std::function<void(StandardMessageEncoder *)> &encode,
+                  const std::function<NaiveValue()> &naive,
+                  std::vector<BenchResult> *results) {
+  StandardMessageEncoder encoder;
+  encode(&encoder);
+  std::vector<uint8_t> message(encoder.data(), encoder.data() + encoder.size());
+  volatile uint64_t sink = 0;
+
+  MeasureCodec("codec_" + name + "_encode", message.size(),
+               [&] {
+                 encoder.Clear();
+                 encode(&encoder);
+                 sink = sink + encoder.size();
+               },
+               results);
+  MeasureCodec("codec_" + name + "_encode_naive", message.size(),
+               [&] {
+                 std::vector<uint8_t> out;
+                 NaiveEncode(naive(), &out);
+                 sink = sink + out.size();
+               },
+               results);
+
+  StandardMessageDecoder decoder;
+  MeasureCodec("codec_" + name + "_decode", message.size(),
+               [&] {
+                 decoder.Decode(message.data(), message.size());
+                 sink = sink + Checksum(decoder.value(0));
+               },
+               results);
+  MeasureCodec("codec_" + name + "_decode_naive", message.size(),
+               [&] {
+                 const uint8_t *position = message.data();
+                 sink = sink + Checksum(NaiveDecode(message.data(), &position));
+               },
+               results);
+}
+
+}  // namespace
+
+std::vector<BenchResult> BenchStandardMessageCodec() {
+  std::vector<BenchResult> results;
+  Telemetry telemetry = MakeTelemetry();
+  BenchPayload("telemetry",
+               [&](StandardMessageEncoder *encoder) {
+                 EncodeTelemetry(telemetry, encoder);
+               },
+               [&] { return NaiveTelemetry(telemetry); }, &results);
+  std::vector<Tile> tiles = MakeTiles();
+  BenchPayload("tiles",
+               [&](StandardMessageEncoder *encoder) {
+                 EncodeTiles(tiles, encoder);
+               },
+               [&] { return NaiveTiles(tiles); }, &results);
+  return results;
+}
@@ -0,0 +1,25 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef LINUX_BENCH_CODEC_BENCH_H_
+#define LINUX_BENCH_CODEC_BENCH_H_
+#include <vector>
+
+#include "bench/bench_results.h"
+
+// Benchmarks encoding and decoding platform channel payloads with the
+// standard message codec, against a naive codec that copies everything into a
+// tree of its own. Reports throughput in MB/s of message, and heap
+// allocations per message.
+std::vector<BenchResult> BenchStandardMessageCodec();
+#endif  // LINUX_BENCH_CODEC_BENCH_H_
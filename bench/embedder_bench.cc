@@ -0,0 +1,822 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmarks the embedder against the stub engine (see stub_engine/), one
+// phase after another within a single window:
+//
+// *   handoff: the latency from the engine presenting a frame to GTK drawing
+//     it, the rate at which new frames are drawn, the time the GTK thread
+//     spends in each render of one, which includes any wait on the GPU, and
+//     the time it spent blocked on frames per second.
+// *   resize: the cost of HandleResizeEvent and of rendering while the window
+//     is resized --resize-rate times per second.
+// *   pointer: the cost of each motion event, and the number of events sent to
+//     the engine per call, under synthetic input at 1, 5 and 10 kHz.
+// *   capture: the GTK thread's cost of capturing each frame at 1080p, while
+//     streaming them to /dev/null as Y4M, and the frames dropped meanwhile.
+// *   texture: the cost of pushing each 1080p frame of an external texture
+//     from a producer thread at --texture-rate, and of uploading it on the GTK
+//     thread, along with the frames dropped and the GL memory held at the end.
+// *   hidpi: the cost of each render, the VRAM held by render targets and the
+//     bytes copied per frame, at each GDK scale factor (X11 only).
+// *   damage: with damage tracking on and the stub engine drawing the same
+//     frame over and over, the share of frames dropped as unchanged, the time
+//     the raster thread takes to issue the checksums of each frame, and the
+//     rendering this saved.
+// *   hidden: the CPU time the process uses while the widget is hidden, as a
+//     share of one core, the VRAM its render targets still hold, and the time
+//     from showing it again to the first new frame rendered, which includes
+//     allocating them again.
+// *   project_args: the cost of building the engine's project arguments.
+// *   codec: the throughput and allocations of encoding and decoding platform
+//     channel payloads, against a naive codec (see codec_bench.h).
+// *   transfer: the throughput of handing 1 to 64 MB buffers to the framework
+//     through shared memory, against a platform message (see
+//     shared_memory_bench.h).
+//
+// Results are written as JSON with the median, 99th percentile and maximum of
+// each benchmark. Given --baseline, they are compared against earlier results,
+// failing if any got worse by more than --tolerance, unless --report-only is
+// given.
+//
+// Usage: embedder_bench [--output=FILE] [--baseline=FILE] [--tolerance=0.1]
+//                       [--report-only] [--seconds=3] [--resize-rate=120]
+//                       [--texture-rate=120]
+#include <gdk/gdkx.h>
+#include <gtk/gtk.h>
+#include <sys/resource.h>
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench/bench_results.h"
+#include "bench/codec_bench.h"
+#include "bench/shared_memory_bench.h"
+#include "include/flutter_embedder.h"
+#include "include/flutter_embedder_widget_handler.h"
+#include "stub_engine/flutter_engine_stub.h"
+
+namespace {
+
+constexpr int kWindowWidth = 800;
+constexpr int kWindowHeight = 600;
+
+// Sizes the window cycles through while resizing.
+constexpr int kResizeSizes[][2] = {
+    {800, 600}, {823, 611}, {1024, 768}, {640, 480}, {1280, 720}};
+
+constexpr int kPointerRates[] = {1000, 5000, 10000};
+
+// The window size frames are captured at.
+constexpr int kCaptureWidth = 1920;
+constexpr int kCaptureHeight = 1080;
+
+// The GDK scale factors the hidpi phase draws at.
+constexpr int kScaleFactors[] = {1, 2};
+
+constexpr int kProjectArgsIterations = 10000;
+
+// How often the handoff throughput is sampled.
+constexpr int kThroughputWindowMs = 250;
+
+// Lets the engine start up before anything is measured.
+constexpr int kWarmUpMs = 1000;
+
+struct BenchOptions {
+  std::string output;
+  std::string baseline;
+  double tolerance = 0.1;
+  // Whether the comparison against the baseline is only reported.
+  bool report_only = false;
+  int seconds = 3;
+  int resize_rate = 120;
+  // Faster than most displays, so that frames are dropped.
+  int texture_rate = 120;
+};
+
+int64_t GetSteadyClockMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+int64_t GetSteadyClockNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Returns the CPU time used by all threads of the process, in microseconds.
+int64_t GetProcessCpuMicros() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000ll +
+         usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+// Returns the value of |arg| if it is |name|=value, or null otherwise.
+const char *GetFlagValue(const char *arg, const char *name) {
+  size_t length = strlen(name);
+  if (strncmp(arg, name, length) != 0 || arg[length] != '=') {
+    return nullptr;
+  }
+  return arg + length + 1;
+}
+
+bool ParseOptions(int argc, char **argv, BenchOptions *options) {
+  for (int i = 1; i < argc; ++i) {
+    const char *value;
+    if ((value = GetFlagValue(argv[i], "--output")) != nullptr) {
+      options->output = value;
+    } else if ((value = GetFlagValue(argv[i], "--baseline")) != nullptr) {
+      options->baseline = value;
+    } else if ((value = GetFlagValue(argv[i], "--tolerance")) != nullptr) {
+      options->tolerance = atof(value);
+    } else if (strcmp(argv[i], "--report-only") == 0) {
+      options->report_only = true;
+    } else if ((value = GetFlagValue(argv[i], "--seconds")) != nullptr) {
+      options->seconds = atoi(value);
+    } else if ((value = GetFlagValue(argv[i], "--resize-rate")) != nullptr) {
+      options->resize_rate = atoi(value);
+    } else if ((value = GetFlagValue(argv[i], "--texture-rate")) != nullptr) {
+      options->texture_rate = atoi(value);
+    } else {
+      std::cerr << "Unknown argument: " << argv[i] << std::endl;
+      return false;
+    }
+  }
+  return options->seconds > 0 && options->resize_rate > 0 &&
+         options->texture_rate > 0;
+}
+
+// Summarizes a histogram of nanoseconds in microseconds.
+BenchResult SummarizeHistogram(const std::string &name,
+                               const LatencyHistogram &histogram) {
+  BenchResult result;
+  result.name = name;
+  result.unit = "us";
+  result.count = histogram.count();
+  result.p50 = histogram.Percentile(50.0) / 1000.0;
+  result.p99 = histogram.Percentile(99.0) / 1000.0;
+  result.max = histogram.max() / 1000.0;
+  return result;
+}
+
+BenchResult BenchProjectArgs() {
+  const char *argv[] = {"", "--dart-non-checked-mode"};
+  std::vector<double> samples;
+  samples.reserve(kProjectArgsIterations);
+  for (int i = 0; i < kProjectArgsIterations; ++i) {
+    int64_t start = GetSteadyClockNanos();
+    FlutterEngineParams params("lib/main.dart", "build/flutter_assets",
+                               ".packages", "icudtl.dat", 2, argv);
+    auto args = params.GetProjectArgs(nullptr);
+    samples.push_back(GetSteadyClockNanos() - start);
+  }
+  return SummarizeSamples("project_args", "ns", false, &samples);
+}
+
+// Runs the phases that need a window, driving the handler directly so that
+// each of its entry points can be timed.
+class WindowBench {
+ public:
+  explicit WindowBench(const BenchOptions &options)
+      : options_(options),
+        phase_(Phase::kWarmUp),
+        window_(nullptr),
+        gl_area_(nullptr),
+        handler_(nullptr),
+        frames_in_window_(0),
+        resize_index_(0),
+        pointer_rate_index_(0),
+        pointer_start_(0),
+        pointer_event_count_(0),
+        first_pointer_event_count_(0),
+        first_pointer_send_count_(0),
+        texture_id_(0),
+        producing_(false),
+        scale_factor_index_(0),
+        scale_frames_(0),
+        first_copied_bytes_(0),
+        first_stats_(),
+        hidden_start_(0),
+        hidden_cpu_start_(0),
+        shown_time_(0) {}
+
+  void Start(GtkApplication *app) {
+    app_ = app;
+    window_ = gtk_application_window_new(app);
+    gtk_window_set_default_size(GTK_WINDOW(window_), kWindowWidth,
+                                kWindowHeight);
+    gl_area_ = gtk_gl_area_new();
+    gtk_gl_area_set_use_es(GTK_GL_AREA(gl_area_), TRUE);
+    gtk_gl_area_set_has_alpha(GTK_GL_AREA(gl_area_), TRUE);
+    const char *argv[] = {"", "--dart-non-checked-mode"};
+    handler_ = new FlutterEmbedderWidgetHandler(
+        "", "", "", "", 2, argv, GTK_GL_AREA(gl_area_));
+    g_signal_connect(gl_area_, "realize", G_CALLBACK(Realize), this);
+    g_signal_connect(gl_area_, "render", G_CALLBACK(Render), this);
+    g_signal_connect(gl_area_, "resize", G_CALLBACK(Resize), this);
+    g_signal_connect(gl_area_, "notify::scale-factor",
+                     G_CALLBACK(ScaleFactorChanged), this);
+    g_signal_connect(gl_area_, "map", G_CALLBACK(Map), this);
+    g_signal_connect(gl_area_, "unmap", G_CALLBACK(Unmap), this);
+    g_signal_connect(gl_area_, "unrealize", G_CALLBACK(Unrealize), this);
+    g_signal_connect(gl_area_, "destroy", G_CALLBACK(Destroy), this);
+    gtk_container_add(GTK_CONTAINER(window_), gl_area_);
+    gtk_widget_show_all(window_);
+    g_timeout_add(kWarmUpMs, NextPhase, this);
+  }
+
+  std::vector<BenchResult> &results() { return results_; }
+
+ private:
+  enum class Phase {
+    kWarmUp,
+    kHandoff,
+    kResize,
+    kPointer,
+    kCaptureWarmUp,
+    kCapture,
+    kTexture,
+    kHiDpiWarmUp,
+    kHiDpi,
+    kDamageWarmUp,
+    kDamage,
+    kHidden,
+    kResume,
+    kDone
+  };
+
+  static gboolean Realize(GtkWidget *area, gpointer user_data) {
+    auto bench = reinterpret_cast<WindowBench *>(user_data);
+    GtkAllocation allocation;
+    gtk_widget_get_allocation(area, &allocation);
+    return bench->handler_->InitFlutterEngine(
+        gtk_gl_area_get_context(GTK_GL_AREA(area)), &allocation);
+  }
+
+  static gboolean Render(GtkWidget *area, GdkGLContext *context,
+                         gpointer user_data) {
+    auto bench = reinterpret_cast<WindowBench *>(user_data);
+    FlutterEmbedderWidgetHandler *handler = bench->handler_;
+    uint64_t stale_count = handler->stale_frame_count();
+    uint64_t skipped_count = handler->skipped_render_count();
+    GtkAllocation allocation;
+    gtk_widget_get_allocation(area, &allocation);
+    int64_t start = GetSteadyClockMicros();
+    handler->RenderGtkWidget(&allocation);
+    int64_t end = GetSteadyClockMicros();
+    bool new_frame = handler->stale_frame_count() == stale_count &&
+                     handler->skipped_render_count() == skipped_count;
+    if (bench->phase_ == Phase::kHandoff && new_frame) {
+      // The frame drawn is the last one presented, give or take one that was
+      // published while its present callback had yet to return.
+      bench->handoff_latency_.push_back(end -
+                                        FlutterStubEngineLastPresentTime());
+      bench->handoff_render_.push_back(end - start);
+      ++bench->frames_in_window_;
+    } else if (bench->phase_ == Phase::kResize) {
+      bench->resize_render_.push_back(end - start);
+    } else if (bench->phase_ == Phase::kHiDpi && new_frame) {
+      bench->scale_render_.push_back(end - start);
+      ++bench->scale_frames_;
+    } else if (bench->phase_ == Phase::kResume && new_frame &&
+               bench->resume_latency_.empty()) {
+      bench->resume_latency_.push_back(end - bench->shown_time_);
+    }
+    return TRUE;
+  }
+
+  static void Resize(GtkWidget *area, gint width, gint height,
+                     gpointer user_data) {
+    auto bench = reinterpret_cast<WindowBench *>(user_data);
+    GtkAllocation allocation;
+    gtk_widget_get_allocation(area, &allocation);
+    int64_t start = GetSteadyClockMicros();
+    bench->handler_->HandleResizeEvent(&allocation);
+    if (bench->phase_ == Phase::kResize) {
+      bench->resize_event_.push_back(GetSteadyClockMicros() - start);
+    }
+  }
+
+  static void ScaleFactorChanged(GObject *object, GParamSpec *pspec,
+                                 gpointer user_data) {
+    auto bench = reinterpret_cast<WindowBench *>(user_data);
+    GtkAllocation allocation;
+    gtk_widget_get_allocation(bench->gl_area_, &allocation);
+    bench->handler_->HandleResizeEvent(&allocation);
+  }
+
+  static void Map(GtkWidget *area, gpointer user_data) {
+    reinterpret_cast<WindowBench *>(user_data)->handler_->HandleMapEvent(true);
+  }
+
+  static void Unmap(GtkWidget *area, gpointer user_data) {
+    reinterpret_cast<WindowBench *>(user_data)->handler_->HandleMapEvent(
+        false);
+  }
+
+  static void Unrealize(GtkWidget *area, gpointer user_data) {
+    auto bench = reinterpret_cast<WindowBench *>(user_data);
+    gtk_gl_area_make_current(GTK_GL_AREA(area));
+    if (gtk_gl_area_get_error(GTK_GL_AREA(area)) == nullptr) {
+      bench->handler_->HandleUnrealizeEvent();
+    }
+  }
+
+  static void Destroy(GtkWidget *area, gpointer user_data) {
+    auto bench = reinterpret_cast<WindowBench *>(user_data);
+    delete bench->handler_;
+    bench->handler_ = nullptr;
+  }
+
+  static gboolean SampleThroughput(gpointer user_data) {
+    auto bench = reinterpret_cast<WindowBench *>(user_data);
+    if (bench->phase_ != Phase::kHandoff) {
+      return G_SOURCE_REMOVE;
+    }
+    bench->handoff_fps_.push_back(bench->frames_in_window_ * 1000.0 /
+                                  kThroughputWindowMs);
+    bench->frames_in_window_ = 0;
+    return G_SOURCE_CONTINUE;
+  }
+
+  static gboolean ResizeWindow(gpointer user_data) {
+    auto bench = reinterpret_cast<WindowBench *>(user_data);
+    if (bench->phase_ != Phase::kResize) {
+      return G_SOURCE_REMOVE;
+    }
+    constexpr size_t kSizeCount = sizeof(kResizeSizes) / sizeof(*kResizeSizes);
+    const int *size = kResizeSizes[++bench->resize_index_ % kSizeCount];
+    gtk_window_resize(GTK_WINDOW(bench->window_), size[0], size[1]);
+    return G_SOURCE_CONTINUE;
+  }
+
+  GdkEvent *NewPointerEvent(GdkEventType type, double t) {
+    GdkEvent *event = gdk_event_new(type);
+    GdkDevice *device = gdk_seat_get_pointer(
+        gdk_display_get_default_seat(gdk_display_get_default()));
+    gdk_event_set_device(event, device);
+    gdk_event_set_source_device(event, device);
+    double x = kWindowWidth / 2 + 100.0 * std::cos(t);
+    double y = kWindowHeight / 2 + 100.0 * std::sin(t);
+    guint32 time = static_cast<guint32>(g_get_monotonic_time() / 1000);
+    if (type == GDK_MOTION_NOTIFY) {
+      event->motion.x = x;
+      event->motion.y = y;
+      event->motion.time = time;
+    } else {
+      event->button.x = x;
+      event->button.y = y;
+      event->button.time = time;
+      event->button.button = 1;
+    }
+    return event;
+  }
+
+  // Sends the motion events due at the current pointer rate.
+  static gboolean SendPointerEvents(gpointer user_data) {
+    auto bench = reinterpret_cast<WindowBench *>(user_data);
+    if (bench->phase_ != Phase::kPointer) {
+      return G_SOURCE_REMOVE;
+    }
+    int rate = kPointerRates[bench->pointer_rate_index_];
+    int64_t due = (GetSteadyClockMicros() - bench->pointer_start_) * rate /
+                  (1000 * 1000);
+    for (; bench->pointer_event_count_ < due; ++bench->pointer_event_count_) {
+      GdkEvent *event = bench->NewPointerEvent(
+          GDK_MOTION_NOTIFY, bench->pointer_event_count_ * 0.01);
+      int64_t start = GetSteadyClockNanos();
+      bench->handler_->HandleMotionEvent(event);
+      bench->pointer_motion_.push_back(GetSteadyClockNanos() - start);
+      gdk_event_free(event);
+    }
+    return G_SOURCE_CONTINUE;
+  }
+
+  void StartPointerRate() {
+    pointer_start_ = GetSteadyClockMicros();
+    pointer_event_count_ = 0;
+    pointer_motion_.clear();
+    first_pointer_event_count_ = handler_->pointer_event_count();
+    first_pointer_send_count_ = handler_->pointer_send_count();
+    GdkEvent *press = NewPointerEvent(GDK_BUTTON_PRESS, 0.0);
+    handler_->HandleButtonPressEvent(press);
+    gdk_event_free(press);
+    g_idle_add(SendPointerEvents, this);
+  }
+
+  void FinishPointerRate() {
+    GdkEvent *release = NewPointerEvent(GDK_BUTTON_RELEASE, 0.0);
+    handler_->HandleButtonReleaseEvent(release);
+    gdk_event_free(release);
+    std::string name =
+        "pointer_" + std::to_string(kPointerRates[pointer_rate_index_]) + "hz";
+    results_.push_back(
+        SummarizeSamples(name + "_motion", "ns", false, &pointer_motion_));
+    uint64_t sends = handler_->pointer_send_count() - first_pointer_send_count_;
+    std::vector<double> events_per_send = {
+        sends > 0 ? static_cast<double>(handler_->pointer_event_count() -
+                                        first_pointer_event_count_) /
+                        sends
+                  : 0.0};
+    results_.push_back(SummarizeSamples(name + "_events_per_send", "events",
+                                        true, &events_per_send));
+  }
+
+  void FinishCapture() {
+    FrameCapture *capture = handler_->frame_capture();
+    capture->StopStream();
+    // The capture keeps its own histogram, in nanoseconds.
+    results_.push_back(SummarizeHistogram("capture_1080p_main_thread",
+                                          capture->capture_time()));
+    std::vector<double> dropped = {
+        static_cast<double>(capture->dropped_count())};
+    results_.push_back(
+        SummarizeSamples("capture_1080p_dropped_frames", "frames", false,
+                         &dropped));
+  }
+
+  // Pushes 1080p frames into the texture at --texture-rate, each a different
+  // shade so that the upload cannot be skipped.
+  void ProduceTextureFrames() {
+    size_t stride = static_cast<size_t>(kCaptureWidth) * 4;
+    std::vector<uint8_t> pixels(stride * kCaptureHeight);
+    auto interval = std::chrono::microseconds(1000 * 1000 /
+                                              options_.texture_rate);
+    auto next = std::chrono::steady_clock::now();
+    for (int frame = 0; producing_.load(); ++frame) {
+      memset(pixels.data(), frame & 0xff, pixels.size());
+      handler_->textures()->PushFrame(texture_id_, pixels.data(),
+                                      kCaptureWidth, kCaptureHeight, stride);
+      next += interval;
+      std::this_thread::sleep_until(next);
+    }
+  }
+
+  void StartTexture() {
+    TextureRegistry *textures = handler_->textures();
+    texture_id_ = textures->RegisterTexture();
+    TextureRect rect;
+    rect.width = kCaptureWidth;
+    rect.height = kCaptureHeight;
+    textures->SetTextureRect(texture_id_, rect);
+    producing_ = true;
+    producer_ = std::thread(&WindowBench::ProduceTextureFrames, this);
+  }
+
+  void FinishTexture() {
+    producing_ = false;
+    producer_.join();
+    TextureRegistry *textures = handler_->textures();
+    // The registry keeps its own histograms, in nanoseconds.
+    results_.push_back(
+        SummarizeHistogram("texture_1080p_push", textures->push_time()));
+    results_.push_back(
+        SummarizeHistogram("texture_1080p_upload", textures->upload_time()));
+    std::vector<double> dropped = {
+        static_cast<double>(textures->dropped_count())};
+    results_.push_back(SummarizeSamples("texture_1080p_dropped_frames",
+                                        "frames", false, &dropped));
+    // Rendering has settled, so this is what a steady stream holds.
+    std::vector<double> memory = {textures->memory_bytes() / 1e6};
+    results_.push_back(
+        SummarizeSamples("texture_1080p_memory", "MB", false, &memory));
+    textures->UnregisterTexture(texture_id_);
+  }
+
+  // Switches the display to the next scale factor, at the default window
+  // size.
+  void StartScaleFactor() {
+    GdkDisplay *display = gdk_display_get_default();
+    if (GDK_IS_X11_DISPLAY(display)) {
+      gdk_x11_display_set_window_scale(display,
+                                       kScaleFactors[scale_factor_index_]);
+    }
+    gtk_window_resize(GTK_WINDOW(window_), kWindowWidth, kWindowHeight);
+  }
+
+  void FinishScaleFactor() {
+    int scale = kScaleFactors[scale_factor_index_];
+    if (handler_->scale_factor() != scale) {
+      std::cerr << "Unable to draw at scale factor " << scale << std::endl;
+    }
+    std::string name = "hidpi_scale" + std::to_string(scale);
+    results_.push_back(
+        SummarizeSamples(name + "_render", "us", false, &scale_render_));
+    std::vector<double> memory = {handler_->render_target_bytes() / 1e6};
+    results_.push_back(SummarizeSamples(name + "_render_target_memory", "MB",
+                                        false, &memory));
+    std::vector<double> copied = {
+        scale_frames_ > 0
+            ? (handler_->copied_bytes() - first_copied_bytes_) / 1e6 /
+                  scale_frames_
+            : 0.0};
+    results_.push_back(
+        SummarizeSamples(name + "_copy_per_frame", "MB", false, &copied));
+    scale_render_.clear();
+  }
+
+  // Has the stub engine draw the same frame over and over, at scale factor 1,
+  // with damage tracking on.
+  void StartDamage() {
+    scale_factor_index_ = 0;
+    StartScaleFactor();
+    FlutterStubEngineSetAnimating(false);
+    handler_->SetDamageTracking(true);
+  }
+
+  // Records the time GTK spent blocked on frames during the handoff phase.
+  void FinishHandoffBlocked() {
+    FlutterEmbedderStats stats;
+    handler_->GetStats(&stats);
+    std::vector<double> blocked = {
+        (stats.blocked_on_frames_us - first_stats_.blocked_on_frames_us) /
+        1000.0 / options_.seconds};
+    results_.push_back(
+        SummarizeSamples("handoff_blocked", "ms/s", false, &blocked));
+  }
+
+  void FinishDamage() {
+    FlutterEmbedderStats stats;
+    handler_->GetStats(&stats);
+    double unchanged = stats.unchanged_frames - first_stats_.unchanged_frames;
+    double published = stats.frames_shown + stats.dropped_frames -
+                       first_stats_.frames_shown - first_stats_.dropped_frames;
+    std::vector<double> skip_rate = {
+        unchanged + published > 0 ? 100.0 * unchanged / (unchanged + published)
+                                  : 0.0};
+    results_.push_back(
+        SummarizeSamples("damage_idle_skip_rate", "%", true, &skip_rate));
+    // The handler keeps its own histogram, in microseconds.
+    BenchResult check;
+    check.name = "damage_idle_check";
+    check.unit = "us";
+    check.count = stats.damage_check.count;
+    check.p50 = stats.damage_check.p50_us;
+    check.p99 = stats.damage_check.p99_us;
+    check.max = stats.damage_check.max_us;
+    results_.push_back(check);
+    std::vector<double> saved = {
+        (stats.skipped_render_bytes - first_stats_.skipped_render_bytes) /
+        1e6 / options_.seconds};
+    results_.push_back(
+        SummarizeSamples("damage_idle_render_saved", "MB/s", true, &saved));
+    handler_->SetDamageTracking(false);
+    FlutterStubEngineSetAnimating(true);
+  }
+
+  // Hides the widget, which unmaps it.
+  void StartHidden() {
+    gtk_widget_hide(gl_area_);
+    hidden_start_ = GetSteadyClockMicros();
+    hidden_cpu_start_ = GetProcessCpuMicros();
+  }
+
+  // Shows the widget again, after measuring the CPU time used while hidden,
+  // and the VRAM left once unmapping released it.
+  void FinishHidden() {
+    double elapsed = GetSteadyClockMicros() - hidden_start_;
+    std::vector<double> cpu = {
+        100.0 * (GetProcessCpuMicros() - hidden_cpu_start_) / elapsed};
+    results_.push_back(SummarizeSamples("hidden_cpu", "%", false, &cpu));
+    std::vector<double> memory = {handler_->render_target_bytes() / 1e6};
+    results_.push_back(SummarizeSamples("hidden_render_target_memory", "MB",
+                                        false, &memory));
+    if (handler_->visible()) {
+      std::cerr << "The widget stayed visible while hidden" << std::endl;
+    }
+    shown_time_ = GetSteadyClockMicros();
+    gtk_widget_show(gl_area_);
+  }
+
+  // Ends the current phase and starts the next one.
+  static gboolean NextPhase(gpointer user_data) {
+    auto bench = reinterpret_cast<WindowBench *>(user_data);
+    int phase_ms = bench->options_.seconds * 1000;
+    switch (bench->phase_) {
+      case Phase::kWarmUp:
+        bench->phase_ = Phase::kHandoff;
+        bench->handler_->GetStats(&bench->first_stats_);
+        g_timeout_add(kThroughputWindowMs, SampleThroughput, bench);
+        g_timeout_add(phase_ms, NextPhase, bench);
+        break;
+      case Phase::kHandoff:
+        bench->results_.push_back(SummarizeSamples(
+            "handoff_latency", "us", false, &bench->handoff_latency_));
+        bench->results_.push_back(SummarizeSamples(
+            "handoff_throughput", "fps", true, &bench->handoff_fps_));
+        bench->results_.push_back(SummarizeSamples(
+            "handoff_render", "us", false, &bench->handoff_render_));
+        bench->FinishHandoffBlocked();
+        bench->phase_ = Phase::kResize;
+        g_timeout_add(1000 / bench->options_.resize_rate, ResizeWindow, bench);
+        g_timeout_add(phase_ms, NextPhase, bench);
+        break;
+      case Phase::kResize:
+        bench->results_.push_back(SummarizeSamples(
+            "resize_event", "us", false, &bench->resize_event_));
+        bench->results_.push_back(SummarizeSamples(
+            "resize_render", "us", false, &bench->resize_render_));
+        bench->allocations_.push_back(
+            bench->handler_->storage_allocation_count());
+        bench->results_.push_back(
+            SummarizeSamples("resize_storage_allocations", "allocations",
+                             false, &bench->allocations_));
+        bench->phase_ = Phase::kPointer;
+        bench->StartPointerRate();
+        g_timeout_add(phase_ms, NextPhase, bench);
+        break;
+      case Phase::kPointer: {
+        bench->FinishPointerRate();
+        constexpr size_t kRateCount =
+            sizeof(kPointerRates) / sizeof(*kPointerRates);
+        if (++bench->pointer_rate_index_ < kRateCount) {
+          bench->StartPointerRate();
+          g_timeout_add(phase_ms, NextPhase, bench);
+          break;
+        }
+        bench->phase_ = Phase::kCaptureWarmUp;
+        gtk_window_resize(GTK_WINDOW(bench->window_), kCaptureWidth,
+                          kCaptureHeight);
+        g_timeout_add(kWarmUpMs, NextPhase, bench);
+        break;
+      }
+      case Phase::kCaptureWarmUp:
+        bench->phase_ = Phase::kCapture;
+        bench->handler_->frame_capture()->StartStream(
+            CreateCaptureSink(CaptureFormat::kY4m, "/dev/null"), 0);
+        g_timeout_add(phase_ms, NextPhase, bench);
+        break;
+      case Phase::kCapture:
+        bench->FinishCapture();
+        bench->phase_ = Phase::kTexture;
+        bench->StartTexture();
+        g_timeout_add(phase_ms, NextPhase, bench);
+        break;
+      case Phase::kTexture:
+        bench->FinishTexture();
+        bench->phase_ = Phase::kHiDpiWarmUp;
+        bench->StartScaleFactor();
+        g_timeout_add(kWarmUpMs, NextPhase, bench);
+        break;
+      case Phase::kHiDpiWarmUp:
+        bench->phase_ = Phase::kHiDpi;
+        bench->scale_frames_ = 0;
+        bench->first_copied_bytes_ = bench->handler_->copied_bytes();
+        g_timeout_add(phase_ms, NextPhase, bench);
+        break;
+      case Phase::kHiDpi: {
+        bench->FinishScaleFactor();
+        constexpr size_t kScaleCount =
+            sizeof(kScaleFactors) / sizeof(*kScaleFactors);
+        if (++bench->scale_factor_index_ < kScaleCount) {
+          bench->phase_ = Phase::kHiDpiWarmUp;
+          bench->StartScaleFactor();
+          g_timeout_add(kWarmUpMs, NextPhase, bench);
+          break;
+        }
+        bench->phase_ = Phase::kDamageWarmUp;
+        bench->StartDamage();
+        g_timeout_add(kWarmUpMs, NextPhase, bench);
+        break;
+      }
+      case Phase::kDamageWarmUp:
+        bench->phase_ = Phase::kDamage;
+        bench->handler_->GetStats(&bench->first_stats_);
+        g_timeout_add(phase_ms, NextPhase, bench);
+        break;
+      case Phase::kDamage:
+        bench->FinishDamage();
+        bench->phase_ = Phase::kHidden;
+        bench->StartHidden();
+        g_timeout_add(phase_ms, NextPhase, bench);
+        break;
+      case Phase::kHidden:
+        bench->FinishHidden();
+        bench->phase_ = Phase::kResume;
+        g_timeout_add(kWarmUpMs, NextPhase, bench);
+        break;
+      case Phase::kResume:
+        bench->results_.push_back(SummarizeSamples(
+            "hidden_resume_latency", "us", false, &bench->resume_latency_));
+        bench->phase_ = Phase::kDone;
+        // Destroying the window deletes the handler, shutting the engine down.
+        gtk_widget_destroy(bench->window_);
+        g_application_quit(G_APPLICATION(bench->app_));
+        break;
+      case Phase::kDone:
+        break;
+    }
+    return G_SOURCE_REMOVE;
+  }
+
+  BenchOptions options_;
+  Phase phase_;
+  GtkApplication *app_;
+  GtkWidget *window_;
+  GtkWidget *gl_area_;
+  FlutterEmbedderWidgetHandler *handler_;
+
+  std::vector<BenchResult> results_;
+  std::vector<double> handoff_latency_;
+  std::vector<double> handoff_fps_;
+  std::vector<double> handoff_render_;
+  int frames_in_window_;
+  std::vector<double> resize_event_;
+  std::vector<double> resize_render_;
+  std::vector<double> allocations_;
+  size_t resize_index_;
+  size_t pointer_rate_index_;
+  int64_t pointer_start_;
+  int64_t pointer_event_count_;
+  std::vector<double> pointer_motion_;
+  uint64_t first_pointer_event_count_;
+  uint64_t first_pointer_send_count_;
+  int64_t texture_id_;
+  std::atomic<bool> producing_;
+  std::thread producer_;
+  size_t scale_factor_index_;
+  std::vector<double> scale_render_;
+  int scale_frames_;
+  uint64_t first_copied_bytes_;
+  // The statistics as the handoff and damage phases started.
+  FlutterEmbedderStats first_stats_;
+  int64_t hidden_start_;
+  int64_t hidden_cpu_start_;
+  int64_t shown_time_;
+  std::vector<double> resume_latency_;
+};
+
+void app_activate(GtkApplication *app, gpointer user_data) {
+  reinterpret_cast<WindowBench *>(user_data)->Start(app);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  BenchOptions options;
+  if (!ParseOptions(argc, argv, &options)) {
+    return EXIT_FAILURE;
+  }
+  // Draw as fast as possible, so that the handoff is what limits throughput.
+  setenv("FLUTTER_STUB_FRAME_RATE", "0", 0);
+
+  flutter_embedder_init();
+  WindowBench bench(options);
+  GtkApplication *app =
+      gtk_application_new("flutter.linux.bench", G_APPLICATION_FLAGS_NONE);
+  g_signal_connect(app, "activate", G_CALLBACK(app_activate), &bench);
+  // The options are not meant for GApplication.
+  g_application_run(G_APPLICATION(app), 0, nullptr);
+  g_object_unref(app);
+
+  std::vector<BenchResult> &results = bench.results();
+  results.push_back(BenchProjectArgs());
+  for (BenchResult &result : BenchStandardMessageCodec()) {
+    results.push_back(result);
+  }
+  for (BenchResult &result : BenchSharedMemory()) {
+    results.push_back(result);
+  }
+  if (options.output.empty()) {
+    WriteBenchResults(results, std::cout);
+  } else {
+    std::ofstream output(options.output);
+    WriteBenchResults(results, output);
+  }
+
+  if (options.baseline.empty()) {
+    return EXIT_SUCCESS;
+  }
+  std::ifstream baseline_file(options.baseline);
+  std::vector<BenchResult> baseline;
+  if (!baseline_file || !ReadBenchResults(baseline_file, &baseline)) {
+    std::cerr << "Unable to read the baseline " << options.baseline
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+  bool passed =
+      CompareBenchResults(baseline, results, options.tolerance, std::cerr);
+  return passed || options.report_only ? EXIT_SUCCESS : EXIT_FAILURE;
+}
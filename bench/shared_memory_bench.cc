@@ -0,0 +1,111 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "bench/shared_memory_bench.h"
+
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <string>
+
+#include "include/shared_memory_pool.h"
+#include "include/standard_message_codec.h"
+
+namespace {
+
+constexpr int kTransferCount = 20;
+constexpr size_t kMegabyte = 1024 * 1024;
+
+// Stands in for the engine handing a message to the framework, which copies
+// it at least once.
+class FakeEngine {
+ public:
+  const StandardValue &Deliver(const StandardMessageEncoder &encoder) {
+    received_.assign(encoder.data(), encoder.data() + encoder.size());
+    decoder_.Decode(received_.data(), received_.size());
+    return decoder_.value(0);
+  }
+
+ private:
+  std::vector<uint8_t> received_;
+  StandardMessageDecoder decoder_;
+};
+
+// Fills a buffer the way a producer would, so both paths pay for writing it.
+void Fill(uint8_t *data, size_t size, int transfer) {
+  memset(data, transfer & 0xff, size);
+}
+
+// Reads a little of the buffer, the way the framework would.
+uint64_t Checksum(const uint8_t *data, size_t size) {
+  return data[0] + data[size / 2] + data[size - 1];
+}
+
+// Runs |transfer| on a buffer of |size| bytes, adding its throughput to
+// |results|.
+void MeasureTransfer(const std::string &name, size_t size,
+                     const std::function<void(int)> &transfer,
+                     std::vector<BenchResult> *results) {
+  // Lets pools and buffers kept between transfers grow first.
+  transfer(0);
+  std::vector<double> throughput;
+  for (int i = 1; i <= kTransferCount; ++i) {
+    auto start = std::chrono::steady_clock::now();
+    transfer(i);
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    throughput.push_back(size / 1e6 / elapsed.count());
+  }
+  results->push_back(SummarizeSamples(name, "MB/s", true, &throughput));
+}
+
+}  // namespace
+
+std::vector<BenchResult> BenchSharedMemory() {
+  std::vector<BenchResult> results;
+  SharedMemoryPool pool(128 * kMegabyte, 128 * kMegabyte);
+  StandardMessageEncoder encoder;
+  FakeEngine engine;
+  std::vector<uint8_t> buffer;
+  volatile uint64_t sink = 0;
+  for (size_t megabytes : {1, 4, 16, 64}) {
+    size_t size = megabytes * kMegabyte;
+    std::string suffix = "_" + std::to_string(megabytes) + "mb";
+    MeasureTransfer("transfer_message" + suffix, size,
+                    [&](int transfer) {
+                      buffer.resize(size);
+                      Fill(buffer.data(), size, transfer);
+                      encoder.Clear();
+                      encoder.WriteTypedData(buffer.data(), size);
+                      TypedDataView<uint8_t> bytes =
+                          engine.Deliver(encoder).AsTypedData<uint8_t>();
+                      sink = sink + Checksum(bytes.bytes(), bytes.size());
+                    },
+                    &results);
+    MeasureTransfer(
+        "transfer_shared_memory" + suffix, size,
+        [&](int transfer) {
+          std::shared_ptr<SharedMemoryRegion> region = pool.Acquire(size);
+          Fill(region->data(), size, transfer);
+          encoder.Clear();
+          pool.Share(std::move(region), size, &encoder);
+          const StandardValue &handle = engine.Deliver(encoder);
+          const uint8_t *data = reinterpret_cast<const uint8_t *>(
+              handle.Find("address")->AsInt());
+          sink = sink + Checksum(data, handle.Find("size")->AsInt());
+          pool.Release(handle.Find("id")->AsInt());
+        },
+        &results);
+  }
+  return results;
+}
@@ -0,0 +1,166 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "include/capture_sink.h"
+
+#include <gtk/gtk.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "include/pixel_conversion.h"
+
+// Returns the first row of |frame| as shown, and the stride that walks down
+// from it.
+static const uint8_t *top_row(const CapturedFrame &frame, ptrdiff_t *stride) {
+  *stride = -frame.stride;
+  return frame.pixels + (frame.height - 1) * frame.stride;
+}
+
+// A sink writing to a single file.
+class FileSink : public CaptureSink {
+ public:
+  explicit FileSink(FILE *file) : file_(file) {}
+  ~FileSink() override { fclose(file_); }
+
+ protected:
+  bool WriteBytes(const void *data, size_t size) {
+    if (fwrite(data, 1, size, file_) != size) {
+      std::cerr << "Failed to write captured frame: " << strerror(errno)
+                << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  std::vector<uint8_t> buffer_;
+
+ private:
+  FILE *file_;
+};
+
+class RawBgraSink : public FileSink {
+ public:
+  using FileSink::FileSink;
+
+  bool Write(const CapturedFrame &frame) override {
+    buffer_.resize(static_cast<size_t>(frame.width) * frame.height * 4);
+    ptrdiff_t stride;
+    const uint8_t *top = top_row(frame, &stride);
+    ConvertRgbaToBgra(top, stride, frame.width, frame.height, buffer_.data());
+    return WriteBytes(buffer_.data(), buffer_.size());
+  }
+};
+
+class Y4mSink : public FileSink {
+ public:
+  using FileSink::FileSink;
+
+  bool Write(const CapturedFrame &frame) override {
+    if (width_ == 0) {
+      // The stream header fixes the size, and the frame rate is nominal, as
+      // frames are only captured when they change.
+      char header[128];
+      int length = snprintf(header, sizeof(header),
+                            "YUV4MPEG2 W%d H%d F60:1 Ip A1:1 C420jpeg "
+                            "XCOLORRANGE=FULL\n",
+                            frame.width, frame.height);
+      if (!WriteBytes(header, length)) {
+        return false;
+      }
+      width_ = frame.width;
+      height_ = frame.height;
+    }
+    if (frame.width != width_ || frame.height != height_) {
+      if (!warned_size_) {
+        std::cerr << "Skipping captured frames of " << frame.width << "x"
+                  << frame.height << ", as the stream is " << width_ << "x"
+                  << height_ << std::endl;
+        warned_size_ = true;
+      }
+      return true;
+    }
+    size_t luma_size = static_cast<size_t>(width_) * height_;
+    size_t chroma_size =
+        static_cast<size_t>((width_ + 1) / 2) * ((height_ + 1) / 2);
+    buffer_.resize(luma_size + 2 * chroma_size);
+    uint8_t *y = buffer_.data();
+    ptrdiff_t stride;
+    const uint8_t *top = top_row(frame, &stride);
+    ConvertRgbaToI420(top, stride, width_, height_, y, y + luma_size,
+                      y + luma_size + chroma_size);
+    static const char kFrameHeader[] = "FRAME\n";
+    return WriteBytes(kFrameHeader, sizeof(kFrameHeader) - 1) &&
+           WriteBytes(buffer_.data(), buffer_.size());
+  }
+
+ private:
+  int width_ = 0;
+  int height_ = 0;
+  bool warned_size_ = false;
+};
+
+class PngSink : public CaptureSink {
+ public:
+  explicit PngSink(const std::string &path) : path_(path), count_(0) {}
+
+  bool Write(const CapturedFrame &frame) override {
+    // gdk-pixbuf wants the top row first, and straight alpha.
+    size_t row_size = static_cast<size_t>(frame.width) * 4;
+    pixels_.resize(row_size * frame.height);
+    ptrdiff_t stride;
+    const uint8_t *top = top_row(frame, &stride);
+    ConvertRgbaToStraightAlpha(top, stride, frame.width, frame.height,
+                               pixels_.data());
+    GdkPixbuf *pixbuf = gdk_pixbuf_new_from_data(
+        pixels_.data(), GDK_COLORSPACE_RGB, TRUE, 8, frame.width,
+        frame.height, row_size, nullptr, nullptr);
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), "_%06u.png", count_++);
+    std::string path = path_ + suffix;
+    GError *error = nullptr;
+    bool saved = gdk_pixbuf_save(pixbuf, path.c_str(), "png", &error, nullptr);
+    g_object_unref(pixbuf);
+    if (!saved) {
+      std::cerr << "Failed to save " << path << ": " << error->message
+                << std::endl;
+      g_error_free(error);
+    }
+    return saved;
+  }
+
+ private:
+  std::string path_;
+  unsigned count_;
+  std::vector<uint8_t> pixels_;
+};
+
+std::unique_ptr<CaptureSink> CreateCaptureSink(CaptureFormat format,
+                                               const std::string &path) {
+  if (format == CaptureFormat::kPng) {
+    return std::unique_ptr<CaptureSink>(new PngSink(path));
+  }
+  FILE *file = fopen(path.c_str(), "wb");
+  if (file == nullptr) {
+    std::cerr << "Failed to open " << path << ": " << strerror(errno)
+              << std::endl;
+    return nullptr;
+  }
+  if (format == CaptureFormat::kY4m) {
+    return std::unique_ptr<CaptureSink>(new Y4mSink(file));
+  }
+  return std::unique_ptr<CaptureSink>(new RawBgraSink(file));
+}
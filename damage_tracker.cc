@@ -0,0 +1,450 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "include/damage_tracker.h"
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+
+#include "include/graphics.h"
+#include "include/trace.h"
+
+static constexpr char kChecksumVertexShader[] = R"glsl(
+in vec2 position;
+
+void main() {
+  gl_Position = vec4(position, 0.0, 1.0);
+}
+)glsl";
+
+// Each fragment hashes the texels of its tile, bottom row first, with FNV-1a
+// and a polynomial hash, so that moving pixels around changes the checksum as
+// well as changing them. When comparing, it also marks whether the tile
+// differs from what another render target holds.
+static constexpr char kChecksumFragmentShader[] = R"glsl(
+uniform sampler2D frame;
+uniform usampler2D contents;
+uniform ivec2 frame_size;
+uniform bool compare;
+out uvec4 checksum;
+
+void main() {
+  ivec2 tile = ivec2(gl_FragCoord.xy);
+  ivec2 start = tile * TILE_SIZE;
+  ivec2 end = min(start + TILE_SIZE, frame_size);
+  uint fnv = 2166136261u;
+  uint polynomial = 0u;
+  for (int y = start.y; y < end.y; ++y) {
+    for (int x = start.x; x < end.x; ++x) {
+      uvec4 c = uvec4(texelFetch(frame, ivec2(x, y), 0) * 255.0 + 0.5);
+      uint texel = c.r | (c.g << 8) | (c.b << 16) | (c.a << 24);
+      fnv = (fnv ^ texel) * 16777619u;
+      polynomial = polynomial * 31u + texel;
+    }
+  }
+  bool changed =
+      !compare || texelFetch(contents, tile, 0).xy != uvec2(fnv, polynomial);
+  checksum = uvec4(fnv, polynomial, changed ? 1u : 0u, 0u);
+}
+)glsl";
+
+// Copies the texels of the tiles the checksum pass marked as changed.
+static constexpr char kCopyFragmentShader[] = R"glsl(
+uniform sampler2D frame;
+uniform usampler2D checksums;
+out vec4 color;
+
+void main() {
+  ivec2 texel = ivec2(gl_FragCoord.xy);
+  if (texelFetch(checksums, texel / TILE_SIZE, 0).z == 0u) {
+    discard;
+  }
+  color = texelFetch(frame, texel, 0);
+}
+)glsl";
+
+// Returns |body| prefixed with the GLSL version of the current context, or an
+// empty string if it has no integer render targets.
+static std::string get_shader_source(const char *body) {
+  std::string source;
+  if (epoxy_is_desktop_gl()) {
+    if (epoxy_gl_version() < 32) {
+      return "";
+    }
+    source = "#version 150\n";
+  } else {
+    if (epoxy_gl_version() < 30) {
+      return "";
+    }
+    source =
+        "#version 300 es\n"
+        "precision highp float;\n"
+        "precision highp int;\n"
+        "precision highp sampler2D;\n"
+        "precision highp usampler2D;\n";
+  }
+  source += "#define TILE_SIZE " + std::to_string(DamageTracker::kTileSize) +
+            "\n";
+  return source + body;
+}
+
+// Saves the GL state the checksum and copy passes change, on top of the
+// bindings saved by SavedBufferContextRestorer, and restores it when released.
+// The engine expects its state to be left as it was.
+struct SavedDrawStateRestorer {
+  GLint program = 0;
+  GLint array_buffer = 0;
+  GLint vertex_array = 0;
+  GLint pixel_pack_buffer = 0;
+  GLint draw_framebuffer = 0;
+  GLint read_framebuffer = 0;
+  GLint active_texture = 0;
+  // The textures bound to the units the passes use.
+  GLint textures[2] = {};
+  GLint viewport[4] = {};
+  GLboolean color_mask[4] = {};
+  GLboolean scissor_test = GL_FALSE;
+  GLboolean cull_face = GL_FALSE;
+  GLboolean blend = GL_FALSE;
+
+  SavedDrawStateRestorer() {
+    glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+    glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &array_buffer);
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &vertex_array);
+    glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &pixel_pack_buffer);
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &draw_framebuffer);
+    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &read_framebuffer);
+    glGetIntegerv(GL_ACTIVE_TEXTURE, &active_texture);
+    for (GLint unit = 0; unit < 2; ++unit) {
+      glActiveTexture(GL_TEXTURE0 + unit);
+      glGetIntegerv(kDefaultTextureTargetBinding, &textures[unit]);
+    }
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glGetBooleanv(GL_COLOR_WRITEMASK, color_mask);
+    scissor_test = glIsEnabled(GL_SCISSOR_TEST);
+    cull_face = glIsEnabled(GL_CULL_FACE);
+    blend = glIsEnabled(GL_BLEND);
+  }
+
+  ~SavedDrawStateRestorer() {
+    glUseProgram(program);
+    glBindVertexArray(vertex_array);
+    glBindBuffer(GL_ARRAY_BUFFER, array_buffer);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pixel_pack_buffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, draw_framebuffer);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, read_framebuffer);
+    for (GLint unit = 0; unit < 2; ++unit) {
+      glActiveTexture(GL_TEXTURE0 + unit);
+      glBindTexture(kDefaultTextureTarget, textures[unit]);
+    }
+    glActiveTexture(active_texture);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    glColorMask(color_mask[0], color_mask[1], color_mask[2], color_mask[3]);
+    if (scissor_test) {
+      glEnable(GL_SCISSOR_TEST);
+    }
+    if (cull_face) {
+      glEnable(GL_CULL_FACE);
+    }
+    if (blend) {
+      glEnable(GL_BLEND);
+    }
+  }
+};
+
+// Returns a program drawing |fragment_body| over the viewport, whose samplers
+// "frame" and |sampler| read from texture units 0 and 1, or 0 if it could not
+// be built.
+static GLuint create_program(const char *fragment_body, const char *sampler) {
+  std::string vertex_source = get_shader_source(kChecksumVertexShader);
+  std::string fragment_source = get_shader_source(fragment_body);
+  GLuint program = LinkProgram(
+      CompileShader(GL_VERTEX_SHADER, vertex_source.c_str()),
+      CompileShader(GL_FRAGMENT_SHADER, fragment_source.c_str()), "position");
+  if (program != 0) {
+    glUseProgram(program);
+    glUniform1i(glGetUniformLocation(program, "frame"), 0);
+    glUniform1i(glGetUniformLocation(program, sampler), 1);
+  }
+  return program;
+}
+
+// Returns a texture holding a texel of checksums for each of |columns|x|rows|
+// tiles, bound to the active texture unit.
+static GLuint create_checksum_texture(int columns, int rows) {
+  GLuint texture = 0;
+  glGenTextures(1, &texture);
+  glBindTexture(kDefaultTextureTarget, texture);
+  glTexParameteri(kDefaultTextureTarget, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(kDefaultTextureTarget, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexImage2D(kDefaultTextureTarget, 0, GL_RGBA32UI, columns, rows, 0,
+               GL_RGBA_INTEGER, GL_UNSIGNED_INT, nullptr);
+  return texture;
+}
+
+DamageTracker::DamageTracker(size_t target_count)
+    : checksum_program_(0),
+      copy_program_(0),
+      vbo_(0),
+      vao_(0),
+      frame_size_location_(-1),
+      compare_location_(-1),
+      checksum_fbo_(0),
+      copy_fbo_(0),
+      texture_columns_(0),
+      texture_rows_(0),
+      targets_(target_count),
+      unsupported_(false) {}
+
+DamageTracker::~DamageTracker() = default;
+
+bool DamageTracker::Initialize() {
+  if (checksum_program_ != 0) {
+    return true;
+  }
+  if (unsupported_) {
+    return false;
+  }
+  if (get_shader_source("").empty()) {
+    std::cerr << "Unable to track damage, as the context has no integer "
+                 "render targets."
+              << std::endl;
+    unsupported_ = true;
+    return false;
+  }
+  checksum_program_ = create_program(kChecksumFragmentShader, "contents");
+  copy_program_ = create_program(kCopyFragmentShader, "checksums");
+  if (checksum_program_ == 0 || copy_program_ == 0) {
+    DeleteProgram(checksum_program_);
+    DeleteProgram(copy_program_);
+    checksum_program_ = 0;
+    copy_program_ = 0;
+    unsupported_ = true;
+    return false;
+  }
+  frame_size_location_ =
+      glGetUniformLocation(checksum_program_, "frame_size");
+  compare_location_ = glGetUniformLocation(checksum_program_, "compare");
+
+  // A triangle covering the viewport, as drawn by BlitProgram.
+  static constexpr GLfloat kVertices[] = {-1.0f, -1.0f, 3.0f,
+                                          -1.0f, -1.0f, 3.0f};
+  glGenBuffers(1, &vbo_);
+  glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(kVertices), kVertices, GL_STATIC_DRAW);
+  glGenVertexArrays(1, &vao_);
+  glBindVertexArray(vao_);
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, nullptr);
+  glGenFramebuffers(1, &checksum_fbo_);
+  glGenFramebuffers(1, &copy_fbo_);
+  return true;
+}
+
+void DamageTracker::Checksum(size_t index, GLuint texture, int width,
+                             int height, const Target *compare,
+                             ChecksumReadback *readback) {
+  int columns = (width + kTileSize - 1) / kTileSize;
+  int rows = (height + kTileSize - 1) / kTileSize;
+  if (columns > texture_columns_ || rows > texture_rows_) {
+    // The checksums of every render target are kept at the same size, so
+    // that they can be copied between them.
+    texture_columns_ = std::max(columns, texture_columns_);
+    texture_rows_ = std::max(rows, texture_rows_);
+    for (Target &target : targets_) {
+      DeleteTexture(target.texture);
+      target = Target();
+    }
+    compare = nullptr;
+  }
+  Target &target = targets_[index];
+  glActiveTexture(GL_TEXTURE0);
+  if (target.texture == 0) {
+    target.texture = create_checksum_texture(texture_columns_, texture_rows_);
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, checksum_fbo_);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                         kDefaultTextureTarget, target.texture, 0);
+
+  glViewport(0, 0, columns, rows);
+  glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+  glDisable(GL_SCISSOR_TEST);
+  glDisable(GL_CULL_FACE);
+  glDisable(GL_BLEND);
+  glUseProgram(checksum_program_);
+  glUniform2i(frame_size_location_, width, height);
+  glUniform1i(compare_location_, compare != nullptr);
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(kDefaultTextureTarget,
+                compare != nullptr ? compare->texture : 0);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(kDefaultTextureTarget, texture);
+  glBindVertexArray(vao_);
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+  target.width = width;
+  target.height = height;
+
+  // Only a few bytes per tile are read back, into a buffer that is mapped
+  // once the fence shows they are there.
+  size_t size = static_cast<size_t>(columns) * rows * 4 * sizeof(uint32_t);
+  if (readback->pbo == 0) {
+    glGenBuffers(1, &readback->pbo);
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, readback->pbo);
+  if (readback->size < size) {
+    glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+    readback->size = size;
+  }
+  glReadPixels(0, 0, columns, rows, GL_RGBA_INTEGER, GL_UNSIGNED_INT,
+               nullptr);
+  DeleteSync(readback->fence);
+  readback->fence = InsertFence();
+  readback->width = width;
+  readback->height = height;
+  readback->columns = columns;
+  readback->rows = rows;
+  readback->copied = false;
+}
+
+bool DamageTracker::Compute(size_t index, GLuint texture, int width,
+                            int height, ChecksumReadback *readback) {
+  TRACE_EVENT("ChecksumFrame");
+  SavedBufferContextRestorer prev_ctx;
+  SavedDrawStateRestorer prev_state;
+  if (!Initialize()) {
+    return false;
+  }
+  Checksum(index, texture, width, height, nullptr, readback);
+  return true;
+}
+
+bool DamageTracker::ComputeAndCopy(size_t source, GLuint source_texture,
+                                   size_t destination,
+                                   GLuint destination_texture, int width,
+                                   int height, ChecksumReadback *readback) {
+  TRACE_EVENT("ChecksumAndCopyFrame");
+  SavedBufferContextRestorer prev_ctx;
+  SavedDrawStateRestorer prev_state;
+  if (!Initialize()) {
+    return false;
+  }
+  const Target &contents = targets_[destination];
+  bool known = contents.texture != 0 && contents.width == width &&
+               contents.height == height;
+  Checksum(source, source_texture, width, height, known ? &contents : nullptr,
+           readback);
+  readback->copied = true;
+
+  // Tiles left unmarked by the checksum pass are discarded, so they are
+  // neither read nor written.
+  glBindFramebuffer(GL_FRAMEBUFFER, copy_fbo_);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                         kDefaultTextureTarget, destination_texture, 0);
+  glViewport(0, 0, width, height);
+  glUseProgram(copy_program_);
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(kDefaultTextureTarget, targets_[source].texture);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(kDefaultTextureTarget, source_texture);
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+
+  // The destination now holds the frame, so it takes on its checksums.
+  Target &target = targets_[destination];
+  if (target.texture == 0) {
+    target.texture = create_checksum_texture(texture_columns_, texture_rows_);
+  }
+  glBindTexture(kDefaultTextureTarget, target.texture);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, checksum_fbo_);
+  glCopyTexSubImage2D(kDefaultTextureTarget, 0, 0, 0, 0, 0, readback->columns,
+                      readback->rows);
+  target.width = width;
+  target.height = height;
+  return true;
+}
+
+void DamageTracker::Invalidate(size_t index) {
+  targets_[index].width = 0;
+  targets_[index].height = 0;
+}
+
+void DamageTracker::Release() {
+  DeleteProgram(checksum_program_);
+  DeleteProgram(copy_program_);
+  DeleteBuffer(vbo_);
+  DeleteVertexArray(vao_);
+  DeleteFramebuffer(checksum_fbo_);
+  DeleteFramebuffer(copy_fbo_);
+  for (Target &target : targets_) {
+    DeleteTexture(target.texture);
+    target = Target();
+  }
+  checksum_program_ = 0;
+  copy_program_ = 0;
+  vbo_ = 0;
+  vao_ = 0;
+  checksum_fbo_ = 0;
+  copy_fbo_ = 0;
+  texture_columns_ = 0;
+  texture_rows_ = 0;
+}
+
+bool DamageTracker::Collect(ChecksumReadback *readback,
+                            TileChecksums *checksums) {
+  // A null fence counts as signalled, but means nothing is being read back.
+  if (readback->fence == nullptr || !IsFenceSignalled(readback->fence)) {
+    return false;
+  }
+  DeleteSync(readback->fence);
+  readback->fence = nullptr;
+  size_t tile_count = static_cast<size_t>(readback->columns) * readback->rows;
+  GLint pixel_pack_buffer = 0;
+  glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &pixel_pack_buffer);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, readback->pbo);
+  const uint32_t *texels = static_cast<const uint32_t *>(
+      glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+                       tile_count * 4 * sizeof(uint32_t), GL_MAP_READ_BIT));
+  if (texels == nullptr) {
+    std::cerr << "Unable to map the checksums read back" << std::endl;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pixel_pack_buffer);
+    return false;
+  }
+  checksums->width = readback->width;
+  checksums->height = readback->height;
+  checksums->columns = readback->columns;
+  checksums->rows = readback->rows;
+  checksums->hashes.resize(tile_count * 2);
+  checksums->copied = readback->copied;
+  checksums->copied_pixels = 0;
+  for (size_t i = 0; i < tile_count; ++i) {
+    checksums->hashes[2 * i] = texels[4 * i];
+    checksums->hashes[2 * i + 1] = texels[4 * i + 1];
+    if (readback->copied && texels[4 * i + 2] != 0) {
+      // Tiles along the top and right edges are clipped to the frame.
+      int x = static_cast<int>(i % readback->columns) * kTileSize;
+      int y = static_cast<int>(i / readback->columns) * kTileSize;
+      checksums->copied_pixels +=
+          static_cast<uint64_t>(std::min(x + kTileSize, readback->width) - x) *
+          (std::min(y + kTileSize, readback->height) - y);
+    }
+  }
+  glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, pixel_pack_buffer);
+  return true;
+}
+
+void DamageTracker::ReleaseReadback(ChecksumReadback *readback) {
+  DeleteBuffer(readback->pbo);
+  DeleteSync(readback->fence);
+  *readback = ChecksumReadback();
+}
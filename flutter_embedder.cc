@@ -14,14 +14,20 @@
 #include "include/flutter_embedder.h"
 
 #include <X11/Xlib.h>
-#include <atomic>
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <utility>
+#include <vector>
 
 #include "include/flutter_embedder_widget_handler.h"
+#include "include/trace.h"
 
 static constexpr char kFlutterDataPrivate[] = "flutter_embedder_internal_";
 
-static std::atomic<bool> pointer_down(false);
+// The widgets created by flutter_embedder_new, for accounting for their VRAM.
+// Only accessed from the GTK thread.
+static std::vector<GtkWidget *> embedders;
 
 // Returns an instance of the stored FlutterEmbedderWidgetHandler.
 static FlutterEmbedderWidgetHandler *get_widget_handler(GtkWidget *widget) {
@@ -29,6 +35,13 @@ static FlutterEmbedderWidgetHandler *get_widget_handler(GtkWidget *widget) {
       g_object_get_data(G_OBJECT(widget), kFlutterDataPrivate));
 }
 
+// Returns the FlutterEmbedderWidgetHandler of a widget created by
+// flutter_embedder_new.
+static FlutterEmbedderWidgetHandler *get_embedder_handler(
+    GtkWidget *flutter_embedder) {
+  return get_widget_handler(gtk_bin_get_child(GTK_BIN(flutter_embedder)));
+}
+
 // Initializes widget state.
 //
 // Called after a widget has been mapped to a GdkWindow.
@@ -41,13 +54,24 @@ static gboolean gl_area_realize(GtkWidget *area) {
                                                      &allocation);
 }
 
-// Resizes the widget.
+// Resizes the widget. Also connected to changes of its scale factor, which
+// change its size in physical pixels.
 static void gl_area_resize(GtkWidget *area) {
   GtkAllocation allocation;
   gtk_widget_get_allocation(area, &allocation);
   get_widget_handler(area)->HandleResizeEvent(&allocation);
 }
 
+// Follows whether the widget is mapped, which is part of whether it is
+// visible.
+static void gl_area_map(GtkWidget *area) {
+  get_widget_handler(area)->HandleMapEvent(true);
+}
+
+static void gl_area_unmap(GtkWidget *area) {
+  get_widget_handler(area)->HandleMapEvent(false);
+}
+
 // Handles rendering the widget.
 static gboolean gl_area_render(GtkWidget *area) {
   GtkAllocation allocation;
@@ -55,67 +79,85 @@ static gboolean gl_area_render(GtkWidget *area) {
   return get_widget_handler(area)->RenderGtkWidget(&allocation);
 }
 
+// Releases widget state tied to the GL area's context before it is destroyed.
+static void gl_area_unrealize(GtkWidget *area) {
+  gtk_gl_area_make_current(GTK_GL_AREA(area));
+  if (gtk_gl_area_get_error(GTK_GL_AREA(area)) != nullptr) {
+    return;
+  }
+  get_widget_handler(area)->HandleUnrealizeEvent();
+}
+
 static void gl_area_destroy(GtkWidget *area) {
   delete get_widget_handler(area);
 }
 
+static void embedder_destroy(GtkWidget *flutter_embedder) {
+  embedders.erase(
+      std::remove(embedders.begin(), embedders.end(), flutter_embedder),
+      embedders.end());
+}
+
 // Sends mouse button press events to the Flutter Engine.
 static void button_press_handler(GtkWidget *widget, GdkEvent *event) {
-  // Occasionally too many consecutive pointer events are sent, causing the
-  // engine to raise exceptoins.
-  if (pointer_down) {
-    return;
-  }
-  // The container class GtkEventBox is a subclass of GtkBin, a container with a
-  // single child.
-  GtkWidget *gl_area = gtk_bin_get_child(GTK_BIN(widget));
-  get_widget_handler(gl_area)->SendFlutterPointerEventWithPhase(
-      FlutterPointerPhase::kDown, event);
-  pointer_down = true;
+  get_embedder_handler(widget)->HandleButtonPressEvent(event);
 }
 
 // Sends mouse button release events to the Flutter Engine.
 static void button_release_handler(GtkWidget *widget, GdkEvent *event) {
-  // See `button_press_handler` for more on this.
-  if (!pointer_down) {
-    return;
-  }
-  GtkWidget *gl_area = gtk_bin_get_child(GTK_BIN(widget));
-  get_widget_handler(gl_area)->SendFlutterPointerEventWithPhase(
-      FlutterPointerPhase::kUp, event);
-  pointer_down = false;
+  get_embedder_handler(widget)->HandleButtonReleaseEvent(event);
+}
+
+// Cancels the press in progress when the pointer grab taken for it is broken,
+// e.g. by another window grabbing the pointer, as its release will not come.
+static gboolean grab_broken_handler(GtkWidget *widget, GdkEvent *event) {
+  get_embedder_handler(widget)->CancelPointer();
+  return FALSE;
 }
 
 // Sends motion data to the Flutter Engine.
 //
 // Only sends motion data if the mouse has been pressed and not released.
 static void pointer_motion_handler(GtkWidget *widget, GdkEvent *event) {
-  GtkWidget *gl_area = gtk_bin_get_child(GTK_BIN(widget));
-  if (!pointer_down) {
-    return;
-  }
-  get_widget_handler(gl_area)->SendFlutterPointerEventWithPhase(
-      FlutterPointerPhase::kMove, event);
+  get_embedder_handler(widget)->HandleMotionEvent(event);
 }
 
 GtkWidget *flutter_embedder_new(const char *main_path, const char *assets_path,
                                 const char *packages_path,
                                 const char *icu_data_path, int argc,
                                 const char **argv) {
+  return flutter_embedder_new_with_flags(main_path, assets_path, packages_path,
+                                         icu_data_path, argc, argv,
+                                         FLUTTER_EMBEDDER_FLAGS_NONE);
+}
+
+GtkWidget *flutter_embedder_new_with_flags(
+    const char *main_path, const char *assets_path, const char *packages_path,
+    const char *icu_data_path, int argc, const char **argv, guint flags) {
   // The container both adds a single layer of opacity to the implementation of
   // the widget and also allows for events to be properly sent to the child
   // widget.
   GtkWidget *container = gtk_event_box_new();
   GtkWidget *gl_area = gtk_gl_area_new();
   gtk_gl_area_set_use_es(GTK_GL_AREA(gl_area), TRUE);
+  // With an alpha channel, the GL area draws into a texture, which direct
+  // rendering relies on.
   gtk_gl_area_set_has_alpha(GTK_GL_AREA(gl_area), TRUE);
+  auto handler = new FlutterEmbedderWidgetHandler(main_path, assets_path,
+                                                  packages_path, icu_data_path,
+                                                  argc, argv,
+                                                  GTK_GL_AREA(gl_area));
+  handler->SetDirectRender((flags & FLUTTER_EMBEDDER_DIRECT_RENDER) != 0);
   g_object_set_data(G_OBJECT(gl_area), kFlutterDataPrivate,
-                    reinterpret_cast<void *>(new FlutterEmbedderWidgetHandler(
-                        main_path, assets_path, packages_path, icu_data_path,
-                        argc, argv, GTK_GL_AREA(gl_area))));
+                    reinterpret_cast<void *>(handler));
   g_signal_connect(gl_area, "render", G_CALLBACK(gl_area_render), NULL);
   g_signal_connect(gl_area, "realize", G_CALLBACK(gl_area_realize), NULL);
   g_signal_connect(gl_area, "resize", G_CALLBACK(gl_area_resize), NULL);
+  g_signal_connect(gl_area, "notify::scale-factor", G_CALLBACK(gl_area_resize),
+                   NULL);
+  g_signal_connect(gl_area, "map", G_CALLBACK(gl_area_map), NULL);
+  g_signal_connect(gl_area, "unmap", G_CALLBACK(gl_area_unmap), NULL);
+  g_signal_connect(gl_area, "unrealize", G_CALLBACK(gl_area_unrealize), NULL);
   g_signal_connect(gl_area, "destroy", G_CALLBACK(gl_area_destroy), NULL);
 
   gtk_widget_add_events(container,
@@ -126,7 +168,11 @@ GtkWidget *flutter_embedder_new(const char *main_path, const char *assets_path,
                    G_CALLBACK(button_release_handler), NULL);
   g_signal_connect(container, "motion-notify-event",
                    G_CALLBACK(pointer_motion_handler), NULL);
+  g_signal_connect(container, "grab-broken-event",
+                   G_CALLBACK(grab_broken_handler), NULL);
+  g_signal_connect(container, "destroy", G_CALLBACK(embedder_destroy), NULL);
   gtk_container_add(GTK_CONTAINER(container), gl_area);
+  embedders.push_back(container);
   return container;
 }
 
@@ -136,4 +182,189 @@ GtkWidget *flutter_embedder_snapshot_mode_new(const char *assets_path,
   return flutter_embedder_new("", assets_path, "", icu_data_path, argc, argv);
 }
 
+void flutter_embedder_set_block_on_frames(GtkWidget *flutter_embedder,
+                                          gboolean block) {
+  get_embedder_handler(flutter_embedder)->SetBlockOnFrames(block);
+}
+
+void flutter_embedder_set_resample_pointer_events(GtkWidget *flutter_embedder,
+                                                  gboolean resample) {
+  get_embedder_handler(flutter_embedder)->SetResamplePointerEvents(resample);
+}
+
+void flutter_embedder_resolution_options_init(
+    FlutterEmbedderResolutionOptions *options) {
+  ResolutionGovernorOptions defaults;
+  options->min_scale = defaults.min_scale;
+  options->max_scale = defaults.max_scale;
+  options->step = defaults.step;
+  options->target_fps = 0.0;
+  options->shrink_threshold = defaults.shrink_threshold;
+  options->grow_threshold = defaults.grow_threshold;
+  options->window_frames = defaults.window_frames;
+  options->grow_windows = defaults.grow_windows;
+}
+
+void flutter_embedder_set_dynamic_resolution(
+    GtkWidget *flutter_embedder,
+    const FlutterEmbedderResolutionOptions *options) {
+  auto handler = get_embedder_handler(flutter_embedder);
+  if (options == nullptr) {
+    handler->SetDynamicResolution(nullptr);
+    return;
+  }
+  ResolutionGovernorOptions governor_options;
+  governor_options.min_scale = options->min_scale;
+  governor_options.max_scale = options->max_scale;
+  governor_options.step = options->step;
+  governor_options.frame_budget_us =
+      options->target_fps > 0.0 ? std::lround(1000000.0 / options->target_fps)
+                                : 0;
+  governor_options.shrink_threshold = options->shrink_threshold;
+  governor_options.grow_threshold = options->grow_threshold;
+  governor_options.window_frames = options->window_frames;
+  governor_options.grow_windows = options->grow_windows;
+  handler->SetDynamicResolution(&governor_options);
+}
+
+gdouble flutter_embedder_get_resolution_scale(GtkWidget *flutter_embedder) {
+  return get_embedder_handler(flutter_embedder)->resolution_scale();
+}
+
+void flutter_embedder_set_damage_tracking(GtkWidget *flutter_embedder,
+                                          gboolean track) {
+  get_embedder_handler(flutter_embedder)->SetDamageTracking(track);
+}
+
+void flutter_embedder_set_depth_buffer(
+    GtkWidget *flutter_embedder, FlutterEmbedderDepthBuffer depth_buffer) {
+  GLenum depth_format = GL_DEPTH_COMPONENT24;
+  if (depth_buffer == FLUTTER_EMBEDDER_DEPTH_BUFFER_16) {
+    depth_format = GL_DEPTH_COMPONENT16;
+  } else if (depth_buffer == FLUTTER_EMBEDDER_DEPTH_BUFFER_NONE) {
+    depth_format = GL_NONE;
+  }
+  get_embedder_handler(flutter_embedder)->SetDepthFormat(depth_format);
+}
+
+void flutter_embedder_set_hidden_release_delay(GtkWidget *flutter_embedder,
+                                               gint delay_ms) {
+  get_embedder_handler(flutter_embedder)->SetHiddenReleaseDelay(delay_ms);
+}
+
+guint flutter_embedder_get_vram_usage(FlutterEmbedderVramUsage *usages,
+                                      guint max_usages) {
+  for (size_t i = 0; i < embedders.size() && i < max_usages; ++i) {
+    auto handler = get_embedder_handler(embedders[i]);
+    FlutterEmbedderVramUsage &usage = usages[i];
+    usage.flutter_embedder = embedders[i];
+    usage.render_target_bytes = handler->render_target_bytes();
+    usage.texture_bytes = handler->textures()->memory_bytes();
+    usage.total_bytes = usage.render_target_bytes + usage.texture_bytes;
+  }
+  return embedders.size();
+}
+
+guint64 flutter_embedder_get_total_vram_bytes() {
+  guint64 bytes = 0;
+  for (GtkWidget *flutter_embedder : embedders) {
+    auto handler = get_embedder_handler(flutter_embedder);
+    bytes +=
+        handler->render_target_bytes() + handler->textures()->memory_bytes();
+  }
+  return bytes;
+}
+
+void flutter_embedder_get_stats(GtkWidget *flutter_embedder,
+                                FlutterEmbedderStats *stats) {
+  get_embedder_handler(flutter_embedder)->GetStats(stats);
+}
+
+void flutter_embedder_set_stats_log_interval(GtkWidget *flutter_embedder,
+                                             guint seconds) {
+  get_embedder_handler(flutter_embedder)->SetStatsLogInterval(seconds);
+}
+
+gboolean flutter_embedder_start_capture(GtkWidget *flutter_embedder,
+                                        FlutterEmbedderCaptureFormat format,
+                                        const char *path, guint max_frames) {
+  CaptureFormat capture_format = CaptureFormat::kRawBgra;
+  if (format == FLUTTER_EMBEDDER_CAPTURE_Y4M) {
+    capture_format = CaptureFormat::kY4m;
+  } else if (format == FLUTTER_EMBEDDER_CAPTURE_PNG) {
+    capture_format = CaptureFormat::kPng;
+  }
+  auto sink = CreateCaptureSink(capture_format, path);
+  if (sink == nullptr) {
+    return FALSE;
+  }
+  get_embedder_handler(flutter_embedder)
+      ->frame_capture()
+      ->StartStream(std::move(sink), max_frames);
+  return TRUE;
+}
+
+void flutter_embedder_stop_capture(GtkWidget *flutter_embedder) {
+  get_embedder_handler(flutter_embedder)->frame_capture()->StopStream();
+}
+
+void flutter_embedder_set_capture_callback(
+    GtkWidget *flutter_embedder, FlutterEmbedderCaptureCallback callback,
+    gpointer user_data) {
+  FrameCapture::Callback capture_callback;
+  if (callback != nullptr) {
+    capture_callback = [callback, user_data](const CapturedFrame &frame) {
+      callback(frame.pixels, frame.width, frame.height, frame.stride,
+               frame.time_us, user_data);
+    };
+  }
+  get_embedder_handler(flutter_embedder)
+      ->frame_capture()
+      ->SetCallback(std::move(capture_callback));
+}
+
+gint64 flutter_embedder_register_texture(GtkWidget *flutter_embedder) {
+  return get_embedder_handler(flutter_embedder)->textures()->RegisterTexture();
+}
+
+void flutter_embedder_unregister_texture(GtkWidget *flutter_embedder,
+                                         gint64 texture_id) {
+  get_embedder_handler(flutter_embedder)
+      ->textures()
+      ->UnregisterTexture(texture_id);
+}
+
+void flutter_embedder_set_texture_rect(GtkWidget *flutter_embedder,
+                                       gint64 texture_id, gint x, gint y,
+                                       gint width, gint height) {
+  TextureRect rect;
+  rect.x = x;
+  rect.y = y;
+  rect.width = width;
+  rect.height = height;
+  get_embedder_handler(flutter_embedder)
+      ->textures()
+      ->SetTextureRect(texture_id, rect);
+}
+
+FlutterEmbedderTextures *flutter_embedder_get_textures(
+    GtkWidget *flutter_embedder) {
+  return reinterpret_cast<FlutterEmbedderTextures *>(
+      get_embedder_handler(flutter_embedder)->textures());
+}
+
+// Only touches the TextureRegistry, which is safe from any thread, and not
+// the widget.
+gboolean flutter_embedder_push_texture_frame(FlutterEmbedderTextures *textures,
+                                             gint64 texture_id,
+                                             const guint8 *pixels, gint width,
+                                             gint height, gint stride) {
+  return reinterpret_cast<TextureRegistry *>(textures)->PushFrame(
+      texture_id, pixels, width, height, stride);
+}
+
+gboolean flutter_embedder_write_trace(const char *path) {
+  return WriteTrace(path);
+}
+
 void flutter_embedder_init() { XInitThreads(); }
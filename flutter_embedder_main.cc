@@ -13,27 +13,82 @@
 // limitations under the License.
 #include "include/flutter_embedder.h"
 
+#include <glib-unix.h>
+#include <signal.h>
+
 #include <cstdint>
 #include <cstdlib>
 
 static constexpr uint32_t kDefaultWindowWidth = 800;
 static constexpr uint32_t kDefaultWindowHeight = 600;
 
+// Returns the value of the environment variable |name|, or |default_value| if
+// it is not set.
+static const char *get_env_or(const char *name, const char *default_value) {
+  const char *value = getenv(name);
+  return value != nullptr ? value : default_value;
+}
+
+static gboolean quit_app(gpointer app) {
+  g_application_quit(G_APPLICATION(app));
+  return G_SOURCE_REMOVE;
+}
+
+// Writes the trace to the file named by FLUTTER_EMBEDDER_TRACE_FILE.
+static gboolean write_trace(gpointer trace_file) {
+  flutter_embedder_write_trace(static_cast<const char *>(trace_file));
+  return G_SOURCE_CONTINUE;
+}
+
 static void app_activate(GtkApplication *app, gpointer user_data) {
   GtkWidget *window = gtk_application_window_new(app);
   int argc = 2;
   const char *argv[] = {"", "--dart-non-checked-mode", NULL};
 #define HOME_PATH "/usr/local/google/home/awdavies/"
 #define FLUTTER_PATH HOME_PATH "proj/flutter/examples/flutter_gallery/"
-  GtkWidget *flutter_embedder = flutter_embedder_new(
-      FLUTTER_PATH "lib/main.dart", FLUTTER_PATH "build/flutter_assets",
-      FLUTTER_PATH ".packages",
-      HOME_PATH "proj/engine/src/out/host_debug_unopt/icudtl.dat", argc, argv);
+  // The paths can be overridden from the environment, e.g. for running against
+  // the stub engine, which ignores them.
+  guint flags = FLUTTER_EMBEDDER_FLAGS_NONE;
+  if (getenv("FLUTTER_EMBEDDER_DIRECT_RENDER") != nullptr) {
+    flags |= FLUTTER_EMBEDDER_DIRECT_RENDER;
+  }
+  GtkWidget *flutter_embedder = flutter_embedder_new_with_flags(
+      get_env_or("FLUTTER_MAIN_PATH", FLUTTER_PATH "lib/main.dart"),
+      get_env_or("FLUTTER_ASSETS_PATH", FLUTTER_PATH "build/flutter_assets"),
+      get_env_or("FLUTTER_PACKAGES_PATH", FLUTTER_PATH ".packages"),
+      get_env_or("FLUTTER_ICU_DATA_PATH",
+                 HOME_PATH "proj/engine/src/out/host_debug_unopt/icudtl.dat"),
+      argc, argv, flags);
   gtk_window_set_title(GTK_WINDOW(window), "Flutter");
   gtk_window_set_default_size(GTK_WINDOW(window), kDefaultWindowWidth,
                               kDefaultWindowHeight);
   gtk_container_add(GTK_CONTAINER(window), flutter_embedder);
+  if (getenv("FLUTTER_EMBEDDER_DYNAMIC_RESOLUTION") != nullptr) {
+    FlutterEmbedderResolutionOptions options;
+    flutter_embedder_resolution_options_init(&options);
+    flutter_embedder_set_dynamic_resolution(flutter_embedder, &options);
+  }
+  if (getenv("FLUTTER_EMBEDDER_DAMAGE_TRACKING") != nullptr) {
+    flutter_embedder_set_damage_tracking(flutter_embedder, TRUE);
+  }
+  // 24 (the default), 16, or 0 for no depth buffer.
+  const char *depth_bits = getenv("FLUTTER_EMBEDDER_DEPTH_BITS");
+  if (depth_bits != nullptr) {
+    FlutterEmbedderDepthBuffer depth_buffer = FLUTTER_EMBEDDER_DEPTH_BUFFER_24;
+    if (atoi(depth_bits) == 0) {
+      depth_buffer = FLUTTER_EMBEDDER_DEPTH_BUFFER_NONE;
+    } else if (atoi(depth_bits) == 16) {
+      depth_buffer = FLUTTER_EMBEDDER_DEPTH_BUFFER_16;
+    }
+    flutter_embedder_set_depth_buffer(flutter_embedder, depth_buffer);
+  }
   gtk_widget_show_all(window);
+
+  // Quits on its own after the given number of seconds, for unattended runs.
+  const char *run_seconds = getenv("FLUTTER_EMBEDDER_RUN_SECONDS");
+  if (run_seconds != nullptr) {
+    g_timeout_add_seconds(atoi(run_seconds), quit_app, app);
+  }
 }
 
 int main(int argc, char **argv) {
@@ -41,7 +96,15 @@ int main(int argc, char **argv) {
   GtkApplication *app =
       gtk_application_new("flutter.linux", G_APPLICATION_FLAGS_NONE);
   g_signal_connect(app, "activate", G_CALLBACK(app_activate), NULL);
+  // The trace is written on SIGUSR1, and on exit.
+  const char *trace_file = getenv("FLUTTER_EMBEDDER_TRACE_FILE");
+  if (trace_file != nullptr) {
+    g_unix_signal_add(SIGUSR1, write_trace, const_cast<char *>(trace_file));
+  }
   g_application_run(G_APPLICATION(app), argc, argv);
+  if (trace_file != nullptr) {
+    write_trace(const_cast<char *>(trace_file));
+  }
   g_object_unref(app);
   return EXIT_SUCCESS;
 }
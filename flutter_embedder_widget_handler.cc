@@ -16,30 +16,502 @@
 #include <gtk/gtk.h>
 #include <time.h>
 
+#include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <cstring>
 #include <iostream>
+#include <utility>
 
 #include "include/graphics.h"
 
+// One render target per mailbox slot, plus the spare.
+static constexpr size_t kSwapchainLength =
+    FrameMailbox<SwapchainFrame>::kSlotCount + 1;
+
+// How long the engine waits for GTK to composite a frame drawn directly into
+// the GL area, before drawing the next frame regardless. Bounds stalls when the
+// widget is not being drawn, e.g. while hidden or shutting down.
+static constexpr std::chrono::milliseconds kDirectFrameTimeout(100);
+
+// How often GTK checks whether the checksums of a frame have arrived when
+// tracking damage, and how long after the frame was presented it renders the
+// frame regardless, in microseconds.
+static constexpr int64_t kChecksumPollIntervalUs = 500;
+static constexpr int64_t kMaxChecksumWaitUs = 4000;
+
+// How long GTK blocks waiting for the engine to finish drawing a new frame,
+// before re-showing what it last rendered and trying again on the next frame.
+// Bounds the wait where glWaitSync would block the calling thread for as long
+// as the GPU takes, as Mesa's llvmpipe does.
+static constexpr GLuint64 kFrameFenceTimeoutNs = 2000000;
+
+// The longest the raster thread is held for each frame the engine presents
+// while the widget is hidden, so that engines that keep drawing regardless do
+// so about once a second.
+static constexpr std::chrono::seconds kHiddenFrameInterval(1);
+
+// The states of the toplevel window in which nothing of it is shown.
+static constexpr int kHiddenWindowStates =
+    GDK_WINDOW_STATE_ICONIFIED | GDK_WINDOW_STATE_WITHDRAWN;
+
+// The channel the framework is told about app lifecycle changes on, as
+// strings.
+static constexpr char kLifecycleChannel[] = "flutter/lifecycle";
+static constexpr char kLifecyclePaused[] = "AppLifecycleState.paused";
+static constexpr char kLifecycleResumed[] = "AppLifecycleState.resumed";
+
+// The threads shared by platform channels handled off the GTK thread.
+static constexpr size_t kPlatformMessageWorkerCount = 2;
+
+// The memory of shared regions kept for reuse once the framework releases
+// them, enough for a couple of the largest buffers expected.
+static constexpr size_t kMaxPooledSharedMemory = 128 * 1024 * 1024;
+
+// The memory of shared regions the framework has yet to release, past which
+// more are refused, so that releases that never come cannot pin memory
+// without bound.
+static constexpr size_t kMaxSharedMemory = 512 * 1024 * 1024;
+
+// Returns |allocation| in physical pixels, at |pixel_ratio| physical pixels
+// per logical one.
+static GtkAllocation get_physical_size(const GtkAllocation &allocation,
+                                       double pixel_ratio) {
+  GtkAllocation size = allocation;
+  size.width = std::max(1L, std::lround(allocation.width * pixel_ratio));
+  size.height = std::max(1L, std::lround(allocation.height * pixel_ratio));
+  return size;
+}
+
+// Dispatches a source that is woken up with g_source_set_ready_time, putting it
+// back to sleep until it is woken up again.
+static gboolean dispatch_wakeup_source(GSource *source, GSourceFunc callback,
+                                       gpointer user_data) {
+  g_source_set_ready_time(source, -1);
+  return callback(user_data);
+}
+
+static GSourceFuncs wakeup_source_funcs = {nullptr, nullptr,
+                                           dispatch_wakeup_source, nullptr};
+
 FlutterEmbedderWidgetHandler::FlutterEmbedderWidgetHandler(
     std::string main_path, std::string assets_path, std::string packages_path,
     std::string icu_data_path, int argc, const char **argv, GtkGLArea *gl_area)
     : engine_params_(main_path, assets_path, packages_path, icu_data_path, argc,
                      argv),
+      platform_message_dispatcher_(kPlatformMessageWorkerCount),
+      shared_memory_pool_(kMaxPooledSharedMemory, kMaxSharedMemory),
+      swapchain_(kSwapchainLength),
+      generation_(0),
+      render_target_pool_(kSwapchainLength),
+      engine_size_(),
+      engine_generation_(0),
+      gtk_texture_(0),
+      gtk_texture_width_(0),
+      gtk_texture_height_(0),
+      storage_released_(false),
+      frame_size_(),
+      frame_generation_(0),
+      frame_begin_time_(0),
+      engine_index_(0),
+      spare_index_(kSwapchainLength - 1),
+      frame_direct_(false),
+      direct_fbo_(0),
+      direct_depth_rb_(0),
+      direct_width_(0),
+      direct_height_(0),
+      direct_depth_format_(GL_NONE),
+      back_buffer_acquired_(false),
+      consecutive_acquired_presents_(0),
+      damage_tracker_(kSwapchainLength),
+      damage_tracked_(false),
       gl_area_(gl_area),
-      frame_ready_(0) {}
+      queued_resize_(),
+      resize_tick_id_(0),
+      widget_size_(),
+      engine_scale_(1.0),
+      engine_scale_factor_(1),
+      engine_pixel_ratio_(1.0),
+      pointer_tick_id_(0),
+      resample_pointer_events_(false),
+      resampled_move_sent_(false),
+      pointer_device_(nullptr),
+      last_pointer_timestamp_(0),
+      direct_render_(false),
+      direct_ready_(nullptr),
+      direct_released_(nullptr),
+      direct_frame_count_(0),
+      direct_frame_pending_(false),
+      direct_present_time_(0),
+      direct_frame_rendered_(0),
+      direct_release_pending_(false),
+      after_paint_clock_(nullptr),
+      after_paint_handler_id_(0),
+      visible_(true),
+      hidden_frame_count_(0),
+      mapped_(true),
+      window_hidden_(false),
+      window_obscured_(false),
+      toplevel_(nullptr),
+      window_state_handler_id_(0),
+      visibility_handler_id_(0),
+      hidden_release_delay_ms_(kDefaultHiddenReleaseDelayMs),
+      release_source_id_(0),
+      release_delay_ms_(0),
+      storage_release_count_(0),
+      block_on_frames_(false),
+      dropped_frame_count_(0),
+      copied_bytes_(0),
+      damage_tracking_(false),
+      unchanged_frame_count_(0),
+      skipped_render_bytes_(0),
+      skipped_copy_bytes_(0),
+      texture_frame_pending_(false),
+      stats_log_id_(0),
+      stale_frame_count_(0),
+      skipped_render_count_(0),
+      stretched_frame_count_(0),
+      pointer_event_count_(0),
+      pointer_send_count_(0),
+      shown_generation_(0),
+      unrendered_frame_(false),
+      awaiting_frame_fence_(false),
+      rendered_width_(0),
+      rendered_height_(0) {
+  auto &frames = mailbox_.slots();
+  for (size_t i = 0; i < frames.size(); ++i) {
+    frames[i].index = i;
+  }
+  // The handler is created on the GTK thread, so this attaches to its context.
+  render_source_ = g_source_new(&wakeup_source_funcs, sizeof(GSource));
+  g_source_set_callback(render_source_,
+                        FlutterEmbedderWidgetHandler::QueueRender, this,
+                        nullptr);
+  g_source_set_ready_time(render_source_, -1);
+  g_source_attach(render_source_, nullptr);
+  platform_message_dispatcher_.SetHandler(
+      kSharedMemoryReleaseChannel,
+      [this](const PlatformMessage &message, PlatformMessageResponse response) {
+        shared_memory_pool_.HandleReleaseMessage(message, std::move(response));
+      });
+  // Frames pushed and textures placed are shown on the next render.
+  texture_registry_.SetFrameCallback([this] {
+    texture_frame_pending_ = true;
+    g_source_set_ready_time(render_source_, 0);
+  });
+  platform_message_dispatcher_.SetHandler(
+      kTextureChannel,
+      [this](const PlatformMessage &message, PlatformMessageResponse response) {
+        texture_registry_.HandlePlacementMessage(message, std::move(response));
+      });
+}
 
 FlutterEmbedderWidgetHandler::~FlutterEmbedderWidgetHandler() {
-  ReleaseRenderBuffers();
+  // Outstanding platform messages are answered while the engine still runs.
+  platform_message_dispatcher_.Shutdown();
+  // Nothing can release the regions the framework was sent from now on.
+  shared_memory_pool_.ReleaseAll();
+  // The raster thread must not be held back while the engine shuts down.
+  {
+    std::lock_guard<std::mutex> lock(visibility_m_);
+    visible_ = true;
+  }
+  visibility_cv_.notify_all();
+  // The engine must be shut down first so that nothing is presented while the
+  // buffers are released.
   FlutterEngineShutdown(flutter_engine_);
+  if (resize_tick_id_ != 0) {
+    gtk_widget_remove_tick_callback(GTK_WIDGET(gl_area_), resize_tick_id_);
+  }
+  if (pointer_tick_id_ != 0) {
+    gtk_widget_remove_tick_callback(GTK_WIDGET(gl_area_), pointer_tick_id_);
+  }
+  if (after_paint_handler_id_ != 0) {
+    g_signal_handler_disconnect(after_paint_clock_, after_paint_handler_id_);
+  }
+  if (toplevel_ != nullptr) {
+    g_signal_handler_disconnect(toplevel_, window_state_handler_id_);
+    g_signal_handler_disconnect(toplevel_, visibility_handler_id_);
+  }
+  if (stats_log_id_ != 0) {
+    g_source_remove(stats_log_id_);
+  }
+  if (release_source_id_ != 0) {
+    g_source_remove(release_source_id_);
+  }
+  g_source_destroy(render_source_);
+  g_source_unref(render_source_);
+  ReleaseRenderBuffers();
 }
 
 void FlutterEmbedderWidgetHandler::ReleaseRenderBuffers() {
-  DeleteTexture(front_buffer_tx_);
+  for (auto &target : swapchain_) {
+    ReleaseRenderTarget(&target);
+  }
+  render_target_pool_.Clear();
+  for (size_t i = 0; i < swapchain_.size(); ++i) {
+    damage_tracker_.Invalidate(i);
+  }
+  DeleteFramebuffer(direct_fbo_);
+  DeleteRenderbuffer(direct_depth_rb_);
+  direct_fbo_ = 0;
+  direct_depth_rb_ = 0;
+  DeleteSync(direct_ready_);
+  DeleteSync(direct_released_);
+  direct_ready_ = nullptr;
+  direct_released_ = nullptr;
+  for (auto &frame : mailbox_.slots()) {
+    DeleteSync(frame.ready);
+    DeleteSync(frame.released);
+    frame.ready = nullptr;
+    frame.released = nullptr;
+    DamageTracker::ReleaseReadback(&frame.checksum_readback);
+    frame.checksums.Clear();
+  }
+}
 
-  DeleteFramebuffer(flutter_engine_fbo_);
-  DeleteTexture(flutter_tx_);
-  DeleteRenderbuffer(flutter_rb_);
+std::unique_lock<std::mutex> FlutterEmbedderWidgetHandler::LockSwapchain() {
+  std::unique_lock<std::mutex> lock(swapchain_m_, std::try_to_lock);
+  if (!lock.owns_lock()) {
+    TRACE_EVENT("WaitForSwapchainLock");
+    lock.lock();
+  }
+  return lock;
+}
+
+void FlutterEmbedderWidgetHandler::BeginEngineFrame() {
+  TRACE_EVENT("BeginEngineFrame");
+  frame_size_ = engine_size_;
+  frame_generation_ = engine_generation_;
+  RenderTarget &target = swapchain_[engine_index_];
+  SavedBufferContextRestorer prev_ctx;
+  // Storage that is swapped out goes back to the pool, from which it is only
+  // handed out again to a render target that is waited on like this one.
+  if (render_target_pool_.Reserve(&target, frame_size_.width,
+                                  frame_size_.height)) {
+    damage_tracker_.Invalidate(engine_index_);
+  }
+  if (!target.attached) {
+    // The framebuffer itself is kept, so engines that cache it keep working.
+    AttachRenderTarget(&target);
+  }
+}
+
+void FlutterEmbedderWidgetHandler::BeginDirectFrame() {
+  TRACE_EVENT("BeginDirectFrame");
+  frame_size_ = engine_size_;
+  frame_generation_ = engine_generation_;
+  {
+    // GTK may still be compositing the last frame.
+    std::lock_guard<std::mutex> lock(direct_m_);
+    if (kUseFenceSync) {
+      GpuWaitFence(direct_released_);
+    }
+  }
+  if (gtk_texture_ == 0) {
+    return;
+  }
+  SavedBufferContextRestorer prev_ctx;
+  if (direct_fbo_ == 0) {
+    glGenFramebuffers(1, &direct_fbo_);
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, direct_fbo_);
+  GLenum depth_format = render_target_pool_.depth_format();
+  if (direct_width_ != gtk_texture_width_ ||
+      direct_height_ != gtk_texture_height_ ||
+      direct_depth_format_ != depth_format) {
+    DeleteRenderbuffer(direct_depth_rb_);
+    direct_depth_rb_ = 0;
+    if (depth_format != GL_NONE) {
+      glGenRenderbuffers(1, &direct_depth_rb_);
+      glBindRenderbuffer(GL_RENDERBUFFER, direct_depth_rb_);
+      glRenderbufferStorage(GL_RENDERBUFFER, depth_format, gtk_texture_width_,
+                            gtk_texture_height_);
+    }
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                              GL_RENDERBUFFER, direct_depth_rb_);
+    direct_width_ = gtk_texture_width_;
+    direct_height_ = gtk_texture_height_;
+    direct_depth_format_ = depth_format;
+  }
+  // GTK may have replaced the texture, even under the same name.
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                         kDefaultTextureTarget, gtk_texture_, 0);
+  // The render targets are neither drawn into nor shown anymore.
+  for (auto &target : swapchain_) {
+    ReleaseRenderTarget(&target);
+  }
+  render_target_pool_.Clear();
+  for (size_t i = 0; i < swapchain_.size(); ++i) {
+    damage_tracker_.Invalidate(i);
+  }
+}
+
+bool FlutterEmbedderWidgetHandler::IsCurrentFrame(
+    const SwapchainFrame &frame) const {
+  // Only the GTK thread writes |engine_generation_|.
+  return frame.ready != nullptr && frame.generation >= engine_generation_;
+}
+
+gboolean FlutterEmbedderWidgetHandler::QueueRender(gpointer user_data) {
+  auto handler = reinterpret_cast<FlutterEmbedderWidgetHandler *>(user_data);
+  if (!handler->texture_frame_pending_.exchange(false) &&
+      handler->SkipUnchangedFrame()) {
+    return G_SOURCE_CONTINUE;
+  }
+  gtk_gl_area_queue_render(handler->gl_area_);
+  return G_SOURCE_CONTINUE;
+}
+
+bool FlutterEmbedderWidgetHandler::CollectChecksums(SwapchainFrame *frame) {
+  if (!DamageTracker::Collect(&frame->checksum_readback, &frame->checksums)) {
+    return false;
+  }
+  // The bytes copied are only known once the checksums arrive.
+  const TileChecksums &checksums = frame->checksums;
+  if (checksums.copied) {
+    uint64_t frame_pixels =
+        static_cast<uint64_t>(checksums.width) * checksums.height;
+    copied_bytes_.fetch_add(checksums.copied_pixels * 4,
+                            std::memory_order_relaxed);
+    skipped_copy_bytes_.fetch_add((frame_pixels - checksums.copied_pixels) * 4,
+                                  std::memory_order_relaxed);
+  }
+  return true;
+}
+
+bool FlutterEmbedderWidgetHandler::SkipUnchangedFrame() {
+  if (direct_render_ || awaiting_frame_fence_ ||
+      !damage_tracking_.load(std::memory_order_relaxed) ||
+      !gtk_widget_get_realized(GTK_WIDGET(gl_area_))) {
+    return false;
+  }
+  if (!unrendered_frame_) {
+    if (!mailbox_.HasPublished()) {
+      return false;
+    }
+    // The frame shown is about to be handed back to the raster thread, so its
+    // checksums are kept for the frames that follow.
+    gtk_gl_area_make_current(gl_area_);
+    if (gtk_gl_area_get_error(gl_area_) != nullptr) {
+      return false;
+    }
+    SwapchainFrame &shown = mailbox_.front();
+    shown_checksums_.Clear();
+    if (shown.ready != nullptr) {
+      CollectChecksums(&shown);
+      std::swap(shown_checksums_, shown.checksums);
+      shown_generation_ = shown.generation;
+    }
+    mailbox_.Acquire();
+    unrendered_frame_ = true;
+  } else {
+    gtk_gl_area_make_current(gl_area_);
+    if (gtk_gl_area_get_error(gl_area_) != nullptr) {
+      return false;
+    }
+    // A newer frame replaces the one yet to be rendered.
+    if (mailbox_.Acquire()) {
+      dropped_frame_count_.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  SwapchainFrame &frame = mailbox_.front();
+  if (frame.ready == nullptr) {
+    return false;
+  }
+  if (frame.checksums.empty() && !CollectChecksums(&frame)) {
+    if (frame.checksum_readback.fence == nullptr) {
+      // The frame was presented without tracking damage.
+      return false;
+    }
+    // Rather than waiting on the GPU, this runs again shortly. Frames whose
+    // checksums take too long are rendered regardless.
+    int64_t now = g_get_monotonic_time();
+    if (now - frame.present_time >= kMaxChecksumWaitUs) {
+      return false;
+    }
+    g_source_set_ready_time(render_source_, now + kChecksumPollIntervalUs);
+    return true;
+  }
+  if (frame.generation != shown_generation_ || shown_checksums_.empty() ||
+      !frame.checksums.Equals(shown_checksums_)) {
+    return false;
+  }
+  // The frame takes the place of the one shown, so GTK renders it whenever it
+  // redraws, once the engine has finished drawing it.
+  if (kUseFenceSync) {
+    GpuWaitFence(frame.ready);
+  }
+  unrendered_frame_ = false;
+  unchanged_frame_count_.fetch_add(1, std::memory_order_relaxed);
+  skipped_render_bytes_.fetch_add(
+      static_cast<uint64_t>(frame.width) * frame.height * 4,
+      std::memory_order_relaxed);
+  return true;
+}
+
+// Returns the physical device |event| came from.
+static GdkDevice *get_event_device(GdkEvent *event) {
+  GdkDevice *device = gdk_event_get_source_device(event);
+  return device != nullptr ? device : gdk_event_get_device(event);
+}
+
+// Returns the bit for the button of |event| in a pressed button mask.
+static uint32_t get_button_bit(GdkEvent *event) {
+  guint button = reinterpret_cast<GdkEventButton *>(event)->button;
+  return button >= 1 && button <= 32 ? 1u << (button - 1) : 0;
+}
+
+void FlutterEmbedderWidgetHandler::HandleButtonPressEvent(GdkEvent *event) {
+  // Double and triple clicks repeat a press that was already handled.
+  if (event->type != GDK_BUTTON_PRESS) {
+    return;
+  }
+  GdkDevice *device = get_event_device(event);
+  uint32_t &buttons = pressed_buttons_[device];
+  bool was_pressed = buttons != 0;
+  buttons |= get_button_bit(event);
+  if (!was_pressed && pointer_device_ == nullptr) {
+    pointer_device_ = device;
+    SendFlutterPointerEventWithPhase(FlutterPointerPhase::kDown, event);
+  }
+}
+
+void FlutterEmbedderWidgetHandler::HandleButtonReleaseEvent(GdkEvent *event) {
+  GdkDevice *device = get_event_device(event);
+  auto it = pressed_buttons_.find(device);
+  if (it == pressed_buttons_.end()) {
+    return;
+  }
+  it->second &= ~get_button_bit(event);
+  if (it->second != 0) {
+    return;
+  }
+  pressed_buttons_.erase(it);
+  if (device == pointer_device_) {
+    pointer_device_ = nullptr;
+    SendFlutterPointerEventWithPhase(FlutterPointerPhase::kUp, event);
+  }
+}
+
+void FlutterEmbedderWidgetHandler::CancelPointer() {
+  pressed_buttons_.clear();
+  if (pointer_device_ == nullptr) {
+    return;
+  }
+  pointer_device_ = nullptr;
+  SendFlutterPointerEventWithPhase(FlutterPointerPhase::kCancel, nullptr);
+  // An unmapped widget's frame clock no longer ticks, so it is sent now.
+  FlushPointerEvents();
+}
+
+void FlutterEmbedderWidgetHandler::HandleMotionEvent(GdkEvent *event) {
+  if (pointer_device_ == nullptr ||
+      get_event_device(event) != pointer_device_) {
+    return;
+  }
+  SendFlutterPointerEventWithPhase(FlutterPointerPhase::kMove, event);
 }
 
 void FlutterEmbedderWidgetHandler::SendFlutterPointerEventWithPhase(
@@ -51,108 +523,733 @@ void FlutterEmbedderWidgetHandler::SendFlutterPointerEventWithPhase(
     case FlutterPointerPhase::kDown:
     case FlutterPointerPhase::kUp: {
       auto button_event = reinterpret_cast<GdkEventButton *>(event);
-      pointer_event.x = button_event->x;
-      pointer_event.y = button_event->y;
+      pointer_event.x = button_event->x * engine_pixel_ratio_;
+      pointer_event.y = button_event->y * engine_pixel_ratio_;
       break;
     }
     case FlutterPointerPhase::kMove: {
       auto move_event = reinterpret_cast<GdkEventMotion *>(event);
-      pointer_event.x = move_event->x;
-      pointer_event.y = move_event->y;
+      pointer_event.x = move_event->x * engine_pixel_ratio_;
+      pointer_event.y = move_event->y * engine_pixel_ratio_;
       break;
     }
     default:  // kCancel
+      // Where the pointer last was while pressed.
+      if (pointer_resampler_.has_sample()) {
+        pointer_event.x = pointer_resampler_.latest().x;
+        pointer_event.y = pointer_resampler_.latest().y;
+      }
       break;
   }
-  pointer_event.timestamp =
-      std::chrono::duration_cast<std::chrono::microseconds>(
-          std::chrono::high_resolution_clock::now().time_since_epoch())
-          .count();
-  FlutterEngineSendPointerEvent(flutter_engine_, &pointer_event, 1);
+  int64_t now = g_get_monotonic_time();
+  int64_t timestamp =
+      event != nullptr
+          ? event_clock_.ToMonotonic(gdk_event_get_time(event), now)
+          : now;
+  last_pointer_timestamp_ = std::max(timestamp, last_pointer_timestamp_);
+  pointer_event.timestamp = last_pointer_timestamp_;
+  if (phase == FlutterPointerPhase::kDown ||
+      phase == FlutterPointerPhase::kMove) {
+    pointer_resampler_.AddSample(pointer_event);
+  } else {
+    pointer_resampler_.Reset();
+  }
+  resampled_move_sent_ = false;
+  ++pointer_event_count_;
+  if (!pointer_events_.Push(pointer_event)) {
+    // Presses and releases must stay in order, so the queue is emptied first.
+    FlushPointerEvents();
+    pointer_events_.Push(pointer_event);
+  }
+  if (pointer_tick_id_ == 0) {
+    pointer_tick_id_ = gtk_widget_add_tick_callback(
+        GTK_WIDGET(gl_area_),
+        FlutterEmbedderWidgetHandler::FlushQueuedPointerEvents, this, nullptr);
+  }
+}
+
+void FlutterEmbedderWidgetHandler::FlushPointerEvents() {
+  if (pointer_events_.empty()) {
+    return;
+  }
+  TRACE_EVENT("DispatchPointerEvents");
+  FlutterEngineSendPointerEvent(flutter_engine_, pointer_events_.data(),
+                                pointer_events_.size());
+  ++pointer_send_count_;
+  pointer_events_.Clear();
+}
+
+gboolean FlutterEmbedderWidgetHandler::FlushQueuedPointerEvents(
+    GtkWidget *widget, GdkFrameClock *frame_clock, gpointer user_data) {
+  auto handler = reinterpret_cast<FlutterEmbedderWidgetHandler *>(user_data);
+  guint tick_id = handler->pointer_tick_id_;
+  handler->pointer_tick_id_ = 0;
+  auto &events = handler->pointer_events_;
+  if (events.empty() && handler->resampled_move_sent_ &&
+      handler->pointer_resampler_.has_sample()) {
+    // The pointer stopped, and the last move sent was resampled to a little
+    // earlier than the last one received, which is sent as-is.
+    events.Push(handler->pointer_resampler_.latest());
+  }
+  handler->resampled_move_sent_ = false;
+  if (handler->resample_pointer_events_ && !events.empty() &&
+      events.back().phase == FlutterPointerPhase::kMove) {
+    GdkFrameTimings *timings = gdk_frame_clock_get_current_timings(frame_clock);
+    int64_t presentation_time =
+        timings != nullptr
+            ? gdk_frame_timings_get_predicted_presentation_time(timings)
+            : 0;
+    if (presentation_time == 0) {
+      presentation_time = gdk_frame_clock_get_frame_time(frame_clock);
+    }
+    handler->resampled_move_sent_ = handler->pointer_resampler_.Resample(
+        &events.back(), presentation_time);
+  }
+  handler->FlushPointerEvents();
+  if (handler->resampled_move_sent_) {
+    // Ticks again, in case the pointer stops.
+    handler->pointer_tick_id_ = tick_id;
+    return G_SOURCE_CONTINUE;
+  }
+  return G_SOURCE_REMOVE;
 }
 
 void FlutterEmbedderWidgetHandler::HandleResizeEvent(
     GtkAllocation *allocation) {
+  TRACE_EVENT("Resize");
+  // Frames already on their way are now the wrong size, and are stretched to
+  // fit the widget until the engine catches up.
+  generation_.fetch_add(1, std::memory_order_release);
+  queued_resize_ = *allocation;
+  if (resize_tick_id_ == 0) {
+    resize_tick_id_ = gtk_widget_add_tick_callback(
+        GTK_WIDGET(gl_area_),
+        FlutterEmbedderWidgetHandler::SendQueuedResizeEvent, this, nullptr);
+  }
+}
+
+gboolean FlutterEmbedderWidgetHandler::SendQueuedResizeEvent(
+    GtkWidget *widget, GdkFrameClock *frame_clock, gpointer user_data) {
+  auto handler = reinterpret_cast<FlutterEmbedderWidgetHandler *>(user_data);
+  handler->resize_tick_id_ = 0;
+  handler->SendFlutterEngineResizeEvent(&handler->queued_resize_);
+  return G_SOURCE_REMOVE;
+}
+
+uint64_t FlutterEmbedderWidgetHandler::storage_allocation_count() {
+  auto lock = LockSwapchain();
+  return render_target_pool_.allocation_count();
+}
+
+size_t FlutterEmbedderWidgetHandler::render_target_bytes() {
+  auto lock = LockSwapchain();
+  size_t bytes = render_target_pool_.memory_bytes();
+  for (const auto &target : swapchain_) {
+    bytes += GetRenderTargetStorageBytes(target);
+  }
+  if (direct_depth_rb_ != 0) {
+    bytes += static_cast<size_t>(direct_width_) * direct_height_ *
+             GetDepthBytesPerPixel(direct_depth_format_);
+  }
+  return bytes;
+}
+
+void FlutterEmbedderWidgetHandler::SetDepthFormat(GLenum depth_format) {
+  auto lock = LockSwapchain();
+  render_target_pool_.SetDepthFormat(depth_format);
+}
+
+void FlutterEmbedderWidgetHandler::GetStats(FlutterEmbedderStats *stats) {
+  *stats = {};
+  frame_stats_.GetStats(stats);
+  stats->dropped_frames = dropped_frame_count();
+  stats->stale_frames = stale_frame_count_;
+  stats->skipped_renders = skipped_render_count_;
+  stats->stretched_frames = stretched_frame_count_;
+  stats->storage_allocations = storage_allocation_count();
+  stats->scale_factor = engine_scale_factor_;
+  stats->render_target_bytes = render_target_bytes();
+  stats->copied_bytes = copied_bytes();
+  stats->hidden_frames = hidden_frame_count();
+  stats->storage_releases = storage_release_count_;
+  stats->unchanged_frames = unchanged_frame_count_;
+  stats->skipped_render_bytes = skipped_render_bytes_;
+  stats->skipped_copy_bytes = skipped_copy_bytes_;
   {
-    std::unique_lock<std::mutex> lock(frame_ready_m_);
-    // Ensure all previously queue-up work has completed.
-    glFinish();
+    std::lock_guard<std::mutex> lock(damage_check_time_m_);
+    GetLatency(damage_check_time_, &stats->damage_check);
+  }
+  stats->resolution_changes = resolution_governor_.change_count();
+  stats->resolution_scale = engine_scale_;
+}
 
-    // Note: this function runs in the GTK thread.
-    ResizeFlutterBuffers(allocation);
-    glDeleteSync(frame_ready_);
-    // It is imperative that this is called here, as the notification will cause
-    // a new frame to be rendered in what could be an incorrectly sized texture
-    // if this isn't guaranteed to complete synchronously.
-    glFinish();
-    frame_ready_ = nullptr;
-    frame_ready_cv_.notify_all();
+void FlutterEmbedderWidgetHandler::SetStatsLogInterval(guint seconds) {
+  if (stats_log_id_ != 0) {
+    g_source_remove(stats_log_id_);
+    stats_log_id_ = 0;
+  }
+  if (seconds > 0) {
+    stats_log_id_ = g_timeout_add_seconds(
+        seconds, FlutterEmbedderWidgetHandler::LogStats, this);
   }
-  SendFlutterEngineResizeEvent(allocation);
 }
 
-void FlutterEmbedderWidgetHandler::ResizeFlutterBuffers(
-    GtkAllocation *allocation) {
-  SavedBufferContextRestorer prev_ctx;
+gboolean FlutterEmbedderWidgetHandler::LogStats(gpointer user_data) {
+  auto handler = reinterpret_cast<FlutterEmbedderWidgetHandler *>(user_data);
+  FlutterEmbedderStats stats;
+  handler->GetStats(&stats);
+  LogFrameStats(stats, std::cerr);
+  return G_SOURCE_CONTINUE;
+}
 
-  glBindTexture(kDefaultTextureTarget, flutter_tx_);
-  AllocateTexture(allocation);
-  // TODO(awdavies):
-  // From https://www.khronos.org/opengl/wiki/Renderbuffer_Object :
-  // It is strongly advised to delete and reallocate render buffers to ensure
-  // fbo completeness.
-  glBindRenderbuffer(GL_RENDERBUFFER, flutter_rb_);
-  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24,
-                        allocation->width, allocation->height);
+void FlutterEmbedderWidgetHandler::HandleMapEvent(bool mapped) {
+  mapped_ = mapped;
+  if (!mapped) {
+    CancelPointer();
+  }
+  if (toplevel_ != nullptr) {
+    g_signal_handler_disconnect(toplevel_, window_state_handler_id_);
+    g_signal_handler_disconnect(toplevel_, visibility_handler_id_);
+    toplevel_ = nullptr;
+  }
+  window_hidden_ = false;
+  window_obscured_ = false;
+  // The window is only followed while mapped, when it is sure to be alive and
+  // to be the one the widget is in.
+  GtkWidget *toplevel = gtk_widget_get_toplevel(GTK_WIDGET(gl_area_));
+  if (mapped && GTK_IS_WINDOW(toplevel)) {
+    toplevel_ = toplevel;
+    gtk_widget_add_events(toplevel_, GDK_VISIBILITY_NOTIFY_MASK);
+    window_state_handler_id_ = g_signal_connect(
+        toplevel_, "window-state-event",
+        G_CALLBACK(FlutterEmbedderWidgetHandler::HandleWindowStateEvent),
+        this);
+    visibility_handler_id_ = g_signal_connect(
+        toplevel_, "visibility-notify-event",
+        G_CALLBACK(FlutterEmbedderWidgetHandler::HandleVisibilityNotifyEvent),
+        this);
+    GdkWindow *window = gtk_widget_get_window(toplevel_);
+    if (window != nullptr) {
+      window_hidden_ =
+          (gdk_window_get_state(window) & kHiddenWindowStates) != 0;
+    }
+  }
+  UpdateVisibility();
+}
 
-  glBindTexture(kDefaultTextureTarget, front_buffer_tx_);
-  AllocateTexture(allocation);
+gboolean FlutterEmbedderWidgetHandler::HandleWindowStateEvent(
+    GtkWidget *widget, GdkEventWindowState *event, gpointer user_data) {
+  auto handler = reinterpret_cast<FlutterEmbedderWidgetHandler *>(user_data);
+  handler->window_hidden_ =
+      (event->new_window_state & kHiddenWindowStates) != 0;
+  handler->UpdateVisibility();
+  // The window handles the event as well.
+  return FALSE;
+}
+
+gboolean FlutterEmbedderWidgetHandler::HandleVisibilityNotifyEvent(
+    GtkWidget *widget, GdkEventVisibility *event, gpointer user_data) {
+  auto handler = reinterpret_cast<FlutterEmbedderWidgetHandler *>(user_data);
+  handler->window_obscured_ = event->state == GDK_VISIBILITY_FULLY_OBSCURED;
+  handler->UpdateVisibility();
+  return FALSE;
+}
+
+void FlutterEmbedderWidgetHandler::UpdateVisibility() {
+  bool visible = mapped_ && !window_hidden_ && !window_obscured_;
+  if (visible == visible_.load(std::memory_order_relaxed)) {
+    // The widget may have gone from hidden to unmapped.
+    ScheduleStorageRelease();
+    return;
+  }
+  TRACE_EVENT("VisibilityChange");
+  {
+    std::lock_guard<std::mutex> lock(visibility_m_);
+    visible_ = visible;
+  }
+  visibility_cv_.notify_all();
+  ScheduleStorageRelease();
+  const char *state = visible ? kLifecycleResumed : kLifecyclePaused;
+  platform_message_dispatcher_.Send(kLifecycleChannel,
+                                    reinterpret_cast<const uint8_t *>(state),
+                                    strlen(state));
+  if (!visible) {
+    return;
+  }
+  // Frames presented while hidden were dropped, so the engine is asked for a
+  // new one straight away (it draws one for any change of window metrics),
+  // and the last frame published is shown meanwhile. A resize already queued
+  // asks for one anyway.
+  if (widget_size_.width > 0 && resize_tick_id_ == 0) {
+    GtkAllocation size = widget_size_;
+    SendFlutterEngineResizeEvent(&size);
+  }
+  gtk_gl_area_queue_render(gl_area_);
+}
+
+void FlutterEmbedderWidgetHandler::WaitWhileHidden() {
+  if (visible_.load(std::memory_order_relaxed)) {
+    return;
+  }
+  TRACE_EVENT("WaitWhileHidden");
+  std::unique_lock<std::mutex> lock(visibility_m_);
+  visibility_cv_.wait_for(lock, kHiddenFrameInterval, [this] {
+    return visible_.load(std::memory_order_relaxed);
+  });
+}
+
+void FlutterEmbedderWidgetHandler::SetHiddenReleaseDelay(int delay_ms) {
+  hidden_release_delay_ms_ = delay_ms;
+  if (release_source_id_ != 0) {
+    g_source_remove(release_source_id_);
+    release_source_id_ = 0;
+  }
+  ScheduleStorageRelease();
+}
+
+void FlutterEmbedderWidgetHandler::ScheduleStorageRelease() {
+  // Unmapped widgets (e.g. in a hidden tab) tend to stay so for long, while
+  // windows are often iconified or moved off the current workspace briefly.
+  int delay_ms = -1;
+  if (!visible_.load(std::memory_order_relaxed) &&
+      hidden_release_delay_ms_ >= 0) {
+    delay_ms = mapped_ ? hidden_release_delay_ms_ : 0;
+  }
+  if (release_source_id_ != 0) {
+    if (delay_ms >= 0 && delay_ms >= release_delay_ms_) {
+      return;
+    }
+    g_source_remove(release_source_id_);
+    release_source_id_ = 0;
+  }
+  if (delay_ms >= 0) {
+    release_delay_ms_ = delay_ms;
+    release_source_id_ = g_timeout_add(
+        delay_ms, FlutterEmbedderWidgetHandler::ReleaseStorageWhileHidden,
+        this);
+  }
+}
+
+gboolean FlutterEmbedderWidgetHandler::ReleaseStorageWhileHidden(
+    gpointer user_data) {
+  auto handler = reinterpret_cast<FlutterEmbedderWidgetHandler *>(user_data);
+  handler->release_source_id_ = 0;
+  handler->ReleaseStorage();
+  return G_SOURCE_REMOVE;
+}
+
+void FlutterEmbedderWidgetHandler::ReleaseStorage() {
+  // Storage can only be deleted from within a context, and the GL area's goes
+  // away when it is unrealized, along with anything the engine's shares.
+  if (direct_render_ || !gtk_widget_get_realized(GTK_WIDGET(gl_area_))) {
+    return;
+  }
+  TRACE_EVENT("ReleaseStorage");
+  gtk_gl_area_make_current(gl_area_);
+  if (gtk_gl_area_get_error(gl_area_) != nullptr) {
+    return;
+  }
+  {
+    auto lock = LockSwapchain();
+    // The engine may draw into its render target at any time, unless it asks
+    // for a new framebuffer every frame and has yet to ask for the next one.
+    bool engine_drawing =
+        back_buffer_acquired_ || consecutive_acquired_presents_ <= 1;
+    render_target_pool_.Clear();
+    for (size_t i = 0; i < swapchain_.size(); ++i) {
+      if (engine_drawing && i == engine_index_) {
+        continue;
+      }
+      // The framebuffer belongs to the engine's context, and is left to the
+      // raster thread.
+      ReleaseRenderTargetStorage(&swapchain_[i]);
+      damage_tracker_.Invalidate(i);
+    }
+    // Frames in released render targets are dropped: GTK shows nothing until
+    // the engine's next frame, and the engine does not wait on GTK for them.
+    // Neither thread is touching the mailbox while the lock is held.
+    for (auto &frame : mailbox_.slots()) {
+      if (swapchain_[frame.index].texture == 0) {
+        DeleteSync(frame.ready);
+        DeleteSync(frame.released);
+        frame.ready = nullptr;
+        frame.released = nullptr;
+      }
+    }
+    // The frame shown may be among them.
+    shown_checksums_.Clear();
+    storage_released_ = true;
+  }
+  ++storage_release_count_;
+  // The framework draws a frame for a change of window metrics even while
+  // paused. It is dropped, but has the raster thread delete the framebuffers.
+  if (widget_size_.width > 0 && resize_tick_id_ == 0) {
+    GtkAllocation size = widget_size_;
+    SendFlutterEngineResizeEvent(&size);
+  }
+}
+
+void FlutterEmbedderWidgetHandler::DeleteReleasedFramebuffers(
+    bool release_engine_target) {
+  TRACE_EVENT("DeleteReleasedFramebuffers");
+  storage_released_ = false;
+  if (release_engine_target) {
+    // The engine drew into the back frame, which is left unpublished.
+    ReleaseRenderTarget(&swapchain_[engine_index_]);
+    damage_tracker_.Invalidate(engine_index_);
+    SwapchainFrame &frame = mailbox_.back();
+    DeleteSync(frame.ready);
+    DeleteSync(frame.released);
+    frame.ready = nullptr;
+    frame.released = nullptr;
+  }
+  // Framebuffers are only left attached to what they were last attached to
+  // when it is released, or replaced without being drawn into again.
+  for (auto &target : swapchain_) {
+    if (target.fbo != 0 && !target.attached) {
+      DeleteFramebuffer(target.fbo);
+      target.fbo = 0;
+    }
+  }
 }
 
 void FlutterEmbedderWidgetHandler::SendFlutterEngineResizeEvent(
     GtkAllocation *allocation) {
+  TRACE_EVENT("SendWindowMetrics");
+  widget_size_ = *allocation;
+  // Frames drawn directly go straight into the GL area's texture, so they are
+  // never scaled.
+  engine_scale_ = direct_render_ ? 1.0 : resolution_governor_.scale();
+  engine_scale_factor_ = gtk_widget_get_scale_factor(GTK_WIDGET(gl_area_));
+  engine_pixel_ratio_ = engine_scale_factor_ * engine_scale_;
+  // The engine draws in physical pixels, keeping the widget's logical size.
+  GtkAllocation size = get_physical_size(*allocation, engine_pixel_ratio_);
+  {
+    auto lock = LockSwapchain();
+    engine_size_ = size;
+    engine_generation_ = generation_.load(std::memory_order_relaxed);
+  }
   FlutterWindowMetricsEvent window_metrics_event = {};
   window_metrics_event.struct_size = sizeof(window_metrics_event);
-  window_metrics_event.width = allocation->width;
-  window_metrics_event.height = allocation->height;
-  window_metrics_event.pixel_ratio = 1.0;
+  window_metrics_event.width = size.width;
+  window_metrics_event.height = size.height;
+  window_metrics_event.pixel_ratio = engine_pixel_ratio_;
   FlutterEngineSendWindowMetricsEvent(flutter_engine_, &window_metrics_event);
 }
 
+void FlutterEmbedderWidgetHandler::SetDynamicResolution(
+    const ResolutionGovernorOptions *options) {
+  if (options != nullptr) {
+    resolution_governor_.Enable(*options);
+  } else {
+    resolution_governor_.Disable();
+  }
+  // Before the engine runs, it is told about the scale along with its size.
+  if (widget_size_.width > 0 && resize_tick_id_ == 0 &&
+      resolution_governor_.scale() != engine_scale_) {
+    GtkAllocation size = widget_size_;
+    HandleResizeEvent(&size);
+  }
+}
+
+void FlutterEmbedderWidgetHandler::UpdateResolutionScale(
+    int64_t frame_time_us) {
+  int64_t refresh_interval = 0;
+  GdkFrameClock *frame_clock = gtk_widget_get_frame_clock(GTK_WIDGET(gl_area_));
+  if (frame_clock != nullptr) {
+    gdk_frame_clock_get_refresh_info(frame_clock, 0, &refresh_interval,
+                                     nullptr);
+  }
+  if (!resolution_governor_.AddFrameTime(frame_time_us, refresh_interval)) {
+    return;
+  }
+  TRACE_EVENT("ResolutionScale");
+  // A resize already queued is sent at the new scale.
+  if (resize_tick_id_ == 0) {
+    GtkAllocation size = widget_size_;
+    HandleResizeEvent(&size);
+  }
+}
+
 bool FlutterEmbedderWidgetHandler::RenderGtkWidget(GtkAllocation *allocation) {
   // Note: this function runs in the GTK thread.
+  TRACE_EVENT("Render");
   GLint fbo = 0;
   glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &fbo);
   if (fbo == 0) {
     // The return value here is ignored.
     return true;
   }
-  std::unique_lock<std::mutex> lock(frame_ready_m_);
-  frame_ready_cv_.wait(lock, [this] { return frame_ready_ != nullptr; });
-  // Ensure all previously queued-up work has completed.
-  glFinish();
+  if (direct_render_ && RenderDirectFrame(allocation)) {
+    // The front frame of the mailbox is no longer what is shown.
+    rendered_width_ = 0;
+    rendered_height_ = 0;
+    SwapchainFrame &front = mailbox_.front();
+    front.checksums.Clear();
+    DeleteSync(front.checksum_readback.fence);
+    front.checksum_readback.fence = nullptr;
+    return true;
+  }
+  FrameTimestamps timestamps;
+  timestamps.render_start = g_get_monotonic_time();
+  // A frame whose fence timed out is held on to, so that newer frames, which
+  // are further behind, do not keep replacing it.
+  bool new_frame =
+      (!awaiting_frame_fence_ && mailbox_.Acquire()) || unrendered_frame_;
+  unrendered_frame_ = false;
+  awaiting_frame_fence_ = false;
+  if (block_on_frames_ && !IsCurrentFrame(mailbox_.front())) {
+    TRACE_EVENT("WaitForFrame");
+    do {
+      std::unique_lock<std::mutex> lock(frame_ready_m_);
+      frame_ready_cv_.wait(lock, [this] { return mailbox_.HasPublished(); });
+      new_frame = mailbox_.Acquire();
+    } while (!IsCurrentFrame(mailbox_.front()));
+    // Time spent waiting counts as blocked rather than rendering.
+    int64_t now = g_get_monotonic_time();
+    frame_stats_.RecordBlocked(now - timestamps.render_start);
+    timestamps.render_start = now;
+  }
+
+  SwapchainFrame &frame = mailbox_.front();
+  if (frame.ready == nullptr || !blit_program_.Initialize()) {
+    // The engine has yet to present its first frame.
+    ++skipped_render_count_;
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    return true;
+  }
+  timestamps.present = frame.present_time;
+  int scale = gtk_widget_get_scale_factor(GTK_WIDGET(gl_area_));
+  int width = allocation->width * scale;
+  int height = allocation->height * scale;
+  if (new_frame) {
+    // Ensure the engine has finished drawing the frame. With fences, this
+    // thread waits a bounded time, and the GPU waits for the rest.
+    if (kUseFenceSync) {
+      if (IsFenceSignalled(frame.ready)) {
+        timestamps.fence_signalled = timestamps.render_start;
+      } else {
+        TRACE_EVENT("WaitForFrameFence");
+        bool signalled = ClientWaitFence(frame.ready, kFrameFenceTimeoutNs);
+        int64_t now = g_get_monotonic_time();
+        frame_stats_.RecordBlocked(now - timestamps.render_start);
+        timestamps.render_start = now;
+        if (signalled) {
+          timestamps.fence_signalled = now;
+        } else if (width == rendered_width_ && height == rendered_height_) {
+          // The GL area keeps what it last rendered, which is shown again, and
+          // the frame is rendered on the next frame clock tick.
+          unrendered_frame_ = true;
+          awaiting_frame_fence_ = true;
+          ++skipped_render_count_;
+          g_source_set_ready_time(render_source_, 0);
+          return true;
+        }
+      }
+      GpuWaitFence(frame.ready);
+    } else {
+      TRACE_EVENT("glFinish");
+      glFinish();
+      int64_t now = g_get_monotonic_time();
+      frame_stats_.RecordBlocked(now - timestamps.render_start);
+      timestamps.fence_signalled = now;
+      timestamps.render_start = now;
+    }
+  } else {
+    ++stale_frame_count_;
+  }
+  if (frame.generation != generation_.load(std::memory_order_relaxed)) {
+    ++stretched_frame_count_;
+  }
+  // Only frames drawn at the current scale say anything about it.
+  if (new_frame && frame.begin_time != 0 && resolution_governor_.enabled() &&
+      IsCurrentFrame(frame)) {
+    UpdateResolutionScale(frame.present_time - frame.begin_time);
+  }
   SavedBufferContextRestorer prev_ctx;
 
-  // Draws the front buffer to the GTK widget area. While performance isn't a
-  // factor right now, it may be faster to use a shader instead.
-  glBindTexture(kDefaultTextureTarget, front_buffer_tx_);
-  glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
-  glEnable(GL_TEXTURE_2D);
-  glBegin(GL_QUADS);
-  glTexCoord2f(0.0f, 1.0f);
-  glVertex3f(-1.0f, 1.0f, 0.0);
-  glTexCoord2f(0.0f, 0.0f);
-  glVertex3f(-1.0f, -1.0f, 0.0);
-  glTexCoord2f(1.0f, 0.0f);
-  glVertex3f(1.0f, -1.0f, 0.0);
-  glTexCoord2f(1.0f, 1.0f);
-  glVertex3f(1.0f, 1.0f, 0.0);
-  glEnd();
-
-  glFinish();
+  // Draws the displayed frame to the GTK widget area, stretching the part of
+  // the storage the engine drew into over the whole area. This also scales
+  // frames drawn before a resize, or at a lower resolution, to the widget's
+  // size.
+  const RenderTarget &target = swapchain_[frame.index];
+  {
+    TRACE_GPU_EVENT(&render_gpu_timer_, "Render");
+    blit_program_.Draw(target.texture,
+                       static_cast<GLfloat>(frame.width) / target.width,
+                       static_cast<GLfloat>(frame.height) / target.height,
+                       target.width, target.height);
+  }
+  texture_registry_.Update();
+  texture_registry_.Draw(width, height, scale);
+  rendered_width_ = width;
+  rendered_height_ = height;
+
+  if (kUseFenceSync) {
+    DeleteSync(frame.released);
+    frame.released = InsertFence();
+  } else {
+    TRACE_EVENT("glFinish");
+    glFinish();
+  }
+  CaptureFrame(allocation, new_frame);
+  timestamps.render_end = g_get_monotonic_time();
+  if (new_frame && timestamps.fence_signalled == 0 &&
+      IsFenceSignalled(frame.ready)) {
+    timestamps.fence_signalled = timestamps.render_end;
+  }
+  frame_stats_.RecordRender(
+      timestamps, new_frame,
+      gtk_widget_get_frame_clock(GTK_WIDGET(gl_area_)));
+  return true;
+}
+
+bool FlutterEmbedderWidgetHandler::RenderDirectFrame(
+    GtkAllocation *allocation) {
+  GLint type = GL_NONE;
+  glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                        GL_FRAMEBUFFER_ATTACHMENT_OBJECT_TYPE,
+                                        &type);
+  if (type != GL_TEXTURE) {
+    std::cerr << "Unable to render directly, as the GL area does not draw into "
+                 "a texture."
+              << std::endl;
+    direct_render_ = false;
+    return false;
+  }
+  GLint texture = 0;
+  glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                        GL_FRAMEBUFFER_ATTACHMENT_OBJECT_NAME,
+                                        &texture);
+  int scale = gtk_widget_get_scale_factor(GTK_WIDGET(gl_area_));
+  {
+    auto lock = LockSwapchain();
+    if (gtk_texture_ == 0) {
+      // The texture is cleared before the engine is given it, and the engine
+      // waits for the clear before drawing.
+      glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+      glClear(GL_COLOR_BUFFER_BIT);
+      std::lock_guard<std::mutex> direct_lock(direct_m_);
+      DeleteSync(direct_released_);
+      direct_released_ = kUseFenceSync ? InsertFence() : nullptr;
+      if (!kUseFenceSync) {
+        glFinish();
+      }
+    }
+    gtk_texture_ = texture;
+    gtk_texture_width_ = allocation->width * scale;
+    gtk_texture_height_ = allocation->height * scale;
+  }
+
+  FrameTimestamps timestamps;
+  timestamps.render_start = g_get_monotonic_time();
+  bool new_frame = false;
+  {
+    std::lock_guard<std::mutex> lock(direct_m_);
+    new_frame =
+        direct_frame_pending_ && direct_frame_count_ != direct_frame_rendered_;
+    if (new_frame) {
+      // Ensure the engine has finished drawing the frame before GTK composites
+      // it. Without fences, the engine finished it before presenting.
+      if (kUseFenceSync) {
+        GpuWaitFence(direct_ready_);
+      }
+      direct_frame_rendered_ = direct_frame_count_;
+      timestamps.present = direct_present_time_;
+    } else if (direct_frame_count_ == 0) {
+      ++skipped_render_count_;
+    } else {
+      ++stale_frame_count_;
+    }
+  }
+  // Whatever the engine drew last is in the texture already, so there is
+  // nothing to draw.
+  GdkFrameClock *frame_clock = gtk_widget_get_frame_clock(GTK_WIDGET(gl_area_));
+  if (new_frame) {
+    direct_release_pending_ = true;
+    if (frame_clock != after_paint_clock_) {
+      if (after_paint_handler_id_ != 0) {
+        g_signal_handler_disconnect(after_paint_clock_,
+                                    after_paint_handler_id_);
+      }
+      after_paint_clock_ = frame_clock;
+      after_paint_handler_id_ = g_signal_connect(
+          frame_clock, "after-paint",
+          G_CALLBACK(FlutterEmbedderWidgetHandler::ReleaseDirectFrame), this);
+    }
+  }
+  CaptureFrame(allocation, new_frame);
+  timestamps.render_end = g_get_monotonic_time();
+  frame_stats_.RecordRender(timestamps, new_frame, frame_clock);
   return true;
 }
 
+void FlutterEmbedderWidgetHandler::CaptureFrame(GtkAllocation *allocation,
+                                                bool new_frame) {
+  if (!new_frame) {
+    frame_capture_.Update();
+    return;
+  }
+  int scale = gtk_widget_get_scale_factor(GTK_WIDGET(gl_area_));
+  frame_capture_.Capture(allocation->width * scale,
+                         allocation->height * scale, g_get_monotonic_time());
+}
+
+void FlutterEmbedderWidgetHandler::ReleaseDirectFrame(
+    GdkFrameClock *frame_clock, gpointer user_data) {
+  auto handler = reinterpret_cast<FlutterEmbedderWidgetHandler *>(user_data);
+  if (!handler->direct_release_pending_) {
+    return;
+  }
+  handler->direct_release_pending_ = false;
+  gtk_gl_area_make_current(handler->gl_area_);
+  GLsync released = nullptr;
+  if (kUseFenceSync) {
+    released = InsertFence();
+  } else {
+    glFinish();
+  }
+  {
+    std::lock_guard<std::mutex> lock(handler->direct_m_);
+    DeleteSync(handler->direct_released_);
+    handler->direct_released_ = released;
+    // A newer frame presented meanwhile is yet to be rendered.
+    if (handler->direct_frame_count_ == handler->direct_frame_rendered_) {
+      handler->direct_frame_pending_ = false;
+    }
+  }
+  handler->direct_cv_.notify_all();
+}
+
+void FlutterEmbedderWidgetHandler::HandleUnrealizeEvent() {
+  rendered_width_ = 0;
+  rendered_height_ = 0;
+  blit_program_.Release();
+  render_gpu_timer_.Release();
+  frame_capture_.Release();
+  texture_registry_.Release();
+  if (after_paint_handler_id_ != 0) {
+    g_signal_handler_disconnect(after_paint_clock_, after_paint_handler_id_);
+    after_paint_clock_ = nullptr;
+    after_paint_handler_id_ = 0;
+  }
+  // The GL area's texture goes with its context, so the engine goes back to
+  // drawing into render targets until GTK hands over a new one.
+  {
+    auto lock = LockSwapchain();
+    gtk_texture_ = 0;
+  }
+  {
+    std::lock_guard<std::mutex> lock(direct_m_);
+    DeleteSync(direct_released_);
+    direct_released_ = nullptr;
+    direct_frame_pending_ = false;
+  }
+  direct_release_pending_ = false;
+  direct_cv_.notify_all();
+}
+
 bool FlutterEmbedderWidgetHandler::InitFlutterEngine(
     GdkGLContext *gtk_context, GtkAllocation *allocation) {
   if (gtk_context == nullptr || allocation == nullptr) {
@@ -165,15 +1262,28 @@ bool FlutterEmbedderWidgetHandler::InitFlutterEngine(
     return false;
   }
   gdk_gl_context_set_use_es(flutter_gl_context_, TRUE);
+  if (direct_render_) {
+    GdkGLContext *shared = gdk_gl_context_get_shared_context(gtk_context);
+    if (shared == nullptr ||
+        shared != gdk_gl_context_get_shared_context(flutter_gl_context_)) {
+      std::cerr << "Unable to render directly, as the GL contexts do not "
+                   "share objects."
+                << std::endl;
+      direct_render_ = false;
+    }
+  }
   AllocateFlutterBuffers(allocation);
 
-  auto project_args = engine_params_.GetProjectArgs();
+  auto project_args = engine_params_.GetProjectArgs(
+      FlutterEmbedderWidgetHandler::OnFlutterPlatformMessage);
   const FlutterOpenGLRendererConfig renderer_config = {
     struct_size : sizeof(FlutterOpenGLRendererConfig),
     make_current : FlutterEmbedderWidgetHandler::FlutterMakeCurrent,
     clear_current : FlutterEmbedderWidgetHandler::FlutterClearCurrent,
     present : FlutterEmbedderWidgetHandler::FlutterPresent,
-    fbo_callback : FlutterEmbedderWidgetHandler::FlutterGetFbo
+    fbo_callback : FlutterEmbedderWidgetHandler::FlutterGetFbo,
+    make_resource_current : nullptr,
+    fbo_reset_after_present : true
   };
   FlutterRendererConfig config = {};
   config.type = kOpenGL;
@@ -185,41 +1295,34 @@ bool FlutterEmbedderWidgetHandler::InitFlutterEngine(
     std::cerr << "Unable to start flutter engine." << std::endl;
     return status;
   }
+  platform_message_dispatcher_.SetEngine(flutter_engine_);
   SendFlutterEngineResizeEvent(allocation);
   return status == kSuccess;
 }
 
 void FlutterEmbedderWidgetHandler::AllocateFlutterBuffers(
     GtkAllocation *allocation) {
+  TRACE_EVENT("AllocateFlutterBuffers");
   // This should be the only place where this is explicitly made current since
   // this is called in the main thread. All other function calls here should be
   // made from the Flutter graphics thread.
   gdk_gl_context_make_current(flutter_gl_context_);
   SavedBufferContextRestorer prev_ctx;
 
-  glGenTextures(1, &flutter_tx_);
-  glGenTextures(1, &front_buffer_tx_);
-
-  glBindTexture(kDefaultTextureTarget, flutter_tx_);
-  AllocateTexture(allocation);
-  glGenRenderbuffers(1, &flutter_rb_);
-  glBindRenderbuffer(GL_RENDERBUFFER, flutter_rb_);
-  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24,
-                        allocation->width, allocation->height);
-
-  glGenFramebuffers(1, &flutter_engine_fbo_);
-  glBindFramebuffer(GL_FRAMEBUFFER, flutter_engine_fbo_);
-  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-                         kDefaultTextureTarget, flutter_tx_, 0);
-  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
-                            GL_RENDERBUFFER, flutter_rb_);
-
-  // Allocate intermediate buffering textures.
-  glBindTexture(kDefaultTextureTarget, front_buffer_tx_);
-  AllocateTexture(allocation);
+  // The render targets hold physical pixels, so that frames are shown 1:1.
+  GtkAllocation size = get_physical_size(
+      *allocation, gtk_widget_get_scale_factor(GTK_WIDGET(gl_area_)));
+  for (const auto &frame : mailbox_.slots()) {
+    RenderTarget &target = swapchain_[frame.index];
+    render_target_pool_.Reserve(&target, size.width, size.height);
+    AttachRenderTarget(&target);
+  }
+  // The engine is told about the size once it is running.
+  engine_size_ = size;
 }
 
 bool FlutterEmbedderWidgetHandler::FlutterMakeCurrent(void *user_data) {
+  TRACE_EVENT("MakeCurrent");
   auto handler = reinterpret_cast<FlutterEmbedderWidgetHandler *>(user_data);
   gdk_gl_context_make_current(handler->flutter_gl_context_);
   return true;
@@ -235,48 +1338,269 @@ bool FlutterEmbedderWidgetHandler::FlutterClearCurrent(void *user_data) {
   return true;
 }
 
+void FlutterEmbedderWidgetHandler::CopyEngineFrameToBackFrame(
+    bool track_damage) {
+  TRACE_EVENT("CopyEngineFrame");
+  TRACE_GPU_EVENT(&present_gpu_timer_, "CopyEngineFrame");
+  SwapchainFrame &frame = mailbox_.back();
+  if (engine_index_ == frame.index) {
+    // The engine will keep drawing into its render target, so it is swapped
+    // out of the mailbox for the spare.
+    std::swap(frame.index, spare_index_);
+    // The engine has already waited on the fence for its render target.
+    DeleteSync(frame.released);
+    frame.released = nullptr;
+  }
+  if (kUseFenceSync) {
+    GpuWaitFence(frame.released);
+  }
+  RenderTarget &source = swapchain_[engine_index_];
+  RenderTarget &destination = swapchain_[frame.index];
+  // Both render targets fit the frame, as the source was reserved for it when
+  // the frame began, so the copy never goes out of bounds.
+  if (render_target_pool_.Reserve(&destination, frame_size_.width,
+                                  frame_size_.height)) {
+    damage_tracker_.Invalidate(frame.index);
+  }
+  // Only the tiles that differ from what the render target holds are copied
+  // when tracking damage, which is counted once the checksums arrive.
+  if (!track_damage || !ChecksumEngineFrame(true)) {
+    // Only the part the engine drew into is copied.
+    glBindFramebuffer(GL_FRAMEBUFFER, source.fbo);
+    glBindTexture(kDefaultTextureTarget, destination.texture);
+    glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, frame_size_.width,
+                        frame_size_.height);
+    damage_tracker_.Invalidate(frame.index);
+    copied_bytes_.fetch_add(
+        static_cast<uint64_t>(frame_size_.width) * frame_size_.height * 4,
+        std::memory_order_relaxed);
+  }
+  GLenum err = glGetError();
+  if (err != GL_NO_ERROR) {
+    std::cerr << "Flutter Present Callback Error: " << err << std::endl;
+  }
+}
+
+bool FlutterEmbedderWidgetHandler::UpdateDamageTracking() {
+  bool tracking = damage_tracking_.load(std::memory_order_relaxed);
+  if (tracking != damage_tracked_) {
+    // Nothing is known of what the render targets hold while not tracking.
+    damage_tracked_ = tracking;
+    for (size_t i = 0; i < swapchain_.size(); ++i) {
+      damage_tracker_.Invalidate(i);
+    }
+    if (!tracking) {
+      damage_tracker_.Release();
+    }
+  }
+  return tracking;
+}
+
+bool FlutterEmbedderWidgetHandler::ChecksumEngineFrame(bool copy) {
+  SwapchainFrame &frame = mailbox_.back();
+  GLuint texture = swapchain_[engine_index_].texture;
+  int64_t start = g_get_monotonic_time();
+  bool tracked =
+      copy ? damage_tracker_.ComputeAndCopy(
+                 engine_index_, texture, frame.index,
+                 swapchain_[frame.index].texture, frame_size_.width,
+                 frame_size_.height, &frame.checksum_readback)
+           : damage_tracker_.Compute(engine_index_, texture, frame_size_.width,
+                                     frame_size_.height,
+                                     &frame.checksum_readback);
+  if (!tracked) {
+    damage_tracking_ = false;
+    DeleteSync(frame.checksum_readback.fence);
+    frame.checksum_readback.fence = nullptr;
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(damage_check_time_m_);
+  damage_check_time_.Record(g_get_monotonic_time() - start);
+  return true;
+}
+
 bool FlutterEmbedderWidgetHandler::FlutterPresent(void *user_data) {
+  TRACE_EVENT("Present");
   auto handler = reinterpret_cast<FlutterEmbedderWidgetHandler *>(user_data);
-  std::unique_lock<std::mutex> lock(handler->frame_ready_m_);
-  // Make sure all previous events (texture reads, etc) complete.
-  glFinish();
-
-  GtkAllocation allocation;
-  gtk_widget_get_allocation(GTK_WIDGET(handler->gl_area_), &allocation);
-  SavedBufferContextRestorer prev_ctx;
-  glBindFramebuffer(GL_FRAMEBUFFER, handler->flutter_engine_fbo_);
+  // The engine has finished drawing the frame.
+  TRACE_GPU_END(&handler->present_gpu_timer_);
+  // Engines that keep drawing while the widget is hidden are held back.
+  handler->WaitWhileHidden();
+  if (handler->frame_direct_) {
+    handler->PresentDirectFrame();
+    return true;
+  }
+  {
+    auto lock = handler->LockSwapchain();
+    // Make sure all previous events (texture reads, etc) complete. With fences,
+    // the waits are placed on the individual buffers instead.
+    if (!kUseFenceSync) {
+      TRACE_EVENT("glFinish");
+      glFinish();
+    }
 
-  // TODO: If we are animating and resizing at the same time, it is possible a
-  // frame could be pushed that is the wrong size.
+    // Engines that cache their framebuffer keep drawing into the same render
+    // target, so it can only be published once the engine has shown that it
+    // asks for a new one after each present. Until then, the frame is copied
+    // into the back frame instead.
+    if (handler->back_buffer_acquired_) {
+      ++handler->consecutive_acquired_presents_;
+    } else {
+      handler->consecutive_acquired_presents_ = 0;
+    }
+    handler->back_buffer_acquired_ = false;
+    bool copied = handler->consecutive_acquired_presents_ <= 1;
+    // Frames presented while hidden are dropped without being checksummed, so
+    // what the engine's render target holds is no longer known.
+    bool hidden = !handler->visible_.load(std::memory_order_relaxed);
+    if (hidden) {
+      handler->damage_tracker_.Invalidate(handler->engine_index_);
+      handler->hidden_frame_count_.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (handler->storage_released_) {
+      // Engines that ask for a new framebuffer every frame get storage again
+      // when they next do, so theirs goes too while hidden.
+      handler->DeleteReleasedFramebuffers(hidden && !copied);
+    }
+    SavedBufferContextRestorer prev_ctx;
+    bool track_damage = handler->UpdateDamageTracking();
 
-  glBindTexture(kDefaultTextureTarget, handler->front_buffer_tx_);
-  // TODO: this causes errors when resizing while an animation is running.
-  glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, allocation.width,
-                      allocation.height);
-  GLenum err = glGetError();
-  if (err != GL_NO_ERROR) {
-    std::cerr << "Flutter Present Callback Error: " << err << std::endl;
+    if (hidden) {
+      // The back frame is left as it was, and the engine draws into its render
+      // target again, whether it is out of the mailbox or the back frame.
+      handler->frame_begin_time_ = 0;
+      if (copied) {
+        handler->BeginEngineFrame();
+      }
+      return true;
+    }
+    SwapchainFrame &frame = handler->mailbox_.back();
+    // The checksums of a frame replaced before GTK got to it may have arrived
+    // since, and are only collected for the bytes its copy wrote.
+    handler->CollectChecksums(&frame);
+    frame.checksums.Clear();
+    if (copied) {
+      handler->CopyEngineFrameToBackFrame(track_damage);
+    } else {
+      // The engine drew straight into the back frame, so the spare is no
+      // longer needed.
+      ReleaseRenderTarget(&handler->swapchain_[handler->spare_index_]);
+      handler->damage_tracker_.Invalidate(handler->spare_index_);
+      if (track_damage) {
+        handler->ChecksumEngineFrame(false);
+      }
+    }
+    if (!track_damage) {
+      // Checksums read back for an earlier frame are not this one's.
+      DeleteSync(frame.checksum_readback.fence);
+      frame.checksum_readback.fence = nullptr;
+    }
+    frame.width = handler->frame_size_.width;
+    frame.height = handler->frame_size_.height;
+    frame.generation = handler->frame_generation_;
+    frame.present_time = g_get_monotonic_time();
+    frame.begin_time = handler->frame_begin_time_;
+    handler->frame_begin_time_ = 0;
+    DeleteSync(frame.ready);
+    frame.ready = InsertFence();
+    // Ensure the sync is attached and copying to the texture
+    // actually occurs properly.
+    if (!kUseFenceSync) {
+      TRACE_EVENT("glFinish");
+      glFinish();
+    }
+    if (handler->mailbox_.Publish()) {
+      handler->dropped_frame_count_.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (copied) {
+      // The engine may draw its next frame without asking for a framebuffer
+      // again, so its render target (which is out of the mailbox) is readied
+      // for it now.
+      handler->BeginEngineFrame();
+    }
   }
 
-  if (handler->frame_ready_ != nullptr) {
-    glDeleteSync(handler->frame_ready_);
+  if (handler->block_on_frames_) {
+    // Taking the lock ensures the GTK thread is either waiting already, or has
+    // yet to check for a published frame.
+    { std::lock_guard<std::mutex> lock(handler->frame_ready_m_); }
+    handler->frame_ready_cv_.notify_all();
   }
-  GLsync frame_ready_sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
-  // Ensure the sync is attached and copying to the texture
-  // actually occurs properly.
-  glFinish();
-  handler->frame_ready_ = frame_ready_sync;
-  handler->frame_ready_cv_.notify_all();
-  gtk_gl_area_queue_render(handler->gl_area_);
+  // GTK must only be called from its own thread, which is woken up here.
+  // Wake-ups coalesce until the GTK thread gets to them.
+  g_source_set_ready_time(handler->render_source_, 0);
   return true;
 }
 
+void FlutterEmbedderWidgetHandler::PresentDirectFrame() {
+  back_buffer_acquired_ = false;
+  GLsync ready = nullptr;
+  if (kUseFenceSync) {
+    ready = InsertFence();
+  } else {
+    TRACE_EVENT("glFinish");
+    glFinish();
+  }
+  {
+    std::lock_guard<std::mutex> lock(direct_m_);
+    // A frame GTK has yet to render is replaced.
+    if (direct_frame_pending_ &&
+        direct_frame_rendered_ != direct_frame_count_) {
+      dropped_frame_count_.fetch_add(1, std::memory_order_relaxed);
+    }
+    DeleteSync(direct_ready_);
+    direct_ready_ = ready;
+    ++direct_frame_count_;
+    direct_frame_pending_ = true;
+    direct_present_time_ = g_get_monotonic_time();
+  }
+  g_source_set_ready_time(render_source_, 0);
+  {
+    // The GL area has a single buffer, so the next frame waits for this one to
+    // be composited.
+    TRACE_EVENT("WaitForComposite");
+    std::unique_lock<std::mutex> lock(direct_m_);
+    direct_cv_.wait_for(lock, kDirectFrameTimeout,
+                        [this] { return !direct_frame_pending_; });
+  }
+  // The engine may draw its next frame without asking for a framebuffer again.
+  auto lock = LockSwapchain();
+  BeginDirectFrame();
+}
+
 uint32_t FlutterEmbedderWidgetHandler::FlutterGetFbo(void *user_data) {
+  TRACE_EVENT("GetFbo");
   auto handler = reinterpret_cast<FlutterEmbedderWidgetHandler *>(user_data);
-  return handler->flutter_engine_fbo_;
+  auto lock = handler->LockSwapchain();
+  // The engine may ask more than once per frame, so only move on to a new
+  // render target once the current one has been presented.
+  if (!handler->back_buffer_acquired_) {
+    handler->back_buffer_acquired_ = true;
+    handler->frame_begin_time_ = g_get_monotonic_time();
+    handler->frame_direct_ =
+        handler->direct_render_ && handler->gtk_texture_ != 0;
+    if (handler->frame_direct_) {
+      handler->BeginDirectFrame();
+    } else {
+      SwapchainFrame &frame = handler->mailbox_.back();
+      handler->engine_index_ = frame.index;
+      // GTK may still be sampling from the render target.
+      if (kUseFenceSync) {
+        GpuWaitFence(frame.released);
+      }
+      handler->BeginEngineFrame();
+    }
+    // Times the engine drawing the frame, until it is presented.
+    TRACE_GPU_BEGIN(&handler->present_gpu_timer_, "EngineFrame");
+  }
+  if (handler->frame_direct_) {
+    return handler->direct_fbo_;
+  }
+  return handler->swapchain_[handler->engine_index_].fbo;
 }
 
 void FlutterEmbedderWidgetHandler::OnFlutterPlatformMessage(
     const FlutterPlatformMessage *platform_message, void *user_data) {
-  // TODO: Implement this along with the plugin framework.
+  auto handler = reinterpret_cast<FlutterEmbedderWidgetHandler *>(user_data);
+  handler->platform_message_dispatcher_.Dispatch(platform_message);
 }
@@ -0,0 +1,235 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "include/frame_capture.h"
+
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <utility>
+
+#include "include/graphics.h"
+#include "include/trace.h"
+
+FrameCapture::FrameCapture()
+    : captured_count_(0),
+      dropped_count_(0),
+      stopping_(false),
+      writer_done_(false),
+      frames_left_(0) {}
+
+FrameCapture::~FrameCapture() {
+  StopStream();
+  if (writer_.joinable()) {
+    writer_.join();
+  }
+  // The buffers should have been released by the owner, as their context may
+  // no longer be current here.
+  for (const Buffer &buffer : buffers_) {
+    assert(buffer.pbo == 0);
+  }
+}
+
+void FrameCapture::SetCallback(Callback callback) {
+  callback_ = std::move(callback);
+}
+
+void FrameCapture::StartStream(std::unique_ptr<CaptureSink> sink,
+                               uint64_t max_frames) {
+  StopStream();
+  if (writer_.joinable()) {
+    writer_.join();
+  }
+  sink_ = std::move(sink);
+  stopping_ = false;
+  writer_done_ = false;
+  frames_left_ = max_frames;
+  writer_ = std::thread(&FrameCapture::WriterLoop, this);
+}
+
+void FrameCapture::StopStream() {
+  std::lock_guard<std::mutex> lock(writer_m_);
+  stopping_ = true;
+  writer_cv_.notify_one();
+}
+
+bool FrameCapture::active() const {
+  if (callback_) {
+    return true;
+  }
+  std::lock_guard<std::mutex> lock(writer_m_);
+  return writer_.joinable() && !stopping_;
+}
+
+void FrameCapture::Capture(int width, int height, int64_t time_us) {
+  TRACE_EVENT("CaptureFrame");
+  auto start = std::chrono::steady_clock::now();
+  Update();
+  if (!active() || width <= 0 || height <= 0) {
+    return;
+  }
+  ReadFrame(width, height, time_us);
+  capture_time_.Record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           std::chrono::steady_clock::now() - start)
+                           .count());
+}
+
+void FrameCapture::ReadFrame(int width, int height, int64_t time_us) {
+  Buffer *buffer = nullptr;
+  for (Buffer &candidate : buffers_) {
+    if (candidate.state == State::kFree) {
+      buffer = &candidate;
+      break;
+    }
+  }
+  if (buffer == nullptr) {
+    ++dropped_count_;
+    return;
+  }
+  if (buffer->pbo == 0) {
+    glGenBuffers(1, &buffer->pbo);
+  }
+  size_t size = static_cast<size_t>(width) * height * 4;
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer->pbo);
+  if (buffer->size != size) {
+    glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+    buffer->size = size;
+  }
+  // Rows of RGBA pixels are always 4-byte aligned, so are tightly packed with
+  // the default GL_PACK_ALIGNMENT.
+  glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  buffer->fence = InsertFence();
+  buffer->state = State::kReading;
+  buffer->frame.pixels = nullptr;
+  buffer->frame.width = width;
+  buffer->frame.height = height;
+  buffer->frame.stride = static_cast<ptrdiff_t>(width) * 4;
+  buffer->frame.time_us = time_us;
+  reading_.push_back(buffer);
+}
+
+void FrameCapture::Update() {
+  JoinStoppedWriter();
+  ReclaimBuffers();
+  CollectFrames();
+}
+
+void FrameCapture::Release() {
+  StopStream();
+  if (writer_.joinable()) {
+    writer_.join();
+  }
+  sink_.reset();
+  // Unmaps everything the writer was handed, as it has finished with them.
+  ReclaimBuffers();
+  for (Buffer &buffer : buffers_) {
+    DeleteSync(buffer.fence);
+    buffer.fence = nullptr;
+    DeleteBuffer(buffer.pbo);
+    buffer.pbo = 0;
+    buffer.size = 0;
+    buffer.state = State::kFree;
+  }
+  reading_.clear();
+}
+
+void FrameCapture::CollectFrames() {
+  while (!reading_.empty() && IsFenceSignalled(reading_.front()->fence)) {
+    Buffer *buffer = reading_.front();
+    reading_.pop_front();
+    DeleteSync(buffer->fence);
+    buffer->fence = nullptr;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer->pbo);
+    void *pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, buffer->size,
+                                    GL_MAP_READ_BIT);
+    if (pixels == nullptr) {
+      std::cerr << "Failed to map captured frame: 0x" << std::hex
+                << glGetError() << std::dec << std::endl;
+      buffer->state = State::kFree;
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+      continue;
+    }
+    buffer->frame.pixels = static_cast<const uint8_t *>(pixels);
+    ++captured_count_;
+    if (callback_) {
+      callback_(buffer->frame);
+    }
+    bool queued = false;
+    {
+      std::lock_guard<std::mutex> lock(writer_m_);
+      if (writer_.joinable() && !stopping_) {
+        buffer->written = false;
+        write_queue_.push_back(buffer);
+        queued = true;
+        if (frames_left_ > 0 && --frames_left_ == 0) {
+          stopping_ = true;
+        }
+        writer_cv_.notify_one();
+      }
+    }
+    if (queued) {
+      buffer->state = State::kMapped;
+    } else {
+      glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+      buffer->state = State::kFree;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  }
+}
+
+void FrameCapture::ReclaimBuffers() {
+  for (Buffer &buffer : buffers_) {
+    if (buffer.state == State::kMapped &&
+        buffer.written.load(std::memory_order_acquire)) {
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer.pbo);
+      glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+      buffer.frame.pixels = nullptr;
+      buffer.state = State::kFree;
+    }
+  }
+}
+
+void FrameCapture::JoinStoppedWriter() {
+  if (writer_.joinable() && writer_done_.load(std::memory_order_acquire)) {
+    writer_.join();
+    sink_.reset();
+  }
+}
+
+void FrameCapture::WriterLoop() {
+  bool failed = false;
+  std::unique_lock<std::mutex> lock(writer_m_);
+  while (true) {
+    writer_cv_.wait(lock,
+                    [this] { return !write_queue_.empty() || stopping_; });
+    if (write_queue_.empty()) {
+      break;
+    }
+    Buffer *buffer = write_queue_.front();
+    write_queue_.pop_front();
+    lock.unlock();
+    {
+      TRACE_EVENT("WriteCapturedFrame");
+      // After a failure, frames are only returned, so the stream can stop.
+      failed = failed || !sink_->Write(buffer->frame);
+    }
+    buffer->written.store(true, std::memory_order_release);
+    lock.lock();
+    if (failed) {
+      stopping_ = true;
+    }
+  }
+  writer_done_.store(true, std::memory_order_release);
+}
@@ -0,0 +1,129 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "include/frame_stats.h"
+
+#include <cstdio>
+
+// GDK only keeps the timings of this many recent frames.
+static constexpr size_t kMaxPendingPresentations = 16;
+
+FrameStats::FrameStats()
+    : frames_shown_(0), blocked_us_(0), last_new_frame_start_(0) {}
+
+void FrameStats::RecordRender(const FrameTimestamps &timestamps,
+                              bool new_frame, GdkFrameClock *frame_clock) {
+  render_.Record(timestamps.render_end - timestamps.render_start);
+  if (frame_clock != nullptr) {
+    UpdatePresentationTimes(frame_clock);
+  }
+  if (!new_frame || timestamps.present == 0) {
+    return;
+  }
+  ++frames_shown_;
+  present_to_render_start_.Record(timestamps.render_start - timestamps.present);
+  present_to_render_end_.Record(timestamps.render_end - timestamps.present);
+  if (timestamps.fence_signalled != 0) {
+    present_to_fence_signalled_.Record(timestamps.fence_signalled -
+                                       timestamps.present);
+  }
+  if (last_new_frame_start_ != 0) {
+    frame_interval_.Record(timestamps.render_start - last_new_frame_start_);
+  }
+  last_new_frame_start_ = timestamps.render_start;
+  if (frame_clock != nullptr) {
+    if (pending_presentations_.size() == kMaxPendingPresentations) {
+      pending_presentations_.pop_front();
+    }
+    pending_presentations_.emplace_back(
+        gdk_frame_clock_get_frame_counter(frame_clock), timestamps.present);
+  }
+}
+
+void FrameStats::UpdatePresentationTimes(GdkFrameClock *frame_clock) {
+  while (!pending_presentations_.empty()) {
+    const auto &pending = pending_presentations_.front();
+    GdkFrameTimings *timings =
+        gdk_frame_clock_get_timings(frame_clock, pending.first);
+    if (timings != nullptr && !gdk_frame_timings_get_complete(timings)) {
+      // Timings complete in order, so the rest are not complete either.
+      return;
+    }
+    // Timings that are gone, or without a presentation time (which not all
+    // windowing systems report), are skipped.
+    int64_t presentation_time =
+        timings != nullptr ? gdk_frame_timings_get_presentation_time(timings)
+                           : 0;
+    if (presentation_time != 0) {
+      present_to_presentation_.Record(presentation_time - pending.second);
+    }
+    pending_presentations_.pop_front();
+  }
+}
+
+void GetLatency(const LatencyHistogram &histogram,
+                FlutterEmbedderLatency *latency) {
+  latency->count = histogram.count();
+  latency->mean_us = histogram.mean();
+  latency->p50_us = histogram.Percentile(50.0);
+  latency->p90_us = histogram.Percentile(90.0);
+  latency->p99_us = histogram.Percentile(99.0);
+  latency->max_us = histogram.max();
+}
+
+void FrameStats::GetStats(FlutterEmbedderStats *stats) const {
+  stats->frames_shown = frames_shown_;
+  stats->blocked_on_frames_us = blocked_us_;
+  GetLatency(present_to_fence_signalled_, &stats->present_to_fence_signalled);
+  GetLatency(present_to_render_start_, &stats->present_to_render_start);
+  GetLatency(present_to_render_end_, &stats->present_to_render_end);
+  GetLatency(present_to_presentation_, &stats->present_to_presentation);
+  GetLatency(render_, &stats->render);
+  GetLatency(frame_interval_, &stats->frame_interval);
+}
+
+// Logs the percentiles of |latency| as "name p50/p90/p99/max", in
+// milliseconds.
+static void log_latency(const char *name, const FlutterEmbedderLatency &latency,
+                        std::ostream &log) {
+  char line[128];
+  snprintf(line, sizeof(line), " %s %.2f/%.2f/%.2f/%.2fms", name,
+           latency.p50_us / 1000.0, latency.p90_us / 1000.0,
+           latency.p99_us / 1000.0, latency.max_us / 1000.0);
+  log << line;
+}
+
+void LogFrameStats(const FlutterEmbedderStats &stats, std::ostream &log) {
+  log << "Frames: " << stats.frames_shown << " shown, " << stats.dropped_frames
+      << " dropped, " << stats.stale_frames << " stale, "
+      << stats.stretched_frames << " stretched, " << stats.hidden_frames
+      << " hidden, " << stats.storage_allocations << " allocations and "
+      << stats.storage_releases << " releases of storage, "
+      << stats.resolution_changes << " resolution changes (scale "
+      << stats.resolution_scale << "), "
+      << stats.blocked_on_frames_us / 1000 << "ms blocked. Scale factor "
+      << stats.scale_factor << ": " << stats.render_target_bytes / 1000000
+      << "MB render targets, " << stats.copied_bytes / 1000000
+      << "MB copied. Damage: " << stats.unchanged_frames
+      << " unchanged frames, " << stats.skipped_render_bytes / 1000000
+      << "MB renders and " << stats.skipped_copy_bytes / 1000000
+      << "MB copies skipped. p50/p90/p99/max:";
+  log_latency("fence", stats.present_to_fence_signalled, log);
+  log_latency("render start", stats.present_to_render_start, log);
+  log_latency("render end", stats.present_to_render_end, log);
+  log_latency("presentation", stats.present_to_presentation, log);
+  log_latency("render", stats.render, log);
+  log_latency("interval", stats.frame_interval, log);
+  log_latency("damage", stats.damage_check, log);
+  log << std::endl;
+}
@@ -0,0 +1,277 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef LINUX_INCLUDE_BLIT_PROGRAM_INLINE_H_
+#define LINUX_INCLUDE_BLIT_PROGRAM_INLINE_H_
+#include <epoxy/gl.h>
+
+#include <string>
+
+#include "graphics.h"
+
+// Options for BlitProgram. Each combination compiles into its own program.
+enum BlitFlags : unsigned {
+  kBlitDefault = 0,
+  // Encodes linear color as sRGB when writing.
+  kBlitEncodeSrgb = 1 << 0,
+  // Premultiplies color by alpha, for textures holding straight alpha.
+  kBlitPremultiplyAlpha = 1 << 1,
+  // Samples only part of the texture, stretching it over the viewport.
+  kBlitScale = 1 << 2,
+  // Filters linearly, for scaling smoothly, without sampling past the part of
+  // the texture drawn.
+  kBlitLinear = 1 << 3,
+};
+
+// Shader sources, written against the macros defined by BlitProgram so that
+// they compile as both GLSL ES 1.00 and desktop GLSL.
+static constexpr char kBlitVertexShader[] = R"glsl(
+VERTEX_IN vec2 position;
+VARYING_OUT vec2 uv;
+#ifdef BLIT_SCALE
+uniform vec2 uv_scale;
+#endif
+
+void main() {
+  uv = position * 0.5 + 0.5;
+#ifdef BLIT_SCALE
+  uv *= uv_scale;
+#endif
+  gl_Position = vec4(position, 0.0, 1.0);
+}
+)glsl";
+
+static constexpr char kBlitFragmentShader[] = R"glsl(
+VARYING_IN vec2 uv;
+uniform sampler2D frame;
+#ifdef BLIT_LINEAR
+// The center of the last texel drawn, which keeps texels past it from being
+// filtered in.
+uniform vec2 uv_max;
+#endif
+
+vec3 EncodeSrgb(vec3 linear) {
+  vec3 low = linear * 12.92;
+  vec3 high = 1.055 * pow(linear, vec3(1.0 / 2.4)) - 0.055;
+  return mix(low, high, step(vec3(0.0031308), linear));
+}
+
+void main() {
+#ifdef BLIT_LINEAR
+  vec4 color = TEXTURE(frame, min(uv, uv_max));
+#else
+  vec4 color = TEXTURE(frame, uv);
+#endif
+#ifdef BLIT_ENCODE_SRGB
+#ifndef BLIT_PREMULTIPLY_ALPHA
+  // Encoding applies to the color before it was premultiplied.
+  color.rgb /= max(color.a, 1.0 / 255.0);
+#endif
+  color.rgb = EncodeSrgb(color.rgb) * color.a;
+#elif defined(BLIT_PREMULTIPLY_ALPHA)
+  color.rgb *= color.a;
+#endif
+  FRAG_COLOR = color;
+}
+)glsl";
+
+// Draws a texture over the whole viewport with a single triangle.
+//
+// The program and its vertices are created once by Initialize, and must be
+// released by Release, both with the context that draws current (vertex arrays
+// are not shared between contexts).
+//
+// Example:
+//
+//   BlitProgram<kBlitScale> blit;
+//   if (blit.Initialize()) {
+//     blit.Draw(texture, 0.5f, 0.5f);  // Draws the bottom-left quarter.
+//   }
+template <unsigned Flags>
+class BlitProgram {
+ public:
+  static constexpr bool kEncodeSrgb = (Flags & kBlitEncodeSrgb) != 0;
+  static constexpr bool kPremultiplyAlpha =
+      (Flags & kBlitPremultiplyAlpha) != 0;
+  static constexpr bool kScale = (Flags & kBlitScale) != 0;
+  static constexpr bool kLinear = (Flags & kBlitLinear) != 0;
+
+  BlitProgram()
+      : program_(0),
+        vbo_(0),
+        vao_(0),
+        uv_scale_location_(-1),
+        uv_max_location_(-1) {}
+
+  // Compiles the program and uploads its vertices, unless already done.
+  //
+  // Returns false (after logging the reason) if compilation failed.
+  bool Initialize() {
+    if (program_ != 0) {
+      return true;
+    }
+    std::string vertex_source =
+        ShaderSource(GL_VERTEX_SHADER, kBlitVertexShader);
+    std::string fragment_source =
+        ShaderSource(GL_FRAGMENT_SHADER, kBlitFragmentShader);
+    program_ = LinkProgram(
+        CompileShader(GL_VERTEX_SHADER, vertex_source.c_str()),
+        CompileShader(GL_FRAGMENT_SHADER, fragment_source.c_str()), "position");
+    if (program_ == 0) {
+      return false;
+    }
+    glUseProgram(program_);
+    glUniform1i(glGetUniformLocation(program_, "frame"), 0);
+    if (kScale) {
+      uv_scale_location_ = glGetUniformLocation(program_, "uv_scale");
+    }
+    if (kLinear) {
+      uv_max_location_ = glGetUniformLocation(program_, "uv_max");
+    }
+    glUseProgram(0);
+
+    // A triangle covering the viewport, so that no fragment is shaded twice
+    // along a diagonal.
+    static constexpr GLfloat kVertices[] = {-1.0f, -1.0f, 3.0f,
+                                            -1.0f, -1.0f, 3.0f};
+    glGenBuffers(1, &vbo_);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(kVertices), kVertices,
+                 GL_STATIC_DRAW);
+    if (HasVertexArrays()) {
+      glGenVertexArrays(1, &vao_);
+      glBindVertexArray(vao_);
+      SetUpVertexAttributes();
+      glBindVertexArray(0);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return true;
+  }
+
+  // Deletes the program and its vertices.
+  void Release() {
+    DeleteProgram(program_);
+    DeleteBuffer(vbo_);
+    DeleteVertexArray(vao_);
+    program_ = 0;
+    vbo_ = 0;
+    vao_ = 0;
+  }
+
+  // Draws |texture| over the viewport. Only the given fraction of the texture,
+  // starting from its origin, is drawn when scaling.
+  //
+  // Filtering linearly needs the size of |texture|, and switches it to linear
+  // filtering.
+  //
+  // Clobbers the active texture unit and its 2D texture binding.
+  void Draw(GLuint texture, GLfloat u_scale = 1.0f, GLfloat v_scale = 1.0f,
+            GLsizei texture_width = 1, GLsizei texture_height = 1) {
+    glUseProgram(program_);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(kDefaultTextureTarget, texture);
+    if (kScale) {
+      glUniform2f(uv_scale_location_, u_scale, v_scale);
+    }
+    if (kLinear) {
+      glTexParameteri(kDefaultTextureTarget, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+      glTexParameteri(kDefaultTextureTarget, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+      glUniform2f(uv_max_location_, u_scale - 0.5f / texture_width,
+                  v_scale - 0.5f / texture_height);
+    }
+    if (vao_ != 0) {
+      glBindVertexArray(vao_);
+    } else {
+      glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+      SetUpVertexAttributes();
+    }
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    if (vao_ != 0) {
+      glBindVertexArray(0);
+    } else {
+      glDisableVertexAttribArray(0);
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    glUseProgram(0);
+  }
+
+ private:
+  // Vertex arrays are core in desktop GL and GLES as of 3.0, and required by
+  // desktop core profiles.
+  static bool HasVertexArrays() { return epoxy_gl_version() >= 30; }
+
+  static void SetUpVertexAttributes() {
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, nullptr);
+  }
+
+  // Prefixes |body| with the GLSL version and macros of the current context,
+  // as well as the definitions for |Flags|.
+  static std::string ShaderSource(GLenum stage, const char *body) {
+    std::string source;
+    if (!epoxy_is_desktop_gl()) {
+      source =
+          "#version 100\n"
+          "#ifdef GL_FRAGMENT_PRECISION_HIGH\n"
+          "precision highp float;\n"
+          "#else\n"
+          "precision mediump float;\n"
+          "#endif\n"
+          "#define VERTEX_IN attribute\n"
+          "#define VARYING_OUT varying\n"
+          "#define VARYING_IN varying\n"
+          "#define TEXTURE texture2D\n"
+          "#define FRAG_COLOR gl_FragColor\n";
+    } else if (epoxy_gl_version() >= 32) {
+      source =
+          "#version 150\n"
+          "#define VERTEX_IN in\n"
+          "#define VARYING_OUT out\n"
+          "#define VARYING_IN in\n"
+          "#define TEXTURE texture\n"
+          "#define FRAG_COLOR frag_color\n";
+      if (stage == GL_FRAGMENT_SHADER) {
+        source += "out vec4 frag_color;\n";
+      }
+    } else {
+      source =
+          "#version 120\n"
+          "#define VERTEX_IN attribute\n"
+          "#define VARYING_OUT varying\n"
+          "#define VARYING_IN varying\n"
+          "#define TEXTURE texture2D\n"
+          "#define FRAG_COLOR gl_FragColor\n";
+    }
+    if (kEncodeSrgb) {
+      source += "#define BLIT_ENCODE_SRGB\n";
+    }
+    if (kPremultiplyAlpha) {
+      source += "#define BLIT_PREMULTIPLY_ALPHA\n";
+    }
+    if (kScale) {
+      source += "#define BLIT_SCALE\n";
+    }
+    if (kLinear) {
+      source += "#define BLIT_LINEAR\n";
+    }
+    return source + body;
+  }
+
+  GLuint program_;
+  GLuint vbo_;
+  // Only used when the context supports vertex arrays.
+  GLuint vao_;
+  GLint uv_scale_location_;
+  GLint uv_max_location_;
+};
+#endif  // LINUX_INCLUDE_BLIT_PROGRAM_INLINE_H_
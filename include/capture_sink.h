@@ -0,0 +1,59 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef LINUX_INCLUDE_CAPTURE_SINK_H_
+#define LINUX_INCLUDE_CAPTURE_SINK_H_
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// A frame read back from GL.
+struct CapturedFrame {
+  // RGBA pixels with premultiplied alpha, as GL draws them, bottom row first
+  // as GL reads them, with rows |stride| bytes apart.
+  const uint8_t *pixels = nullptr;
+  int width = 0;
+  int height = 0;
+  ptrdiff_t stride = 0;
+  // When the frame was shown, in microseconds of the monotonic clock.
+  int64_t time_us = 0;
+};
+
+// Writes captured frames out. Only ever called from one thread at a time.
+class CaptureSink {
+ public:
+  virtual ~CaptureSink() {}
+
+  // Writes |frame|, returning false (after logging the reason) on failure.
+  virtual bool Write(const CapturedFrame &frame) = 0;
+};
+
+enum class CaptureFormat {
+  // Raw BGRA frames with premultiplied alpha, one after another, e.g. for
+  // `ffmpeg -f rawvideo -pix_fmt bgra -s WxH -i FILE`. Frames keep their size,
+  // which may change between frames.
+  kRawBgra,
+  // A YUV4MPEG2 stream of I420 frames, which most video tools read directly.
+  // Frames of another size than the first are skipped.
+  kY4m,
+  // A PNG file per frame, with straight alpha, named after the path with the
+  // frame number appended, e.g. "shot_000000.png" for "shot".
+  kPng,
+};
+
+// Returns a sink writing frames to |path| in |format|, or null (after logging
+// the reason) if |path| could not be opened.
+std::unique_ptr<CaptureSink> CreateCaptureSink(CaptureFormat format,
+                                               const std::string &path);
+#endif  // LINUX_INCLUDE_CAPTURE_SINK_H_
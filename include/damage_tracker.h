@@ -0,0 +1,160 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef LINUX_INCLUDE_DAMAGE_TRACKER_H_
+#define LINUX_INCLUDE_DAMAGE_TRACKER_H_
+#include <epoxy/gl.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// The checksums of the square tiles of a frame, which tell whether it changed
+// from another frame.
+struct TileChecksums {
+  // The size of the frame, in pixels.
+  int width = 0;
+  int height = 0;
+  // The tiles along each axis, the last of which may be partly outside the
+  // frame.
+  int columns = 0;
+  int rows = 0;
+  // Two 32-bit hashes per tile, a row of tiles at a time from the bottom.
+  std::vector<uint32_t> hashes;
+  // Whether the frame was copied into the render target it is shown from, and
+  // the pixels of the tiles that were: those that differed from what the
+  // render target held.
+  bool copied = false;
+  uint64_t copied_pixels = 0;
+
+  bool empty() const { return hashes.empty(); }
+
+  void Clear() {
+    width = 0;
+    height = 0;
+    columns = 0;
+    rows = 0;
+    hashes.clear();
+    copied = false;
+    copied_pixels = 0;
+  }
+
+  // Returns true if |other| is of the same size, and has the same contents.
+  bool Equals(const TileChecksums &other) const {
+    return width == other.width && height == other.height &&
+           hashes == other.hashes;
+  }
+};
+
+// Checksums of a frame being read back from the GPU.
+struct ChecksumReadback {
+  // The pixel pack buffer read into, and the size of its storage in bytes.
+  GLuint pbo = 0;
+  size_t size = 0;
+  // Signalled once the checksums are in the buffer, or null if none are
+  // being read back.
+  GLsync fence = nullptr;
+  int width = 0;
+  int height = 0;
+  int columns = 0;
+  int rows = 0;
+  bool copied = false;
+};
+
+// Checksums the tiles of frames on the GPU, and reads back a few bytes per
+// tile instead of the frame itself, without waiting for the GPU.
+//
+// The checksums of what each render target holds are also kept on the GPU,
+// so that copying a frame between render targets only writes the tiles that
+// changed, which needs no readback at all.
+//
+// Each tile is hashed by a single fragment into an integer render target, so
+// this needs GLES 3.0 or desktop GL 3.2. Apart from Collect, all calls must be
+// made with the same context current. Its GL objects go away with that
+// context, unless released first.
+class DamageTracker {
+ public:
+  // The size of the tiles, in pixels.
+  static constexpr int kTileSize = 32;
+
+  // |target_count| is the number of render targets, by index.
+  explicit DamageTracker(size_t target_count);
+  ~DamageTracker();
+
+  // Checksums the |width|x|height| frame at the bottom-left corner of
+  // |texture|, the storage of render target |index|, and starts reading the
+  // checksums back into |readback|.
+  //
+  // Returns false (after logging the reason, once) if the context does not
+  // support it. Saves and restores the GL state it changes.
+  bool Compute(size_t index, GLuint texture, int width, int height,
+               ChecksumReadback *readback);
+
+  // Like Compute, then copies the frame into |destination_texture|, the
+  // storage of render target |destination|, skipping the tiles it already
+  // holds unless what it holds is unknown.
+  bool ComputeAndCopy(size_t source, GLuint source_texture,
+                      size_t destination, GLuint destination_texture,
+                      int width, int height, ChecksumReadback *readback);
+
+  // Forgets what render target |index| holds, as when its storage changes or
+  // it is drawn into without being checksummed. Makes no GL calls.
+  void Invalidate(size_t index);
+
+  // Deletes all GL objects.
+  void Release();
+
+  // Reads the checksums of |readback| into |checksums| if they are ready,
+  // without waiting. Returns false if they are not, or none are being read
+  // back. May be called with any context sharing objects with the one they
+  // were computed with.
+  static bool Collect(ChecksumReadback *readback, TileChecksums *checksums);
+
+  // Deletes the GL objects of |readback|.
+  static void ReleaseReadback(ChecksumReadback *readback);
+
+ private:
+  // The checksums of what a render target holds, as a texel per tile.
+  struct Target {
+    GLuint texture = 0;
+    // The size of the frame they are of, or 0 if unknown.
+    int width = 0;
+    int height = 0;
+  };
+
+  // Creates the GL objects, unless already done. Returns false if the context
+  // does not support them.
+  bool Initialize();
+
+  // Draws the checksums of the frame in |texture| into those of render target
+  // |index|, marking the tiles that differ from those of |compare| if it is
+  // not null, and reads them back into |readback|.
+  void Checksum(size_t index, GLuint texture, int width, int height,
+                const Target *compare, ChecksumReadback *readback);
+
+  GLuint checksum_program_;
+  GLuint copy_program_;
+  GLuint vbo_;
+  GLuint vao_;
+  GLint frame_size_location_;
+  GLint compare_location_;
+  // The framebuffers the checksums, and copies of frames, are drawn into.
+  GLuint checksum_fbo_;
+  GLuint copy_fbo_;
+  // The size of the checksum textures, in tiles.
+  int texture_columns_;
+  int texture_rows_;
+  std::vector<Target> targets_;
+  bool unsupported_;
+};
+#endif  // LINUX_INCLUDE_DAMAGE_TRACKER_H_
@@ -41,6 +41,14 @@ typedef struct {
   BoolCallback clear_current;
   BoolCallback present;
   UIntCallback fbo_callback;
+  // This is an optional callback. Passing a resource context allows the engine
+  // to upload textures on a separate thread.
+  BoolCallback make_resource_current;
+  // By default, the renderer config assumes that the FBO does not change for
+  // the duration of the engine run. If this argument is true, the engine will
+  // ask the embedder for an updated FBO target (via an fbo_callback
+  // invocation) after a present call.
+  bool fbo_reset_after_present;
 } FlutterOpenGLRendererConfig;
 
 typedef struct {
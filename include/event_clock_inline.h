@@ -0,0 +1,71 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef LINUX_INCLUDE_EVENT_CLOCK_INLINE_H_
+#define LINUX_INCLUDE_EVENT_CLOCK_INLINE_H_
+#include <cstdint>
+
+// Converts GDK event times to the monotonic clock the engine and the GDK frame
+// clock use (g_get_monotonic_time, in microseconds).
+//
+// GDK event times are 32-bit millisecond counts from the windowing system,
+// whose origin is not specified. They are unwrapped into 64 bits, and offset by
+// the smallest delivery latency seen so far, so that the spacing between events
+// is that of the hardware, not of the main loop dispatching them.
+//
+// Example:
+//
+//   int64_t timestamp =
+//       clock.ToMonotonic(gdk_event_get_time(event), g_get_monotonic_time());
+class EventClock {
+ public:
+  // An offset implying a longer delivery latency than this means either clock
+  // jumped, so the offset is measured again.
+  static constexpr int64_t kMaxLatencyUs = 1000 * 1000;
+
+  EventClock() : has_offset_(false), last_time_ms_(0), wraps_(0), offset_(0) {}
+
+  // Returns the monotonic time of an event with |event_time_ms|, received at
+  // monotonic time |now_us|. Never returns a time later than |now_us|.
+  //
+  // Events without a time (i.e. GDK_CURRENT_TIME) are given |now_us|.
+  int64_t ToMonotonic(uint32_t event_time_ms, int64_t now_us) {
+    if (event_time_ms == 0) {
+      return now_us;
+    }
+    // Event times may arrive slightly out of order across devices, so only a
+    // large step backwards counts as wrapping around.
+    if (has_offset_ && event_time_ms < last_time_ms_ &&
+        last_time_ms_ - event_time_ms > UINT32_MAX / 2) {
+      ++wraps_;
+    }
+    last_time_ms_ = event_time_ms;
+    int64_t event_us = ((wraps_ << 32) + event_time_ms) * 1000;
+
+    int64_t offset = now_us - event_us;
+    if (!has_offset_ || offset < offset_ || offset - offset_ > kMaxLatencyUs) {
+      offset_ = offset;
+      has_offset_ = true;
+    }
+    int64_t timestamp = event_us + offset_;
+    return timestamp < now_us ? timestamp : now_us;
+  }
+
+ private:
+  bool has_offset_;
+  uint32_t last_time_ms_;
+  int64_t wraps_;
+  // Monotonic time minus event time, at the smallest delivery latency seen.
+  int64_t offset_;
+};
+#endif  // LINUX_INCLUDE_EVENT_CLOCK_INLINE_H_
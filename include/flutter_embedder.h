@@ -25,10 +25,303 @@ GtkWidget *flutter_embedder_new(const char *main_path, const char *assets_path,
                                 const char *icu_data_path, int argc,
                                 const char **argv);
 
+// Options for flutter_embedder_new_with_flags.
+typedef enum {
+  FLUTTER_EMBEDDER_FLAGS_NONE = 0,
+  // The Flutter Engine draws straight into the widget's own GL texture, saving
+  // a fullscreen draw per frame and the VRAM of its own render targets. The
+  // texture has a single buffer, so the engine waits for each frame to be
+  // shown before drawing the next, and the window repainting for any other
+  // reason may show a partly drawn frame. Meant for fullscreen windows showing
+  // nothing but the engine. Falls back to the default when unsupported.
+  FLUTTER_EMBEDDER_DIRECT_RENDER = 1 << 0,
+} FlutterEmbedderFlags;
+
+// Like flutter_embedder_new, with |flags| combined from FlutterEmbedderFlags.
+GtkWidget *flutter_embedder_new_with_flags(
+    const char *main_path, const char *assets_path, const char *packages_path,
+    const char *icu_data_path, int argc, const char **argv, guint flags);
+
 GtkWidget *flutter_embedder_snapshot_mode_new(const char *assets_path,
                                               const char *icu_data_path,
                                               int argc, const char **argv);
 
+// Sets whether rendering |flutter_embedder| waits for the Flutter Engine to
+// produce a frame. When FALSE (the default), the GTK main loop never waits on
+// the engine, and the last frame is shown until a newer one is finished.
+void flutter_embedder_set_block_on_frames(GtkWidget *flutter_embedder,
+                                          gboolean block);
+
+// Sets whether pointer moves sent to |flutter_embedder| are resampled to
+// shortly before the presentation time of each frame, between the moves
+// received (never ahead of them), evening out the distance moved
+// between frames. Defaults to FALSE.
+void flutter_embedder_set_resample_pointer_events(GtkWidget *flutter_embedder,
+                                                  gboolean resample);
+
+// Options for flutter_embedder_set_dynamic_resolution. Scales are fractions
+// of the widget's size along each axis.
+typedef struct {
+  // The bounds of the scale, and how far it moves at a time.
+  gdouble min_scale;
+  gdouble max_scale;
+  gdouble step;
+  // The frame rate to sustain, or 0 to follow the display's refresh rate.
+  gdouble target_fps;
+  // The resolution shrinks once the 90th percentile time the engine takes to
+  // draw a frame goes over this fraction of the frame's time, and grows back
+  // once it stays under the grow fraction for |grow_windows| windows in a
+  // row.
+  gdouble shrink_threshold;
+  gdouble grow_threshold;
+  // The frames measured before each decision.
+  guint window_frames;
+  guint grow_windows;
+} FlutterEmbedderResolutionOptions;
+
+// Fills in |options| with the defaults: scales from 0.5 to 1 in steps of
+// 0.125, following the display's refresh rate, shrinking over 90% and growing
+// under 60% of the frame time, in windows of 30 frames, growing after 3.
+void flutter_embedder_resolution_options_init(
+    FlutterEmbedderResolutionOptions *options);
+
+// Scales the resolution |flutter_embedder| has the Flutter Engine draw at
+// with the time the engine takes to draw each frame, trading sharpness for
+// frame rate under load. Frames are upscaled to fit the widget with linear
+// filtering. NULL |options| go back to the full resolution. Has no effect with
+// FLUTTER_EMBEDDER_DIRECT_RENDER.
+void flutter_embedder_set_dynamic_resolution(
+    GtkWidget *flutter_embedder,
+    const FlutterEmbedderResolutionOptions *options);
+
+// Returns the resolution |flutter_embedder| has the Flutter Engine draw at,
+// as a fraction of its size.
+gdouble flutter_embedder_get_resolution_scale(GtkWidget *flutter_embedder);
+
+// Sets whether |flutter_embedder| checksums each frame the Flutter Engine
+// presents, in tiles, on the GPU. Frames unchanged from the one shown are then
+// never rendered, which saves idle apps rendering and compositing, and only
+// the tiles that changed are copied for engines that keep drawing into the
+// same framebuffer. The checksums are read back without blocking either
+// thread, so a frame is rendered regardless if they take more than a few
+// milliseconds. Defaults to FALSE. Needs GLES 3.0, and has no effect with
+// FLUTTER_EMBEDDER_DIRECT_RENDER.
+void flutter_embedder_set_damage_tracking(GtkWidget *flutter_embedder,
+                                          gboolean track);
+
+// Formats of the depth buffer the Flutter Engine draws with.
+typedef enum {
+  // 24 bits, the default.
+  FLUTTER_EMBEDDER_DEPTH_BUFFER_24,
+  // 16 bits, at half the VRAM.
+  FLUTTER_EMBEDDER_DEPTH_BUFFER_16,
+  // None, for engines that never depth test, which halves the VRAM of each
+  // render target.
+  FLUTTER_EMBEDDER_DEPTH_BUFFER_NONE,
+} FlutterEmbedderDepthBuffer;
+
+// Sets the depth buffer |flutter_embedder| has the Flutter Engine draw with.
+// Render targets are reallocated as the engine draws its next frames.
+void flutter_embedder_set_depth_buffer(GtkWidget *flutter_embedder,
+                                       FlutterEmbedderDepthBuffer depth_buffer);
+
+// Sets how long |flutter_embedder| stays hidden (in an iconified, withdrawn or
+// fully obscured window) before the VRAM of its render targets is released,
+// in milliseconds, or -1 to keep it. Defaults to 10 seconds. The VRAM is
+// released as soon as the widget is unmapped, unless -1, and allocated again
+// as the Flutter Engine draws its first frames once shown, until which the
+// widget shows nothing. Has no effect with FLUTTER_EMBEDDER_DIRECT_RENDER.
+void flutter_embedder_set_hidden_release_delay(GtkWidget *flutter_embedder,
+                                               gint delay_ms);
+
+// The VRAM held by a widget, in bytes.
+typedef struct {
+  GtkWidget *flutter_embedder;
+  // Render targets the Flutter Engine draws into, including storage pooled
+  // for reuse.
+  guint64 render_target_bytes;
+  // Textures registered with flutter_embedder_register_texture, and their
+  // upload buffers.
+  guint64 texture_bytes;
+  guint64 total_bytes;
+} FlutterEmbedderVramUsage;
+
+// Fills in |usages| with the VRAM held by each widget in the process, up to
+// |max_usages| of them, and returns the number of widgets. Must be called
+// from the GTK thread.
+guint flutter_embedder_get_vram_usage(FlutterEmbedderVramUsage *usages,
+                                      guint max_usages);
+
+// Returns the bytes of VRAM held by all widgets in the process. Must be called
+// from the GTK thread.
+guint64 flutter_embedder_get_total_vram_bytes(void);
+
+// A summary of durations, in microseconds. Percentiles are accurate to within
+// about 6%.
+typedef struct {
+  guint64 count;
+  guint64 mean_us;
+  guint64 p50_us;
+  guint64 p90_us;
+  guint64 p99_us;
+  guint64 max_us;
+} FlutterEmbedderLatency;
+
+// Statistics about the frames shown by a widget since it was created.
+typedef struct {
+  // Frames the Flutter Engine presented that were then shown.
+  guint64 frames_shown;
+  // Frames the Flutter Engine presented that were replaced by a newer frame
+  // before they could be shown.
+  guint64 dropped_frames;
+  // Renders that showed the last frame again, as no newer one was finished.
+  guint64 stale_frames;
+  // Renders that had no frame to show, before the first frame.
+  guint64 skipped_renders;
+  // Renders that stretched a frame drawn before the last resize.
+  guint64 stretched_frames;
+  // Frames the Flutter Engine presented while the widget was hidden, which
+  // were dropped.
+  guint64 hidden_frames;
+  // Times render target storage was allocated, mostly on resizes, and times
+  // it was all released while the widget was hidden.
+  guint64 storage_allocations;
+  guint64 storage_releases;
+  // The GDK scale factor frames are drawn at, the bytes of VRAM held by
+  // render targets at that scale, and the bytes copied between render targets
+  // so far (only for engines that keep drawing into the same framebuffer).
+  gint scale_factor;
+  guint64 render_target_bytes;
+  guint64 copied_bytes;
+  // Times dynamic resolution changed the resolution the engine draws at, and
+  // that resolution as a fraction of the widget's size.
+  guint64 resolution_changes;
+  gdouble resolution_scale;
+  // With damage tracking, the frames the Flutter Engine presented unchanged
+  // from the one shown, which were dropped rather than rendered, the bytes of
+  // rendering (and compositing) this saved, and the bytes of copies skipped
+  // for tiles that had not changed.
+  guint64 unchanged_frames;
+  guint64 skipped_render_bytes;
+  guint64 skipped_copy_bytes;
+  // Time spent blocked waiting for the Flutter Engine to present frames, or
+  // for the GPU to finish drawing them.
+  guint64 blocked_on_frames_us;
+
+  // Time from the Flutter Engine presenting a frame until the GPU was seen to
+  // have finished drawing it. The fence is only checked when rendering, so
+  // this is an upper bound.
+  FlutterEmbedderLatency present_to_fence_signalled;
+  // Time from the Flutter Engine presenting a frame until it was rendered.
+  FlutterEmbedderLatency present_to_render_start;
+  FlutterEmbedderLatency present_to_render_end;
+  // Time from the Flutter Engine presenting a frame until the frame clock
+  // reported it presented on screen, where the windowing system reports it.
+  FlutterEmbedderLatency present_to_presentation;
+  // Time taken by each render.
+  FlutterEmbedderLatency render;
+  // Time between renders of consecutive new frames. Jank shows up as a long
+  // tail here.
+  FlutterEmbedderLatency frame_interval;
+  // Time taken to issue the checksums of each frame presented, with damage
+  // tracking. The GPU computes and reads them back later.
+  FlutterEmbedderLatency damage_check;
+} FlutterEmbedderStats;
+
+// Fills in |stats| for |flutter_embedder|.
+void flutter_embedder_get_stats(GtkWidget *flutter_embedder,
+                                FlutterEmbedderStats *stats);
+
+// Sets how often a summary of the statistics of |flutter_embedder| is logged
+// to stderr. Zero (the default) disables logging.
+void flutter_embedder_set_stats_log_interval(GtkWidget *flutter_embedder,
+                                             guint seconds);
+
+typedef enum {
+  // Raw BGRA frames, one after another.
+  FLUTTER_EMBEDDER_CAPTURE_RAW_BGRA,
+  // A YUV4MPEG2 stream of I420 frames, all the size of the first.
+  FLUTTER_EMBEDDER_CAPTURE_Y4M,
+  // A PNG file per frame, named after |path| with "_<frame number>.png"
+  // appended.
+  FLUTTER_EMBEDDER_CAPTURE_PNG,
+} FlutterEmbedderCaptureFormat;
+
+// Starts writing the frames |flutter_embedder| shows to |path| in |format|,
+// replacing any capture already running. Frames are read back without
+// stalling rendering and written on a background thread, so frames may be
+// dropped if writing falls behind. Stops after |max_frames| frames, unless it
+// is 0: e.g. a PNG capture of 1 frame takes a screenshot.
+//
+// Returns FALSE if |path| could not be opened.
+gboolean flutter_embedder_start_capture(GtkWidget *flutter_embedder,
+                                        FlutterEmbedderCaptureFormat format,
+                                        const char *path, guint max_frames);
+
+// Stops writing frames. Frames already read back are still written.
+void flutter_embedder_stop_capture(GtkWidget *flutter_embedder);
+
+// Called on the GTK thread with each frame |flutter_embedder| shows, a few
+// frames after it was shown. The RGBA pixels are mapped straight from the GPU
+// and only valid during the call. Rows are |stride| bytes apart, bottom row
+// first.
+typedef void (*FlutterEmbedderCaptureCallback)(const guint8 *pixels,
+                                               gint width, gint height,
+                                               gint stride, gint64 time_us,
+                                               gpointer user_data);
+
+// Sets the callback frames shown by |flutter_embedder| are handed to, or
+// clears it if |callback| is NULL. The callback should return quickly, as it
+// holds up rendering.
+void flutter_embedder_set_capture_callback(
+    GtkWidget *flutter_embedder, FlutterEmbedderCaptureCallback callback,
+    gpointer user_data);
+
+// Registers a texture drawn over the Flutter frame of |flutter_embedder|, for
+// frames from outside Flutter such as video, and returns its id. It is hidden
+// until placed, either with flutter_embedder_set_texture_rect or by the app
+// sending a map of "id", "x", "y", "width" and "height" on the
+// "flutter_embedder/textures" channel. Not drawn with
+// FLUTTER_EMBEDDER_DIRECT_RENDER.
+gint64 flutter_embedder_register_texture(GtkWidget *flutter_embedder);
+
+// Removes a texture registered with flutter_embedder_register_texture.
+void flutter_embedder_unregister_texture(GtkWidget *flutter_embedder,
+                                         gint64 texture_id);
+
+// Sets where a texture is drawn, in logical pixels from the top-left corner of
+// |flutter_embedder|. A width or height of 0 hides it.
+void flutter_embedder_set_texture_rect(GtkWidget *flutter_embedder,
+                                       gint64 texture_id, gint x, gint y,
+                                       gint width, gint height);
+
+// The textures of a flutter_embedder widget, as a handle producer threads push
+// frames through without touching the widget.
+typedef struct _FlutterEmbedderTextures FlutterEmbedderTextures;
+
+// Returns the textures of |flutter_embedder|. Must be called on the GTK
+// thread, as GTK is not thread-safe, but the handle may then be used from any
+// thread while |flutter_embedder| exists.
+FlutterEmbedderTextures *flutter_embedder_get_textures(
+    GtkWidget *flutter_embedder);
+
+// Copies a frame of RGBA pixels with straight alpha, rows |stride| bytes apart
+// from the top, to be shown on the next render. May be called from any
+// thread. Frames pushed faster than they are shown replace the one waiting.
+//
+// Returns FALSE if the frame was dropped, as all upload buffers were busy, or
+// the texture is not registered.
+gboolean flutter_embedder_push_texture_frame(FlutterEmbedderTextures *textures,
+                                             gint64 texture_id,
+                                             const guint8 *pixels, gint width,
+                                             gint height, gint stride);
+
+// Writes the trace events recorded by all widgets so far to |path|, as Chrome
+// trace JSON (viewable in chrome://tracing or Perfetto). Returns FALSE if the
+// file could not be written, or the embedder was built without
+// FLUTTER_EMBEDDER_TRACING.
+gboolean flutter_embedder_write_trace(const char *path);
+
 G_END_DECLS
 
 #endif  // LINUX_INCLUDE_FLUTTER_EMBEDDER_H_
@@ -18,15 +18,66 @@
 #include <epoxy/gl.h>
 #include <gtk/gtk.h>
 
+#include <atomic>
 #include <condition_variable>
 #include <mutex>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
+#include "blit_program_inline.h"
+#include "damage_tracker.h"
+#include "event_clock_inline.h"
 #include "flutter_engine_params_inline.h"
+#include "frame_capture.h"
+#include "frame_mailbox_inline.h"
+#include "frame_stats.h"
+#include "graphics.h"
+#include "latency_histogram_inline.h"
+#include "platform_message_dispatcher.h"
+#include "pointer_event_queue_inline.h"
+#include "pointer_resampler_inline.h"
+#include "render_target_pool.h"
+#include "resolution_governor_inline.h"
+#include "shared_memory_pool.h"
+#include "texture_registry.h"
+#include "trace.h"
+
+// A frame handed from the Flutter raster thread to the GTK thread.
+struct SwapchainFrame {
+  // Index of the swapchain render target holding the frame.
+  size_t index = 0;
+  // Signalled once the engine has finished drawing the frame.
+  GLsync ready = nullptr;
+  // Signalled once GTK has finished sampling from the render target, after
+  // which it may be drawn into again.
+  GLsync released = nullptr;
+  // The part of the render target the engine drew into, starting from its
+  // bottom-left corner.
+  int width = 0;
+  int height = 0;
+  // The resize generation the engine started the frame in. Frames from before
+  // the last resize are stretched to fit the widget.
+  uint64_t generation = 0;
+  // When the engine presented the frame, in microseconds of the monotonic
+  // clock.
+  int64_t present_time = 0;
+  // When the engine asked for the framebuffer to draw the frame into, on the
+  // same clock, or 0 if it drew into one it already had.
+  int64_t begin_time = 0;
+  // The checksums of the frame when tracking damage, being read back without
+  // blocking either thread, and once collected, the checksums themselves.
+  ChecksumReadback checksum_readback;
+  TileChecksums checksums;
+};
 
 // Handles the drawing backend and Flutter API calls for the parent GTK widget.
 class FlutterEmbedderWidgetHandler {
  public:
+  // How long the widget stays hidden before its render targets are released,
+  // unless set otherwise.
+  static constexpr int kDefaultHiddenReleaseDelayMs = 10000;
+
   FlutterEmbedderWidgetHandler(std::string main_path, std::string assets_path,
                                std::string packages_path,
                                std::string icu_data_path, int argc,
@@ -45,34 +96,397 @@ class FlutterEmbedderWidgetHandler {
   // calls, so the surrounding context is not guaranteed to be the same).
   //
   // This must be called from the GTK widget graphics context.
+  //
+  // Unless blocking on frames, this returns immediately, showing the newest
+  // frame the engine has presented, or else the last frame shown.
   bool RenderGtkWidget(GtkAllocation *allocation);
 
-  // Resizes the Flutter Drawing area, and tells the engine to redraw.
+  // Sets whether the engine draws straight into the GL area's own texture,
+  // rather than into render targets of its own that are then drawn into the GL
+  // area. Defaults to false. Must be set before InitFlutterEngine.
+  //
+  // This saves a fullscreen draw per frame and the VRAM of the render targets,
+  // but the GL area has a single buffer: the engine waits for each frame to be
+  // composited before drawing the next, and anything else repainting the
+  // window while the engine draws may show a partly drawn frame. It suits
+  // fullscreen windows showing nothing but the engine.
+  //
+  // Frames are never waited for, even when blocking on frames. Falls back to
+  // drawing into render targets if the GL contexts do not share objects, or
+  // the GL area does not draw into a texture.
+  void SetDirectRender(bool direct) { direct_render_ = direct; }
+
+  // Sets whether RenderGtkWidget waits for the engine to produce a frame when
+  // there is none to show. Defaults to false.
+  void SetBlockOnFrames(bool block) { block_on_frames_ = block; }
+
+  // The number of renders that re-showed the last frame, as the engine had no
+  // newer frame finished.
+  uint64_t stale_frame_count() const { return stale_frame_count_; }
+
+  // The number of renders that had no frame to show at all (i.e. before the
+  // first frame), and cleared the widget instead.
+  uint64_t skipped_render_count() const { return skipped_render_count_; }
+
+  // The number of renders that stretched a frame drawn before the last resize
+  // to fit the widget.
+  uint64_t stretched_frame_count() const { return stretched_frame_count_; }
+
+  // The number of frames the engine presented that GTK never picked up, as a
+  // newer frame replaced them first.
+  uint64_t dropped_frame_count() const {
+    return dropped_frame_count_.load(std::memory_order_relaxed);
+  }
+
+  // Fills in |stats| with the frame statistics collected so far.
+  //
+  // Must be called from the GTK thread.
+  void GetStats(FlutterEmbedderStats *stats);
+
+  // Sets how often the frame statistics are logged to stderr. Zero disables
+  // logging.
+  void SetStatsLogInterval(guint seconds);
+
+  // Routes platform messages between the engine and handlers registered by
+  // channel name. May be used from any thread.
+  PlatformMessageDispatcher *platform_messages() {
+    return &platform_message_dispatcher_;
+  }
+
+  // Regions of memory shared with the framework, for buffers too large to
+  // copy through platform messages. May be used from any thread.
+  SharedMemoryPool *shared_memory() { return &shared_memory_pool_; }
+
+  // Textures drawn over the Flutter frame, for frames from outside Flutter
+  // such as video. Producers may push frames from any thread. Not drawn when
+  // rendering directly, as the engine then draws straight into the GL area.
+  TextureRegistry *textures() { return &texture_registry_; }
+
+  // The capture of frames shown, which reads back each new frame rendered
+  // into the GL area. Must only be used from the GTK thread.
+  FrameCapture *frame_capture() { return &frame_capture_; }
+
+  // Resizes the Flutter Drawing area, and tells the engine to redraw. Also
+  // called when the widget's scale factor changes, e.g. on moving to another
+  // monitor.
+  //
+  // The engine is told about the new size on the next frame clock tick, so
+  // that a burst of resizes only sends it the last one. No GL work happens
+  // here: the raster thread resizes each render target as it starts drawing
+  // into it.
   void HandleResizeEvent(GtkAllocation *allocation);
 
+  // The number of times render target storage has been allocated.
+  uint64_t storage_allocation_count();
+
+  // The bytes of VRAM held by render targets, including pooled storage and
+  // the depth buffer used when rendering directly.
+  size_t render_target_bytes();
+
+  // Sets the format of the depth buffer the engine draws with:
+  // GL_DEPTH_COMPONENT24 (the default), GL_DEPTH_COMPONENT16, or GL_NONE for
+  // engines that never depth test, which saves half the VRAM of each render
+  // target. Render targets are reallocated as the engine starts its next
+  // frames.
+  //
+  // Must be called from the GTK thread.
+  void SetDepthFormat(GLenum depth_format);
+
+  // The bytes the raster thread copied from the engine's render target into
+  // the mailbox, for engines that do not ask for a new framebuffer every
+  // frame.
+  uint64_t copied_bytes() const {
+    return copied_bytes_.load(std::memory_order_relaxed);
+  }
+
+  // The GDK scale factor the engine was last told about. The engine draws at
+  // the widget's size in physical pixels, so frames are shown 1:1 (unless
+  // dynamic resolution lowers it).
+  int scale_factor() const { return engine_scale_factor_; }
+
+  // Releases everything created within the GTK widget graphics context, which
+  // is about to be destroyed.
+  //
+  // This must be called from the GTK widget graphics context.
+  void HandleUnrealizeEvent();
+
   // Sends pointer events to the Flutter Engine.
   //
-  // The pointer event is marked with the timestamp of when this function was
-  // called, so it must be called synchronously with the pointer event.
+  // The pointer event is marked with the time GDK gives |event|, converted to
+  // the monotonic clock.
+  //
+  // Events are queued and sent together on the next frame clock tick, with
+  // consecutive moves coalesced into the latest one.
   void SendFlutterPointerEventWithPhase(FlutterPointerPhase phase,
                                         GdkEvent *event);
 
+  // Handles the GL area being mapped or unmapped. While mapped, the state of
+  // its toplevel window is followed too.
+  //
+  // The widget counts as hidden while unmapped, while its window is iconified
+  // or withdrawn (which X11 window managers do to windows on other
+  // workspaces), or while the window is fully obscured (which compositing
+  // window managers never report). While hidden, frames the engine presents
+  // are dropped without being copied or rendered, the engine's raster thread
+  // is held to about a frame a second, and the framework is told the app is
+  // paused, so that it stops scheduling frames at all. Once shown
+  // again, the framework is told the app resumed, and the engine is asked for
+  // a frame straight away.
+  void HandleMapEvent(bool mapped);
+
+  // Whether the widget was visible as of the last event from GTK.
+  bool visible() const { return visible_; }
+
+  // The number of frames dropped while the widget was hidden.
+  uint64_t hidden_frame_count() const {
+    return hidden_frame_count_.load(std::memory_order_relaxed);
+  }
+
+  // Sets how long the widget stays hidden before the storage of its render
+  // targets is released, in milliseconds, or -1 to keep it. Storage is
+  // released as soon as the widget is unmapped, unless -1.
+  //
+  // Released storage is allocated again as the engine draws its first frames
+  // once shown, and nothing is shown until then. Has no effect when rendering
+  // directly, as the engine then holds no render targets of its own.
+  //
+  // Must be called from the GTK thread.
+  void SetHiddenReleaseDelay(int delay_ms);
+
+  // The number of times the storage of the render targets was released while
+  // hidden.
+  uint64_t storage_release_count() const { return storage_release_count_; }
+
+  // Handle pointer events from GTK, sending presses, moves while pressed, and
+  // releases on to the engine.
+  //
+  // Buttons are tracked per input device. The engine knows of a single
+  // pointer, which the first device to press a button drives until all of its
+  // buttons are released; other devices are ignored meanwhile.
+  void HandleButtonPressEvent(GdkEvent *event);
+  void HandleButtonReleaseEvent(GdkEvent *event);
+  void HandleMotionEvent(GdkEvent *event);
+
+  // Cancels the press the engine's pointer is in, if any, and forgets the
+  // buttons held on every device. For when releases can no longer reach the
+  // widget: its pointer grab was broken, or it was unmapped.
+  void CancelPointer();
+
+  // Sets whether the last move sent on each frame clock tick is moved to where
+  // the pointer was a few milliseconds before the frame is presented,
+  // between the last two moves received. Defaults to false.
+  //
+  // Once the pointer stops, the last move received is sent as-is on the next
+  // tick, so that the engine ends up where the pointer really is.
+  void SetResamplePointerEvents(bool resample) {
+    resample_pointer_events_ = resample;
+  }
+
+  // The number of pointer events received from GTK.
+  uint64_t pointer_event_count() const { return pointer_event_count_; }
+
+  // The number of pointer events dropped by coalescing moves.
+  uint64_t coalesced_pointer_event_count() const {
+    return pointer_events_.coalesced_count();
+  }
+
+  // The number of calls made to send pointer events to the engine.
+  uint64_t pointer_send_count() const { return pointer_send_count_; }
+
+  // Scales the resolution the engine draws at with the time it takes the
+  // engine to draw each frame, or goes back to the full resolution if
+  // |options| is null. Frames are upscaled to fit the widget with linear
+  // filtering. Has no effect when rendering directly.
+  //
+  // Must be called from the GTK thread.
+  void SetDynamicResolution(const ResolutionGovernorOptions *options);
+
+  // The resolution the engine was last told to draw at, as a fraction of the
+  // widget's size along each axis.
+  double resolution_scale() const { return engine_scale_; }
+
+  // Sets whether each frame the engine presents is checksummed tile by tile,
+  // for GTK to skip rendering frames unchanged from the one it shows, and to
+  // copy only the tiles that changed for engines that keep drawing into the
+  // same framebuffer. Defaults to false. Has no effect when rendering
+  // directly.
+  //
+  // The checksums are read back behind a fence, which GTK polls for a few
+  // milliseconds before rendering a frame regardless, so neither thread ever
+  // waits on the GPU for them. Needs GLES 3.0: it turns itself off where
+  // unsupported.
+  void SetDamageTracking(bool track) { damage_tracking_ = track; }
+
  protected:
-  // Allocates space in VRAM for the rendering buffers (different from
-  // ResizeFlutterBuffers, as that function does not generate any of the
-  // textures, or bind anything to any framebuffers).
+  // Allocates space in VRAM for the rendering buffers.
   void AllocateFlutterBuffers(GtkAllocation *allocation);
 
-  // Reallocates the Flutter rendering buffers to fit to the size of the new GTK
-  // window allocation.
-  void ResizeFlutterBuffers(GtkAllocation *allocation);
-
   // Deletes all buffers (textures/fbo/renderbuffers).
   void ReleaseRenderBuffers();
 
-  // Sends a resize event to the Flutter Engine.
+  // Reads back the frame just rendered into the GL area for |frame_capture_|
+  // if it is |new_frame|, and hands out frames read back earlier.
+  void CaptureFrame(GtkAllocation *allocation, bool new_frame);
+
+  // Takes |swapchain_m_|, tracing any time spent waiting for it.
+  std::unique_lock<std::mutex> LockSwapchain();
+
+  // Starts a new engine frame in the render target at |engine_index_|: records
+  // the size and generation the engine was last told about, and makes sure the
+  // render target fits that size.
+  //
+  // Must be called from the raster thread with |swapchain_m_| held, once
+  // nothing may be sampling from the render target anymore.
+  void BeginEngineFrame();
+
+  // Starts a new engine frame drawn directly into the GL area's texture,
+  // attaching the texture if it changed.
+  //
+  // Must be called from the raster thread with |swapchain_m_| held.
+  void BeginDirectFrame();
+
+  // Hands the frame drawn directly into the GL area's texture to GTK, and waits
+  // for GTK to composite it.
+  //
+  // Must be called from the raster thread.
+  void PresentDirectFrame();
+
+  // Renders the GTK widget area in direct rendering mode, which only needs to
+  // wait for the engine to finish drawing.
+  //
+  // Returns false if direct rendering turned out to be unsupported, in which
+  // case the widget falls back to rendering frames from the mailbox.
+  bool RenderDirectFrame(GtkAllocation *allocation);
+
+  // Lets the engine draw into the GL area's texture again once the frame
+  // rendered by RenderDirectFrame is composited. Runs on the GTK thread after
+  // each paint of the frame clock.
+  static void ReleaseDirectFrame(GdkFrameClock *frame_clock,
+                                 gpointer user_data);
+
+  // Copies the frame the engine drew into its own render target into the back
+  // frame of the mailbox. With |track_damage|, only the tiles that differ from
+  // what the back frame holds are copied.
+  //
+  // Must be called from the raster thread with |swapchain_m_| held.
+  void CopyEngineFrameToBackFrame(bool track_damage);
+
+  // Follows changes to SetDamageTracking, forgetting what the render targets
+  // hold when it changes. Returns whether damage is tracked.
+  //
+  // Must be called from the raster thread with |swapchain_m_| held.
+  bool UpdateDamageTracking();
+
+  // Checksums the frame the engine just drew, starting to read the checksums
+  // back into the back frame of the mailbox. With |copy|, the frame is also
+  // copied into the back frame as CopyEngineFrameToBackFrame does. Returns
+  // false, having turned damage tracking off, if it is unsupported.
+  //
+  // Must be called from the raster thread with |swapchain_m_| held.
+  bool ChecksumEngineFrame(bool copy);
+
+  // Reads the checksums of |frame| into it if they have arrived, recording the
+  // bytes its copy wrote and skipped. Returns false if they have yet to arrive,
+  // or none are being read back.
+  //
+  // Must be called with a context sharing the engine's current, from the
+  // thread owning |frame|.
+  bool CollectChecksums(SwapchainFrame *frame);
+
+  // When tracking damage, acquires the frame published last and returns true
+  // if GTK need not render it: either it is unchanged from the frame shown, or
+  // its checksums have yet to arrive, in which case this runs again shortly.
+  //
+  // Must be called from the GTK thread.
+  bool SkipUnchangedFrame();
+
+  // Returns true if |frame| was started at the size the engine was last told
+  // about, so that no newer frame is on its way.
+  //
+  // Must be called from the GTK thread.
+  bool IsCurrentFrame(const SwapchainFrame &frame) const;
+
+  // Sends a resize event to the Flutter Engine, for the widget to be
+  // |allocation| in size. The engine is told to draw in physical pixels, at
+  // the widget's scale factor and the current resolution scale.
   void SendFlutterEngineResizeEvent(GtkAllocation *allocation);
 
+  // Feeds the time the engine took to draw a frame to the resolution
+  // governor, and tells the engine about the new size if the scale changes.
+  //
+  // Must be called from the GTK thread.
+  void UpdateResolutionScale(int64_t frame_time_us);
+
+  // Sends the last resize event queued by HandleResizeEvent. Runs on the GTK
+  // thread on the frame clock tick after the resize.
+  static gboolean SendQueuedResizeEvent(GtkWidget *widget,
+                                        GdkFrameClock *frame_clock,
+                                        gpointer user_data);
+
+  // Sends all queued pointer events to the engine in one call.
+  void FlushPointerEvents();
+
+  // Flushes the pointer events queued by SendFlutterPointerEventWithPhase.
+  // Runs on the GTK thread on the frame clock tick after the first of them.
+  static gboolean FlushQueuedPointerEvents(GtkWidget *widget,
+                                           GdkFrameClock *frame_clock,
+                                           gpointer user_data);
+
+  // Works out whether the widget is visible, and tells the engine if that
+  // changed.
+  //
+  // Must be called from the GTK thread.
+  void UpdateVisibility();
+
+  // Follow the state of the toplevel window. Run on the GTK thread.
+  static gboolean HandleWindowStateEvent(GtkWidget *widget,
+                                         GdkEventWindowState *event,
+                                         gpointer user_data);
+  static gboolean HandleVisibilityNotifyEvent(GtkWidget *widget,
+                                              GdkEventVisibility *event,
+                                              gpointer user_data);
+
+  // Holds the raster thread for up to kHiddenFrameInterval while the widget
+  // is hidden, returning as soon as it is shown.
+  //
+  // Must be called from the raster thread.
+  void WaitWhileHidden();
+
+  // Schedules the release of the render targets' storage while hidden (see
+  // SetHiddenReleaseDelay), or cancels it once visible. A release already due
+  // sooner is kept.
+  //
+  // Must be called from the GTK thread.
+  void ScheduleStorageRelease();
+
+  // Runs the release scheduled by ScheduleStorageRelease on the GTK thread.
+  static gboolean ReleaseStorageWhileHidden(gpointer user_data);
+
+  // Releases the storage of every render target the engine cannot be drawing
+  // into, from within the GL area's context, which shares it. The frames they
+  // held are dropped. The engine is then asked for a frame, for the raster
+  // thread to call DeleteReleasedFramebuffers.
+  //
+  // Must be called from the GTK thread.
+  void ReleaseStorage();
+
+  // Deletes the framebuffers of render targets whose storage was released or
+  // replaced, which would otherwise keep it alive in the driver. With
+  // |release_engine_target|, the engine's render target is released as well,
+  // for engines that ask for a new framebuffer every frame.
+  //
+  // Must be called from the raster thread with |swapchain_m_| held, before
+  // saving the framebuffer binding, as the engine's may be deleted.
+  void DeleteReleasedFramebuffers(bool release_engine_target);
+
+  // Logs the frame statistics. Runs on the GTK thread every stats log
+  // interval.
+  static gboolean LogStats(gpointer user_data);
+
+  // Queues a render of the GL area. Runs on the GTK thread whenever
+  // |render_source_| is woken up by the raster thread.
+  static gboolean QueueRender(gpointer user_data);
+
   /////---- Flutter Engine Callbacks ----//////
   static bool FlutterMakeCurrent(void *user_data);
   static bool FlutterClearCurrent(void *user_data);
@@ -84,13 +498,76 @@ class FlutterEmbedderWidgetHandler {
  private:
   FlutterEngineParams engine_params_;
   FlutterEngine flutter_engine_;
-  GLuint flutter_engine_fbo_;
+  PlatformMessageDispatcher platform_message_dispatcher_;
+  SharedMemoryPool shared_memory_pool_;
+  TextureRegistry texture_registry_;
 
-  GLuint front_buffer_tx_;
+  // Render targets shared between the engine and GTK: one per mailbox slot,
+  // plus a spare that is only allocated for engines that keep drawing into the
+  // same framebuffer.
+  std::vector<RenderTarget> swapchain_;
+  // Frames handed from the raster thread to the GTK thread.
+  FrameMailbox<SwapchainFrame> mailbox_;
+  // Bumped by every resize of the widget. Only written by the GTK thread.
+  std::atomic<uint64_t> generation_;
 
-  // Default texture/renderbuffer to use with the Flutter Engine framebuffer.
-  GLuint flutter_tx_;
-  GLuint flutter_rb_;
+  // Guards the swapchain storage, and the size the engine was told about. Only
+  // taken by the GTK thread when telling the engine about a resize, or
+  // releasing storage while hidden, so the raster thread never contends for it
+  // otherwise.
+  std::mutex swapchain_m_;
+  // The following are guarded by |swapchain_m_|.
+  RenderTargetPool render_target_pool_;
+  // The size the engine was last told to draw at.
+  GtkAllocation engine_size_;
+  // The generation of the resize the engine was last told about.
+  uint64_t engine_generation_;
+  // The GL area's texture and its size, once GTK has handed it over for
+  // direct rendering.
+  GLuint gtk_texture_;
+  GLsizei gtk_texture_width_;
+  GLsizei gtk_texture_height_;
+  // Whether the GTK thread released storage while hidden, leaving framebuffers
+  // for the raster thread to delete.
+  bool storage_released_;
+  // The following are owned by the raster thread, but also released by the
+  // GTK thread under |swapchain_m_| while hidden, apart from the render target
+  // the engine may be drawing into and framebuffers, which belong to the
+  // engine's context.
+  // The size and generation of the frame the engine is drawing, and when it
+  // asked for the framebuffer to draw it into (0 if it did not).
+  GtkAllocation frame_size_;
+  uint64_t frame_generation_;
+  int64_t frame_begin_time_;
+  // Times the engine's drawing and the copies on the GPU. Its queries belong to
+  // the engine's context, and go away with it.
+  GpuTraceTimer present_gpu_timer_;
+  // Index of the render target most recently handed to the engine.
+  size_t engine_index_;
+  // Index of the render target not owned by any mailbox slot.
+  size_t spare_index_;
+  // Whether the engine is drawing the current frame directly into the GL
+  // area's texture.
+  bool frame_direct_;
+  // The engine's framebuffer drawing into the GL area's texture, with a depth
+  // renderbuffer of its own, and the size and format of the renderbuffer.
+  GLuint direct_fbo_;
+  GLuint direct_depth_rb_;
+  GLsizei direct_width_;
+  GLsizei direct_height_;
+  GLenum direct_depth_format_;
+  // Whether the engine has asked for a framebuffer since the last present.
+  bool back_buffer_acquired_;
+  // The number of consecutive presents preceded by a call to FlutterGetFbo.
+  // Once the engine has shown that it asks for a new framebuffer every frame,
+  // back frames are published directly instead of being copied.
+  int consecutive_acquired_presents_;
+  // Checksums frames when tracking damage, keeping the checksums of what each
+  // render target holds. Its GL objects belong to the engine's context, and go
+  // away with it.
+  DamageTracker damage_tracker_;
+  // Whether damage was tracked for the last frame presented.
+  bool damage_tracked_;
 
   // Respective OpenGL contexts (not owned).
   GdkGLContext *flutter_gl_context_;
@@ -98,8 +575,146 @@ class FlutterEmbedderWidgetHandler {
   // Instance of the GL area for pushing frames (not owned).
   GtkGLArea *gl_area_;
 
+  // Draws frames into the GL area, filtering linearly for frames drawn at a
+  // lower resolution. Created within the GTK widget graphics context on the
+  // first render.
+  BlitProgram<kBlitScale | kBlitLinear> blit_program_;
+  // Times rendering on the GPU, within the GTK widget graphics context.
+  GpuTraceTimer render_gpu_timer_;
+
+  // The resize event to send on the next frame clock tick, if
+  // |resize_tick_id_| is non-zero.
+  GtkAllocation queued_resize_;
+  guint resize_tick_id_;
+
+  // The following are only accessed from the GTK thread.
+  // Picks the resolution scale from the time frames take to draw.
+  ResolutionGovernor resolution_governor_;
+  // The size of the widget, and the resolution scale and scale factor the
+  // engine was last told about. Pointer events, which GTK gives in logical
+  // pixels, are scaled by the resulting pixel ratio.
+  GtkAllocation widget_size_;
+  double engine_scale_;
+  int engine_scale_factor_;
+  double engine_pixel_ratio_;
+
+  // Pointer events to send on the next frame clock tick, if
+  // |pointer_tick_id_| is non-zero.
+  PointerEventQueue pointer_events_;
+  guint pointer_tick_id_;
+  EventClock event_clock_;
+  PointerResampler pointer_resampler_;
+  bool resample_pointer_events_;
+  // Whether the last move sent was resampled, with no event received since.
+  bool resampled_move_sent_;
+  // The buttons held on each device, one bit per button.
+  std::unordered_map<GdkDevice *, uint32_t> pressed_buttons_;
+  // The device driving the engine's pointer, or null if none is pressed.
+  GdkDevice *pointer_device_;
+  // The timestamps of events received never go backwards from this, even when
+  // devices deliver them slightly out of order. Resampled moves fall between
+  // two of them, so they are left out.
+  int64_t last_pointer_timestamp_;
+
+  // Whether the engine draws directly into the GL area's texture (see
+  // SetDirectRender). Only cleared by the GTK thread, when falling back.
+  std::atomic<bool> direct_render_;
+  // Frames drawn directly into the GL area's texture are handed between the
+  // threads with the following, guarded by |direct_m_|.
+  std::mutex direct_m_;
+  std::condition_variable direct_cv_;
+  // Signalled once the engine has finished drawing the last frame presented.
+  GLsync direct_ready_;
+  // Signalled once GTK has finished compositing the last frame it rendered.
+  GLsync direct_released_;
+  // The number of frames presented, and whether the last one is yet to be
+  // composited.
+  uint64_t direct_frame_count_;
+  bool direct_frame_pending_;
+  int64_t direct_present_time_;
+  // The number of the last frame rendered by RenderDirectFrame.
+  uint64_t direct_frame_rendered_;
+  // The following are only accessed from the GTK thread.
+  // Whether a frame rendered by RenderDirectFrame awaits the end of the paint
+  // to be released.
+  bool direct_release_pending_;
+  // The frame clock ReleaseDirectFrame is connected to.
+  GdkFrameClock *after_paint_clock_;
+  gulong after_paint_handler_id_;
+
+  // Whether the widget is visible (see HandleMapEvent). Only written by the
+  // GTK thread, under |visibility_m_| so that WaitWhileHidden does not miss
+  // the widget being shown.
+  std::atomic<bool> visible_;
+  std::mutex visibility_m_;
+  std::condition_variable visibility_cv_;
+  std::atomic<uint64_t> hidden_frame_count_;
+  // The following are only accessed from the GTK thread. The widget is
+  // assumed visible until GTK says otherwise.
+  bool mapped_;
+  // Whether the toplevel window is iconified or withdrawn, or fully obscured.
+  bool window_hidden_;
+  bool window_obscured_;
+  // The toplevel window followed while mapped, and its signal handlers.
+  GtkWidget *toplevel_;
+  gulong window_state_handler_id_;
+  gulong visibility_handler_id_;
+  // See SetHiddenReleaseDelay. The release is scheduled with
+  // |release_source_id_|, |release_delay_ms_| from when it was scheduled.
+  int hidden_release_delay_ms_;
+  guint release_source_id_;
+  int release_delay_ms_;
+  uint64_t storage_release_count_;
+
+  // Woken up by the raster thread for every published frame, and dispatched
+  // on the GTK thread once per main loop iteration, however many frames were
+  // published in between.
+  GSource *render_source_;
+
+  // Only used when blocking on frames, for the GTK thread to wait on the
+  // raster thread.
   std::mutex frame_ready_m_;
   std::condition_variable frame_ready_cv_;
-  GLsync frame_ready_;
+  std::atomic<bool> block_on_frames_;
+  std::atomic<uint64_t> dropped_frame_count_;
+  std::atomic<uint64_t> copied_bytes_;
+  // Whether to track damage (see SetDamageTracking). Only cleared by the
+  // raster thread, where unsupported.
+  std::atomic<bool> damage_tracking_;
+  // The frames dropped for being unchanged, the bytes GTK would have rendered
+  // for them, and the bytes of copies skipped for tiles that had not changed.
+  std::atomic<uint64_t> unchanged_frame_count_;
+  std::atomic<uint64_t> skipped_render_bytes_;
+  std::atomic<uint64_t> skipped_copy_bytes_;
+  // Guards the time taken to issue the checksums of each frame, in
+  // microseconds.
+  std::mutex damage_check_time_m_;
+  LatencyHistogram damage_check_time_;
+  // Whether a texture frame was pushed since the last render, which must not
+  // be skipped then.
+  std::atomic<bool> texture_frame_pending_;
+
+  // The following are only accessed from the GTK thread.
+  FrameStats frame_stats_;
+  guint stats_log_id_;
+  FrameCapture frame_capture_;
+  uint64_t stale_frame_count_;
+  uint64_t skipped_render_count_;
+  uint64_t stretched_frame_count_;
+  uint64_t pointer_event_count_;
+  uint64_t pointer_send_count_;
+  // The checksums and generation of the frame shown, or empty if unknown.
+  TileChecksums shown_checksums_;
+  uint64_t shown_generation_;
+  // Whether the front frame of the mailbox was acquired without being
+  // rendered, by SkipUnchangedFrame or a render that timed out waiting for it.
+  bool unrendered_frame_;
+  // Whether that render timed out, in which case the frame is rendered before
+  // any newer one.
+  bool awaiting_frame_fence_;
+  // The size, in physical pixels, of the GL area when a frame from the mailbox
+  // was last rendered into it, or 0 if what it holds is unknown.
+  int rendered_width_;
+  int rendered_height_;
 };
 #endif  // LINUX_INCLUDE_FLUTTER_EMBEDDER_WIDGET_HANDLER_H_
@@ -54,11 +54,13 @@ class FlutterEngineParams {
     }
   }
 
-  // Creates a FlutterProjectArgs struct.
+  // Creates a FlutterProjectArgs struct, with platform messages from the
+  // engine going to |platform_message_callback|.
   //
   // The lifetime of this pointer must not be longer than this object, as all
   // strings are tied to this instance.
-  std::unique_ptr<FlutterProjectArgs> GetProjectArgs() {
+  std::unique_ptr<FlutterProjectArgs> GetProjectArgs(
+      FlutterPlatformMessageCallback platform_message_callback) {
     auto args = std::make_unique<FlutterProjectArgs>();
     args->struct_size = sizeof(FlutterProjectArgs);
     args->assets_path = assets_path_.c_str();
@@ -67,6 +69,7 @@ class FlutterEngineParams {
     args->icu_data_path = icu_data_path_.c_str();
     args->command_line_argc = argc_;
     args->command_line_argv = argv_;
+    args->platform_message_callback = platform_message_callback;
     return std::move(args);
   }
 
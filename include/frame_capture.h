@@ -0,0 +1,142 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef LINUX_INCLUDE_FRAME_CAPTURE_H_
+#define LINUX_INCLUDE_FRAME_CAPTURE_H_
+#include <epoxy/gl.h>
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "capture_sink.h"
+#include "latency_histogram_inline.h"
+
+// Reads frames back from the bound framebuffer without stalling the pipeline.
+//
+// Each frame is read into one of a ring of pixel pack buffers, which is only
+// mapped once its fence has signalled, a few frames later. The mapped pixels
+// are handed out without copying: to a callback on the calling thread, and to
+// a sink on a writer thread of its own, after which the buffer is unmapped and
+// reused. Frames are dropped while all buffers are in use.
+//
+// Apart from SetCallback, StartStream and StopStream, all calls must be made
+// with the same context current. Release must be called before that context
+// goes away.
+class FrameCapture {
+ public:
+  // Called with each frame read back. The pixels are only valid during the
+  // call.
+  using Callback = std::function<void(const CapturedFrame &)>;
+
+  // The number of pixel pack buffers, and so the most frames in flight.
+  static constexpr size_t kBufferCount = 4;
+
+  FrameCapture();
+  ~FrameCapture();
+
+  // Sets the callback frames are handed to, or clears it if null.
+  void SetCallback(Callback callback);
+
+  // Writes frames to |sink| on a writer thread, stopping after |max_frames|
+  // frames unless it is 0. Stops any stream already running.
+  void StartStream(std::unique_ptr<CaptureSink> sink, uint64_t max_frames);
+
+  // Stops handing frames to the sink. Frames already read back are still
+  // written, after which the sink is closed on a later call to Capture or
+  // Update.
+  void StopStream();
+
+  // Whether frames are being captured.
+  bool active() const;
+
+  // Starts reading back the |width|x|height| frame in the read framebuffer,
+  // shown at |time_us|, and hands out earlier frames that are ready. Clobbers
+  // the pixel pack buffer binding.
+  void Capture(int width, int height, int64_t time_us);
+
+  // Hands out frames that are ready, without reading back a new one.
+  void Update();
+
+  // Stops the stream, waiting for the writer to finish, and deletes the
+  // buffers.
+  void Release();
+
+  // The number of frames handed out, and dropped for want of a buffer.
+  uint64_t captured_count() const { return captured_count_; }
+  uint64_t dropped_count() const { return dropped_count_; }
+
+  // The time spent in each call to Capture while active, in nanoseconds.
+  const LatencyHistogram &capture_time() const { return capture_time_; }
+
+ private:
+  enum class State {
+    kFree,
+    // glReadPixels has been issued, and |fence| inserted after it.
+    kReading,
+    // Mapped, and queued for the writer thread until |written| is set.
+    kMapped,
+  };
+
+  struct Buffer {
+    GLuint pbo = 0;
+    GLsync fence = nullptr;
+    State state = State::kFree;
+    // The size of the buffer's storage, in bytes.
+    size_t size = 0;
+    CapturedFrame frame;
+    std::atomic<bool> written{false};
+  };
+
+  // Reads the frame into a free buffer, or drops it if there is none.
+  void ReadFrame(int width, int height, int64_t time_us);
+
+  // Maps the buffers that finished reading, in order, and hands them out.
+  void CollectFrames();
+
+  // Unmaps the buffers the writer thread is done with.
+  void ReclaimBuffers();
+
+  // Joins the writer thread once it has stopped, closing the sink.
+  void JoinStoppedWriter();
+
+  void WriterLoop();
+
+  std::array<Buffer, kBufferCount> buffers_;
+  // The buffers in kReading, oldest first.
+  std::deque<Buffer *> reading_;
+  Callback callback_;
+  uint64_t captured_count_;
+  uint64_t dropped_count_;
+  LatencyHistogram capture_time_;
+
+  // Guards the writer thread's state below.
+  mutable std::mutex writer_m_;
+  std::condition_variable writer_cv_;
+  std::thread writer_;
+  std::unique_ptr<CaptureSink> sink_;
+  std::deque<Buffer *> write_queue_;
+  // Set once the writer should stop after writing what is queued.
+  bool stopping_;
+  // Set by the writer thread once it has stopped.
+  std::atomic<bool> writer_done_;
+  // The frames the sink may still be handed, or 0 for no limit.
+  uint64_t frames_left_;
+};
+#endif  // LINUX_INCLUDE_FRAME_CAPTURE_H_
@@ -0,0 +1,110 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef LINUX_INCLUDE_FRAME_MAILBOX_INLINE_H_
+#define LINUX_INCLUDE_FRAME_MAILBOX_INLINE_H_
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// A lock-free triple buffer for handing values from a single producer thread
+// to a single consumer thread.
+//
+// The producer owns the back slot and the consumer owns the front slot. The
+// third slot holds the most recently published value, and is swapped with
+// either side's slot atomically, so neither side ever waits on the other.
+//
+// Example:
+//
+//   // Producer thread.
+//   mailbox.back() = MakeFrame();
+//   mailbox.Publish();
+//
+//   // Consumer thread.
+//   if (mailbox.Acquire()) {
+//     Show(mailbox.front());
+//   }
+template <typename T>
+class FrameMailbox {
+ public:
+  static constexpr size_t kSlotCount = 3;
+
+  FrameMailbox() : back_(0), pending_(1), front_(2) {}
+
+  // Returns the slot owned by the producer.
+  T &back() { return slots_[back_]; }
+
+  // Publishes the back slot, and hands the producer the slot it replaces.
+  //
+  // Returns true if the replaced slot had been published without ever being
+  // picked up by the consumer (i.e. its value was dropped).
+  //
+  // Must only be called from the producer thread.
+  bool Publish() {
+    uint8_t previous = pending_.exchange(static_cast<uint8_t>(back_) | kFresh,
+                                         std::memory_order_acq_rel);
+    back_ = previous & kIndexMask;
+    return (previous & kFresh) != 0;
+  }
+
+  // Returns the slot owned by the consumer.
+  T &front() { return slots_[front_]; }
+
+  // Returns true if a slot has been published since the consumer last picked
+  // one up.
+  bool HasPublished() const {
+    return (pending_.load(std::memory_order_acquire) & kFresh) != 0;
+  }
+
+  // Picks up the most recently published slot as the front slot.
+  //
+  // Returns false, leaving the front slot as-is, if nothing has been published
+  // since the last call.
+  //
+  // Must only be called from the consumer thread.
+  bool Acquire() {
+    if (!HasPublished()) {
+      return false;
+    }
+    uint8_t previous = pending_.exchange(static_cast<uint8_t>(front_),
+                                         std::memory_order_acq_rel);
+    front_ = previous & kIndexMask;
+    return true;
+  }
+
+  // Returns all slots, regardless of owner.
+  //
+  // Only for setup and teardown, or while both sides are otherwise kept from
+  // touching their slots.
+  std::array<T, kSlotCount> &slots() { return slots_; }
+
+ private:
+  static constexpr uint8_t kIndexMask = 0x3;
+  static constexpr uint8_t kFresh = 0x4;
+
+  // Padding that keeps each side's index off the cache line of |pending_|,
+  // which is the only state both sides touch.
+  static constexpr size_t kCacheLineSize = 64;
+
+  std::array<T, kSlotCount> slots_;
+  // Only accessed by the producer.
+  size_t back_;
+  char producer_padding_[kCacheLineSize];
+  // Index of the published slot, plus kFresh if it has yet to be picked up.
+  std::atomic<uint8_t> pending_;
+  char consumer_padding_[kCacheLineSize];
+  // Only accessed by the consumer.
+  size_t front_;
+};
+#endif  // LINUX_INCLUDE_FRAME_MAILBOX_INLINE_H_
@@ -0,0 +1,86 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef LINUX_INCLUDE_FRAME_STATS_H_
+#define LINUX_INCLUDE_FRAME_STATS_H_
+#include <gtk/gtk.h>
+
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <utility>
+
+#include "flutter_embedder.h"
+#include "latency_histogram_inline.h"
+
+// The times a frame reached each stage on its way to the screen, in
+// microseconds of the monotonic clock. Zero where unknown.
+struct FrameTimestamps {
+  // The engine presented the frame.
+  int64_t present = 0;
+  // The frame's fence was first seen signalled.
+  int64_t fence_signalled = 0;
+  // GTK started and finished rendering the frame.
+  int64_t render_start = 0;
+  int64_t render_end = 0;
+};
+
+// Collects latency histograms and counters for the frames shown in a widget.
+//
+// Must only be used from the GTK thread. Timestamps taken on the raster thread
+// are handed over along with the frames themselves.
+class FrameStats {
+ public:
+  FrameStats();
+
+  // Records a render of a frame, |new_frame| being whether it was the first
+  // render of that frame. The time the frame is presented on screen is looked
+  // up in |frame_clock| on later renders, once the windowing system has
+  // reported it.
+  void RecordRender(const FrameTimestamps &timestamps, bool new_frame,
+                    GdkFrameClock *frame_clock);
+
+  // Records time spent blocked waiting for the engine to present a frame, or
+  // for the GPU to finish drawing it.
+  void RecordBlocked(int64_t duration) { blocked_us_ += duration; }
+
+  // Fills in the parts of |stats| kept here.
+  void GetStats(FlutterEmbedderStats *stats) const;
+
+ private:
+  // Records the presentation time of any frames the frame clock has timings
+  // for by now.
+  void UpdatePresentationTimes(GdkFrameClock *frame_clock);
+
+  LatencyHistogram present_to_fence_signalled_;
+  LatencyHistogram present_to_render_start_;
+  LatencyHistogram present_to_render_end_;
+  LatencyHistogram present_to_presentation_;
+  LatencyHistogram render_;
+  LatencyHistogram frame_interval_;
+  uint64_t frames_shown_;
+  uint64_t blocked_us_;
+  // The render start of the last new frame.
+  int64_t last_new_frame_start_;
+  // New frames awaiting their presentation time: the frame clock counter of
+  // their render, and when the engine presented them.
+  std::deque<std::pair<int64_t, int64_t>> pending_presentations_;
+};
+
+// Copies the summary of |histogram|, in microseconds, into |latency|.
+void GetLatency(const LatencyHistogram &histogram,
+                FlutterEmbedderLatency *latency);
+
+// Logs |stats| to |log| on a single line.
+void LogFrameStats(const FlutterEmbedderStats &stats, std::ostream &log);
+#endif  // LINUX_INCLUDE_FRAME_STATS_H_
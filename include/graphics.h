@@ -17,9 +17,20 @@
 #include <epoxy/gl.h>
 #include <gtk/gtk.h>
 
+#include <iostream>
+
 static constexpr GLenum kDefaultTextureTargetBinding = GL_TEXTURE_BINDING_2D;
 static constexpr GLenum kDefaultTextureTarget = GL_TEXTURE_2D;
 
+// Whether the Flutter and GTK contexts are synchronized with fences. Define
+// FLUTTER_EMBEDDER_GL_FINISH_SYNC to fall back to draining the GPU pipeline
+// with glFinish instead.
+#ifdef FLUTTER_EMBEDDER_GL_FINISH_SYNC
+static constexpr bool kUseFenceSync = false;
+#else
+static constexpr bool kUseFenceSync = true;
+#endif
+
 // Saves the bound texture, render, and frame buffers for as long as this object
 // is in scope, then restores them when released.
 //
@@ -67,17 +78,17 @@ struct SavedBufferContextRestorer {
   GdkGLContext *context_;
 };
 
-// Allocates a texture to fit into the alloted window.
+// Allocates storage of |width|x|height| for the bound texture.
 //
 // Assumes contexts and bound textures have already been handled.
-inline void AllocateTexture(GtkAllocation *allocation) {
+inline void AllocateTexture(GLsizei width, GLsizei height) {
   GLenum target = kDefaultTextureTarget;
   glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
   glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
   glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
   glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-  glTexImage2D(target, 0, GL_RGBA8, allocation->width, allocation->height, 0,
-               GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+  glTexImage2D(target, 0, GL_RGBA8, width, height, 0, GL_RGBA,
+               GL_UNSIGNED_BYTE, NULL);
 }
 
 inline void DeleteTexture(GLuint texture) {
@@ -97,4 +108,215 @@ inline void DeleteFramebuffer(GLuint fbo) {
     glDeleteFramebuffers(1, &fbo);
   }
 }
+
+inline void DeleteProgram(GLuint program) {
+  if (program != 0) {
+    glDeleteProgram(program);
+  }
+}
+
+inline void DeleteBuffer(GLuint buffer) {
+  if (buffer != 0) {
+    glDeleteBuffers(1, &buffer);
+  }
+}
+
+inline void DeleteVertexArray(GLuint vao) {
+  if (vao != 0) {
+    glDeleteVertexArrays(1, &vao);
+  }
+}
+
+// Compiles a shader of |type| from |source|.
+//
+// Returns 0 (after logging the reason) if compilation failed.
+inline GLuint CompileShader(GLenum type, const char *source) {
+  GLuint shader = glCreateShader(type);
+  glShaderSource(shader, 1, &source, nullptr);
+  glCompileShader(shader);
+  GLint status = GL_FALSE;
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+  if (status != GL_TRUE) {
+    GLchar log[1024] = {};
+    glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+    std::cerr << "Unable to compile shader: " << log << std::endl;
+    glDeleteShader(shader);
+    return 0;
+  }
+  return shader;
+}
+
+// Links a program from the given shaders, binding |attribute| to location 0.
+//
+// The shaders are deleted either way. Returns 0 (after logging the reason) if
+// either shader is 0, or linking failed.
+inline GLuint LinkProgram(GLuint vertex_shader, GLuint fragment_shader,
+                          const char *attribute) {
+  GLuint program = 0;
+  if (vertex_shader != 0 && fragment_shader != 0) {
+    program = glCreateProgram();
+    glAttachShader(program, vertex_shader);
+    glAttachShader(program, fragment_shader);
+    glBindAttribLocation(program, 0, attribute);
+    glLinkProgram(program);
+    GLint status = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if (status != GL_TRUE) {
+      GLchar log[1024] = {};
+      glGetProgramInfoLog(program, sizeof(log), nullptr, log);
+      std::cerr << "Unable to link program: " << log << std::endl;
+      glDeleteProgram(program);
+      program = 0;
+    }
+  }
+  if (vertex_shader != 0) {
+    glDeleteShader(vertex_shader);
+  }
+  if (fragment_shader != 0) {
+    glDeleteShader(fragment_shader);
+  }
+  return program;
+}
+
+inline void DeleteSync(GLsync sync) {
+  if (sync != nullptr) {
+    glDeleteSync(sync);
+  }
+}
+
+// Returns a fence following all commands issued so far in the current context.
+//
+// The commands are flushed so that other contexts may wait on the fence.
+inline GLsync InsertFence() {
+  GLsync sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  glFlush();
+  return sync;
+}
+
+// Makes the GPU wait for |sync| before executing any commands subsequently
+// issued in the current context. Does not block the calling thread.
+inline void GpuWaitFence(GLsync sync) {
+  if (sync != nullptr) {
+    glWaitSync(sync, 0, GL_TIMEOUT_IGNORED);
+  }
+}
+
+// Returns true if |sync| has signalled, without waiting for it.
+inline bool IsFenceSignalled(GLsync sync) {
+  if (sync == nullptr) {
+    return true;
+  }
+  GLint status = GL_UNSIGNALED;
+  glGetSynciv(sync, GL_SYNC_STATUS, 1, nullptr, &status);
+  return status == GL_SIGNALED;
+}
+
+// Blocks the calling thread until |sync| signals or |timeout_ns| elapses.
+//
+// Returns false if the wait timed out or failed.
+inline bool ClientWaitFence(GLsync sync, GLuint64 timeout_ns) {
+  if (sync == nullptr) {
+    return true;
+  }
+  GLenum result =
+      glClientWaitSync(sync, GL_SYNC_FLUSH_COMMANDS_BIT, timeout_ns);
+  return result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED;
+}
+
+// A color texture and depth renderbuffer attached to a framebuffer.
+//
+// Framebuffers are not shared between GL contexts, so the framebuffer must be
+// created and attached within the context that will render to it. The texture
+// and renderbuffer (the storage) are shared, and may be swapped out from any
+// context in the share group, after which the target must be re-attached.
+struct RenderTarget {
+  GLuint fbo = 0;
+  GLuint texture = 0;
+  GLuint depth_rb = 0;
+  // The format of the depth renderbuffer, or GL_NONE if there is none.
+  GLenum depth_format = GL_NONE;
+  // The size of the storage, which may be larger than what is drawn into it.
+  GLsizei width = 0;
+  GLsizei height = 0;
+  // Whether the storage is what is attached to the framebuffer.
+  bool attached = false;
+};
+
+// Generates storage of |width|x|height| for |target|, with a depth
+// renderbuffer of |depth_format| unless it is GL_NONE.
+//
+// Assumes contexts have already been handled, and clobbers the texture and
+// renderbuffer bindings.
+inline void AllocateRenderTargetStorage(RenderTarget *target, GLsizei width,
+                                        GLsizei height, GLenum depth_format) {
+  glGenTextures(1, &target->texture);
+  glBindTexture(kDefaultTextureTarget, target->texture);
+  AllocateTexture(width, height);
+  if (depth_format != GL_NONE) {
+    glGenRenderbuffers(1, &target->depth_rb);
+    glBindRenderbuffer(GL_RENDERBUFFER, target->depth_rb);
+    glRenderbufferStorage(GL_RENDERBUFFER, depth_format, width, height);
+  }
+  target->depth_format = depth_format;
+  target->width = width;
+  target->height = height;
+  target->attached = false;
+}
+
+// Returns the bytes per pixel of a depth renderbuffer of |depth_format|.
+// Drivers pad 24-bit depth to 4 bytes.
+inline size_t GetDepthBytesPerPixel(GLenum depth_format) {
+  switch (depth_format) {
+    case GL_NONE:
+      return 0;
+    case GL_DEPTH_COMPONENT16:
+      return 2;
+    default:
+      return 4;
+  }
+}
+
+// Returns the bytes of VRAM held by the storage of |target|: RGBA8 color and
+// its depth buffer, if any.
+inline size_t GetRenderTargetStorageBytes(const RenderTarget &target) {
+  if (target.texture == 0) {
+    return 0;
+  }
+  return static_cast<size_t>(target.width) * target.height *
+         (4 + GetDepthBytesPerPixel(target.depth_format));
+}
+
+inline void ReleaseRenderTargetStorage(RenderTarget *target) {
+  DeleteTexture(target->texture);
+  DeleteRenderbuffer(target->depth_rb);
+  target->texture = 0;
+  target->depth_rb = 0;
+  target->depth_format = GL_NONE;
+  target->width = 0;
+  target->height = 0;
+  target->attached = false;
+}
+
+// Attaches the storage of |target| to its framebuffer, generating the
+// framebuffer first if needed.
+//
+// Assumes the context that renders to |target| is current, and clobbers the
+// framebuffer binding.
+inline void AttachRenderTarget(RenderTarget *target) {
+  if (target->fbo == 0) {
+    glGenFramebuffers(1, &target->fbo);
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, target->fbo);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                         kDefaultTextureTarget, target->texture, 0);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                            GL_RENDERBUFFER, target->depth_rb);
+  target->attached = true;
+}
+
+inline void ReleaseRenderTarget(RenderTarget *target) {
+  DeleteFramebuffer(target->fbo);
+  ReleaseRenderTargetStorage(target);
+  *target = RenderTarget();
+}
 #endif  // LINUX_INCLUDE_GRAPHICS_H_
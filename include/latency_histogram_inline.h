@@ -0,0 +1,113 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef LINUX_INCLUDE_LATENCY_HISTOGRAM_INLINE_H_
+#define LINUX_INCLUDE_LATENCY_HISTOGRAM_INLINE_H_
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// A histogram of durations with a fixed relative precision, in the manner of
+// HdrHistogram: values are bucketed by power of two, and each power of two is
+// split into kSubBucketCount linear sub-buckets. Values are recorded in
+// constant time without allocating, and percentiles are accurate to within
+// 1 / kSubBucketCount of the true value.
+//
+// Not thread-safe.
+//
+// Example:
+//
+//   LatencyHistogram histogram;
+//   histogram.Record(end_us - start_us);
+//   uint64_t p99 = histogram.Percentile(99.0);
+class LatencyHistogram {
+ public:
+  static constexpr size_t kSubBucketBits = 4;
+  static constexpr size_t kSubBucketCount = 1 << kSubBucketBits;
+
+  LatencyHistogram() { Reset(); }
+
+  // Records |value|, clamping negative values to 0.
+  void Record(int64_t value) {
+    uint64_t v = value > 0 ? static_cast<uint64_t>(value) : 0;
+    ++counts_[BucketIndex(v)];
+    ++count_;
+    sum_ += v;
+    if (v > max_) {
+      max_ = v;
+    }
+  }
+
+  void Reset() {
+    counts_.fill(0);
+    count_ = 0;
+    sum_ = 0;
+    max_ = 0;
+  }
+
+  uint64_t count() const { return count_; }
+  uint64_t max() const { return max_; }
+  uint64_t mean() const { return count_ > 0 ? sum_ / count_ : 0; }
+
+  // Returns the smallest value that |percentile| percent of the recorded values
+  // are at most (to within the precision of the buckets), or 0 if nothing was
+  // recorded.
+  uint64_t Percentile(double percentile) const {
+    if (count_ == 0) {
+      return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(percentile / 100.0 * count_ + 0.5);
+    rank = rank < 1 ? 1 : (rank > count_ ? count_ : rank);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts_.size(); ++i) {
+      seen += counts_[i];
+      if (seen >= rank) {
+        uint64_t upper = BucketUpperBound(i);
+        return upper < max_ ? upper : max_;
+      }
+    }
+    return max_;
+  }
+
+ private:
+  // Values below kSubBucketCount each get their own bucket. Each power of two
+  // above that is split into kSubBucketCount buckets.
+  static constexpr size_t kBucketCount = (64 - kSubBucketBits + 1) *
+                                         kSubBucketCount;
+
+  static size_t BucketIndex(uint64_t value) {
+    if (value < kSubBucketCount) {
+      return static_cast<size_t>(value);
+    }
+    size_t magnitude = 63 - __builtin_clzll(value);
+    size_t shift = magnitude - kSubBucketBits;
+    size_t sub_bucket = static_cast<size_t>(value >> shift) - kSubBucketCount;
+    return (shift + 1) * kSubBucketCount + sub_bucket;
+  }
+
+  // Returns the largest value that falls into bucket |index|.
+  static uint64_t BucketUpperBound(size_t index) {
+    if (index < kSubBucketCount) {
+      return index;
+    }
+    size_t shift = index / kSubBucketCount - 1;
+    uint64_t sub_bucket = index % kSubBucketCount + kSubBucketCount;
+    return ((sub_bucket + 1) << shift) - 1;
+  }
+
+  std::array<uint64_t, kBucketCount> counts_;
+  uint64_t count_;
+  uint64_t sum_;
+  uint64_t max_;
+};
+#endif  // LINUX_INCLUDE_LATENCY_HISTOGRAM_INLINE_H_
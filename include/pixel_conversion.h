@@ -0,0 +1,44 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef LINUX_INCLUDE_PIXEL_CONVERSION_H_
+#define LINUX_INCLUDE_PIXEL_CONVERSION_H_
+#include <cstddef>
+#include <cstdint>
+
+// Conversions of RGBA8 images, as read back from GL, into the layouts video
+// and image encoders expect. SSE2 is used where available, with scalar code
+// elsewhere; both give identical results.
+//
+// Source rows are |src_stride| bytes apart, which may be negative to flip the
+// image vertically (GL reads images bottom row first).
+
+// Converts |width|x|height| RGBA pixels into tightly packed BGRA pixels.
+void ConvertRgbaToBgra(const uint8_t *src, ptrdiff_t src_stride, int width,
+                       int height, uint8_t *dst);
+
+// Converts |width|x|height| RGBA pixels with premultiplied alpha, as GL draws
+// them, into tightly packed RGBA pixels with straight alpha, as image files
+// hold them. Fully transparent pixels become transparent black.
+void ConvertRgbaToStraightAlpha(const uint8_t *src, ptrdiff_t src_stride,
+                                int width, int height, uint8_t *dst);
+
+// Converts |width|x|height| RGBA pixels into planar YUV 4:2:0 (I420), using
+// full range BT.601 coefficients (as JPEG does). Chroma is averaged over each
+// 2x2 block of pixels.
+//
+// The planes are tightly packed: |y| holds width*height bytes, and |u| and |v|
+// each hold ((width+1)/2)*((height+1)/2) bytes.
+void ConvertRgbaToI420(const uint8_t *src, ptrdiff_t src_stride, int width,
+                       int height, uint8_t *y, uint8_t *u, uint8_t *v);
+#endif  // LINUX_INCLUDE_PIXEL_CONVERSION_H_
@@ -0,0 +1,173 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef LINUX_INCLUDE_PLATFORM_MESSAGE_DISPATCHER_H_
+#define LINUX_INCLUDE_PLATFORM_MESSAGE_DISPATCHER_H_
+#include "embedder.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "latency_histogram_inline.h"
+
+// A platform message received from the engine. The data is only valid while
+// the handler runs.
+struct PlatformMessage {
+  const char *channel;
+  const uint8_t *data;
+  size_t size;
+};
+
+class PlatformMessageDispatcher;
+
+// The response to a platform message, sent through the engine at most once.
+//
+// Responses may be moved anywhere and sent from any thread. A response that is
+// never sent is sent empty when destroyed, which the framework takes to mean
+// the message was not handled; the engine leaks messages left unanswered.
+class PlatformMessageResponse {
+ public:
+  PlatformMessageResponse(PlatformMessageResponse &&other);
+  PlatformMessageResponse &operator=(PlatformMessageResponse &&other);
+  ~PlatformMessageResponse();
+
+  // Sends |size| bytes at |data| as the response. Does nothing if the message
+  // expects no response, a response was already sent, or the engine has shut
+  // down.
+  void Send(const uint8_t *data, size_t size);
+
+ private:
+  friend class PlatformMessageDispatcher;
+  struct Engine;
+  struct Channel;
+
+  PlatformMessageResponse(std::shared_ptr<Engine> engine,
+                          std::shared_ptr<Channel> channel,
+                          const FlutterPlatformMessageResponseHandle *handle,
+                          int64_t received_us);
+
+  std::shared_ptr<Engine> engine_;
+  std::shared_ptr<Channel> channel_;
+  const FlutterPlatformMessageResponseHandle *handle_;
+  int64_t received_us_;
+};
+
+// Handles a message, responding now or later through |response|.
+using PlatformMessageHandler =
+    std::function<void(const PlatformMessage &message,
+                        PlatformMessageResponse response)>;
+
+struct PlatformChannelOptions {
+  // Whether the handler runs on the dispatcher's worker threads, rather than
+  // inline on the thread the engine delivers messages on (the GTK thread).
+  // Each channel's messages are handled one at a time, in order, so a slow
+  // channel only ever holds up a single worker.
+  bool use_worker_pool = false;
+  // The most messages a worker pool channel queues. Messages beyond this are
+  // answered empty straight away, and counted as rejected.
+  size_t max_pending = 64;
+};
+
+struct PlatformChannelStats {
+  uint64_t received = 0;
+  // Messages answered empty as the channel's queue was full.
+  uint64_t rejected = 0;
+  // Messages queued for the worker pool, and the most that ever were.
+  size_t pending = 0;
+  size_t max_pending = 0;
+  // In microseconds: from receipt to the handler starting, the time the
+  // handler ran for, and from receipt to the response being sent.
+  LatencyHistogram queue_time;
+  LatencyHistogram handle_time;
+  LatencyHistogram response_time;
+};
+
+// Routes platform messages from the engine to handlers registered by channel
+// name, and sends messages to the engine.
+//
+// All methods may be called from any thread.
+class PlatformMessageDispatcher {
+ public:
+  // |worker_count| is the number of threads worker pool channels share. The
+  // threads are only started once such a channel is registered.
+  explicit PlatformMessageDispatcher(size_t worker_count);
+  ~PlatformMessageDispatcher();
+
+  // Sets the engine responses and messages are sent to, once it runs.
+  void SetEngine(FlutterEngine engine);
+
+  // Stops the worker threads, answering any queued messages empty, and stops
+  // sending to the engine. Must be called before the engine shuts down.
+  void Shutdown();
+
+  // Sets the handler of |channel|, replacing any previous one. A null handler
+  // removes the channel, answering its queued messages empty.
+  void SetHandler(const std::string &channel, PlatformMessageHandler handler,
+                  const PlatformChannelOptions &options);
+  void SetHandler(const std::string &channel, PlatformMessageHandler handler) {
+    SetHandler(channel, std::move(handler), PlatformChannelOptions());
+  }
+
+  // Handles |message| from the engine: inline, queued for the worker pool, or
+  // answered empty if no handler is registered for its channel.
+  void Dispatch(const FlutterPlatformMessage *message);
+
+  // Sends |size| bytes at |data| to the framework on |channel|. Returns false
+  // if the engine is not running or rejected the message.
+  bool Send(const std::string &channel, const uint8_t *data, size_t size);
+
+  // Fills in |stats| for |channel|. Returns false if it has no handler.
+  bool GetChannelStats(const std::string &channel, PlatformChannelStats *stats);
+
+  // The number of messages received for channels with no handler.
+  uint64_t unhandled_count();
+
+ private:
+  using Engine = PlatformMessageResponse::Engine;
+  using Channel = PlatformMessageResponse::Channel;
+
+  // Runs |handler| with |message| on the calling thread, recording how long
+  // it waited and ran for in |channel|'s stats.
+  static void RunHandler(Channel *channel,
+                         const PlatformMessageHandler &handler,
+                         const PlatformMessage &message,
+                         PlatformMessageResponse response,
+                         int64_t received_us);
+
+  void WorkerLoop();
+
+  std::shared_ptr<Engine> engine_;
+  const size_t worker_count_;
+
+  // Guards everything below, and the channels' state.
+  std::mutex m_;
+  std::condition_variable work_cv_;
+  std::unordered_map<std::string, std::shared_ptr<Channel>> channels_;
+  // Reused to look up channels without allocating.
+  std::string lookup_key_;
+  // Worker pool channels with queued messages and no worker running them,
+  // in the order they became ready.
+  std::deque<std::shared_ptr<Channel>> ready_;
+  std::vector<std::thread> workers_;
+  bool stopping_;
+  uint64_t unhandled_count_;
+};
+#endif  // LINUX_INCLUDE_PLATFORM_MESSAGE_DISPATCHER_H_
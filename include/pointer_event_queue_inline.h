@@ -0,0 +1,76 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef LINUX_INCLUDE_POINTER_EVENT_QUEUE_INLINE_H_
+#define LINUX_INCLUDE_POINTER_EVENT_QUEUE_INLINE_H_
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "embedder.h"
+
+// A fixed-size queue of pointer events, gathered so that they can be sent to
+// the engine in a single call.
+//
+// Consecutive moves are coalesced into the latest one, as the engine only needs
+// the newest position between two presses or releases. Presses and releases
+// are kept in the order they were queued.
+//
+// Example:
+//
+//   if (!queue.Push(event)) {
+//     Send(queue.data(), queue.size());
+//     queue.Clear();
+//     queue.Push(event);
+//   }
+class PointerEventQueue {
+ public:
+  static constexpr size_t kCapacity = 128;
+
+  PointerEventQueue() : size_(0), coalesced_count_(0) {}
+
+  // Queues |event|, replacing the last queued event if both are moves.
+  //
+  // Returns false, queueing nothing, if the queue is full.
+  bool Push(const FlutterPointerEvent &event) {
+    if (size_ > 0 && event.phase == kMove &&
+        events_[size_ - 1].phase == kMove) {
+      events_[size_ - 1] = event;
+      ++coalesced_count_;
+      return true;
+    }
+    if (size_ == kCapacity) {
+      return false;
+    }
+    events_[size_++] = event;
+    return true;
+  }
+
+  const FlutterPointerEvent *data() const { return events_.data(); }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  // Returns the last queued event. The queue must not be empty.
+  FlutterPointerEvent &back() { return events_[size_ - 1]; }
+
+  void Clear() { size_ = 0; }
+
+  // The number of moves that were replaced by a later one.
+  uint64_t coalesced_count() const { return coalesced_count_; }
+
+ private:
+  std::array<FlutterPointerEvent, kCapacity> events_;
+  size_t size_;
+  uint64_t coalesced_count_;
+};
+#endif  // LINUX_INCLUDE_POINTER_EVENT_QUEUE_INLINE_H_
@@ -0,0 +1,86 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef LINUX_INCLUDE_POINTER_RESAMPLER_INLINE_H_
+#define LINUX_INCLUDE_POINTER_RESAMPLER_INLINE_H_
+#include <cstdint>
+
+#include "embedder.h"
+
+// Moves pointer positions to where the pointer was at a given time, from the
+// last two moves received.
+//
+// Input devices and the display refresh at unrelated rates, so the pointer
+// moves an uneven distance between frames. Sampling it a fixed latency before
+// each frame's presentation time instead evens this out.
+//
+// Positions are only interpolated between moves received, never extrapolated
+// past the last one, so that a resampled move is never ahead of the pointer,
+// and its timestamp falls between those of the moves around it.
+class PointerResampler {
+ public:
+  // How long before the presentation time the pointer is sampled. Most
+  // devices report moves at least this often, so the time usually falls
+  // between the last two.
+  static constexpr int64_t kResampleLatencyUs = 5 * 1000;
+
+  PointerResampler() : previous_(), latest_(), sample_count_(0) {}
+
+  // Records a move as received, before any resampling.
+  void AddSample(const FlutterPointerEvent &event) {
+    previous_ = latest_;
+    latest_ = event;
+    if (sample_count_ < 2) {
+      ++sample_count_;
+    }
+  }
+
+  // Forgets all moves, e.g. once the pointer is released.
+  void Reset() { sample_count_ = 0; }
+
+  // Whether a move was added since the last reset.
+  bool has_sample() const { return sample_count_ > 0; }
+
+  // The last move added, as received. Only valid if has_sample().
+  const FlutterPointerEvent &latest() const { return latest_; }
+
+  // Moves |event|, which must be the last move added, to where the pointer was
+  // kResampleLatencyUs before |presentation_time_us|.
+  //
+  // Returns false, leaving |event| as-is, if too few moves have been received,
+  // or the time is not strictly between the last two moves.
+  bool Resample(FlutterPointerEvent *event,
+                int64_t presentation_time_us) const {
+    if (sample_count_ < 2) {
+      return false;
+    }
+    int64_t latest_time = latest_.timestamp;
+    int64_t previous_time = previous_.timestamp;
+    int64_t time_us = presentation_time_us - kResampleLatencyUs;
+    if (time_us <= previous_time || time_us >= latest_time) {
+      return false;
+    }
+    double t = static_cast<double>(time_us - previous_time) /
+               (latest_time - previous_time);
+    event->x = previous_.x + (latest_.x - previous_.x) * t;
+    event->y = previous_.y + (latest_.y - previous_.y) * t;
+    event->timestamp = time_us;
+    return true;
+  }
+
+ private:
+  FlutterPointerEvent previous_;
+  FlutterPointerEvent latest_;
+  int sample_count_;
+};
+#endif  // LINUX_INCLUDE_POINTER_RESAMPLER_INLINE_H_
@@ -0,0 +1,75 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef LINUX_INCLUDE_RENDER_TARGET_BUCKETS_INLINE_H_
+#define LINUX_INCLUDE_RENDER_TARGET_BUCKETS_INLINE_H_
+#include <cstddef>
+#include <cstdint>
+
+// The sizes RenderTargetPool allocates storage at, and which storage it can
+// reuse for a size. Kept apart from the pool, which needs GL, so that they can
+// be tested on their own.
+//
+// Example:
+//
+//   size_t index = RenderTargetBuckets::FindReusable(pool, width, height,
+//                                                    depth_format);
+//   if (index == pool.size()) {
+//     Allocate(RenderTargetBuckets::RoundUp(width),
+//              RenderTargetBuckets::RoundUp(height));
+//   }
+class RenderTargetBuckets {
+ public:
+  // Storage dimensions are rounded up to multiples of this.
+  static constexpr int kBucketSize = 128;
+
+  // Returns |size| rounded up to its bucket.
+  static int RoundUp(int size) {
+    if (size <= 0) {
+      return kBucketSize;
+    }
+    return (size + kBucketSize - 1) / kBucketSize * kBucketSize;
+  }
+
+  // Returns true if storage of |storage_width|x|storage_height| can be drawn
+  // into at |width|x|height| without wasting more than half of it.
+  static bool Fits(int storage_width, int storage_height, int width,
+                   int height) {
+    if (storage_width < width || storage_height < height) {
+      return false;
+    }
+    int64_t needed = static_cast<int64_t>(RoundUp(width)) * RoundUp(height);
+    return static_cast<int64_t>(storage_width) * storage_height <= 2 * needed;
+  }
+
+  // Returns the index of the first entry of |storage| that fits
+  // |width|x|height| and has a depth buffer of |depth_format|, or
+  // storage.size() if none does and new storage has to be allocated.
+  //
+  // |Storage| is a container of entries with |width|, |height| and
+  // |depth_format| members, e.g. RenderTarget.
+  template <typename Storage>
+  static size_t FindReusable(const Storage &storage, int width, int height,
+                             unsigned int depth_format) {
+    size_t index = 0;
+    for (const auto &entry : storage) {
+      if (entry.depth_format == depth_format &&
+          Fits(entry.width, entry.height, width, height)) {
+        break;
+      }
+      ++index;
+    }
+    return index;
+  }
+};
+#endif  // LINUX_INCLUDE_RENDER_TARGET_BUCKETS_INLINE_H_
@@ -0,0 +1,73 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef LINUX_INCLUDE_RENDER_TARGET_POOL_H_
+#define LINUX_INCLUDE_RENDER_TARGET_POOL_H_
+#include <epoxy/gl.h>
+
+#include <cstdint>
+#include <deque>
+
+#include "graphics.h"
+#include "render_target_buckets_inline.h"
+
+// Hands out render target storage in sizes rounded up to coarse buckets (see
+// RenderTargetBuckets), and keeps storage that was swapped out around for
+// reuse.
+//
+// This way, resizing a widget only reallocates when crossing a bucket, and
+// going back and forth between two sizes (e.g. maximizing) reallocates nothing.
+//
+// All calls must be made with a context of the share group current.
+class RenderTargetPool {
+ public:
+  // |capacity| is the number of storage entries kept for reuse.
+  explicit RenderTargetPool(size_t capacity);
+  ~RenderTargetPool();
+
+  // Returns true if the storage of |target| can be drawn into at
+  // |width|x|height| without wasting more than half of it, and has the depth
+  // buffer that storage is handed out with.
+  bool Fits(const RenderTarget &target, GLsizei width, GLsizei height) const;
+
+  // Sets the format of the depth renderbuffer storage is handed out with:
+  // GL_DEPTH_COMPONENT24 (the default), GL_DEPTH_COMPONENT16, or GL_NONE for
+  // none. Storage with another depth buffer is replaced as it is reserved.
+  void SetDepthFormat(GLenum depth_format) { depth_format_ = depth_format; }
+  GLenum depth_format() const { return depth_format_; }
+
+  // Ensures |target| has storage that fits |width|x|height|, by keeping its
+  // own, swapping it for pooled storage, or else allocating new storage.
+  //
+  // Returns true if the storage changed, in which case the target has to be
+  // re-attached before it is drawn into. Clobbers the texture and renderbuffer
+  // bindings.
+  bool Reserve(RenderTarget *target, GLsizei width, GLsizei height);
+
+  // Deletes all pooled storage.
+  void Clear();
+
+  // The number of times storage has been allocated.
+  uint64_t allocation_count() const { return allocation_count_; }
+
+  // The bytes of VRAM held by the pooled storage.
+  size_t memory_bytes() const;
+
+ private:
+  size_t capacity_;
+  // Storage only: none of these have a framebuffer. Most recently used first.
+  std::deque<RenderTarget> pool_;
+  GLenum depth_format_;
+  uint64_t allocation_count_;
+};
+#endif  // LINUX_INCLUDE_RENDER_TARGET_POOL_H_
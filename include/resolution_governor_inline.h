@@ -0,0 +1,175 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef LINUX_INCLUDE_RESOLUTION_GOVERNOR_INLINE_H_
+#define LINUX_INCLUDE_RESOLUTION_GOVERNOR_INLINE_H_
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+struct ResolutionGovernorOptions {
+  // The bounds of the scale, as a fraction of the full resolution along each
+  // axis, and how far it moves at a time.
+  double min_scale = 0.5;
+  double max_scale = 1.0;
+  double step = 0.125;
+  // The time each frame has, or 0 to follow the display's refresh interval.
+  int64_t frame_budget_us = 0;
+  // The resolution shrinks once the 90th percentile frame time goes over this
+  // fraction of the budget, and grows back once it stays under the grow
+  // fraction for |grow_windows| windows in a row.
+  double shrink_threshold = 0.9;
+  double grow_threshold = 0.6;
+  // The frames measured before each decision.
+  int window_frames = 30;
+  int grow_windows = 3;
+};
+
+// Picks the resolution the engine draws at from the time it takes to draw
+// frames, trading sharpness for frame rate when the GPU cannot keep up.
+//
+// Frame time is assumed to scale with the number of pixels drawn, i.e. with
+// the square of the scale. Shrinking jumps as many steps as that predicts it
+// takes to get back under the budget, while growing takes one step at a time,
+// and only if the frame time predicted at the larger scale stays under the
+// shrink threshold, so that the scale does not flip back and forth.
+class ResolutionGovernor {
+ public:
+  // The 90th percentile of each window is what the thresholds apply to, so
+  // that an odd slow frame does not shrink the resolution.
+  static constexpr double kPercentile = 0.9;
+
+  // The budget used before the display's refresh interval is known.
+  static constexpr int64_t kDefaultFrameBudgetUs = 16667;
+
+  ResolutionGovernor()
+      : enabled_(false), scale_(1.0), good_windows_(0), change_count_(0) {}
+
+  // Starts governing with |options|, starting from the largest scale. Out of
+  // range options are clamped.
+  void Enable(const ResolutionGovernorOptions &options) {
+    options_ = options;
+    options_.max_scale = std::min(std::max(options_.max_scale, 0.01), 1.0);
+    options_.min_scale =
+        std::min(std::max(options_.min_scale, 0.01), options_.max_scale);
+    options_.step = std::max(options_.step, 0.01);
+    options_.grow_threshold =
+        std::min(options_.grow_threshold, options_.shrink_threshold);
+    options_.window_frames = std::max(options_.window_frames, 1);
+    options_.grow_windows = std::max(options_.grow_windows, 1);
+    enabled_ = true;
+    SetScale(options_.max_scale);
+  }
+
+  // Stops governing, going back to the full resolution.
+  void Disable() {
+    enabled_ = false;
+    SetScale(1.0);
+  }
+
+  bool enabled() const { return enabled_; }
+
+  // The current scale, as a fraction of the full resolution along each axis.
+  double scale() const { return scale_; }
+
+  // The number of times the scale changed.
+  uint64_t change_count() const { return change_count_; }
+
+  // Forgets the frames measured so far, e.g. once the frames to come are drawn
+  // at another size.
+  void Reset() {
+    frame_times_.clear();
+    good_windows_ = 0;
+  }
+
+  // Records the time taken by a frame drawn at the current scale.
+  // |refresh_interval_us| is the budget when the options do not set one, or 0
+  // if unknown.
+  //
+  // Returns true if the scale changed, in which case the frames measured so
+  // far are forgotten.
+  bool AddFrameTime(int64_t frame_time_us, int64_t refresh_interval_us) {
+    if (!enabled_) {
+      return false;
+    }
+    frame_times_.push_back(frame_time_us);
+    if (frame_times_.size() < static_cast<size_t>(options_.window_frames)) {
+      return false;
+    }
+    auto percentile = frame_times_.begin() +
+                      static_cast<size_t>(frame_times_.size() * kPercentile);
+    if (percentile == frame_times_.end()) {
+      --percentile;
+    }
+    std::nth_element(frame_times_.begin(), percentile, frame_times_.end());
+    double frame_time = std::max<double>(*percentile, 1.0);
+    frame_times_.clear();
+
+    int64_t budget = options_.frame_budget_us;
+    if (budget <= 0) {
+      budget = refresh_interval_us;
+    }
+    if (budget <= 0) {
+      budget = kDefaultFrameBudgetUs;
+    }
+    double shrink_time = budget * options_.shrink_threshold;
+    if (frame_time > shrink_time) {
+      good_windows_ = 0;
+      if (scale_ <= options_.min_scale) {
+        return false;
+      }
+      double target = scale_ * std::sqrt(shrink_time / frame_time);
+      double steps = std::ceil((scale_ - target) / options_.step);
+      return SetScale(std::max(scale_ - std::max(steps, 1.0) * options_.step,
+                               options_.min_scale));
+    }
+    if (frame_time >= budget * options_.grow_threshold ||
+        scale_ >= options_.max_scale) {
+      good_windows_ = 0;
+      return false;
+    }
+    if (++good_windows_ < options_.grow_windows) {
+      return false;
+    }
+    good_windows_ = 0;
+    double next = std::min(scale_ + options_.step, options_.max_scale);
+    double ratio = next / scale_;
+    if (frame_time * ratio * ratio >= shrink_time) {
+      return false;
+    }
+    return SetScale(next);
+  }
+
+ private:
+  // Moves to |scale|, returning whether it changed.
+  bool SetScale(double scale) {
+    Reset();
+    if (scale == scale_) {
+      return false;
+    }
+    scale_ = scale;
+    ++change_count_;
+    return true;
+  }
+
+  ResolutionGovernorOptions options_;
+  bool enabled_;
+  double scale_;
+  // The frame times of the current window.
+  std::vector<int64_t> frame_times_;
+  // The windows in a row with room to grow.
+  int good_windows_;
+  uint64_t change_count_;
+};
+#endif  // LINUX_INCLUDE_RESOLUTION_GOVERNOR_INLINE_H_
@@ -0,0 +1,116 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef LINUX_INCLUDE_SHARED_MEMORY_POOL_H_
+#define LINUX_INCLUDE_SHARED_MEMORY_POOL_H_
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "platform_message_dispatcher.h"
+#include "standard_message_codec.h"
+
+// The channel the framework releases shared regions on, sending the id of the
+// region as a standard codec integer. Messages sent from the embedder get no
+// response, so this is how the framework says it is done reading.
+constexpr char kSharedMemoryReleaseChannel[] = "flutter_embedder/shared_memory";
+
+// A memfd-backed region of memory, mapped into the embedder's address space.
+//
+// Other code in the process (Dart through FFI, or native plugins) can read it
+// in place through its address, and other processes by mapping its fd.
+class SharedMemoryRegion {
+ public:
+  ~SharedMemoryRegion();
+
+  // Returns a new region of |capacity| bytes, or null (after logging the
+  // reason) if it could not be created.
+  static std::unique_ptr<SharedMemoryRegion> Create(size_t capacity);
+
+  uint8_t *data() const { return data_; }
+  size_t capacity() const { return capacity_; }
+  int fd() const { return fd_; }
+
+ private:
+  SharedMemoryRegion(int fd, uint8_t *data, size_t capacity)
+      : fd_(fd), data_(data), capacity_(capacity) {}
+
+  int fd_;
+  uint8_t *data_;
+  size_t capacity_;
+};
+
+// Hands out shared regions, recycling them once their last reference goes
+// away, and sends them to the framework as small handles rather than copying
+// their contents through platform messages.
+//
+// All methods may be called from any thread.
+class SharedMemoryPool {
+ public:
+  // Regions are rounded up to a power of two of at least this many bytes, so
+  // that they can be reused for similar sizes.
+  static constexpr size_t kMinRegionSize = 64 * 1024;
+
+  // |max_pooled_bytes| bounds the memory of regions kept for reuse, and
+  // |max_shared_bytes| that of regions the framework has yet to release.
+  SharedMemoryPool(size_t max_pooled_bytes, size_t max_shared_bytes);
+  ~SharedMemoryPool();
+
+  // Returns a region of at least |size| bytes, which goes back to the pool once
+  // all references to it are gone. Returns null if one could not be created.
+  std::shared_ptr<SharedMemoryRegion> Acquire(size_t size);
+
+  // Writes a handle to the first |size| bytes of |region| to |encoder|, as a
+  // map of "id", "fd", "address" and "size", for embedding in a larger
+  // message. The pool keeps a reference to the region until the framework
+  // sends the id back on kSharedMemoryReleaseChannel, or Release is called.
+  //
+  // Returns the id, or 0 (after logging the reason) if |size| is larger than
+  // the region, or sharing it would exceed |max_shared_bytes|. Regions are
+  // refused rather than others evicted, as the framework may still be reading
+  // those.
+  int64_t Share(std::shared_ptr<SharedMemoryRegion> region, size_t size,
+                StandardMessageEncoder *encoder);
+
+  // Sends a handle to the first |size| bytes of |region| to the framework on
+  // |channel|, as Share does.
+  //
+  // Returns false if the message could not be sent, in which case the
+  // reference is dropped straight away.
+  bool Send(PlatformMessageDispatcher *dispatcher, const std::string &channel,
+            std::shared_ptr<SharedMemoryRegion> region, size_t size);
+
+  // Drops the reference Share kept to the region shared as |id|. Returns false
+  // if there is none.
+  bool Release(int64_t id);
+
+  // Drops the references to every shared region, for when the framework can
+  // no longer release them (e.g. the engine is shutting down).
+  void ReleaseAll();
+
+  // Handles a message on kSharedMemoryReleaseChannel.
+  void HandleReleaseMessage(const PlatformMessage &message,
+                            PlatformMessageResponse response);
+
+  // The number of regions created, and of regions the framework has yet to
+  // release.
+  uint64_t allocation_count();
+  size_t shared_count();
+
+ private:
+  struct State;
+
+  std::shared_ptr<State> state_;
+};
+#endif  // LINUX_INCLUDE_SHARED_MEMORY_POOL_H_
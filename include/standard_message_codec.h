@@ -0,0 +1,325 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef LINUX_INCLUDE_STANDARD_MESSAGE_CODEC_H_
+#define LINUX_INCLUDE_STANDARD_MESSAGE_CODEC_H_
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// The binary format of Flutter's StandardMessageCodec, which platform channels
+// use by default.
+//
+// Decoding makes no copies: strings and typed data are views into the message,
+// so the message must outlive the decoded values. Encoding appends to a buffer
+// that is reused from message to message, so that a channel keeping its own
+// encoder stops allocating once the buffer has grown to its largest message.
+//
+// Example:
+//
+//   StandardMessageDecoder decoder;
+//   if (decoder.Decode(message->message, message->message_size)) {
+//     const StandardValue &value = decoder.value(0);
+//     TypedDataView<double> samples = value.MapValue(0).AsTypedData<double>();
+//   }
+//
+//   encoder_.Clear();
+//   encoder_.WriteMap(1);
+//   encoder_.WriteString("samples");
+//   encoder_.WriteTypedData(samples);
+//   if (encoder_.ok()) {
+//     response.Send(encoder_.data(), encoder_.size());
+//   }
+
+enum class StandardType : uint8_t {
+  kNull = 0,
+  kTrue = 1,
+  kFalse = 2,
+  kInt32 = 3,
+  kInt64 = 4,
+  // An integer too large for 64 bits, as a string of hex digits.
+  kLargeInt = 5,
+  kFloat64 = 6,
+  kString = 7,
+  kUint8List = 8,
+  kInt32List = 9,
+  kInt64List = 10,
+  kFloat64List = 11,
+  kList = 12,
+  kMap = 13,
+  kFloat32List = 14,
+};
+
+// The type of typed data with elements of type T. Only specialized for the
+// element types the format has lists of.
+template <typename T>
+struct StandardTypedData;
+
+template <>
+struct StandardTypedData<uint8_t> {
+  static constexpr StandardType kType = StandardType::kUint8List;
+};
+
+template <>
+struct StandardTypedData<int32_t> {
+  static constexpr StandardType kType = StandardType::kInt32List;
+};
+
+template <>
+struct StandardTypedData<int64_t> {
+  static constexpr StandardType kType = StandardType::kInt64List;
+};
+
+template <>
+struct StandardTypedData<float> {
+  static constexpr StandardType kType = StandardType::kFloat32List;
+};
+
+template <>
+struct StandardTypedData<double> {
+  static constexpr StandardType kType = StandardType::kFloat64List;
+};
+
+// A view of typed data within a message.
+//
+// The format aligns elements relative to the start of the message, so they
+// are only aligned in memory if the message is. Indexing works either way;
+// data() is only available when aligned.
+template <typename T>
+class TypedDataView {
+ public:
+  TypedDataView() : bytes_(nullptr), size_(0) {}
+  TypedDataView(const uint8_t *bytes, size_t size)
+      : bytes_(bytes), size_(size) {}
+
+  size_t size() const { return size_; }
+
+  T operator[](size_t index) const {
+    T value;
+    memcpy(&value, bytes_ + index * sizeof(T), sizeof(T));
+    return value;
+  }
+
+  bool aligned() const {
+    return reinterpret_cast<uintptr_t>(bytes_) % alignof(T) == 0;
+  }
+
+  // Returns the elements, or null if they are not aligned.
+  const T *data() const {
+    return aligned() ? reinterpret_cast<const T *>(bytes_) : nullptr;
+  }
+
+  const uint8_t *bytes() const { return bytes_; }
+
+ private:
+  const uint8_t *bytes_;
+  size_t size_;
+};
+
+// A decoded value, viewing the message it was decoded from. Accessors for
+// another type than the value's return zero or empty values.
+class StandardValue {
+ public:
+  StandardType type() const { return type_; }
+  bool IsNull() const { return type_ == StandardType::kNull; }
+
+  bool AsBool() const { return type_ == StandardType::kTrue; }
+
+  // Returns kInt32 and kInt64 values.
+  int64_t AsInt() const {
+    return type_ == StandardType::kInt32 || type_ == StandardType::kInt64
+               ? int_value_
+               : 0;
+  }
+
+  double AsDouble() const {
+    return type_ == StandardType::kFloat64 ? double_value_ : 0.0;
+  }
+
+  // Returns the UTF-8 bytes of kString values (or the digits of kLargeInt
+  // values), which are not null terminated.
+  const char *string_data() const {
+    return IsStringLike() ? reinterpret_cast<const char *>(bytes_) : nullptr;
+  }
+  size_t string_size() const { return IsStringLike() ? size_ : 0; }
+  // Returns a copy of the string.
+  std::string ToString() const {
+    return std::string(string_data(), string_size());
+  }
+  bool StringEquals(const char *string) const {
+    return IsStringLike() && strlen(string) == size_ &&
+           memcmp(bytes_, string, size_) == 0;
+  }
+
+  template <typename T>
+  TypedDataView<T> AsTypedData() const {
+    if (type_ != StandardTypedData<T>::kType) {
+      return TypedDataView<T>();
+    }
+    return TypedDataView<T>(bytes_, size_);
+  }
+
+  // The number of elements of kList values, or of entries of kMap values.
+  size_t size() const {
+    return type_ == StandardType::kList || type_ == StandardType::kMap ? size_
+                                                                       : 0;
+  }
+
+  // Returns elements of kList values.
+  const StandardValue &operator[](size_t index) const {
+    return children_[index];
+  }
+
+  // Returns the keys and values of kMap entries.
+  const StandardValue &MapKey(size_t index) const {
+    return children_[index * 2];
+  }
+  const StandardValue &MapValue(size_t index) const {
+    return children_[index * 2 + 1];
+  }
+
+  // Returns the value of the entry of a kMap value with the string |key|, or
+  // null if there is none.
+  const StandardValue *Find(const char *key) const;
+
+ private:
+  friend class StandardMessageDecoder;
+
+  bool IsStringLike() const {
+    return type_ == StandardType::kString || type_ == StandardType::kLargeInt;
+  }
+
+  StandardType type_;
+  // Bytes of strings, elements of typed data, or children of lists and maps
+  // (two per map entry).
+  size_t size_;
+  union {
+    int64_t int_value_;
+    double double_value_;
+    const uint8_t *bytes_;
+    const StandardValue *children_;
+  };
+};
+
+// Decodes messages. The values decoded are stored in the decoder, and reused
+// by the next message decoded.
+class StandardMessageDecoder {
+ public:
+  // Lists and maps nested deeper than this are rejected, to bound recursion.
+  static constexpr int kMaxDepth = 128;
+
+  // Decodes the values in the |size| bytes at |data| (e.g. a method call's
+  // name and arguments).
+  //
+  // Returns false (after logging the reason) if the message is malformed.
+  bool Decode(const uint8_t *data, size_t size);
+
+  // The top-level values of the last message decoded.
+  size_t value_count() const { return value_count_; }
+  const StandardValue &value(size_t index) const { return values_[index]; }
+
+ private:
+  struct Reader;
+
+  // Checks the value at |reader| is well formed, counting the values in it.
+  bool Scan(Reader *reader, int depth, size_t *count);
+
+  // Decodes a value Scan accepted into |value|, taking the values of any
+  // elements from |values_| at |next_value_|.
+  void Read(Reader *reader, StandardValue *value);
+
+  std::vector<StandardValue> values_;
+  size_t value_count_ = 0;
+  size_t next_value_ = 0;
+};
+
+// Encodes messages into a buffer that grows as needed and is kept between
+// messages.
+//
+// Sizes are at most 32 bits in the format. Writing a string, typed data, list
+// or map any larger logs an error and fails the message, which must then not
+// be sent.
+class StandardMessageEncoder {
+ public:
+  // Empties the buffer for the next message, keeping its storage.
+  void Clear() {
+    buffer_.clear();
+    ok_ = true;
+  }
+
+  // Returns false if the message failed since the last Clear().
+  bool ok() const { return ok_; }
+
+  const uint8_t *data() const { return buffer_.data(); }
+  size_t size() const { return buffer_.size(); }
+
+  void WriteNull() { WriteType(StandardType::kNull); }
+  void WriteBool(bool value) {
+    WriteType(value ? StandardType::kTrue : StandardType::kFalse);
+  }
+  // Writes |value| as kInt32 where it fits, and as kInt64 otherwise.
+  void WriteInt(int64_t value);
+  void WriteDouble(double value);
+  void WriteString(const char *string, size_t size);
+  void WriteString(const char *string) { WriteString(string, strlen(string)); }
+  void WriteString(const std::string &string) {
+    WriteString(string.data(), string.size());
+  }
+
+  template <typename T>
+  void WriteTypedData(const T *elements, size_t count) {
+    WriteType(StandardTypedData<T>::kType);
+    if (!WriteSize(count)) {
+      return;
+    }
+    Align(sizeof(T));
+    WriteBytes(elements, count * sizeof(T));
+  }
+  // Copies typed data from another message, whether or not it is aligned.
+  template <typename T>
+  void WriteTypedData(const TypedDataView<T> &elements) {
+    WriteType(StandardTypedData<T>::kType);
+    if (!WriteSize(elements.size())) {
+      return;
+    }
+    Align(sizeof(T));
+    WriteBytes(elements.bytes(), elements.size() * sizeof(T));
+  }
+
+  // Starts a list of |count| elements, or a map of |count| entries, which
+  // must be written next (as key, value, key, value, ... for maps).
+  void WriteList(size_t count) {
+    WriteType(StandardType::kList);
+    WriteSize(count);
+  }
+  void WriteMap(size_t count) {
+    WriteType(StandardType::kMap);
+    WriteSize(count);
+  }
+
+ private:
+  void WriteType(StandardType type) {
+    buffer_.push_back(static_cast<uint8_t>(type));
+  }
+  // Returns false, failing the message, if |size| does not fit in 32 bits.
+  bool WriteSize(size_t size);
+  void WriteBytes(const void *bytes, size_t size);
+  // Pads the buffer to a multiple of |alignment|.
+  void Align(size_t alignment);
+
+  std::vector<uint8_t> buffer_;
+  bool ok_ = true;
+};
+#endif  // LINUX_INCLUDE_STANDARD_MESSAGE_CODEC_H_
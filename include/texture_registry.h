@@ -0,0 +1,216 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef LINUX_INCLUDE_TEXTURE_REGISTRY_H_
+#define LINUX_INCLUDE_TEXTURE_REGISTRY_H_
+#include <epoxy/gl.h>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "blit_program_inline.h"
+#include "latency_histogram_inline.h"
+#include "platform_message_dispatcher.h"
+
+// The channel the framework places textures on, with a standard codec map of
+// "id", "x", "y", "width" and "height", in logical pixels from the top-left
+// corner of the widget. A width or height of 0 hides the texture.
+constexpr char kTextureChannel[] = "flutter_embedder/textures";
+
+// Where a texture is drawn, in logical pixels from the top-left corner.
+struct TextureRect {
+  int x = 0;
+  int y = 0;
+  int width = 0;
+  int height = 0;
+};
+
+// Textures whose frames come from outside Flutter (e.g. video or cameras),
+// drawn over the Flutter frame where the framework places them.
+//
+// Producers push frames from any thread, copying them straight into pixel
+// unpack buffers mapped for them ahead of time. Update then uploads the
+// latest frame of each texture from its buffer without stalling, into a
+// texture from a pool, and only maps the buffer again once a fence shows the
+// upload finished. Frames pushed faster than they are uploaded replace the
+// one waiting, which is dropped.
+//
+// Apart from the methods noted as callable from any thread, all calls must be
+// made with the same context current. Release must be called before that
+// context goes away.
+class TextureRegistry {
+ public:
+  // The pixel unpack buffers per texture: one being uploaded, one holding the
+  // next frame, and one being written by the producer.
+  static constexpr size_t kBufferCount = 3;
+
+  // The textures kept for reuse once replaced or unregistered.
+  static constexpr size_t kMaxPooledTextures = 4;
+
+  TextureRegistry();
+  ~TextureRegistry();
+
+  // Sets the function called (from the producer's thread) after a frame is
+  // pushed, to have it drawn. Must be set before any frame is pushed.
+  void SetFrameCallback(std::function<void()> callback);
+
+  // Returns the id of a new texture, hidden until placed. Any thread.
+  int64_t RegisterTexture();
+
+  // Removes the texture, whose GL objects are deleted on the next Update. Any
+  // thread.
+  void UnregisterTexture(int64_t id);
+
+  // Sets where the texture is drawn. Returns false if there is no such
+  // texture. Any thread.
+  bool SetTextureRect(int64_t id, const TextureRect &rect);
+
+  // Copies a frame of |width|x|height| RGBA pixels with straight alpha, rows
+  // |stride| bytes apart from the top, for the next Update to upload. Any
+  // thread.
+  //
+  // Returns false if the frame was dropped: there is no such texture, or the
+  // producer is outrunning the uploads.
+  bool PushFrame(int64_t id, const uint8_t *pixels, int width, int height,
+                 size_t stride);
+
+  // Uploads the latest frame of each texture, and maps buffers for the frames
+  // to come. Clobbers the pixel unpack buffer and texture bindings.
+  void Update();
+
+  // Draws the textures placed as of the last Update over the bound
+  // |width|x|height| framebuffer, |scale| physical pixels to the logical one.
+  // Clobbers the viewport, which is set back to the whole framebuffer, and the
+  // texture binding.
+  void Draw(int width, int height, int scale);
+
+  // Deletes all GL objects. Textures stay registered, showing again from the
+  // next frame pushed.
+  void Release();
+
+  // Handles a message on kTextureChannel.
+  void HandlePlacementMessage(const PlatformMessage &message,
+                              PlatformMessageResponse response);
+
+  // The frames uploaded, and dropped for being replaced or finding no buffer.
+  uint64_t uploaded_count() const { return uploaded_count_; }
+  uint64_t dropped_count() const { return dropped_count_; }
+
+  // The bytes of GL storage held, in textures and buffers.
+  size_t memory_bytes();
+
+  // The time spent copying each frame pushed, and issuing each upload, in
+  // nanoseconds. Only to be read while no frames are being pushed.
+  const LatencyHistogram &push_time() const { return push_time_; }
+  const LatencyHistogram &upload_time() const { return upload_time_; }
+
+ private:
+  enum class State {
+    // Unmapped, with no upload pending.
+    kFree,
+    // Mapped, waiting for a frame.
+    kMapped,
+    // Being written by a producer.
+    kWriting,
+    // Holding a frame, waiting for Update.
+    kReady,
+    // Unmapped and being uploaded from, until |fence| signals.
+    kUploading,
+  };
+
+  struct Buffer {
+    GLuint pbo = 0;
+    GLsync fence = nullptr;
+    State state = State::kFree;
+    // The size of the buffer's storage, in bytes.
+    size_t size = 0;
+    uint8_t *pixels = nullptr;
+    // The frame the buffer is mapped for or holds, and the order it was
+    // pushed in.
+    int width = 0;
+    int height = 0;
+    uint64_t sequence = 0;
+  };
+
+  // A GL texture, with a fence following the last draw that sampled it.
+  struct PooledTexture {
+    GLuint texture = 0;
+    int width = 0;
+    int height = 0;
+    GLsync released = nullptr;
+  };
+
+  struct Texture {
+    // Guards everything but |front|, which only Update and Draw use.
+    std::mutex m;
+    std::array<Buffer, kBufferCount> buffers;
+    // The size of the last frame pushed, which buffers are mapped for.
+    int frame_width = 0;
+    int frame_height = 0;
+    // A frame that found no buffer of its size, copied here until the buffers
+    // are mapped for its size.
+    std::vector<uint8_t> staging;
+    bool staging_ready = false;
+    int staging_width = 0;
+    int staging_height = 0;
+    uint64_t staging_sequence = 0;
+    uint64_t next_sequence = 1;
+    TextureRect rect;
+    // The texture showing the last frame uploaded.
+    PooledTexture front;
+  };
+
+  // Returns the texture registered as |id|, or null.
+  std::shared_ptr<Texture> FindTexture(int64_t id);
+
+  // Uploads the newest frame waiting in |texture|, if any.
+  void UploadFrame(Texture *texture);
+
+  // Maps the free buffers of |texture| for frames of its current size.
+  void MapBuffers(Texture *texture);
+
+  // Returns a texture of |width|x|height| whose last draw finished, creating
+  // one if the pool has none.
+  PooledTexture AcquireTexture(int width, int height);
+
+  // Returns |texture| to the pool, deleting the oldest if it is full.
+  void RecycleTexture(PooledTexture texture);
+
+  // Deletes the GL objects of |texture|, apart from buffers a producer is
+  // still writing into. Returns whether all were deleted.
+  bool DeleteGlObjects(Texture *texture);
+
+  std::function<void()> frame_callback_;
+  BlitProgram<kBlitPremultiplyAlpha> blit_program_;
+  std::vector<PooledTexture> texture_pool_;
+  // The textures Update and Draw go through, kept to save allocating.
+  std::vector<std::shared_ptr<Texture>> update_list_;
+  std::atomic<uint64_t> uploaded_count_;
+  std::atomic<uint64_t> dropped_count_;
+  LatencyHistogram upload_time_;
+
+  // Guards everything below.
+  std::mutex m_;
+  std::unordered_map<int64_t, std::shared_ptr<Texture>> textures_;
+  // Textures unregistered whose GL objects are yet to be deleted.
+  std::vector<std::shared_ptr<Texture>> unregistered_;
+  int64_t next_id_;
+  LatencyHistogram push_time_;
+};
+#endif  // LINUX_INCLUDE_TEXTURE_REGISTRY_H_
@@ -0,0 +1,152 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef LINUX_INCLUDE_TRACE_H_
+#define LINUX_INCLUDE_TRACE_H_
+#include <epoxy/gl.h>
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+// Tracing of the embedder's threads, written out in the Chrome trace event
+// format (which chrome://tracing and Perfetto both load).
+//
+// Tracing is compiled in with FLUTTER_EMBEDDER_TRACING. Otherwise the macros
+// below expand to nothing, and GpuTraceTimer does nothing.
+//
+// Example:
+//
+//   void Draw() {
+//     TRACE_EVENT("Draw");
+//     TRACE_GPU_EVENT(&gpu_timer_, "Draw");
+//     ...
+//   }
+
+// Writes all events recorded so far to |path|, as Chrome trace JSON.
+//
+// May be called from any thread. Returns false (after logging the reason) if
+// the file could not be written, or tracing is not compiled in.
+bool WriteTrace(const std::string &path);
+
+#ifdef FLUTTER_EMBEDDER_TRACING
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+// Traces the rest of the enclosing scope as |name|, which must be a string
+// literal.
+#define TRACE_EVENT(name) \
+  ScopedTraceEvent TRACE_CONCAT(trace_event_, __LINE__)(name)
+
+// Times the GL commands issued in the rest of the enclosing scope with
+// |timer|, tracing them as |name| once the GPU has run them.
+#define TRACE_GPU_EVENT(timer, name) \
+  ScopedGpuTraceEvent TRACE_CONCAT(gpu_trace_event_, __LINE__)(timer, name)
+
+// Times the GL commands issued between the two with |timer|, for spans that
+// are not a single scope.
+#define TRACE_GPU_BEGIN(timer, name) (timer)->Begin(name)
+#define TRACE_GPU_END(timer) (timer)->End()
+
+// Returns the current time in microseconds of the monotonic clock.
+int64_t GetTraceTime();
+
+// Records an event on the calling thread, to its own ring buffer. Once the
+// buffer is full, the oldest events are overwritten.
+//
+// |gpu| events are shown on a track of their own next to the thread's.
+void AddTraceEvent(const char *name, int64_t start_us, int64_t duration_us,
+                   bool gpu);
+
+class ScopedTraceEvent {
+ public:
+  explicit ScopedTraceEvent(const char *name)
+      : name_(name), start_(GetTraceTime()) {}
+  ~ScopedTraceEvent() {
+    AddTraceEvent(name_, start_, GetTraceTime() - start_, false);
+  }
+
+ private:
+  const char *name_;
+  int64_t start_;
+};
+
+// Measures how long the GPU takes to run GL commands with GL_TIME_ELAPSED
+// queries, where the context supports them.
+//
+// Queries belong to the context they are created in, so a timer must only be
+// used with one context, which must be current for all calls. Results are
+// collected on later calls to Begin, so they arrive a few frames late.
+//
+// Only one timer may be running per context at a time.
+class GpuTraceTimer {
+ public:
+  GpuTraceTimer();
+
+  // Starts timing the GL commands that follow as |name|, which must be a
+  // string literal.
+  void Begin(const char *name);
+
+  // Stops timing.
+  void End();
+
+  // Deletes the queries.
+  void Release();
+
+ private:
+  struct Query {
+    GLuint id;
+    const char *name;
+    // When the query began on the CPU. The GPU time the commands started at is
+    // not known, so events are placed here.
+    int64_t start;
+  };
+
+  // Traces the results of finished queries, returning them to |free_queries_|.
+  void CollectResults();
+
+  // Whether the context supports timer queries; checked on first use.
+  enum class Support { kUnknown, kSupported, kUnsupported };
+  Support support_;
+  bool running_;
+  std::deque<Query> pending_queries_;
+  std::vector<GLuint> free_queries_;
+};
+
+class ScopedGpuTraceEvent {
+ public:
+  ScopedGpuTraceEvent(GpuTraceTimer *timer, const char *name) : timer_(timer) {
+    timer_->Begin(name);
+  }
+  ~ScopedGpuTraceEvent() { timer_->End(); }
+
+ private:
+  GpuTraceTimer *timer_;
+};
+
+#else  // FLUTTER_EMBEDDER_TRACING
+
+#define TRACE_EVENT(name)
+#define TRACE_GPU_EVENT(timer, name)
+#define TRACE_GPU_BEGIN(timer, name)
+#define TRACE_GPU_END(timer)
+
+class GpuTraceTimer {
+ public:
+  void Release() {}
+};
+
+#endif  // FLUTTER_EMBEDDER_TRACING
+#endif  // LINUX_INCLUDE_TRACE_H_
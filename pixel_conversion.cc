@@ -0,0 +1,237 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "include/pixel_conversion.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <cstring>
+
+// Full range BT.601 coefficients, in 8.8 fixed point.
+static constexpr int kYR = 77, kYG = 150, kYB = 29;
+static constexpr int kUR = -43, kUG = -85, kUB = 128;
+static constexpr int kVR = 128, kVG = -107, kVB = -21;
+
+static inline uint8_t clamp_to_byte(int value) {
+  return value < 0 ? 0 : (value > 255 ? 255 : static_cast<uint8_t>(value));
+}
+
+static inline uint8_t get_y(const uint8_t *rgba) {
+  return (kYR * rgba[0] + kYG * rgba[1] + kYB * rgba[2] + 128) >> 8;
+}
+
+static inline uint8_t get_u(const uint8_t *rgba) {
+  return clamp_to_byte(
+      ((kUR * rgba[0] + kUG * rgba[1] + kUB * rgba[2] + 128) >> 8) + 128);
+}
+
+static inline uint8_t get_v(const uint8_t *rgba) {
+  return clamp_to_byte(
+      ((kVR * rgba[0] + kVG * rgba[1] + kVB * rgba[2] + 128) >> 8) + 128);
+}
+
+// Rounds up like _mm_avg_epu8, so that both paths average alike.
+static inline uint8_t average(uint8_t a, uint8_t b) { return (a + b + 1) >> 1; }
+
+// Averages the 2x2 block of pixels at |top| and |bottom| into |rgba|.
+// |right| is the offset of the right column, which is 0 at an odd edge.
+static inline void average_block(const uint8_t *top, const uint8_t *bottom,
+                                 int right, uint8_t *rgba) {
+  for (int c = 0; c < 3; ++c) {
+    rgba[c] = average(average(top[c], bottom[c]),
+                      average(top[right + c], bottom[right + c]));
+  }
+}
+
+#ifdef __SSE2__
+// Returns the dot products of the four RGBA pixels in |pixels| with
+// |coefficients|, which holds 16-bit (r, g, b, 0) twice.
+static inline __m128i dot_pixels(__m128i pixels, __m128i coefficients) {
+  __m128i zero = _mm_setzero_si128();
+  // Each holds the (r*cr + g*cg, b*cb) sums of two pixels.
+  __m128 low = _mm_castsi128_ps(
+      _mm_madd_epi16(_mm_unpacklo_epi8(pixels, zero), coefficients));
+  __m128 high = _mm_castsi128_ps(
+      _mm_madd_epi16(_mm_unpackhi_epi8(pixels, zero), coefficients));
+  __m128i even =
+      _mm_castps_si128(_mm_shuffle_ps(low, high, _MM_SHUFFLE(2, 0, 2, 0)));
+  __m128i odd =
+      _mm_castps_si128(_mm_shuffle_ps(low, high, _MM_SHUFFLE(3, 1, 3, 1)));
+  return _mm_add_epi32(even, odd);
+}
+
+// Returns the luma of the four pixels in |pixels|, as 32-bit values.
+static inline __m128i get_y4(__m128i pixels) {
+  const __m128i coefficients =
+      _mm_setr_epi16(kYR, kYG, kYB, 0, kYR, kYG, kYB, 0);
+  return _mm_srli_epi32(
+      _mm_add_epi32(dot_pixels(pixels, coefficients), _mm_set1_epi32(128)), 8);
+}
+
+// Returns the chroma of the four pixels in |pixels| for |coefficients|,
+// offset to be unsigned but not clamped, as 32-bit values.
+static inline __m128i get_chroma4(__m128i pixels, __m128i coefficients) {
+  __m128i dot = _mm_add_epi32(dot_pixels(pixels, coefficients),
+                              _mm_set1_epi32(128));
+  return _mm_add_epi32(_mm_srai_epi32(dot, 8), _mm_set1_epi32(128));
+}
+
+// Returns the 2x2 averages of the eight pixels at |top| and |bottom|.
+static inline __m128i average_blocks4(const uint8_t *top,
+                                      const uint8_t *bottom) {
+  auto load = [](const uint8_t *p) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+  };
+  __m128i left = _mm_avg_epu8(load(top), load(bottom));
+  __m128i right = _mm_avg_epu8(load(top + 16), load(bottom + 16));
+  // Averages each pixel with its horizontal neighbour, then keeps one of each
+  // pair.
+  left = _mm_avg_epu8(left, _mm_shuffle_epi32(left, _MM_SHUFFLE(2, 3, 0, 1)));
+  right =
+      _mm_avg_epu8(right, _mm_shuffle_epi32(right, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(left),
+                                         _mm_castsi128_ps(right),
+                                         _MM_SHUFFLE(2, 0, 2, 0)));
+}
+#endif  // __SSE2__
+
+// Converts a row of |width| pixels to luma.
+static void convert_row_to_y(const uint8_t *src, int width, uint8_t *y) {
+  int x = 0;
+#ifdef __SSE2__
+  for (; x + 16 <= width; x += 16) {
+    const __m128i *pixels = reinterpret_cast<const __m128i *>(src + x * 4);
+    __m128i y0 = get_y4(_mm_loadu_si128(pixels));
+    __m128i y1 = get_y4(_mm_loadu_si128(pixels + 1));
+    __m128i y2 = get_y4(_mm_loadu_si128(pixels + 2));
+    __m128i y3 = get_y4(_mm_loadu_si128(pixels + 3));
+    __m128i packed = _mm_packus_epi16(_mm_packs_epi32(y0, y1),
+                                      _mm_packs_epi32(y2, y3));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(y + x), packed);
+  }
+#endif  // __SSE2__
+  for (; x < width; ++x) {
+    y[x] = get_y(src + x * 4);
+  }
+}
+
+// Converts the rows at |top| and |bottom| to a row of chroma, averaging each
+// 2x2 block.
+static void convert_rows_to_uv(const uint8_t *top, const uint8_t *bottom,
+                               int width, uint8_t *u, uint8_t *v) {
+  int x = 0;
+#ifdef __SSE2__
+  const __m128i u_coefficients =
+      _mm_setr_epi16(kUR, kUG, kUB, 0, kUR, kUG, kUB, 0);
+  const __m128i v_coefficients =
+      _mm_setr_epi16(kVR, kVG, kVB, 0, kVR, kVG, kVB, 0);
+  for (; x + 8 <= width; x += 8) {
+    __m128i blocks = average_blocks4(top + x * 4, bottom + x * 4);
+    __m128i u4 = get_chroma4(blocks, u_coefficients);
+    __m128i v4 = get_chroma4(blocks, v_coefficients);
+    // Clamps to bytes, with U in the low four and V in the next four.
+    __m128i packed = _mm_packus_epi16(_mm_packs_epi32(u4, v4), u4);
+    int32_t uv[2];
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(uv), packed);
+    memcpy(u + x / 2, &uv[0], 4);
+    memcpy(v + x / 2, &uv[1], 4);
+  }
+#endif  // __SSE2__
+  for (; x < width; x += 2) {
+    uint8_t block[3];
+    average_block(top + x * 4, bottom + x * 4, x + 1 < width ? 4 : 0, block);
+    u[x / 2] = get_u(block);
+    v[x / 2] = get_v(block);
+  }
+}
+
+void ConvertRgbaToBgra(const uint8_t *src, ptrdiff_t src_stride, int width,
+                       int height, uint8_t *dst) {
+  for (int row = 0; row < height; ++row, src += src_stride) {
+    int x = 0;
+#ifdef __SSE2__
+    const __m128i green_alpha = _mm_set1_epi32(0xff00ff00);
+    const __m128i red_blue = _mm_set1_epi32(0x00ff00ff);
+    for (; x + 4 <= width; x += 4) {
+      __m128i pixels =
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x * 4));
+      __m128i swapped = _mm_and_si128(pixels, red_blue);
+      swapped = _mm_or_si128(_mm_slli_epi32(swapped, 16),
+                             _mm_srli_epi32(swapped, 16));
+      _mm_storeu_si128(
+          reinterpret_cast<__m128i *>(dst + x * 4),
+          _mm_or_si128(_mm_and_si128(pixels, green_alpha), swapped));
+    }
+#endif  // __SSE2__
+    for (; x < width; ++x) {
+      dst[x * 4 + 0] = src[x * 4 + 2];
+      dst[x * 4 + 1] = src[x * 4 + 1];
+      dst[x * 4 + 2] = src[x * 4 + 0];
+      dst[x * 4 + 3] = src[x * 4 + 3];
+    }
+    dst += width * 4;
+  }
+}
+
+void ConvertRgbaToStraightAlpha(const uint8_t *src, ptrdiff_t src_stride,
+                                int width, int height, uint8_t *dst) {
+  for (int row = 0; row < height; ++row, src += src_stride) {
+    int x = 0;
+    while (x < width) {
+#ifdef __SSE2__
+      // Opaque pixels are the same either way, and most pixels are opaque.
+      const __m128i alpha = _mm_set1_epi32(0xff000000);
+      for (; x + 4 <= width; x += 4) {
+        __m128i pixels =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x * 4));
+        __m128i opaque = _mm_cmpeq_epi32(_mm_and_si128(pixels, alpha), alpha);
+        if (_mm_movemask_epi8(opaque) != 0xffff) {
+          break;
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x * 4), pixels);
+      }
+#endif  // __SSE2__
+      // Up to the end of the row, or of the block of 4 that was not opaque.
+      int end = x + 4 < width ? x + 4 : width;
+      for (; x < end; ++x) {
+        const uint8_t *pixel = src + x * 4;
+        uint8_t a = pixel[3];
+        for (int channel = 0; channel < 3; ++channel) {
+          dst[x * 4 + channel] =
+              a == 0 ? 0
+                     : clamp_to_byte((pixel[channel] * 255 + a / 2) / a);
+        }
+        dst[x * 4 + 3] = a;
+      }
+    }
+    dst += width * 4;
+  }
+}
+
+void ConvertRgbaToI420(const uint8_t *src, ptrdiff_t src_stride, int width,
+                       int height, uint8_t *y, uint8_t *u, uint8_t *v) {
+  int chroma_width = (width + 1) / 2;
+  for (int row = 0; row < height; row += 2) {
+    const uint8_t *top = src + row * src_stride;
+    // An odd last row is paired with itself.
+    const uint8_t *bottom = row + 1 < height ? top + src_stride : top;
+    convert_row_to_y(top, width, y + row * width);
+    if (row + 1 < height) {
+      convert_row_to_y(bottom, width, y + (row + 1) * width);
+    }
+    convert_rows_to_uv(top, bottom, width, u + row / 2 * chroma_width,
+                       v + row / 2 * chroma_width);
+  }
+}
@@ -0,0 +1,321 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "include/platform_message_dispatcher.h"
+
+#include <pthread.h>
+
+#include <chrono>
+#include <utility>
+
+#include "include/trace.h"
+
+// The engine responses are sent to. Shared with outstanding responses, so that
+// they can tell once the engine has shut down.
+struct PlatformMessageResponse::Engine {
+  // Held while sending, so the engine cannot shut down meanwhile.
+  std::mutex m;
+  FlutterEngine engine = nullptr;
+};
+
+struct PlatformMessageResponse::Channel {
+  // A message queued for the worker pool, with its data copied, as the engine
+  // only keeps it alive for the duration of the callback.
+  struct Task {
+    std::vector<uint8_t> data;
+    PlatformMessageResponse response;
+    int64_t received_us;
+  };
+
+  std::string name;
+
+  // The following are guarded by the dispatcher's mutex. The handler is
+  // replaced rather than changed, so it can be called without the mutex.
+  std::shared_ptr<const PlatformMessageHandler> handler;
+  PlatformChannelOptions options;
+  std::deque<Task> queue;
+  // Whether the channel is in the dispatcher's ready queue, and whether a
+  // worker is running one of its messages.
+  bool ready = false;
+  bool running = false;
+
+  std::mutex stats_m;
+  PlatformChannelStats stats;
+};
+
+static int64_t get_time_us() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+PlatformMessageResponse::PlatformMessageResponse(
+    std::shared_ptr<Engine> engine, std::shared_ptr<Channel> channel,
+    const FlutterPlatformMessageResponseHandle *handle, int64_t received_us)
+    : engine_(std::move(engine)),
+      channel_(std::move(channel)),
+      handle_(handle),
+      received_us_(received_us) {}
+
+PlatformMessageResponse::PlatformMessageResponse(
+    PlatformMessageResponse &&other)
+    : engine_(std::move(other.engine_)),
+      channel_(std::move(other.channel_)),
+      handle_(other.handle_),
+      received_us_(other.received_us_) {
+  other.handle_ = nullptr;
+}
+
+PlatformMessageResponse &PlatformMessageResponse::operator=(
+    PlatformMessageResponse &&other) {
+  if (this != &other) {
+    Send(nullptr, 0);
+    engine_ = std::move(other.engine_);
+    channel_ = std::move(other.channel_);
+    handle_ = other.handle_;
+    received_us_ = other.received_us_;
+    other.handle_ = nullptr;
+  }
+  return *this;
+}
+
+PlatformMessageResponse::~PlatformMessageResponse() { Send(nullptr, 0); }
+
+void PlatformMessageResponse::Send(const uint8_t *data, size_t size) {
+  if (handle_ == nullptr) {
+    return;
+  }
+  const FlutterPlatformMessageResponseHandle *handle = handle_;
+  handle_ = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(engine_->m);
+    if (engine_->engine != nullptr) {
+      FlutterEngineSendPlatformMessageResponse(engine_->engine, handle, data,
+                                               size);
+    }
+  }
+  if (channel_ != nullptr) {
+    int64_t now = get_time_us();
+    std::lock_guard<std::mutex> lock(channel_->stats_m);
+    channel_->stats.response_time.Record(now - received_us_);
+  }
+}
+
+PlatformMessageDispatcher::PlatformMessageDispatcher(size_t worker_count)
+    : engine_(std::make_shared<Engine>()),
+      worker_count_(worker_count),
+      stopping_(false),
+      unhandled_count_(0) {}
+
+PlatformMessageDispatcher::~PlatformMessageDispatcher() { Shutdown(); }
+
+void PlatformMessageDispatcher::SetEngine(FlutterEngine engine) {
+  std::lock_guard<std::mutex> lock(engine_->m);
+  engine_->engine = engine;
+}
+
+void PlatformMessageDispatcher::Shutdown() {
+  {
+    std::lock_guard<std::mutex> lock(m_);
+    stopping_ = true;
+  }
+  work_cv_.notify_all();
+  for (std::thread &worker : workers_) {
+    worker.join();
+  }
+  workers_.clear();
+  // Answers whatever is still queued, outside the lock.
+  std::vector<Channel::Task> dropped;
+  {
+    std::lock_guard<std::mutex> lock(m_);
+    for (auto &entry : channels_) {
+      for (Channel::Task &task : entry.second->queue) {
+        dropped.push_back(std::move(task));
+      }
+      entry.second->queue.clear();
+    }
+    ready_.clear();
+  }
+  dropped.clear();
+  std::lock_guard<std::mutex> lock(engine_->m);
+  engine_->engine = nullptr;
+}
+
+void PlatformMessageDispatcher::SetHandler(
+    const std::string &channel, PlatformMessageHandler handler,
+    const PlatformChannelOptions &options) {
+  // Declared before the lock, so that queued messages of a removed channel are
+  // answered after it is released.
+  std::deque<Channel::Task> dropped;
+  std::lock_guard<std::mutex> lock(m_);
+  auto it = channels_.find(channel);
+  if (!handler) {
+    if (it != channels_.end()) {
+      dropped.swap(it->second->queue);
+      channels_.erase(it);
+    }
+    return;
+  }
+  if (it == channels_.end()) {
+    it = channels_.emplace(channel, std::make_shared<Channel>()).first;
+    it->second->name = channel;
+  }
+  it->second->handler =
+      std::make_shared<const PlatformMessageHandler>(std::move(handler));
+  it->second->options = options;
+  if (options.use_worker_pool && workers_.empty() && !stopping_) {
+    for (size_t i = 0; i < worker_count_; ++i) {
+      workers_.emplace_back(&PlatformMessageDispatcher::WorkerLoop, this);
+    }
+  }
+}
+
+void PlatformMessageDispatcher::Dispatch(
+    const FlutterPlatformMessage *message) {
+  TRACE_EVENT("DispatchPlatformMessage");
+  int64_t received_us = get_time_us();
+  std::unique_lock<std::mutex> lock(m_);
+  lookup_key_.assign(message->channel);
+  auto it = channels_.find(lookup_key_);
+  if (it == channels_.end() || stopping_) {
+    ++unhandled_count_;
+    lock.unlock();
+    // Answers the message empty.
+    PlatformMessageResponse(engine_, nullptr, message->response_handle,
+                            received_us);
+    return;
+  }
+  std::shared_ptr<Channel> channel = it->second;
+  PlatformMessageResponse response(engine_, channel, message->response_handle,
+                                   received_us);
+  if (!channel->options.use_worker_pool) {
+    std::shared_ptr<const PlatformMessageHandler> handler = channel->handler;
+    lock.unlock();
+    {
+      std::lock_guard<std::mutex> stats_lock(channel->stats_m);
+      ++channel->stats.received;
+    }
+    PlatformMessage view = {message->channel, message->message,
+                            message->message_size};
+    RunHandler(channel.get(), *handler, view, std::move(response), received_us);
+    return;
+  }
+  size_t pending = channel->queue.size();
+  bool rejected = pending >= channel->options.max_pending;
+  if (!rejected) {
+    Channel::Task task = {
+        std::vector<uint8_t>(message->message,
+                             message->message + message->message_size),
+        std::move(response), received_us};
+    channel->queue.push_back(std::move(task));
+    ++pending;
+    if (!channel->running && !channel->ready) {
+      channel->ready = true;
+      ready_.push_back(channel);
+      work_cv_.notify_one();
+    }
+  }
+  lock.unlock();
+  std::lock_guard<std::mutex> stats_lock(channel->stats_m);
+  ++channel->stats.received;
+  if (rejected) {
+    ++channel->stats.rejected;
+  } else if (pending > channel->stats.max_pending) {
+    channel->stats.max_pending = pending;
+  }
+  // A rejected message's response goes out empty as it goes out of scope.
+}
+
+void PlatformMessageDispatcher::RunHandler(
+    Channel *channel, const PlatformMessageHandler &handler,
+    const PlatformMessage &message, PlatformMessageResponse response,
+    int64_t received_us) {
+  TRACE_EVENT("HandlePlatformMessage");
+  int64_t start = get_time_us();
+  handler(message, std::move(response));
+  int64_t end = get_time_us();
+  std::lock_guard<std::mutex> lock(channel->stats_m);
+  channel->stats.queue_time.Record(start - received_us);
+  channel->stats.handle_time.Record(end - start);
+}
+
+bool PlatformMessageDispatcher::Send(const std::string &channel,
+                                     const uint8_t *data, size_t size) {
+  FlutterPlatformMessage message = {sizeof(FlutterPlatformMessage),
+                                    channel.c_str(), data, size, nullptr};
+  std::lock_guard<std::mutex> lock(engine_->m);
+  if (engine_->engine == nullptr) {
+    return false;
+  }
+  return FlutterEngineSendPlatformMessage(engine_->engine, &message) ==
+         kSuccess;
+}
+
+bool PlatformMessageDispatcher::GetChannelStats(const std::string &channel,
+                                                PlatformChannelStats *stats) {
+  std::shared_ptr<Channel> entry;
+  size_t pending = 0;
+  {
+    std::lock_guard<std::mutex> lock(m_);
+    auto it = channels_.find(channel);
+    if (it == channels_.end()) {
+      return false;
+    }
+    entry = it->second;
+    pending = entry->queue.size();
+  }
+  std::lock_guard<std::mutex> lock(entry->stats_m);
+  *stats = entry->stats;
+  stats->pending = pending;
+  return true;
+}
+
+uint64_t PlatformMessageDispatcher::unhandled_count() {
+  std::lock_guard<std::mutex> lock(m_);
+  return unhandled_count_;
+}
+
+void PlatformMessageDispatcher::WorkerLoop() {
+  pthread_setname_np(pthread_self(), "platform_msg");
+  std::unique_lock<std::mutex> lock(m_);
+  while (true) {
+    work_cv_.wait(lock, [this] { return stopping_ || !ready_.empty(); });
+    if (stopping_) {
+      break;
+    }
+    std::shared_ptr<Channel> channel = std::move(ready_.front());
+    ready_.pop_front();
+    channel->ready = false;
+    if (channel->queue.empty()) {
+      // The channel was removed while it waited.
+      continue;
+    }
+    Channel::Task task = std::move(channel->queue.front());
+    channel->queue.pop_front();
+    channel->running = true;
+    std::shared_ptr<const PlatformMessageHandler> handler = channel->handler;
+    lock.unlock();
+    PlatformMessage view = {channel->name.c_str(), task.data.data(),
+                            task.data.size()};
+    RunHandler(channel.get(), *handler, view, std::move(task.response),
+               task.received_us);
+    lock.lock();
+    channel->running = false;
+    // Goes to the back of the line, so that busy channels take turns.
+    if (!channel->queue.empty()) {
+      channel->ready = true;
+      ready_.push_back(std::move(channel));
+      work_cv_.notify_one();
+    }
+  }
+}
@@ -0,0 +1,82 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "include/render_target_pool.h"
+
+RenderTargetPool::RenderTargetPool(size_t capacity)
+    : capacity_(capacity),
+      depth_format_(GL_DEPTH_COMPONENT24),
+      allocation_count_(0) {}
+
+RenderTargetPool::~RenderTargetPool() {
+  // Nothing should be left behind by the owner, as the share group may no
+  // longer be current here.
+  assert(pool_.empty());
+}
+
+bool RenderTargetPool::Fits(const RenderTarget &target, GLsizei width,
+                            GLsizei height) const {
+  return target.texture != 0 && target.depth_format == depth_format_ &&
+         RenderTargetBuckets::Fits(target.width, target.height, width, height);
+}
+
+bool RenderTargetPool::Reserve(RenderTarget *target, GLsizei width,
+                               GLsizei height) {
+  if (Fits(*target, width, height)) {
+    return false;
+  }
+  RenderTarget storage;
+  size_t index =
+      RenderTargetBuckets::FindReusable(pool_, width, height, depth_format_);
+  if (index < pool_.size()) {
+    storage = pool_[index];
+    pool_.erase(pool_.begin() + index);
+  } else {
+    AllocateRenderTargetStorage(&storage, RenderTargetBuckets::RoundUp(width),
+                                RenderTargetBuckets::RoundUp(height),
+                                depth_format_);
+    ++allocation_count_;
+  }
+
+  if (target->texture != 0) {
+    RenderTarget old_storage = *target;
+    old_storage.fbo = 0;
+    pool_.push_front(old_storage);
+    while (pool_.size() > capacity_) {
+      ReleaseRenderTargetStorage(&pool_.back());
+      pool_.pop_back();
+    }
+  }
+  target->texture = storage.texture;
+  target->depth_rb = storage.depth_rb;
+  target->depth_format = storage.depth_format;
+  target->width = storage.width;
+  target->height = storage.height;
+  target->attached = false;
+  return true;
+}
+
+size_t RenderTargetPool::memory_bytes() const {
+  size_t bytes = 0;
+  for (const auto &storage : pool_) {
+    bytes += GetRenderTargetStorageBytes(storage);
+  }
+  return bytes;
+}
+
+void RenderTargetPool::Clear() {
+  for (auto &storage : pool_) {
+    ReleaseRenderTargetStorage(&storage);
+  }
+  pool_.clear();
+}
@@ -0,0 +1,233 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "include/shared_memory_pool.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+struct SharedMemoryPool::State {
+  State(size_t max_pooled_bytes, size_t max_shared_bytes)
+      : max_pooled_bytes(max_pooled_bytes),
+        max_shared_bytes(max_shared_bytes) {}
+
+  std::mutex m;
+  size_t max_pooled_bytes;
+  size_t pooled_bytes = 0;
+  size_t max_shared_bytes;
+  size_t shared_bytes = 0;
+  // Regions kept for reuse, by capacity.
+  std::unordered_map<size_t, std::vector<std::unique_ptr<SharedMemoryRegion>>>
+      free_regions;
+  // The references Share keeps until the framework releases them, by id.
+  std::unordered_map<int64_t, std::shared_ptr<SharedMemoryRegion>> shared;
+  int64_t next_id = 1;
+  uint64_t allocation_count = 0;
+};
+
+// Rounds |size| up to the capacity of the regions it is served from.
+static size_t get_region_capacity(size_t size) {
+  size_t capacity = SharedMemoryPool::kMinRegionSize;
+  while (capacity < size) {
+    capacity *= 2;
+  }
+  return capacity;
+}
+
+SharedMemoryRegion::~SharedMemoryRegion() {
+  munmap(data_, capacity_);
+  close(fd_);
+}
+
+std::unique_ptr<SharedMemoryRegion> SharedMemoryRegion::Create(
+    size_t capacity) {
+  int fd = memfd_create("flutter_embedder_shared_memory", MFD_CLOEXEC);
+  if (fd < 0) {
+    std::cerr << "Failed to create shared memory: " << strerror(errno)
+              << std::endl;
+    return nullptr;
+  }
+  if (ftruncate(fd, capacity) != 0) {
+    std::cerr << "Failed to size shared memory to " << capacity
+              << " bytes: " << strerror(errno) << std::endl;
+    close(fd);
+    return nullptr;
+  }
+  void *data =
+      mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (data == MAP_FAILED) {
+    std::cerr << "Failed to map shared memory: " << strerror(errno)
+              << std::endl;
+    close(fd);
+    return nullptr;
+  }
+  return std::unique_ptr<SharedMemoryRegion>(
+      new SharedMemoryRegion(fd, static_cast<uint8_t *>(data), capacity));
+}
+
+SharedMemoryPool::SharedMemoryPool(size_t max_pooled_bytes,
+                                   size_t max_shared_bytes)
+    : state_(std::make_shared<State>(max_pooled_bytes, max_shared_bytes)) {}
+
+// Regions still referenced elsewhere are destroyed with their last reference
+// instead of being recycled.
+SharedMemoryPool::~SharedMemoryPool() = default;
+
+std::shared_ptr<SharedMemoryRegion> SharedMemoryPool::Acquire(size_t size) {
+  size_t capacity = get_region_capacity(size);
+  std::unique_ptr<SharedMemoryRegion> region;
+  {
+    std::lock_guard<std::mutex> lock(state_->m);
+    auto &free_regions = state_->free_regions[capacity];
+    if (!free_regions.empty()) {
+      region = std::move(free_regions.back());
+      free_regions.pop_back();
+      state_->pooled_bytes -= capacity;
+    }
+  }
+  if (!region) {
+    region = SharedMemoryRegion::Create(capacity);
+    if (!region) {
+      return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(state_->m);
+    ++state_->allocation_count;
+  }
+  std::weak_ptr<State> weak_state = state_;
+  return std::shared_ptr<SharedMemoryRegion>(
+      region.release(), [weak_state](SharedMemoryRegion *released) {
+        std::unique_ptr<SharedMemoryRegion> owned(released);
+        std::shared_ptr<State> state = weak_state.lock();
+        if (!state) {
+          return;
+        }
+        std::lock_guard<std::mutex> lock(state->m);
+        size_t capacity = owned->capacity();
+        if (state->pooled_bytes + capacity <= state->max_pooled_bytes) {
+          state->pooled_bytes += capacity;
+          state->free_regions[capacity].push_back(std::move(owned));
+        }
+      });
+}
+
+int64_t SharedMemoryPool::Share(std::shared_ptr<SharedMemoryRegion> region,
+                                size_t size, StandardMessageEncoder *encoder) {
+  if (size > region->capacity()) {
+    std::cerr << "Cannot share " << size << " bytes of a "
+              << region->capacity() << " byte shared region" << std::endl;
+    return 0;
+  }
+  int fd = region->fd();
+  intptr_t address = reinterpret_cast<intptr_t>(region->data());
+  size_t capacity = region->capacity();
+  int64_t id;
+  {
+    // The framework may release the region as soon as the handle is sent.
+    std::lock_guard<std::mutex> lock(state_->m);
+    if (state_->shared_bytes + capacity > state_->max_shared_bytes) {
+      std::cerr << "Cannot share another " << capacity << " bytes, as "
+                << state_->shared_bytes
+                << " bytes of shared regions are yet to be released"
+                << std::endl;
+      return 0;
+    }
+    state_->shared_bytes += capacity;
+    id = state_->next_id++;
+    state_->shared[id] = std::move(region);
+  }
+  encoder->WriteMap(4);
+  encoder->WriteString("id");
+  encoder->WriteInt(id);
+  encoder->WriteString("fd");
+  encoder->WriteInt(fd);
+  encoder->WriteString("address");
+  encoder->WriteInt(address);
+  encoder->WriteString("size");
+  encoder->WriteInt(size);
+  return id;
+}
+
+bool SharedMemoryPool::Send(PlatformMessageDispatcher *dispatcher,
+                            const std::string &channel,
+                            std::shared_ptr<SharedMemoryRegion> region,
+                            size_t size) {
+  StandardMessageEncoder encoder;
+  int64_t id = Share(std::move(region), size, &encoder);
+  if (id == 0) {
+    return false;
+  }
+  if (!dispatcher->Send(channel, encoder.data(), encoder.size())) {
+    Release(id);
+    return false;
+  }
+  return true;
+}
+
+bool SharedMemoryPool::Release(int64_t id) {
+  std::shared_ptr<SharedMemoryRegion> region;
+  {
+    std::lock_guard<std::mutex> lock(state_->m);
+    auto it = state_->shared.find(id);
+    if (it == state_->shared.end()) {
+      return false;
+    }
+    region = std::move(it->second);
+    state_->shared.erase(it);
+    state_->shared_bytes -= region->capacity();
+  }
+  // Dropped outside the lock, as dropping the last reference recycles the
+  // region, which takes it again.
+  region.reset();
+  return true;
+}
+
+void SharedMemoryPool::ReleaseAll() {
+  std::unordered_map<int64_t, std::shared_ptr<SharedMemoryRegion>> shared;
+  {
+    std::lock_guard<std::mutex> lock(state_->m);
+    shared.swap(state_->shared);
+    state_->shared_bytes = 0;
+  }
+  if (!shared.empty()) {
+    std::cerr << "Dropping " << shared.size()
+              << " shared regions the framework never released" << std::endl;
+  }
+}
+
+void SharedMemoryPool::HandleReleaseMessage(const PlatformMessage &message,
+                                            PlatformMessageResponse response) {
+  StandardMessageDecoder decoder;
+  if (!decoder.Decode(message.data, message.size) ||
+      decoder.value_count() != 1 || !Release(decoder.value(0).AsInt())) {
+    std::cerr << "Ignoring a release of an unknown shared region on "
+              << message.channel << std::endl;
+  }
+}
+
+uint64_t SharedMemoryPool::allocation_count() {
+  std::lock_guard<std::mutex> lock(state_->m);
+  return state_->allocation_count;
+}
+
+size_t SharedMemoryPool::shared_count() {
+  std::lock_guard<std::mutex> lock(state_->m);
+  return state_->shared.size();
+}
@@ -0,0 +1,305 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "include/standard_message_codec.h"
+
+#include <iostream>
+
+// Sizes below this are a single byte. Larger ones are marked by 254 for a
+// 16-bit size or 255 for a 32-bit size, which follows.
+static constexpr uint8_t kSize16 = 254;
+static constexpr uint8_t kSize32 = 255;
+
+struct StandardMessageDecoder::Reader {
+  const uint8_t *begin;
+  const uint8_t *position;
+  const uint8_t *end;
+
+  size_t remaining() const { return end - position; }
+
+  template <typename T>
+  bool Read(T *value) {
+    if (remaining() < sizeof(T)) {
+      return false;
+    }
+    memcpy(value, position, sizeof(T));
+    position += sizeof(T);
+    return true;
+  }
+
+  bool ReadSize(size_t *size) {
+    uint8_t byte;
+    if (!Read(&byte)) {
+      return false;
+    }
+    if (byte < kSize16) {
+      *size = byte;
+    } else if (byte == kSize16) {
+      uint16_t value;
+      if (!Read(&value)) {
+        return false;
+      }
+      *size = value;
+    } else {
+      uint32_t value;
+      if (!Read(&value)) {
+        return false;
+      }
+      *size = value;
+    }
+    return true;
+  }
+
+  // Skips padding up to a multiple of |alignment| from the message start.
+  bool Align(size_t alignment) {
+    size_t offset = (position - begin) % alignment;
+    if (offset == 0) {
+      return true;
+    }
+    if (remaining() < alignment - offset) {
+      return false;
+    }
+    position += alignment - offset;
+    return true;
+  }
+
+  // Skips |count| elements of |element_size| bytes, aligned to their size.
+  bool Skip(size_t count, size_t element_size) {
+    if (!Align(element_size) || count > remaining() / element_size) {
+      return false;
+    }
+    position += count * element_size;
+    return true;
+  }
+};
+
+// Returns the element size of typed data and strings of |type|, or 0 for
+// other types.
+static size_t get_element_size(StandardType type) {
+  switch (type) {
+    case StandardType::kLargeInt:
+    case StandardType::kString:
+    case StandardType::kUint8List:
+      return 1;
+    case StandardType::kInt32List:
+    case StandardType::kFloat32List:
+      return 4;
+    case StandardType::kInt64List:
+    case StandardType::kFloat64List:
+      return 8;
+    default:
+      return 0;
+  }
+}
+
+const StandardValue *StandardValue::Find(const char *key) const {
+  if (type_ != StandardType::kMap) {
+    return nullptr;
+  }
+  for (size_t i = 0; i < size_; ++i) {
+    if (MapKey(i).StringEquals(key)) {
+      return &MapValue(i);
+    }
+  }
+  return nullptr;
+}
+
+bool StandardMessageDecoder::Decode(const uint8_t *data, size_t size) {
+  value_count_ = 0;
+  // Checks and counts everything first, so that |values_| is sized once and
+  // the values can point at each other.
+  Reader reader = {data, data, data + size};
+  size_t top_level_count = 0;
+  size_t count = 0;
+  while (reader.remaining() > 0) {
+    ++top_level_count;
+    ++count;
+    if (!Scan(&reader, 0, &count)) {
+      std::cerr << "Malformed standard codec message at byte "
+                << reader.position - data << " of " << size << std::endl;
+      return false;
+    }
+  }
+  values_.resize(count);
+  reader.position = data;
+  next_value_ = top_level_count;
+  for (size_t i = 0; i < top_level_count; ++i) {
+    Read(&reader, &values_[i]);
+  }
+  value_count_ = top_level_count;
+  return true;
+}
+
+bool StandardMessageDecoder::Scan(Reader *reader, int depth, size_t *count) {
+  uint8_t type_byte;
+  if (!reader->Read(&type_byte)) {
+    return false;
+  }
+  StandardType type = static_cast<StandardType>(type_byte);
+  size_t size;
+  switch (type) {
+    case StandardType::kNull:
+    case StandardType::kTrue:
+    case StandardType::kFalse:
+      return true;
+    // Integers are not aligned, unlike doubles and typed data.
+    case StandardType::kInt32:
+      return reader->Skip(4, 1);
+    case StandardType::kInt64:
+      return reader->Skip(8, 1);
+    case StandardType::kFloat64:
+      return reader->Skip(1, 8);
+    case StandardType::kLargeInt:
+    case StandardType::kString:
+    case StandardType::kUint8List:
+    case StandardType::kInt32List:
+    case StandardType::kInt64List:
+    case StandardType::kFloat32List:
+    case StandardType::kFloat64List:
+      return reader->ReadSize(&size) &&
+             reader->Skip(size, get_element_size(type));
+    case StandardType::kList:
+    case StandardType::kMap:
+      if (depth >= kMaxDepth || !reader->ReadSize(&size)) {
+        return false;
+      }
+      if (type == StandardType::kMap) {
+        size *= 2;
+      }
+      // Every value takes at least a byte, which bounds what a malformed size
+      // can make the decoder allocate.
+      if (size > reader->remaining()) {
+        return false;
+      }
+      *count += size;
+      for (size_t i = 0; i < size; ++i) {
+        if (!Scan(reader, depth + 1, count)) {
+          return false;
+        }
+      }
+      return true;
+  }
+  return false;
+}
+
+void StandardMessageDecoder::Read(Reader *reader, StandardValue *value) {
+  // Scan checked the value, so none of the reads below fail.
+  uint8_t type_byte = 0;
+  reader->Read(&type_byte);
+  value->type_ = static_cast<StandardType>(type_byte);
+  value->size_ = 0;
+  value->int_value_ = 0;
+  switch (value->type_) {
+    case StandardType::kNull:
+    case StandardType::kTrue:
+    case StandardType::kFalse:
+      break;
+    case StandardType::kInt32: {
+      int32_t int_value = 0;
+      reader->Read(&int_value);
+      value->int_value_ = int_value;
+      break;
+    }
+    case StandardType::kInt64:
+      reader->Read(&value->int_value_);
+      break;
+    case StandardType::kFloat64:
+      reader->Align(8);
+      reader->Read(&value->double_value_);
+      break;
+    case StandardType::kLargeInt:
+    case StandardType::kString:
+    case StandardType::kUint8List:
+    case StandardType::kInt32List:
+    case StandardType::kInt64List:
+    case StandardType::kFloat32List:
+    case StandardType::kFloat64List: {
+      size_t element_size = get_element_size(value->type_);
+      reader->ReadSize(&value->size_);
+      reader->Align(element_size);
+      value->bytes_ = reader->position;
+      reader->position += value->size_ * element_size;
+      break;
+    }
+    case StandardType::kList:
+    case StandardType::kMap: {
+      reader->ReadSize(&value->size_);
+      size_t count =
+          value->type_ == StandardType::kMap ? value->size_ * 2 : value->size_;
+      StandardValue *children = values_.data() + next_value_;
+      next_value_ += count;
+      value->children_ = children;
+      for (size_t i = 0; i < count; ++i) {
+        Read(reader, &children[i]);
+      }
+      break;
+    }
+  }
+}
+
+void StandardMessageEncoder::WriteInt(int64_t value) {
+  if (value >= INT32_MIN && value <= INT32_MAX) {
+    WriteType(StandardType::kInt32);
+    int32_t int_value = static_cast<int32_t>(value);
+    WriteBytes(&int_value, sizeof(int_value));
+  } else {
+    WriteType(StandardType::kInt64);
+    WriteBytes(&value, sizeof(value));
+  }
+}
+
+void StandardMessageEncoder::WriteDouble(double value) {
+  WriteType(StandardType::kFloat64);
+  Align(8);
+  WriteBytes(&value, sizeof(value));
+}
+
+void StandardMessageEncoder::WriteString(const char *string, size_t size) {
+  WriteType(StandardType::kString);
+  if (WriteSize(size)) {
+    WriteBytes(string, size);
+  }
+}
+
+bool StandardMessageEncoder::WriteSize(size_t size) {
+  if (size > UINT32_MAX) {
+    std::cerr << "Cannot encode a size of " << size
+              << " in a standard codec message" << std::endl;
+    ok_ = false;
+    return false;
+  }
+  if (size < kSize16) {
+    buffer_.push_back(static_cast<uint8_t>(size));
+  } else if (size <= UINT16_MAX) {
+    buffer_.push_back(kSize16);
+    uint16_t value = static_cast<uint16_t>(size);
+    WriteBytes(&value, sizeof(value));
+  } else {
+    buffer_.push_back(kSize32);
+    uint32_t value = static_cast<uint32_t>(size);
+    WriteBytes(&value, sizeof(value));
+  }
+  return true;
+}
+
+void StandardMessageEncoder::WriteBytes(const void *bytes, size_t size) {
+  const uint8_t *begin = static_cast<const uint8_t *>(bytes);
+  buffer_.insert(buffer_.end(), begin, begin + size);
+}
+
+void StandardMessageEncoder::Align(size_t alignment) {
+  size_t offset = buffer_.size() % alignment;
+  if (offset != 0) {
+    buffer_.insert(buffer_.end(), alignment - offset, 0);
+  }
+}
@@ -0,0 +1,400 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A stand-in for libflutter_engine, implementing include/embedder.h without
+// running any Dart code.
+//
+// Like the real engine, it draws from its own raster thread through the
+// embedder's make_current, fbo_callback and present callbacks. Each frame
+// clears to a color that cycles over time (unless stopped through
+// FlutterStubEngineSetAnimating), marks the last pointer position, and then
+// draws a configurable number of blended fullscreen triangles as synthetic GPU
+// load.
+//
+// Configured through the environment:
+//
+// *   FLUTTER_STUB_FRAME_RATE: frames per second to draw (default 60, 0 for as
+//     fast as possible).
+// *   FLUTTER_STUB_GPU_LOAD: fullscreen triangles to draw per frame (default
+//     0).
+// *   FLUTTER_STUB_CACHE_FBO: if set to 1, asks for the framebuffer only once,
+//     as engines did before fbo_reset_after_present.
+//
+// Like the framework, it draws nothing while told on flutter/lifecycle that
+// the app is paused, until told that it resumed, apart from a single frame for
+// each change of window metrics.
+//
+// A summary of what the engine did is printed to stderr on shutdown.
+#include "stub_engine/flutter_engine_stub.h"
+
+#include <epoxy/gl.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "include/graphics.h"
+
+namespace {
+
+constexpr char kVertexShader[] = R"glsl(#version 100
+attribute vec2 position;
+void main() {
+  gl_Position = vec4(position, 0.0, 1.0);
+}
+)glsl";
+
+constexpr char kFragmentShader[] = R"glsl(#version 100
+precision mediump float;
+uniform vec4 color;
+void main() {
+  gl_FragColor = color;
+}
+)glsl";
+
+// The channel the embedder sends app lifecycle changes on, and the state in
+// which nothing is drawn.
+constexpr char kLifecycleChannel[] = "flutter/lifecycle";
+constexpr char kLifecyclePaused[] = "AppLifecycleState.paused";
+
+// Half the size of the square drawn at the last pointer position.
+constexpr GLint kPointerMarkerRadius = 4;
+
+// See FlutterStubEngineLastPresentTime.
+std::atomic<int64_t> last_present_time_us(0);
+
+// See FlutterStubEngineSetAnimating.
+std::atomic<bool> animating(true);
+
+int64_t GetSteadyClockMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Returns the integer value of the environment variable |name|, or
+// |default_value| if it is not set.
+long GetEnvInt(const char *name, long default_value) {
+  const char *value = getenv(name);
+  return value != nullptr && value[0] != '\0' ? strtol(value, nullptr, 10)
+                                              : default_value;
+}
+
+// Returns the program drawing the synthetic load, or 0 if it failed to build
+// (in which case the load is drawn with clears instead).
+GLuint CreateLoadProgram() {
+  GLuint vertex_shader = CompileShader(GL_VERTEX_SHADER, kVertexShader);
+  GLuint fragment_shader = CompileShader(GL_FRAGMENT_SHADER, kFragmentShader);
+  GLuint program = LinkProgram(vertex_shader, fragment_shader, "position");
+  if (program == 0) {
+    std::cerr << "Stub engine: unable to build the load program, drawing "
+                 "clears instead."
+              << std::endl;
+  }
+  return program;
+}
+
+}  // namespace
+
+struct _FlutterEngine {
+  FlutterOpenGLRendererConfig config;
+  void *user_data;
+
+  // Read once from the environment by FlutterEngineRun.
+  std::chrono::microseconds frame_interval;
+  long gpu_load;
+  bool cache_fbo;
+
+  std::thread raster_thread;
+  std::atomic<bool> running;
+
+  // Guards the state sent by the embedder, which the raster thread reads.
+  std::mutex metrics_m;
+  size_t width;
+  size_t height;
+  double pointer_x;
+  double pointer_y;
+  bool pointer_down;
+  // Whether the app is paused, until which the raster thread is woken up,
+  // and whether a frame is to be drawn regardless, as the framework forces one
+  // when the window metrics change.
+  bool paused;
+  bool forced_frame;
+  std::condition_variable resumed_cv;
+
+  std::atomic<uint64_t> frame_count;
+  std::atomic<uint64_t> fbo_callback_count;
+  std::atomic<uint64_t> metrics_event_count;
+  std::atomic<uint64_t> pointer_event_count;
+  std::atomic<uint64_t> pointer_send_count;
+  std::atomic<uint64_t> platform_message_count;
+  // Total time spent in the present callback, in microseconds.
+  std::atomic<uint64_t> present_time_us;
+
+  void RasterLoop();
+  void DrawFrame(GLuint program, GLuint vertex_buffer, uint64_t frame);
+};
+
+void _FlutterEngine::RasterLoop() {
+  config.make_current(user_data);
+  GLuint program = gpu_load > 0 ? CreateLoadProgram() : 0;
+  GLuint vertex_buffer = 0;
+  if (program != 0) {
+    static constexpr GLfloat kVertices[] = {-1.0f, -1.0f, 3.0f,
+                                            -1.0f, -1.0f, 3.0f};
+    glGenBuffers(1, &vertex_buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(kVertices), kVertices,
+                 GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+
+  uint32_t fbo = 0;
+  bool has_fbo = false;
+  auto next_frame = std::chrono::steady_clock::now();
+  while (running) {
+    if (frame_interval.count() > 0) {
+      next_frame += frame_interval;
+      auto now = std::chrono::steady_clock::now();
+      if (next_frame < now) {
+        // Fell behind, so skip ahead rather than drawing a burst of frames.
+        next_frame = now;
+      }
+      std::this_thread::sleep_until(next_frame);
+    }
+    {
+      // Like the engine, nothing is drawn until the window size is known, or
+      // while the app is paused.
+      std::unique_lock<std::mutex> lock(metrics_m);
+      resumed_cv.wait(lock,
+                      [this] { return !paused || forced_frame || !running; });
+      forced_frame = false;
+      if (width == 0 || height == 0) {
+        continue;
+      }
+    }
+    if (!has_fbo || !cache_fbo) {
+      fbo = config.fbo_callback(user_data);
+      has_fbo = true;
+      ++fbo_callback_count;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    DrawFrame(program, vertex_buffer, frame_count);
+
+    int64_t present_start = GetSteadyClockMicros();
+    config.present(user_data);
+    int64_t present_end = GetSteadyClockMicros();
+    last_present_time_us = present_end;
+    present_time_us += present_end - present_start;
+    ++frame_count;
+  }
+
+  if (program != 0) {
+    glDeleteProgram(program);
+    glDeleteBuffers(1, &vertex_buffer);
+  }
+  config.clear_current(user_data);
+}
+
+void _FlutterEngine::DrawFrame(GLuint program, GLuint vertex_buffer,
+                               uint64_t frame) {
+  GLsizei frame_width;
+  GLsizei frame_height;
+  GLint marker_x;
+  GLint marker_y;
+  bool marker_visible;
+  {
+    std::lock_guard<std::mutex> lock(metrics_m);
+    frame_width = static_cast<GLsizei>(width);
+    frame_height = static_cast<GLsizei>(height);
+    // Pointer coordinates start from the top, framebuffer ones from the bottom.
+    marker_x = static_cast<GLint>(pointer_x);
+    marker_y = frame_height - static_cast<GLint>(pointer_y);
+    marker_visible = pointer_down;
+  }
+  glViewport(0, 0, frame_width, frame_height);
+
+  float phase = animating ? static_cast<float>(frame % 120) / 120.0f : 0.0f;
+  glClearColor(phase, 0.5f, 1.0f - phase, 1.0f);
+  glClearDepthf(1.0f);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+  if (program != 0) {
+    glUseProgram(program);
+    glUniform4f(glGetUniformLocation(program, "color"), 1.0f, 1.0f, 1.0f,
+                1.0f / 64.0f);
+    glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, nullptr);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    for (long i = 0; i < gpu_load; ++i) {
+      glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+    glDisable(GL_BLEND);
+    glDisableVertexAttribArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glUseProgram(0);
+  } else {
+    for (long i = 0; i < gpu_load; ++i) {
+      glClear(GL_COLOR_BUFFER_BIT);
+    }
+  }
+
+  if (marker_visible) {
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(marker_x - kPointerMarkerRadius, marker_y - kPointerMarkerRadius,
+              2 * kPointerMarkerRadius, 2 * kPointerMarkerRadius);
+    glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glDisable(GL_SCISSOR_TEST);
+  }
+}
+
+FlutterResult FlutterEngineRun(size_t version,
+                               const FlutterRendererConfig *config,
+                               const FlutterProjectArgs *args, void *user_data,
+                               FlutterEngine *engine_out) {
+  if (version != FLUTTER_ENGINE_VERSION) {
+    return kInvalidLibraryVersion;
+  }
+  if (config == nullptr || args == nullptr || engine_out == nullptr ||
+      config->type != kOpenGL) {
+    return kInvalidArguments;
+  }
+  const FlutterOpenGLRendererConfig &open_gl = config->open_gl;
+  if (open_gl.make_current == nullptr || open_gl.clear_current == nullptr ||
+      open_gl.present == nullptr || open_gl.fbo_callback == nullptr) {
+    return kInvalidArguments;
+  }
+
+  auto engine = new _FlutterEngine();
+  engine->config = open_gl;
+  engine->user_data = user_data;
+  long frame_rate = GetEnvInt("FLUTTER_STUB_FRAME_RATE", 60);
+  engine->frame_interval = std::chrono::microseconds(
+      frame_rate > 0 ? 1000 * 1000 / frame_rate : 0);
+  engine->gpu_load = GetEnvInt("FLUTTER_STUB_GPU_LOAD", 0);
+  engine->cache_fbo = GetEnvInt("FLUTTER_STUB_CACHE_FBO", 0) != 0 ||
+                      !open_gl.fbo_reset_after_present;
+  engine->width = 0;
+  engine->height = 0;
+  engine->pointer_x = 0.0;
+  engine->pointer_y = 0.0;
+  engine->pointer_down = false;
+  engine->paused = false;
+  engine->forced_frame = false;
+  engine->running = true;
+  engine->raster_thread = std::thread(&_FlutterEngine::RasterLoop, engine);
+  *engine_out = engine;
+  return kSuccess;
+}
+
+FlutterResult FlutterEngineShutdown(FlutterEngine engine) {
+  if (engine == nullptr) {
+    return kInvalidArguments;
+  }
+  {
+    std::lock_guard<std::mutex> lock(engine->metrics_m);
+    engine->running = false;
+  }
+  engine->resumed_cv.notify_all();
+  engine->raster_thread.join();
+  uint64_t frames = engine->frame_count;
+  std::cerr << "Stub engine: " << frames << " frames, "
+            << engine->fbo_callback_count << " fbo callbacks, "
+            << engine->metrics_event_count << " metrics events, "
+            << engine->pointer_event_count << " pointer events in "
+            << engine->pointer_send_count << " calls, "
+            << engine->platform_message_count << " platform messages";
+  if (frames > 0) {
+    std::cerr << ", " << engine->present_time_us / frames
+              << "us mean present";
+  }
+  std::cerr << "." << std::endl;
+  delete engine;
+  return kSuccess;
+}
+
+FlutterResult FlutterEngineSendWindowMetricsEvent(
+    FlutterEngine engine, const FlutterWindowMetricsEvent *event) {
+  if (engine == nullptr || event == nullptr) {
+    return kInvalidArguments;
+  }
+  {
+    std::lock_guard<std::mutex> lock(engine->metrics_m);
+    engine->width = event->width;
+    engine->height = event->height;
+    engine->forced_frame = true;
+    ++engine->metrics_event_count;
+  }
+  engine->resumed_cv.notify_all();
+  return kSuccess;
+}
+
+FlutterResult FlutterEngineSendPointerEvent(FlutterEngine engine,
+                                            const FlutterPointerEvent *events,
+                                            size_t events_count) {
+  if (engine == nullptr || events == nullptr) {
+    return kInvalidArguments;
+  }
+  std::lock_guard<std::mutex> lock(engine->metrics_m);
+  for (size_t i = 0; i < events_count; ++i) {
+    engine->pointer_x = events[i].x;
+    engine->pointer_y = events[i].y;
+    engine->pointer_down =
+        events[i].phase == kDown || events[i].phase == kMove;
+  }
+  engine->pointer_event_count += events_count;
+  ++engine->pointer_send_count;
+  return kSuccess;
+}
+
+FlutterResult FlutterEngineSendPlatformMessage(
+    FlutterEngine engine, const FlutterPlatformMessage *message) {
+  if (engine == nullptr || message == nullptr) {
+    return kInvalidArguments;
+  }
+  ++engine->platform_message_count;
+  if (message->channel != nullptr &&
+      strcmp(message->channel, kLifecycleChannel) == 0) {
+    std::string state(reinterpret_cast<const char *>(message->message),
+                      message->message_size);
+    {
+      std::lock_guard<std::mutex> lock(engine->metrics_m);
+      engine->paused = state == kLifecyclePaused;
+    }
+    engine->resumed_cv.notify_all();
+  }
+  return kSuccess;
+}
+
+FlutterResult FlutterEngineSendPlatformMessageResponse(
+    FlutterEngine engine, const FlutterPlatformMessageResponseHandle *handle,
+    const uint8_t *data, size_t data_length) {
+  if (engine == nullptr || handle == nullptr) {
+    return kInvalidArguments;
+  }
+  return kSuccess;
+}
+
+int64_t FlutterStubEngineLastPresentTime() { return last_present_time_us; }
+
+void FlutterStubEngineSetAnimating(bool value) { animating = value; }
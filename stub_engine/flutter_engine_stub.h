@@ -0,0 +1,39 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef LINUX_STUB_ENGINE_FLUTTER_ENGINE_STUB_H_
+#define LINUX_STUB_ENGINE_FLUTTER_ENGINE_STUB_H_
+#include <stdint.h>
+
+#include "include/embedder.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+// Returns when the present callback last returned to the stub engine, in
+// microseconds of std::chrono::steady_clock (CLOCK_MONOTONIC), or 0 if it never
+// has. Only meaningful with a single engine running.
+FLUTTER_EXPORT
+int64_t FlutterStubEngineLastPresentTime(void);
+
+// Sets whether the clear color of each frame cycles over time (the default),
+// or stays the same so that frames are unchanged while the pointer is still.
+FLUTTER_EXPORT
+void FlutterStubEngineSetAnimating(bool animating);
+
+#if defined(__cplusplus)
+}  // extern "C"
+#endif
+
+#endif  // LINUX_STUB_ENGINE_FLUTTER_ENGINE_STUB_H_
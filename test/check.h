@@ -0,0 +1,39 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef LINUX_TEST_CHECK_H_
+#define LINUX_TEST_CHECK_H_
+#include <cmath>
+#include <iostream>
+
+// Minimal checks for the tests in test/, which build without GTK or a test
+// framework. Failures are logged and counted, and the test's
+// main returns TEST_RESULT().
+static int test_failure_count = 0;
+
+#define EXPECT_TRUE(condition)                                             \
+  do {                                                                     \
+    if (!(condition)) {                                                    \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": expected " #condition \
+                << std::endl;                                              \
+      ++test_failure_count;                                                \
+    }                                                                      \
+  } while (false)
+
+#define EXPECT_EQ(expected, actual) EXPECT_TRUE((expected) == (actual))
+
+#define EXPECT_NEAR(expected, actual, tolerance) \
+  EXPECT_TRUE(std::fabs((expected) - (actual)) <= (tolerance))
+
+#define TEST_RESULT() (test_failure_count == 0 ? 0 : 1)
+#endif  // LINUX_TEST_CHECK_H_
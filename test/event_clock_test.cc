@@ -0,0 +1,64 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "include/event_clock_inline.h"
+
+#include "test/check.h"
+
+namespace {
+
+// Events keep the spacing of their own times, offset by the smallest delivery
+// latency seen.
+void TestKeepsEventSpacing() {
+  EventClock clock;
+  EXPECT_EQ(5000000, clock.ToMonotonic(1000, 5000000));
+  // Delivered 3ms late: the spacing of the event times is kept.
+  EXPECT_EQ(5010000, clock.ToMonotonic(1010, 5013000));
+  // Delivered sooner than the first: the offset moves, but never past now.
+  EXPECT_EQ(5019000, clock.ToMonotonic(1020, 5019000));
+  EXPECT_EQ(5029000, clock.ToMonotonic(1030, 5030000));
+}
+
+// Events without a time are given the current time.
+void TestCurrentTime() {
+  EventClock clock;
+  EXPECT_EQ(1234, clock.ToMonotonic(0, 1234));
+}
+
+// 32-bit event times wrap around without going backwards.
+void TestWrapsAround() {
+  EventClock clock;
+  int64_t before = clock.ToMonotonic(UINT32_MAX - 5, 100000000);
+  int64_t after = clock.ToMonotonic(4, 100010000);
+  EXPECT_EQ(before + 10000, after);
+}
+
+// A step far outside the latency seen means a clock jumped, so the offset is
+// measured again rather than putting events in the past.
+void TestClockJump() {
+  EventClock clock;
+  clock.ToMonotonic(1000, 5000000);
+  int64_t now = 5000000 + 2 * EventClock::kMaxLatencyUs + 10000;
+  EXPECT_EQ(now, clock.ToMonotonic(1010, now));
+  EXPECT_EQ(now + 10000, clock.ToMonotonic(1020, now + 10000));
+}
+
+}  // namespace
+
+int main() {
+  TestKeepsEventSpacing();
+  TestCurrentTime();
+  TestWrapsAround();
+  TestClockJump();
+  return TEST_RESULT();
+}
@@ -0,0 +1,142 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "include/frame_mailbox_inline.h"
+
+#include <atomic>
+#include <set>
+#include <thread>
+
+#include "test/check.h"
+
+namespace {
+
+// The consumer takes the most recently published frame, and those published
+// before it are dropped.
+void TestNewestWins() {
+  FrameMailbox<int> mailbox;
+  mailbox.back() = 1;
+  EXPECT_TRUE(!mailbox.Publish());
+  mailbox.back() = 2;
+  // Frame 1 was never taken.
+  EXPECT_TRUE(mailbox.Publish());
+  mailbox.back() = 3;
+  EXPECT_TRUE(mailbox.Publish());
+  EXPECT_TRUE(mailbox.HasPublished());
+  EXPECT_TRUE(mailbox.Acquire());
+  EXPECT_EQ(3, mailbox.front());
+}
+
+// Nothing is taken until something new is published, and the frame last
+// taken stays in front.
+void TestNoStaleTake() {
+  FrameMailbox<int> mailbox;
+  EXPECT_TRUE(!mailbox.HasPublished());
+  EXPECT_TRUE(!mailbox.Acquire());
+
+  mailbox.back() = 1;
+  mailbox.Publish();
+  EXPECT_TRUE(mailbox.Acquire());
+  EXPECT_EQ(1, mailbox.front());
+  EXPECT_TRUE(!mailbox.HasPublished());
+  EXPECT_TRUE(!mailbox.Acquire());
+  EXPECT_EQ(1, mailbox.front());
+
+  // A frame taken is not counted as dropped when it is replaced.
+  mailbox.back() = 2;
+  EXPECT_TRUE(!mailbox.Publish());
+  EXPECT_TRUE(mailbox.Acquire());
+  EXPECT_EQ(2, mailbox.front());
+}
+
+// Each side always holds a different slot from the other and from the one
+// published, so slots are reused without either side writing to the other's.
+void TestSlotReuse() {
+  FrameMailbox<int> mailbox;
+  for (int frame = 1; frame <= 10; ++frame) {
+    int *published = &mailbox.back();
+    *published = frame;
+    mailbox.Publish();
+    EXPECT_TRUE(&mailbox.back() != published);
+    EXPECT_TRUE(&mailbox.back() != &mailbox.front());
+    // Writing the next frame does not touch the one published.
+    mailbox.back() = -1;
+    EXPECT_TRUE(mailbox.Acquire());
+    EXPECT_TRUE(&mailbox.front() == published);
+    EXPECT_EQ(frame, mailbox.front());
+    EXPECT_TRUE(&mailbox.back() != &mailbox.front());
+  }
+
+  // Slots only ever come from the three the mailbox has.
+  std::set<int *> slots;
+  for (int &slot : mailbox.slots()) {
+    slots.insert(&slot);
+  }
+  EXPECT_EQ(FrameMailbox<int>::kSlotCount, slots.size());
+  EXPECT_EQ(1u, slots.count(&mailbox.back()));
+  EXPECT_EQ(1u, slots.count(&mailbox.front()));
+}
+
+// A producer and consumer running at once: the consumer sees frames in the
+// order they were published, each one written in full.
+void TestTwoThreads() {
+  struct Frame {
+    int sequence = 0;
+    int check = 0;
+  };
+  constexpr int kFrameCount = 200000;
+  FrameMailbox<Frame> mailbox;
+  std::atomic<bool> done(false);
+
+  std::thread producer([&] {
+    for (int sequence = 1; sequence <= kFrameCount; ++sequence) {
+      mailbox.back().sequence = sequence;
+      mailbox.back().check = -sequence;
+      mailbox.Publish();
+    }
+    done.store(true, std::memory_order_release);
+  });
+
+  int last_sequence = 0;
+  int taken = 0;
+  bool backwards = false;
+  bool torn = false;
+  while (last_sequence < kFrameCount) {
+    bool finished = done.load(std::memory_order_acquire);
+    if (mailbox.Acquire()) {
+      const Frame &frame = mailbox.front();
+      backwards |= frame.sequence <= last_sequence;
+      torn |= frame.check != -frame.sequence;
+      last_sequence = frame.sequence;
+      ++taken;
+    } else if (finished) {
+      break;
+    }
+  }
+  producer.join();
+  EXPECT_TRUE(!backwards);
+  EXPECT_TRUE(!torn);
+  // The last frame is always taken.
+  EXPECT_EQ(kFrameCount, last_sequence);
+  EXPECT_TRUE(taken > 0);
+}
+
+}  // namespace
+
+int main() {
+  TestNewestWins();
+  TestNoStaleTake();
+  TestSlotReuse();
+  TestTwoThreads();
+  return TEST_RESULT();
+}
@@ -0,0 +1,119 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "include/latency_histogram_inline.h"
+
+#include <vector>
+
+#include "test/check.h"
+
+namespace {
+
+// Returns the value the bucket holding |value| reports, by recording it below
+// a larger value so that the maximum does not clamp it.
+uint64_t Reported(int64_t value) {
+  LatencyHistogram histogram;
+  histogram.Record(value);
+  histogram.Record(value * 4 + 100);
+  return histogram.Percentile(50.0);
+}
+
+// Nothing recorded reads as zero.
+void TestEmpty() {
+  LatencyHistogram histogram;
+  EXPECT_EQ(0u, histogram.count());
+  EXPECT_EQ(0u, histogram.max());
+  EXPECT_EQ(0u, histogram.mean());
+  EXPECT_EQ(0u, histogram.Percentile(99.0));
+}
+
+// Values below the sub-bucket count are exact, and each power of two above
+// it is split into 16 buckets, the width of which doubles with each power.
+void TestBucketBoundaries() {
+  for (int64_t value = 0; value < 16; ++value) {
+    EXPECT_EQ(static_cast<uint64_t>(value), Reported(value));
+  }
+  // 16 to 31 still fit a bucket each.
+  EXPECT_EQ(16u, Reported(16));
+  EXPECT_EQ(31u, Reported(31));
+  // 32 to 63 share buckets of 2.
+  EXPECT_EQ(33u, Reported(32));
+  EXPECT_EQ(33u, Reported(33));
+  EXPECT_EQ(35u, Reported(34));
+  EXPECT_EQ(63u, Reported(63));
+  // 64 to 127 share buckets of 4.
+  EXPECT_EQ(67u, Reported(64));
+  EXPECT_EQ(67u, Reported(67));
+  EXPECT_EQ(71u, Reported(68));
+  EXPECT_EQ(127u, Reported(127));
+  // 1024 to 2047 share buckets of 64.
+  EXPECT_EQ(1087u, Reported(1024));
+  EXPECT_EQ(1151u, Reported(1088));
+}
+
+// The minimum, maximum and mean, with negative values clamped to 0.
+void TestMinMax() {
+  LatencyHistogram histogram;
+  histogram.Record(-5);
+  histogram.Record(1000);
+  histogram.Record(123456);
+  EXPECT_EQ(3u, histogram.count());
+  EXPECT_EQ(0u, histogram.Percentile(0.0));
+  // The largest value is reported exactly, not as its bucket's bound.
+  EXPECT_EQ(123456u, histogram.max());
+  EXPECT_EQ(123456u, histogram.Percentile(100.0));
+  EXPECT_EQ((1000u + 123456u) / 3, histogram.mean());
+
+  histogram.Reset();
+  EXPECT_EQ(0u, histogram.count());
+  EXPECT_EQ(0u, histogram.max());
+  histogram.Record(7);
+  EXPECT_EQ(7u, histogram.Percentile(0.0));
+  EXPECT_EQ(7u, histogram.max());
+}
+
+// Percentiles are never below the true value, and at most 1/16 above it.
+void TestPercentileError() {
+  LatencyHistogram histogram;
+  std::vector<int64_t> values;
+  for (int64_t value = 1; value <= 100000; value += 7) {
+    values.push_back(value);
+    histogram.Record(value);
+  }
+  for (double percentile : {1.0, 10.0, 50.0, 90.0, 99.0, 99.9}) {
+    size_t rank = static_cast<size_t>(percentile / 100.0 * values.size() + 0.5);
+    double expected = static_cast<double>(values[rank - 1]);
+    double reported = static_cast<double>(histogram.Percentile(percentile));
+    EXPECT_TRUE(reported >= expected);
+    EXPECT_TRUE(reported <=
+                expected * (1.0 + 1.0 / LatencyHistogram::kSubBucketCount));
+  }
+
+  // The same holds across many powers of two.
+  for (int64_t value = 1; value < (INT64_C(1) << 40); value = value * 3 + 1) {
+    double reported = static_cast<double>(Reported(value));
+    EXPECT_TRUE(reported >= value);
+    EXPECT_TRUE(reported <=
+                value * (1.0 + 1.0 / LatencyHistogram::kSubBucketCount));
+  }
+}
+
+}  // namespace
+
+int main() {
+  TestEmpty();
+  TestBucketBoundaries();
+  TestMinMax();
+  TestPercentileError();
+  return TEST_RESULT();
+}
@@ -0,0 +1,126 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "include/pointer_event_queue_inline.h"
+
+#include "test/check.h"
+
+namespace {
+
+FlutterPointerEvent MakeEvent(FlutterPointerPhase phase, double x,
+                              size_t timestamp) {
+  FlutterPointerEvent event = {};
+  event.struct_size = sizeof(event);
+  event.phase = phase;
+  event.x = x;
+  event.y = x * 2;
+  event.timestamp = timestamp;
+  return event;
+}
+
+// Consecutive moves are replaced by the latest one.
+void TestCoalescesMoves() {
+  PointerEventQueue queue;
+  EXPECT_TRUE(queue.empty());
+  EXPECT_TRUE(queue.Push(MakeEvent(kMove, 1.0, 1000)));
+  EXPECT_TRUE(queue.Push(MakeEvent(kMove, 2.0, 2000)));
+  EXPECT_TRUE(queue.Push(MakeEvent(kMove, 3.0, 3000)));
+  EXPECT_EQ(1u, queue.size());
+  EXPECT_EQ(3.0, queue.data()[0].x);
+  EXPECT_EQ(6.0, queue.data()[0].y);
+  EXPECT_EQ(3000u, queue.data()[0].timestamp);
+  EXPECT_EQ(2u, queue.coalesced_count());
+}
+
+// Moves are never merged across a press, release or cancel, so the position
+// each one happened at is kept.
+void TestKeepsMovesAroundButtons() {
+  PointerEventQueue queue;
+  for (FlutterPointerPhase phase : {kDown, kUp, kCancel}) {
+    queue.Clear();
+    queue.Push(MakeEvent(kMove, 1.0, 1000));
+    queue.Push(MakeEvent(phase, 2.0, 2000));
+    queue.Push(MakeEvent(kMove, 3.0, 3000));
+    EXPECT_EQ(3u, queue.size());
+    EXPECT_EQ(1.0, queue.data()[0].x);
+    EXPECT_EQ(3.0, queue.data()[2].x);
+  }
+  EXPECT_EQ(0u, queue.coalesced_count());
+
+  // Presses and releases are never merged with each other either.
+  queue.Clear();
+  queue.Push(MakeEvent(kDown, 1.0, 1000));
+  queue.Push(MakeEvent(kDown, 1.0, 1000));
+  queue.Push(MakeEvent(kUp, 1.0, 2000));
+  queue.Push(MakeEvent(kUp, 1.0, 2000));
+  EXPECT_EQ(4u, queue.size());
+}
+
+// A full queue refuses anything it cannot coalesce, and keeps what it holds.
+void TestCapacity() {
+  PointerEventQueue queue;
+  for (size_t i = 0; i < PointerEventQueue::kCapacity; ++i) {
+    EXPECT_TRUE(queue.Push(
+        MakeEvent(i % 2 == 0 ? kDown : kUp, static_cast<double>(i), i)));
+  }
+  EXPECT_EQ(PointerEventQueue::kCapacity, queue.size());
+  EXPECT_TRUE(!queue.Push(MakeEvent(kDown, -1.0, 0)));
+  // The last event is a release, so a move is not coalesced either.
+  EXPECT_TRUE(!queue.Push(MakeEvent(kMove, -1.0, 0)));
+  EXPECT_EQ(PointerEventQueue::kCapacity, queue.size());
+  EXPECT_EQ(127.0, queue.back().x);
+
+  // A move still coalesces into a move at the end of a full queue.
+  queue.back() = MakeEvent(kMove, 200.0, 200);
+  EXPECT_TRUE(queue.Push(MakeEvent(kMove, 300.0, 300)));
+  EXPECT_EQ(PointerEventQueue::kCapacity, queue.size());
+  EXPECT_EQ(300.0, queue.back().x);
+
+  // Clearing empties the queue for the next batch.
+  queue.Clear();
+  EXPECT_TRUE(queue.empty());
+  EXPECT_TRUE(queue.Push(MakeEvent(kDown, 1.0, 1000)));
+  EXPECT_EQ(1u, queue.size());
+}
+
+// The batch holds events in the order they were queued, each move at the
+// latest position before the next press or release.
+void TestBatchOrder() {
+  PointerEventQueue queue;
+  queue.Push(MakeEvent(kMove, 1.0, 1000));
+  queue.Push(MakeEvent(kMove, 2.0, 2000));
+  queue.Push(MakeEvent(kDown, 3.0, 3000));
+  queue.Push(MakeEvent(kMove, 4.0, 4000));
+  queue.Push(MakeEvent(kMove, 5.0, 5000));
+  queue.Push(MakeEvent(kUp, 6.0, 6000));
+  queue.Push(MakeEvent(kMove, 7.0, 7000));
+
+  const FlutterPointerPhase phases[] = {kMove, kDown, kMove, kUp, kMove};
+  const double xs[] = {2.0, 3.0, 5.0, 6.0, 7.0};
+  EXPECT_EQ(5u, queue.size());
+  for (size_t i = 0; i < 5 && i < queue.size(); ++i) {
+    EXPECT_EQ(phases[i], queue.data()[i].phase);
+    EXPECT_EQ(xs[i], queue.data()[i].x);
+  }
+  EXPECT_EQ(2u, queue.coalesced_count());
+}
+
+}  // namespace
+
+int main() {
+  TestCoalescesMoves();
+  TestKeepsMovesAroundButtons();
+  TestCapacity();
+  TestBatchOrder();
+  return TEST_RESULT();
+}
@@ -0,0 +1,105 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "include/pointer_resampler_inline.h"
+
+#include "test/check.h"
+
+namespace {
+
+FlutterPointerEvent MakeMove(double x, double y, int64_t timestamp) {
+  FlutterPointerEvent event = {};
+  event.struct_size = sizeof(event);
+  event.phase = kMove;
+  event.x = x;
+  event.y = y;
+  event.timestamp = timestamp;
+  return event;
+}
+
+// A single move is sent as received.
+void TestNeedsTwoMoves() {
+  PointerResampler resampler;
+  EXPECT_TRUE(!resampler.has_sample());
+  FlutterPointerEvent move = MakeMove(10.0, 20.0, 1000);
+  resampler.AddSample(move);
+  EXPECT_TRUE(resampler.has_sample());
+  EXPECT_TRUE(!resampler.Resample(&move, 100000));
+  EXPECT_EQ(1000, move.timestamp);
+}
+
+// A time between the last two moves is interpolated, latency included.
+void TestInterpolates() {
+  PointerResampler resampler;
+  resampler.AddSample(MakeMove(0.0, 0.0, 10000));
+  FlutterPointerEvent move = MakeMove(100.0, 50.0, 20000);
+  resampler.AddSample(move);
+  EXPECT_TRUE(resampler.Resample(
+      &move, 15000 + PointerResampler::kResampleLatencyUs));
+  EXPECT_NEAR(50.0, move.x, 1e-9);
+  EXPECT_NEAR(25.0, move.y, 1e-9);
+  EXPECT_EQ(15000, move.timestamp);
+  // The move as received is kept, to be sent once the pointer stops.
+  EXPECT_EQ(20000, resampler.latest().timestamp);
+  EXPECT_NEAR(100.0, resampler.latest().x, 1e-9);
+}
+
+// Times past the last move are never extrapolated to, so neither the position
+// nor the timestamp gets ahead of the moves received.
+void TestNeverExtrapolates() {
+  PointerResampler resampler;
+  resampler.AddSample(MakeMove(0.0, 0.0, 10000));
+  FlutterPointerEvent move = MakeMove(100.0, 0.0, 20000);
+  resampler.AddSample(move);
+  EXPECT_TRUE(!resampler.Resample(
+      &move, 20000 + PointerResampler::kResampleLatencyUs));
+  EXPECT_TRUE(!resampler.Resample(&move, 100000));
+  EXPECT_NEAR(100.0, move.x, 1e-9);
+  EXPECT_EQ(20000, move.timestamp);
+}
+
+// Times before the previous move, or moves without any time between them,
+// leave the move as received.
+void TestOutOfRange() {
+  PointerResampler resampler;
+  resampler.AddSample(MakeMove(0.0, 0.0, 10000));
+  FlutterPointerEvent move = MakeMove(100.0, 0.0, 20000);
+  resampler.AddSample(move);
+  EXPECT_TRUE(!resampler.Resample(&move, 10000));
+  resampler.AddSample(move);
+  EXPECT_TRUE(!resampler.Resample(
+      &move, 20000 + PointerResampler::kResampleLatencyUs - 1));
+  EXPECT_EQ(20000, move.timestamp);
+}
+
+void TestReset() {
+  PointerResampler resampler;
+  resampler.AddSample(MakeMove(0.0, 0.0, 10000));
+  FlutterPointerEvent move = MakeMove(100.0, 0.0, 20000);
+  resampler.AddSample(move);
+  resampler.Reset();
+  EXPECT_TRUE(!resampler.has_sample());
+  EXPECT_TRUE(!resampler.Resample(
+      &move, 15000 + PointerResampler::kResampleLatencyUs));
+}
+
+}  // namespace
+
+int main() {
+  TestNeedsTwoMoves();
+  TestInterpolates();
+  TestNeverExtrapolates();
+  TestOutOfRange();
+  TestReset();
+  return TEST_RESULT();
+}
@@ -0,0 +1,104 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "include/render_target_buckets_inline.h"
+
+#include <deque>
+
+#include "test/check.h"
+
+namespace {
+
+// Stands in for RenderTarget, which needs GL.
+struct Storage {
+  int width;
+  int height;
+  unsigned int depth_format;
+};
+
+constexpr unsigned int kDepth = 1;
+constexpr unsigned int kNoDepth = 0;
+
+// Sizes round up to the next multiple of 128, and empty sizes to one bucket.
+void TestRoundUp() {
+  EXPECT_EQ(128, RenderTargetBuckets::RoundUp(-1));
+  EXPECT_EQ(128, RenderTargetBuckets::RoundUp(0));
+  EXPECT_EQ(128, RenderTargetBuckets::RoundUp(1));
+  EXPECT_EQ(128, RenderTargetBuckets::RoundUp(128));
+  EXPECT_EQ(256, RenderTargetBuckets::RoundUp(129));
+  EXPECT_EQ(1920, RenderTargetBuckets::RoundUp(1920));
+  EXPECT_EQ(1152, RenderTargetBuckets::RoundUp(1080));
+}
+
+// Storage fits sizes it is at least as large as, unless more than half of it
+// would go unused.
+void TestFits() {
+  // Sizes within the bucket the storage was allocated for.
+  EXPECT_TRUE(RenderTargetBuckets::Fits(1024, 768, 1024, 768));
+  EXPECT_TRUE(RenderTargetBuckets::Fits(1024, 768, 1000, 700));
+  EXPECT_TRUE(RenderTargetBuckets::Fits(1024, 768, 897, 641));
+  // Too small along either axis.
+  EXPECT_TRUE(!RenderTargetBuckets::Fits(1024, 768, 1025, 768));
+  EXPECT_TRUE(!RenderTargetBuckets::Fits(1024, 768, 1024, 769));
+  // Exactly twice the rounded up area still fits; any more does not.
+  EXPECT_TRUE(RenderTargetBuckets::Fits(1024, 768, 512, 768));
+  EXPECT_TRUE(!RenderTargetBuckets::Fits(1024, 768, 384, 768));
+  // Rounding is what the waste is measured against, so 385 counts as 512.
+  EXPECT_TRUE(RenderTargetBuckets::Fits(1024, 768, 385, 768));
+}
+
+// Going back and forth between two sizes (e.g. maximizing) reuses the storage
+// of each, and a size nothing fits allocates.
+void TestFindReusable() {
+  std::deque<Storage> pool = {
+      {1920, 1152, kDepth},
+      {896, 640, kDepth},
+  };
+  // Maximized, then restored.
+  EXPECT_EQ(0u, RenderTargetBuckets::FindReusable(pool, 1920, 1080, kDepth));
+  EXPECT_EQ(1u, RenderTargetBuckets::FindReusable(pool, 800, 600, kDepth));
+  // Larger than all of it.
+  EXPECT_EQ(pool.size(),
+            RenderTargetBuckets::FindReusable(pool, 2560, 1440, kDepth));
+  // Smaller than half of all of it.
+  EXPECT_EQ(pool.size(),
+            RenderTargetBuckets::FindReusable(pool, 200, 200, kDepth));
+  // Storage with another depth buffer is never reused.
+  EXPECT_EQ(pool.size(),
+            RenderTargetBuckets::FindReusable(pool, 800, 600, kNoDepth));
+  // An empty pool always allocates.
+  EXPECT_EQ(0u, RenderTargetBuckets::FindReusable(std::deque<Storage>(), 800,
+                                                  600, kDepth));
+}
+
+// The most recently pooled storage that fits is picked first.
+void TestFindReusableOrder() {
+  std::deque<Storage> pool = {
+      {1024, 768, kNoDepth},
+      {1024, 768, kDepth},
+      {1152, 768, kDepth},
+  };
+  EXPECT_EQ(1u, RenderTargetBuckets::FindReusable(pool, 1000, 700, kDepth));
+  EXPECT_EQ(2u, RenderTargetBuckets::FindReusable(pool, 1100, 700, kDepth));
+  EXPECT_EQ(0u, RenderTargetBuckets::FindReusable(pool, 1000, 700, kNoDepth));
+}
+
+}  // namespace
+
+int main() {
+  TestRoundUp();
+  TestFits();
+  TestFindReusable();
+  TestFindReusableOrder();
+  return TEST_RESULT();
+}
@@ -0,0 +1,178 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "include/resolution_governor_inline.h"
+
+#include "test/check.h"
+
+namespace {
+
+constexpr int64_t kBudgetUs = 10000;
+
+ResolutionGovernorOptions MakeOptions() {
+  ResolutionGovernorOptions options;
+  options.min_scale = 0.5;
+  options.max_scale = 1.0;
+  options.step = 0.125;
+  options.frame_budget_us = kBudgetUs;
+  options.shrink_threshold = 0.9;
+  options.grow_threshold = 0.6;
+  options.window_frames = 10;
+  options.grow_windows = 3;
+  return options;
+}
+
+// Records a window of frames drawing |full_frame_us| worth of work at the full
+// resolution, scaled by the pixels drawn at the current scale. Returns whether
+// the scale changed.
+bool RunWindow(ResolutionGovernor *governor, double full_frame_us) {
+  double scale = governor->scale();
+  int64_t frame_time = static_cast<int64_t>(full_frame_us * scale * scale);
+  bool changed = false;
+  for (int i = 0; i < MakeOptions().window_frames; ++i) {
+    changed |= governor->AddFrameTime(frame_time, 0);
+  }
+  return changed;
+}
+
+// Nothing changes while disabled, or before a window is complete.
+void TestDisabledAndPartialWindow() {
+  ResolutionGovernor governor;
+  EXPECT_TRUE(!governor.AddFrameTime(100000, 0));
+  EXPECT_EQ(1.0, governor.scale());
+
+  governor.Enable(MakeOptions());
+  for (int i = 0; i < MakeOptions().window_frames - 1; ++i) {
+    EXPECT_TRUE(!governor.AddFrameTime(100000, 0));
+  }
+  EXPECT_EQ(1.0, governor.scale());
+  EXPECT_TRUE(governor.AddFrameTime(100000, 0));
+  EXPECT_TRUE(governor.scale() < 1.0);
+
+  governor.Disable();
+  EXPECT_EQ(1.0, governor.scale());
+}
+
+// Heavy load shrinks several steps at once, to the first scale predicted to
+// fit the budget, and slight overload one step at a time.
+void TestShrinksUnderLoad() {
+  ResolutionGovernor governor;
+  governor.Enable(MakeOptions());
+  // Twice the budget: sqrt(9000 / 20000) is 0.67, three steps down.
+  EXPECT_TRUE(RunWindow(&governor, 20000));
+  EXPECT_EQ(0.625, governor.scale());
+  EXPECT_EQ(1u, governor.change_count());
+  // 20000 * 0.625^2 is under the shrink threshold, so it stays.
+  EXPECT_TRUE(!RunWindow(&governor, 20000));
+  EXPECT_EQ(0.625, governor.scale());
+
+  // Load that does not get lighter with the scale takes one step at a time.
+  governor.Enable(MakeOptions());
+  const double scales[] = {0.875, 0.75, 0.625, 0.5};
+  for (double scale : scales) {
+    for (int i = 0; i < MakeOptions().window_frames; ++i) {
+      governor.AddFrameTime(9500, 0);
+    }
+    EXPECT_EQ(scale, governor.scale());
+  }
+}
+
+// The scale never goes below min_scale, however slow frames are.
+void TestClampsAtMinScale() {
+  ResolutionGovernor governor;
+  governor.Enable(MakeOptions());
+  // sqrt(9000 / 100000) is 0.3, below the minimum.
+  EXPECT_TRUE(RunWindow(&governor, 100000));
+  EXPECT_EQ(0.5, governor.scale());
+  uint64_t change_count = governor.change_count();
+  for (int window = 0; window < 5; ++window) {
+    EXPECT_TRUE(!RunWindow(&governor, 100000));
+  }
+  EXPECT_EQ(0.5, governor.scale());
+  EXPECT_EQ(change_count, governor.change_count());
+}
+
+// The scale grows one step only after grow_windows good windows in a row, and
+// a window that is not good starts the count again.
+void TestGrowsAfterGoodWindows() {
+  ResolutionGovernor governor;
+  governor.Enable(MakeOptions());
+  RunWindow(&governor, 100000);
+  EXPECT_EQ(0.5, governor.scale());
+
+  // 4000 at full resolution is under the grow threshold at every scale.
+  EXPECT_TRUE(!RunWindow(&governor, 4000));
+  EXPECT_TRUE(!RunWindow(&governor, 4000));
+  // A window between the thresholds resets the count.
+  EXPECT_TRUE(!RunWindow(&governor, 7000 / 0.25));
+  EXPECT_TRUE(!RunWindow(&governor, 4000));
+  EXPECT_TRUE(!RunWindow(&governor, 4000));
+  EXPECT_EQ(0.5, governor.scale());
+  EXPECT_TRUE(RunWindow(&governor, 4000));
+  EXPECT_EQ(0.625, governor.scale());
+
+  // Each step needs its own run of good windows.
+  for (double scale : {0.75, 0.875, 1.0}) {
+    for (int window = 0; window < MakeOptions().grow_windows - 1; ++window) {
+      EXPECT_TRUE(!RunWindow(&governor, 4000));
+    }
+    EXPECT_TRUE(RunWindow(&governor, 4000));
+    EXPECT_EQ(scale, governor.scale());
+  }
+  // And it never grows past max_scale.
+  for (int window = 0; window < 5; ++window) {
+    EXPECT_TRUE(!RunWindow(&governor, 4000));
+  }
+  EXPECT_EQ(1.0, governor.scale());
+}
+
+// Frame times right at either threshold change nothing, and a scale that would
+// go over the shrink threshold once grown is never grown to, so the scale does
+// not flip back and forth.
+void TestNoFlipFlopAtThreshold() {
+  ResolutionGovernor governor;
+  governor.Enable(MakeOptions());
+  // Exactly at the shrink threshold.
+  for (int window = 0; window < 10; ++window) {
+    EXPECT_TRUE(!RunWindow(&governor, 9000));
+  }
+  EXPECT_EQ(1.0, governor.scale());
+  EXPECT_EQ(0u, governor.change_count());
+
+  // At 0.5, 23600 takes 5900: under the grow threshold, but 9218 at 0.625,
+  // which would shrink again.
+  EXPECT_TRUE(RunWindow(&governor, 23600));
+  EXPECT_EQ(0.5, governor.scale());
+  for (int window = 0; window < 20; ++window) {
+    EXPECT_TRUE(!RunWindow(&governor, 23600));
+  }
+  EXPECT_EQ(0.5, governor.scale());
+  EXPECT_EQ(1u, governor.change_count());
+
+  // Exactly at the grow threshold is not room to grow.
+  for (int window = 0; window < 10; ++window) {
+    EXPECT_TRUE(!RunWindow(&governor, 6000 / 0.25));
+  }
+  EXPECT_EQ(0.5, governor.scale());
+}
+
+}  // namespace
+
+int main() {
+  TestDisabledAndPartialWindow();
+  TestShrinksUnderLoad();
+  TestClampsAtMinScale();
+  TestGrowsAfterGoodWindows();
+  TestNoFlipFlopAtThreshold();
+  return TEST_RESULT();
+}
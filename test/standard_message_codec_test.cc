@@ -0,0 +1,223 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "include/standard_message_codec.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "test/check.h"
+
+namespace {
+
+std::vector<uint8_t> Encoded(const StandardMessageEncoder &encoder) {
+  return std::vector<uint8_t>(encoder.data(), encoder.data() + encoder.size());
+}
+
+// Every type decodes back to what was encoded.
+void TestRoundTrip() {
+  std::vector<int32_t> ids = {1, -2, 3};
+  std::vector<double> samples = {0.5, -1.25};
+  StandardMessageEncoder encoder;
+  encoder.WriteMap(2);
+  encoder.WriteString("values");
+  encoder.WriteList(6);
+  encoder.WriteNull();
+  encoder.WriteBool(true);
+  encoder.WriteInt(-7);
+  encoder.WriteInt(INT64_C(1) << 40);
+  encoder.WriteDouble(2.5);
+  encoder.WriteTypedData(ids.data(), ids.size());
+  encoder.WriteString("samples");
+  encoder.WriteTypedData(samples.data(), samples.size());
+  EXPECT_TRUE(encoder.ok());
+
+  StandardMessageDecoder decoder;
+  EXPECT_TRUE(decoder.Decode(encoder.data(), encoder.size()));
+  EXPECT_EQ(1u, decoder.value_count());
+  const StandardValue &map = decoder.value(0);
+  EXPECT_TRUE(map.type() == StandardType::kMap);
+  EXPECT_EQ(2u, map.size());
+  EXPECT_TRUE(map.MapKey(0).StringEquals("values"));
+
+  const StandardValue *values = map.Find("values");
+  EXPECT_TRUE(values != nullptr);
+  if (values != nullptr) {
+    EXPECT_EQ(6u, values->size());
+    EXPECT_TRUE((*values)[0].IsNull());
+    EXPECT_TRUE((*values)[1].AsBool());
+    EXPECT_TRUE((*values)[2].type() == StandardType::kInt32);
+    EXPECT_EQ(-7, (*values)[2].AsInt());
+    EXPECT_TRUE((*values)[3].type() == StandardType::kInt64);
+    EXPECT_EQ(INT64_C(1) << 40, (*values)[3].AsInt());
+    EXPECT_EQ(2.5, (*values)[4].AsDouble());
+    TypedDataView<int32_t> decoded_ids = (*values)[5].AsTypedData<int32_t>();
+    EXPECT_EQ(ids.size(), decoded_ids.size());
+    for (size_t i = 0; i < ids.size() && i < decoded_ids.size(); ++i) {
+      EXPECT_EQ(ids[i], decoded_ids[i]);
+    }
+  }
+
+  TypedDataView<double> decoded_samples =
+      map.MapValue(1).AsTypedData<double>();
+  EXPECT_EQ(samples.size(), decoded_samples.size());
+  for (size_t i = 0; i < samples.size() && i < decoded_samples.size(); ++i) {
+    EXPECT_EQ(samples[i], decoded_samples[i]);
+  }
+  // Other types read as empty.
+  EXPECT_EQ(0u, map.MapValue(1).AsTypedData<float>().size());
+  EXPECT_TRUE(map.Find("missing") == nullptr);
+}
+
+// The size prefix takes 1 byte below 254, 3 bytes up to 65535, and 5 bytes
+// beyond.
+void TestSizePrefix() {
+  struct Case {
+    size_t size;
+    std::vector<uint8_t> prefix;
+  };
+  std::vector<Case> cases = {
+      {253, {253}},
+      {254, {254, 254, 0}},
+      {65535, {254, 0xff, 0xff}},
+      {65536, {255, 0, 0, 1, 0}},
+  };
+  for (const Case &test_case : cases) {
+    std::string string(test_case.size, 's');
+    StandardMessageEncoder encoder;
+    encoder.WriteString(string);
+    EXPECT_TRUE(encoder.ok());
+    std::vector<uint8_t> encoded = Encoded(encoder);
+    EXPECT_EQ(1 + test_case.prefix.size() + string.size(), encoded.size());
+    EXPECT_EQ(static_cast<uint8_t>(StandardType::kString), encoded[0]);
+    EXPECT_TRUE(std::equal(test_case.prefix.begin(), test_case.prefix.end(),
+                           encoded.begin() + 1));
+
+    StandardMessageDecoder decoder;
+    EXPECT_TRUE(decoder.Decode(encoder.data(), encoder.size()));
+    EXPECT_EQ(string.size(), decoder.value(0).string_size());
+    EXPECT_TRUE(decoder.value(0).ToString() == string);
+  }
+}
+
+// The largest size fits in the prefix, and only the prefix is checked so as
+// not to write its elements. Anything larger fails the message.
+void TestLargestSize() {
+  StandardMessageEncoder encoder;
+  encoder.WriteList(UINT32_MAX);
+  EXPECT_TRUE(encoder.ok());
+  std::vector<uint8_t> expected = {
+      static_cast<uint8_t>(StandardType::kList), 255, 0xff, 0xff, 0xff, 0xff};
+  EXPECT_TRUE(Encoded(encoder) == expected);
+
+  if (sizeof(size_t) > sizeof(uint32_t)) {
+    encoder.Clear();
+    encoder.WriteList(static_cast<size_t>(UINT32_MAX) + 1);
+    EXPECT_TRUE(!encoder.ok());
+    // Clearing starts a message that can succeed again.
+    encoder.Clear();
+    encoder.WriteNull();
+    EXPECT_TRUE(encoder.ok());
+  }
+}
+
+// Elements of type T are padded to their size relative to the start of the
+// message, after a prefix of every length modulo it.
+template <typename T>
+void TestTypedDataAlignment() {
+  std::vector<T> elements = {1, 2, 3};
+  for (size_t offset = 0; offset < sizeof(T); ++offset) {
+    std::string prefix(offset, 'p');
+    StandardMessageEncoder encoder;
+    encoder.WriteList(2);
+    encoder.WriteString(prefix);
+    encoder.WriteTypedData(elements.data(), elements.size());
+    EXPECT_TRUE(encoder.ok());
+    // List type and size, string type, size and bytes, then the elements'
+    // type and size.
+    size_t unpadded = 2 + 2 + prefix.size() + 2;
+    size_t padded = (unpadded + sizeof(T) - 1) / sizeof(T) * sizeof(T);
+    EXPECT_EQ(padded + elements.size() * sizeof(T), encoder.size());
+
+    // A vector's storage is aligned for any of the element types.
+    std::vector<uint8_t> message = Encoded(encoder);
+    StandardMessageDecoder decoder;
+    EXPECT_TRUE(decoder.Decode(message.data(), message.size()));
+    TypedDataView<T> view = decoder.value(0)[1].AsTypedData<T>();
+    EXPECT_EQ(message.data() + padded, view.bytes());
+    EXPECT_TRUE(view.data() != nullptr);
+    EXPECT_EQ(elements.size(), view.size());
+    for (size_t i = 0; i < elements.size() && i < view.size(); ++i) {
+      EXPECT_EQ(elements[i], view[i]);
+    }
+  }
+}
+
+// Doubles are padded to 8 bytes in the same way.
+void TestDoubleAlignment() {
+  for (size_t offset = 0; offset < 8; ++offset) {
+    std::string prefix(offset, 'p');
+    StandardMessageEncoder encoder;
+    encoder.WriteList(2);
+    encoder.WriteString(prefix);
+    encoder.WriteDouble(offset + 0.25);
+    size_t unpadded = 2 + 2 + prefix.size() + 1;
+    EXPECT_EQ((unpadded + 7) / 8 * 8 + 8, encoder.size());
+
+    StandardMessageDecoder decoder;
+    EXPECT_TRUE(decoder.Decode(encoder.data(), encoder.size()));
+    EXPECT_EQ(offset + 0.25, decoder.value(0)[1].AsDouble());
+  }
+}
+
+// A message that is not aligned in memory still decodes, with its typed data
+// read through indexing, and copied into another message.
+void TestUnalignedMessage() {
+  std::vector<double> samples = {1.5, 2.5, 3.5};
+  StandardMessageEncoder encoder;
+  encoder.WriteTypedData(samples.data(), samples.size());
+  std::vector<uint8_t> buffer(encoder.size() + 1);
+  std::copy(encoder.data(), encoder.data() + encoder.size(),
+            buffer.begin() + 1);
+
+  StandardMessageDecoder decoder;
+  EXPECT_TRUE(decoder.Decode(buffer.data() + 1, encoder.size()));
+  TypedDataView<double> view = decoder.value(0).AsTypedData<double>();
+  EXPECT_TRUE(!view.aligned());
+  EXPECT_TRUE(view.data() == nullptr);
+  EXPECT_EQ(samples.size(), view.size());
+  for (size_t i = 0; i < samples.size() && i < view.size(); ++i) {
+    EXPECT_EQ(samples[i], view[i]);
+  }
+
+  StandardMessageEncoder copy;
+  copy.WriteTypedData(view);
+  EXPECT_TRUE(copy.ok());
+  EXPECT_TRUE(Encoded(copy) == Encoded(encoder));
+}
+
+}  // namespace
+
+int main() {
+  TestRoundTrip();
+  TestSizePrefix();
+  TestLargestSize();
+  TestTypedDataAlignment<int32_t>();
+  TestTypedDataAlignment<int64_t>();
+  TestTypedDataAlignment<float>();
+  TestTypedDataAlignment<double>();
+  TestDoubleAlignment();
+  TestUnalignedMessage();
+  return TEST_RESULT();
+}
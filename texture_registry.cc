@@ -0,0 +1,472 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "include/texture_registry.h"
+
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <utility>
+
+#include "include/graphics.h"
+#include "include/standard_message_codec.h"
+#include "include/trace.h"
+
+// Copies |height| rows of |row_size| bytes, |stride| bytes apart from the top,
+// bottom row first, as textures are sampled from their bottom-left corner.
+static void copy_rows_flipped(uint8_t *destination, const uint8_t *source,
+                              size_t row_size, int height, size_t stride) {
+  for (int row = 0; row < height; ++row) {
+    memcpy(destination + row * row_size, source + (height - 1 - row) * stride,
+           row_size);
+  }
+}
+
+static int64_t get_elapsed_nanos(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+TextureRegistry::TextureRegistry()
+    : uploaded_count_(0), dropped_count_(0), next_id_(1) {}
+
+TextureRegistry::~TextureRegistry() {
+  // The GL objects should have been released by the owner, as their context
+  // may no longer be current here.
+  assert(texture_pool_.empty());
+  for (const auto &entry : textures_) {
+    assert(entry.second->front.texture == 0);
+  }
+}
+
+void TextureRegistry::SetFrameCallback(std::function<void()> callback) {
+  frame_callback_ = std::move(callback);
+}
+
+int64_t TextureRegistry::RegisterTexture() {
+  std::lock_guard<std::mutex> lock(m_);
+  int64_t id = next_id_++;
+  textures_[id] = std::make_shared<Texture>();
+  return id;
+}
+
+void TextureRegistry::UnregisterTexture(int64_t id) {
+  std::lock_guard<std::mutex> lock(m_);
+  auto it = textures_.find(id);
+  if (it != textures_.end()) {
+    unregistered_.push_back(std::move(it->second));
+    textures_.erase(it);
+  }
+}
+
+bool TextureRegistry::SetTextureRect(int64_t id, const TextureRect &rect) {
+  std::shared_ptr<Texture> texture = FindTexture(id);
+  if (!texture) {
+    return false;
+  }
+  {
+    std::lock_guard<std::mutex> lock(texture->m);
+    texture->rect = rect;
+  }
+  if (frame_callback_) {
+    frame_callback_();
+  }
+  return true;
+}
+
+std::shared_ptr<TextureRegistry::Texture> TextureRegistry::FindTexture(
+    int64_t id) {
+  std::lock_guard<std::mutex> lock(m_);
+  auto it = textures_.find(id);
+  return it != textures_.end() ? it->second : nullptr;
+}
+
+bool TextureRegistry::PushFrame(int64_t id, const uint8_t *pixels, int width,
+                                int height, size_t stride) {
+  std::shared_ptr<Texture> texture = FindTexture(id);
+  if (!texture || width <= 0 || height <= 0) {
+    return false;
+  }
+  TRACE_EVENT("PushTextureFrame");
+  auto start = std::chrono::steady_clock::now();
+  size_t row_size = static_cast<size_t>(width) * 4;
+  Buffer *buffer = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(texture->m);
+    texture->frame_width = width;
+    texture->frame_height = height;
+    // Takes a mapped buffer, or else replaces the oldest frame waiting.
+    bool has_buffers = false;
+    Buffer *oldest_ready = nullptr;
+    for (Buffer &candidate : texture->buffers) {
+      if (candidate.width != width || candidate.height != height) {
+        continue;
+      }
+      has_buffers = true;
+      if (candidate.state == State::kMapped) {
+        buffer = &candidate;
+        break;
+      }
+      if (candidate.state == State::kReady &&
+          (oldest_ready == nullptr ||
+           candidate.sequence < oldest_ready->sequence)) {
+        oldest_ready = &candidate;
+      }
+    }
+    if (buffer == nullptr && oldest_ready != nullptr) {
+      buffer = oldest_ready;
+      ++dropped_count_;
+    }
+    if (buffer != nullptr) {
+      buffer->state = State::kWriting;
+    } else if (has_buffers) {
+      // Every buffer is being written or uploaded.
+      ++dropped_count_;
+      return false;
+    } else {
+      // The size changed, and the next Update maps buffers for it.
+      if (texture->staging_ready) {
+        ++dropped_count_;
+      }
+      texture->staging.resize(row_size * height);
+      copy_rows_flipped(texture->staging.data(), pixels, row_size, height,
+                        stride);
+      texture->staging_ready = true;
+      texture->staging_width = width;
+      texture->staging_height = height;
+      texture->staging_sequence = texture->next_sequence++;
+    }
+  }
+  if (buffer != nullptr) {
+    // The buffer stays mapped while written, which Update waits for.
+    copy_rows_flipped(buffer->pixels, pixels, row_size, height, stride);
+    std::lock_guard<std::mutex> lock(texture->m);
+    buffer->state = State::kReady;
+    buffer->sequence = texture->next_sequence++;
+  }
+  {
+    std::lock_guard<std::mutex> lock(m_);
+    push_time_.Record(get_elapsed_nanos(start));
+  }
+  if (frame_callback_) {
+    frame_callback_();
+  }
+  return true;
+}
+
+void TextureRegistry::Update() {
+  TRACE_EVENT("UpdateTextures");
+  std::vector<std::shared_ptr<Texture>> unregistered;
+  {
+    std::lock_guard<std::mutex> lock(m_);
+    update_list_.clear();
+    for (const auto &entry : textures_) {
+      update_list_.push_back(entry.second);
+    }
+    unregistered.swap(unregistered_);
+  }
+  for (auto &texture : unregistered) {
+    if (!DeleteGlObjects(texture.get())) {
+      // Tried again once the producer is done writing.
+      std::lock_guard<std::mutex> lock(m_);
+      unregistered_.push_back(std::move(texture));
+    }
+  }
+  for (const auto &texture : update_list_) {
+    UploadFrame(texture.get());
+    MapBuffers(texture.get());
+  }
+}
+
+void TextureRegistry::UploadFrame(Texture *texture) {
+  std::lock_guard<std::mutex> lock(texture->m);
+  // Picks the newest frame waiting, handing the buffers of older ones back to
+  // the producer.
+  Buffer *newest = nullptr;
+  for (Buffer &buffer : texture->buffers) {
+    if (buffer.state == State::kUploading && IsFenceSignalled(buffer.fence)) {
+      DeleteSync(buffer.fence);
+      buffer.fence = nullptr;
+      buffer.state = State::kFree;
+    } else if (buffer.state == State::kReady) {
+      Buffer *older = &buffer;
+      if (newest == nullptr || buffer.sequence > newest->sequence) {
+        std::swap(older, newest);
+      }
+      if (older != nullptr) {
+        older->state = State::kMapped;
+        ++dropped_count_;
+      }
+    }
+  }
+  bool use_staging = texture->staging_ready &&
+                     (newest == nullptr ||
+                      texture->staging_sequence > newest->sequence);
+  if (texture->staging_ready && !use_staging) {
+    texture->staging_ready = false;
+    ++dropped_count_;
+  } else if (use_staging && newest != nullptr) {
+    newest->state = State::kMapped;
+    newest = nullptr;
+    ++dropped_count_;
+  }
+  if (newest == nullptr && !use_staging) {
+    return;
+  }
+
+  TRACE_EVENT("UploadTextureFrame");
+  auto start = std::chrono::steady_clock::now();
+  int width = use_staging ? texture->staging_width : newest->width;
+  int height = use_staging ? texture->staging_height : newest->height;
+  PooledTexture target = AcquireTexture(width, height);
+  glBindTexture(kDefaultTextureTarget, target.texture);
+  bool uploaded = true;
+  if (use_staging) {
+    // Copied by the driver before returning, so the staging frame can go.
+    glTexSubImage2D(kDefaultTextureTarget, 0, 0, 0, width, height, GL_RGBA,
+                    GL_UNSIGNED_BYTE, texture->staging.data());
+    texture->staging_ready = false;
+  } else {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, newest->pbo);
+    // The contents of a mapped buffer can be lost, e.g. on a mode switch.
+    uploaded = glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) == GL_TRUE;
+    newest->pixels = nullptr;
+    if (uploaded) {
+      glTexSubImage2D(kDefaultTextureTarget, 0, 0, 0, width, height, GL_RGBA,
+                      GL_UNSIGNED_BYTE, nullptr);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    newest->fence = InsertFence();
+    newest->state = State::kUploading;
+  }
+  if (!uploaded) {
+    ++dropped_count_;
+    RecycleTexture(target);
+    return;
+  }
+  if (texture->front.texture != 0) {
+    RecycleTexture(texture->front);
+  }
+  texture->front = target;
+  ++uploaded_count_;
+  upload_time_.Record(get_elapsed_nanos(start));
+}
+
+void TextureRegistry::MapBuffers(Texture *texture) {
+  std::lock_guard<std::mutex> lock(texture->m);
+  int width = texture->frame_width;
+  int height = texture->frame_height;
+  if (width == 0 || height == 0) {
+    return;
+  }
+  size_t size = static_cast<size_t>(width) * height * 4;
+  for (Buffer &buffer : texture->buffers) {
+    if (buffer.state == State::kMapped &&
+        (buffer.width != width || buffer.height != height)) {
+      // Mapped for frames of a size no longer pushed.
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.pbo);
+      glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+      buffer.pixels = nullptr;
+      buffer.state = State::kFree;
+    }
+    if (buffer.state != State::kFree) {
+      continue;
+    }
+    if (buffer.pbo == 0) {
+      glGenBuffers(1, &buffer.pbo);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.pbo);
+    if (buffer.size != size) {
+      glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+      buffer.size = size;
+    }
+    // The upload from the buffer has finished, so this does not stall.
+    void *pixels =
+        glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+                         GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (pixels == nullptr) {
+      std::cerr << "Failed to map texture upload buffer: 0x" << std::hex
+                << glGetError() << std::dec << std::endl;
+      break;
+    }
+    buffer.pixels = static_cast<uint8_t *>(pixels);
+    buffer.width = width;
+    buffer.height = height;
+    buffer.state = State::kMapped;
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+TextureRegistry::PooledTexture TextureRegistry::AcquireTexture(int width,
+                                                               int height) {
+  for (auto it = texture_pool_.begin(); it != texture_pool_.end(); ++it) {
+    if (it->width == width && it->height == height &&
+        IsFenceSignalled(it->released)) {
+      PooledTexture texture = *it;
+      texture_pool_.erase(it);
+      DeleteSync(texture.released);
+      texture.released = nullptr;
+      return texture;
+    }
+  }
+  PooledTexture texture;
+  texture.width = width;
+  texture.height = height;
+  glGenTextures(1, &texture.texture);
+  glBindTexture(kDefaultTextureTarget, texture.texture);
+  AllocateTexture(width, height);
+  // Textures are scaled to wherever they are placed.
+  glTexParameteri(kDefaultTextureTarget, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(kDefaultTextureTarget, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  return texture;
+}
+
+void TextureRegistry::RecycleTexture(PooledTexture texture) {
+  texture_pool_.push_back(texture);
+  if (texture_pool_.size() > kMaxPooledTextures) {
+    DeleteSync(texture_pool_.front().released);
+    DeleteTexture(texture_pool_.front().texture);
+    texture_pool_.erase(texture_pool_.begin());
+  }
+}
+
+void TextureRegistry::Draw(int width, int height, int scale) {
+  TRACE_EVENT("DrawTextures");
+  bool drawn = false;
+  for (const auto &texture : update_list_) {
+    TextureRect rect;
+    {
+      std::lock_guard<std::mutex> lock(texture->m);
+      rect = texture->rect;
+    }
+    PooledTexture &front = texture->front;
+    if (front.texture == 0 || rect.width <= 0 || rect.height <= 0) {
+      continue;
+    }
+    if (!drawn) {
+      if (!blit_program_.Initialize()) {
+        return;
+      }
+      // Blends the premultiplied output over the Flutter frame.
+      glEnable(GL_BLEND);
+      glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+      drawn = true;
+    }
+    // The viewport is from the bottom-left corner.
+    glViewport(rect.x * scale, height - (rect.y + rect.height) * scale,
+               rect.width * scale, rect.height * scale);
+    blit_program_.Draw(front.texture);
+    DeleteSync(front.released);
+    front.released = InsertFence();
+  }
+  if (drawn) {
+    glDisable(GL_BLEND);
+    glViewport(0, 0, width, height);
+  }
+}
+
+bool TextureRegistry::DeleteGlObjects(Texture *texture) {
+  std::lock_guard<std::mutex> lock(texture->m);
+  bool writing = false;
+  for (Buffer &buffer : texture->buffers) {
+    if (buffer.state == State::kWriting) {
+      writing = true;
+      continue;
+    }
+    // Deleting a buffer unmaps it.
+    DeleteSync(buffer.fence);
+    DeleteBuffer(buffer.pbo);
+    buffer = Buffer();
+  }
+  DeleteSync(texture->front.released);
+  DeleteTexture(texture->front.texture);
+  texture->front = PooledTexture();
+  return !writing;
+}
+
+void TextureRegistry::Release() {
+  std::vector<std::shared_ptr<Texture>> textures;
+  {
+    std::lock_guard<std::mutex> lock(m_);
+    for (const auto &entry : textures_) {
+      textures.push_back(entry.second);
+    }
+    textures.insert(textures.end(), unregistered_.begin(),
+                    unregistered_.end());
+    unregistered_.clear();
+  }
+  // Frames pushed meanwhile find no buffers, so are staged instead, and the
+  // writes in progress are only a copy away from finishing.
+  for (const auto &texture : textures) {
+    while (!DeleteGlObjects(texture.get())) {
+      std::this_thread::yield();
+    }
+  }
+  update_list_.clear();
+  for (PooledTexture &texture : texture_pool_) {
+    DeleteSync(texture.released);
+    DeleteTexture(texture.texture);
+  }
+  texture_pool_.clear();
+  blit_program_.Release();
+}
+
+void TextureRegistry::HandlePlacementMessage(
+    const PlatformMessage &message, PlatformMessageResponse response) {
+  StandardMessageDecoder decoder;
+  if (!decoder.Decode(message.data, message.size) ||
+      decoder.value_count() != 1) {
+    return;
+  }
+  const StandardValue &placement = decoder.value(0);
+  const StandardValue *id = placement.Find("id");
+  const StandardValue *x = placement.Find("x");
+  const StandardValue *y = placement.Find("y");
+  const StandardValue *width = placement.Find("width");
+  const StandardValue *height = placement.Find("height");
+  if (id == nullptr || x == nullptr || y == nullptr || width == nullptr ||
+      height == nullptr) {
+    std::cerr << "Ignoring a texture placement missing fields on "
+              << message.channel << std::endl;
+    return;
+  }
+  TextureRect rect;
+  rect.x = static_cast<int>(x->AsInt());
+  rect.y = static_cast<int>(y->AsInt());
+  rect.width = static_cast<int>(width->AsInt());
+  rect.height = static_cast<int>(height->AsInt());
+  if (!SetTextureRect(id->AsInt(), rect)) {
+    std::cerr << "Ignoring a placement of unknown texture " << id->AsInt()
+              << std::endl;
+  }
+}
+
+size_t TextureRegistry::memory_bytes() {
+  size_t bytes = 0;
+  for (const PooledTexture &texture : texture_pool_) {
+    bytes += static_cast<size_t>(texture.width) * texture.height * 4;
+  }
+  std::lock_guard<std::mutex> lock(m_);
+  for (const auto &entry : textures_) {
+    std::lock_guard<std::mutex> texture_lock(entry.second->m);
+    for (const Buffer &buffer : entry.second->buffers) {
+      bytes += buffer.size;
+    }
+    const PooledTexture &front = entry.second->front;
+    bytes += static_cast<size_t>(front.width) * front.height * 4;
+  }
+  return bytes;
+}
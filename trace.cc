@@ -0,0 +1,293 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "include/trace.h"
+
+#include <iostream>
+
+#ifdef FLUTTER_EMBEDDER_TRACING
+
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+
+// The number of events kept per thread.
+static constexpr size_t kTraceBufferSize = 1 << 14;
+
+// GPU tracks are given the thread id of their thread plus this.
+static constexpr int64_t kGpuTrackOffset = int64_t(1) << 32;
+
+// An event in a TraceBuffer. The fields are atomic only so that reading them
+// from another thread while they are overwritten is not undefined; torn events
+// are detected and dropped by the reader.
+struct TraceBufferEvent {
+  std::atomic<const char *> name;
+  std::atomic<int64_t> start_us;
+  std::atomic<int64_t> duration_us;
+  std::atomic<bool> gpu;
+};
+
+// A ring buffer of events, written to by a single thread without locking, and
+// read from any thread.
+class TraceBuffer {
+ public:
+  TraceBuffer(int64_t tid, const std::string &thread_name)
+      : tid_(tid), thread_name_(thread_name), written_(0) {}
+
+  // Must only be called from the thread owning the buffer.
+  void Add(const char *name, int64_t start_us, int64_t duration_us, bool gpu) {
+    uint64_t index = written_.load(std::memory_order_relaxed);
+    // Orders the previous update of |written_| before the event is overwritten.
+    std::atomic_thread_fence(std::memory_order_release);
+    TraceBufferEvent &event = events_[index % kTraceBufferSize];
+    event.name.store(name, std::memory_order_relaxed);
+    event.start_us.store(start_us, std::memory_order_relaxed);
+    event.duration_us.store(duration_us, std::memory_order_relaxed);
+    event.gpu.store(gpu, std::memory_order_relaxed);
+    written_.store(index + 1, std::memory_order_release);
+  }
+
+  // Writes the events in the buffer as JSON objects, each preceded by a comma
+  // unless it is the very first written.
+  void Write(std::ostream &out, bool *first) const {
+    uint64_t end = written_.load(std::memory_order_acquire);
+    uint64_t begin = end > kTraceBufferSize ? end - kTraceBufferSize : 0;
+    std::vector<std::pair<uint64_t, Event>> events;
+    events.reserve(end - begin);
+    for (uint64_t i = begin; i < end; ++i) {
+      const TraceBufferEvent &event = events_[i % kTraceBufferSize];
+      events.emplace_back(
+          i, Event{event.name.load(std::memory_order_relaxed),
+                   event.start_us.load(std::memory_order_relaxed),
+                   event.duration_us.load(std::memory_order_relaxed),
+                   event.gpu.load(std::memory_order_relaxed)});
+    }
+    // Events the owning thread started overwriting while they were copied are
+    // dropped.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t overwritten = written_.load(std::memory_order_relaxed);
+    bool has_gpu_events = false;
+    for (const auto &entry : events) {
+      if (entry.first + kTraceBufferSize <= overwritten) {
+        continue;
+      }
+      const Event &event = entry.second;
+      has_gpu_events |= event.gpu;
+      char line[256];
+      snprintf(line, sizeof(line),
+               "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%lld,"
+               "\"ts\":%lld,\"dur\":%lld}",
+               *first ? "" : ",\n", event.name, getpid(),
+               static_cast<long long>(tid_ + (event.gpu ? kGpuTrackOffset : 0)),
+               static_cast<long long>(event.start_us),
+               static_cast<long long>(event.duration_us));
+      out << line;
+      *first = false;
+    }
+    WriteThreadName(out, first, tid_, thread_name_);
+    if (has_gpu_events) {
+      WriteThreadName(out, first, tid_ + kGpuTrackOffset,
+                      thread_name_ + " (GPU)");
+    }
+  }
+
+ private:
+  struct Event {
+    const char *name;
+    int64_t start_us;
+    int64_t duration_us;
+    bool gpu;
+  };
+
+  static void WriteThreadName(std::ostream &out, bool *first, int64_t tid,
+                              const std::string &name) {
+    char line[256];
+    snprintf(line, sizeof(line),
+             "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+             "\"tid\":%lld,\"args\":{\"name\":\"%s\"}}",
+             *first ? "" : ",\n", getpid(), static_cast<long long>(tid),
+             name.c_str());
+    out << line;
+    *first = false;
+  }
+
+  const int64_t tid_;
+  const std::string thread_name_;
+  std::array<TraceBufferEvent, kTraceBufferSize> events_;
+  // The number of events ever added.
+  std::atomic<uint64_t> written_;
+};
+
+// Buffers are never freed, so that the events of threads that have exited are
+// still written out.
+static std::mutex &get_buffers_mutex() {
+  static auto *mutex = new std::mutex();
+  return *mutex;
+}
+
+static std::vector<TraceBuffer *> &get_buffers() {
+  static auto *buffers = new std::vector<TraceBuffer *>();
+  return *buffers;
+}
+
+// Returns the calling thread's buffer, creating it on first use.
+static TraceBuffer *get_thread_buffer() {
+  static thread_local TraceBuffer *buffer = nullptr;
+  if (buffer == nullptr) {
+    char name[64] = {};
+    pthread_getname_np(pthread_self(), name, sizeof(name));
+    // Names are written into JSON strings as they are.
+    for (char &c : name) {
+      if (c == '"' || c == '\\') {
+        c = '_';
+      }
+    }
+    buffer = new TraceBuffer(syscall(SYS_gettid), name);
+    std::lock_guard<std::mutex> lock(get_buffers_mutex());
+    get_buffers().push_back(buffer);
+  }
+  return buffer;
+}
+
+int64_t GetTraceTime() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void AddTraceEvent(const char *name, int64_t start_us, int64_t duration_us,
+                   bool gpu) {
+  get_thread_buffer()->Add(name, start_us, duration_us, gpu);
+}
+
+bool WriteTrace(const std::string &path) {
+  std::ofstream out(path);
+  if (!out) {
+    std::cerr << "Unable to open trace file: " << path << std::endl;
+    return false;
+  }
+  out << "{\"traceEvents\":[\n";
+  bool first = true;
+  {
+    std::lock_guard<std::mutex> lock(get_buffers_mutex());
+    for (const TraceBuffer *buffer : get_buffers()) {
+      buffer->Write(out, &first);
+    }
+  }
+  out << "\n],\"displayTimeUnit\":\"ms\"}" << std::endl;
+  if (!out) {
+    std::cerr << "Unable to write trace file: " << path << std::endl;
+    return false;
+  }
+  return true;
+}
+
+GpuTraceTimer::GpuTraceTimer() : support_(Support::kUnknown), running_(false) {}
+
+// Returns true if the current context supports GL_TIME_ELAPSED queries.
+static bool has_timer_queries() {
+  if (epoxy_is_desktop_gl()) {
+    return epoxy_gl_version() >= 33 ||
+           epoxy_has_gl_extension("GL_ARB_timer_query");
+  }
+  return epoxy_has_gl_extension("GL_EXT_disjoint_timer_query");
+}
+
+void GpuTraceTimer::Begin(const char *name) {
+  if (support_ == Support::kUnknown) {
+    support_ =
+        has_timer_queries() ? Support::kSupported : Support::kUnsupported;
+  }
+  if (support_ != Support::kSupported || running_) {
+    return;
+  }
+  CollectResults();
+  GLuint id = 0;
+  if (free_queries_.empty()) {
+    glGenQueries(1, &id);
+  } else {
+    id = free_queries_.back();
+    free_queries_.pop_back();
+  }
+  glBeginQuery(GL_TIME_ELAPSED, id);
+  pending_queries_.push_back(Query{id, name, GetTraceTime()});
+  running_ = true;
+}
+
+void GpuTraceTimer::End() {
+  if (!running_) {
+    return;
+  }
+  glEndQuery(GL_TIME_ELAPSED);
+  running_ = false;
+}
+
+void GpuTraceTimer::CollectResults() {
+  // On GLES, the results of queries spanning a disjoint operation (e.g. a
+  // clock change) are meaningless.
+  GLint disjoint = GL_FALSE;
+  if (!epoxy_is_desktop_gl()) {
+    glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+  }
+  while (!pending_queries_.empty()) {
+    const Query &query = pending_queries_.front();
+    GLuint available = GL_FALSE;
+    glGetQueryObjectuiv(query.id, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) {
+      // Queries finish in order.
+      return;
+    }
+    GLuint64 elapsed_ns = 0;
+    glGetQueryObjectui64v(query.id, GL_QUERY_RESULT, &elapsed_ns);
+    if (!disjoint) {
+      AddTraceEvent(query.name, query.start,
+                    static_cast<int64_t>(elapsed_ns / 1000), true);
+    }
+    free_queries_.push_back(query.id);
+    pending_queries_.pop_front();
+  }
+}
+
+void GpuTraceTimer::Release() {
+  if (running_) {
+    End();
+  }
+  for (const auto &query : pending_queries_) {
+    glDeleteQueries(1, &query.id);
+  }
+  if (!free_queries_.empty()) {
+    glDeleteQueries(free_queries_.size(), free_queries_.data());
+  }
+  pending_queries_.clear();
+  free_queries_.clear();
+  // The timer may be used with a new context next.
+  support_ = Support::kUnknown;
+}
+
+#else  // FLUTTER_EMBEDDER_TRACING
+
+bool WriteTrace(const std::string &path) {
+  std::cerr << "Unable to write trace file: tracing is not compiled in, build "
+               "with DEFINES=-DFLUTTER_EMBEDDER_TRACING."
+            << std::endl;
+  return false;
+}
+
+#endif  // FLUTTER_EMBEDDER_TRACING